@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdint.h> /* int64_t */
+#include <pthread.h>
 
 /* libarchive */
 #include <archive.h>
@@ -46,6 +47,9 @@
 #include "db.h"
 #include "remove.h"
 #include "handle.h"
+#include "deps.h"
+#include "fileowners.h"
+#include "durable.h"
 
 int SYMEXPORT alpm_add_pkg(alpm_handle_t *handle, alpm_pkg_t *pkg)
 {
@@ -110,10 +114,13 @@ int SYMEXPORT alpm_add_pkg(alpm_handle_t *handle, alpm_pkg_t *pkg)
 	return 0;
 }
 
-static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, const char *filename)
+/* archive_write_disk_new() reads the umask by setting it to 0 for a moment.
+ * The umask is shared by all threads, so while packages are extracted on
+ * several threads nothing else may create files in the meantime. */
+static pthread_mutex_t umask_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct archive *disk_writer_new(alpm_handle_t *handle)
 {
-	int ret;
 	struct archive *archive_writer;
 	const int archive_flags = ARCHIVE_EXTRACT_OWNER |
 	                          ARCHIVE_EXTRACT_PERM |
@@ -122,21 +129,130 @@ static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
 	                          ARCHIVE_EXTRACT_XATTR |
 	                          ARCHIVE_EXTRACT_SECURE_SYMLINKS;
 
-	archive_entry_set_pathname(entry, filename);
-
+	pthread_mutex_lock(&umask_lock);
 	archive_writer = archive_write_disk_new();
+	pthread_mutex_unlock(&umask_lock);
 	if (archive_writer == NULL) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("cannot allocate disk archive object"));
 		alpm_logaction(handle, ALPM_CALLER_PREFIX,
 				"error: cannot allocate disk archive object");
-		return 1;
+		return NULL;
 	}
 
 	archive_write_disk_set_options(archive_writer, archive_flags);
+	return archive_writer;
+}
+
+/* Write an entry to disk as archive_read_extract2() does, computing the
+ * MD5 digest of its data on the way. Errors are reported on archive. */
+static int extract_with_digest(struct archive *archive, struct archive_entry *entry,
+		struct archive *writer, char **digest)
+{
+	static const char zeros[4096];
+	alpm_digest_t *md5;
+	const void *buf;
+	size_t size;
+	int64_t offset, hashed = 0, end;
+	int ret, r;
+
+	if((md5 = _alpm_digest_new(ALPM_PKG_VALIDATION_MD5SUM)) == NULL) {
+		archive_set_error(archive, ENOMEM, "could not compute digest");
+		return ARCHIVE_FATAL;
+	}
+
+	ret = archive_write_header(writer, entry);
+	if(ret < ARCHIVE_WARN) {
+		goto writer_error;
+	}
+
+	while((r = archive_read_data_block(archive, &buf, &size, &offset)) == ARCHIVE_OK) {
+		/* holes of sparse entries read back as zeros */
+		while(hashed < offset) {
+			size_t len = offset - hashed < (int64_t)sizeof(zeros) ?
+				(size_t)(offset - hashed) : sizeof(zeros);
+			_alpm_digest_update(md5, zeros, len);
+			hashed += len;
+		}
+		_alpm_digest_update(md5, buf, size);
+		hashed += size;
+		r = archive_write_data_block(writer, buf, size, offset);
+		if(r < ARCHIVE_WARN) {
+			ret = r;
+			goto writer_error;
+		}
+	}
+	if(r != ARCHIVE_EOF) {
+		_alpm_digest_free(md5);
+		return r;
+	}
+	end = archive_entry_size(entry);
+	while(hashed < end) {
+		size_t len = end - hashed < (int64_t)sizeof(zeros) ?
+			(size_t)(end - hashed) : sizeof(zeros);
+		_alpm_digest_update(md5, zeros, len);
+		hashed += len;
+	}
+
+	r = archive_write_finish_entry(writer);
+	if(r < ARCHIVE_WARN) {
+		ret = r;
+		goto writer_error;
+	}
+	if(r < ret) {
+		ret = r;
+	}
+	if(ret == ARCHIVE_WARN) {
+		archive_set_error(archive, archive_errno(writer), "%s",
+				archive_error_string(writer));
+	}
+
+	*digest = _alpm_digest_final(md5);
+	return ret;
+
+writer_error:
+	archive_set_error(archive, archive_errno(writer), "%s",
+			archive_error_string(writer));
+	_alpm_digest_free(md5);
+	return ret;
+}
+
+/* Extract an entry through the disk writer shared by the entries of a
+ * package, which is created on first use and left in *writer for the
+ * caller to free. If digest is given, the MD5 digest of a regular file is
+ * computed while it is written and left in *digest. */
+static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
+		struct archive_entry *entry, const char *filename, struct archive **writer,
+		char **digest)
+{
+	int ret;
 
-	ret = archive_read_extract2(archive, entry, archive_writer);
+	archive_entry_set_pathname(entry, filename);
 
-	archive_write_free(archive_writer);
+	if(S_ISDIR(archive_entry_mode(entry))) {
+		/* the permissions and times of directories are only restored when
+		 * their writer is closed, which has to happen right away */
+		struct archive *dir_writer = disk_writer_new(handle);
+		if(dir_writer == NULL) {
+			return 1;
+		}
+		ret = archive_read_extract2(archive, entry, dir_writer);
+		archive_write_free(dir_writer);
+	} else {
+		if(*writer == NULL && (*writer = disk_writer_new(handle)) == NULL) {
+			return 1;
+		}
+		if(digest && S_ISREG(archive_entry_mode(entry))
+				&& archive_entry_hardlink(entry) == NULL) {
+			ret = extract_with_digest(archive, entry, *writer, digest);
+		} else {
+			ret = archive_read_extract2(archive, entry, *writer);
+		}
+		if(ret != ARCHIVE_OK && ret != ARCHIVE_WARN) {
+			/* do not carry a writer in a failed state over to the next entry */
+			archive_write_free(*writer);
+			*writer = NULL;
+		}
+	}
 
 	if(ret == ARCHIVE_WARN && archive_errno(archive) != ENOSPC) {
 		/* operation succeeded but a "non-critical" error was encountered */
@@ -165,8 +281,19 @@ static int try_rename(alpm_handle_t *handle, const char *src, const char *dest)
 	return 0;
 }
 
+/* Moves src to dest, once it is on disk if the transaction is durable. */
+static int install_file(alpm_handle_t *handle, alpm_durable_t *durable,
+		const char *src, const char *dest)
+{
+	if(durable) {
+		return _alpm_durable_add(durable, src, dest) != 0;
+	}
+	return try_rename(handle, src, dest);
+}
+
 static int extract_db_file(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, alpm_pkg_t *newpkg, const char *entryname)
+		struct archive_entry *entry, alpm_pkg_t *newpkg, const char *entryname,
+		struct archive **writer, alpm_durable_t *durable)
 {
 	char filename[PATH_MAX]; /* the actual file we're extracting */
 	const char *dbfile = NULL;
@@ -185,24 +312,32 @@ static int extract_db_file(alpm_handle_t *handle, struct archive *archive,
 	archive_entry_set_perm(entry, 0644);
 	snprintf(filename, PATH_MAX, "%s%s-%s/%s",
 			_alpm_db_path(handle->db_local), newpkg->name, newpkg->version, dbfile);
-	return perform_extraction(handle, archive, entry, filename);
+	if(perform_extraction(handle, archive, entry, filename, writer, NULL)) {
+		return 1;
+	}
+	/* the database entry is new, nothing to replace */
+	return durable ? _alpm_durable_add(durable, filename, NULL) != 0 : 0;
 }
 
 static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, alpm_pkg_t *newpkg, alpm_pkg_t *oldpkg)
+		struct archive_entry *entry, alpm_pkg_t *newpkg, alpm_pkg_t *oldpkg,
+		struct archive **writer, alpm_durable_t *durable)
 {
 	const char *entryname = archive_entry_pathname(entry);
 	mode_t entrymode = archive_entry_mode(entry);
 	alpm_backup_t *backup = _alpm_needbackup(entryname, newpkg);
 	char filename[PATH_MAX]; /* the actual file we're extracting */
+	char staged[PATH_MAX]; /* where it is written if the transaction is durable */
+	const char *written = filename;
 	int needbackup = 0, notouch = 0;
 	const char *hash_orig = NULL;
+	char *hash_new = NULL; /* digest of the extracted file */
 	int isnewfile = 0, errors = 0;
 	struct stat lsbuf;
 	size_t filename_len;
 
 	if(*entryname == '.') {
-		return extract_db_file(handle, archive, entry, newpkg, entryname);
+		return extract_db_file(handle, archive, entry, newpkg, entryname, writer, durable);
 	}
 
 	if (!alpm_filelist_contains(&newpkg->files, entryname)) {
@@ -324,15 +459,45 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 		isnewfile = (llstat(filename, &lsbuf) != 0 && errno == ENOENT);
 	}
 
-	_alpm_log(handle, ALPM_LOG_DEBUG, "extracting %s\n", filename);
-	if(perform_extraction(handle, archive, entry, filename)) {
+	if(durable && !S_ISDIR(entrymode) && !notouch && !needbackup) {
+		/* write a replacement next to the file, moved in place once on disk */
+		const char *hardlink = archive_entry_hardlink(entry);
+		if(_alpm_durable_stage(filename, staged, PATH_MAX) != 0) {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("unable to extract %s: path too long"), filename);
+			return 1;
+		}
+		if(hardlink) {
+			char target[PATH_MAX];
+			const char *staged_target;
+			snprintf(target, PATH_MAX, "%s%s", handle->root, hardlink);
+			if((staged_target = _alpm_durable_find(durable, target))) {
+				archive_entry_set_hardlink(entry, staged_target);
+			}
+		}
+		written = staged;
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG, "extracting %s\n", written);
+	if(perform_extraction(handle, archive, entry, written, writer,
+				backup || needbackup ? &hash_new : NULL)) {
 		errors++;
 		return errors;
 	}
 
+	if(durable && !notouch && !needbackup) {
+		if(_alpm_durable_add(durable, written, written == staged ? filename : NULL) != 0) {
+			errors++;
+		}
+	}
+
+	if(hash_new == NULL && (backup || needbackup)) {
+		hash_new = alpm_compute_md5sum(written);
+	}
 	if(backup) {
 		FREE(backup->hash);
-		backup->hash = alpm_compute_md5sum(filename);
+		backup->hash = hash_new;
+		hash_new = NULL;
 	}
 
 	if(notouch) {
@@ -343,6 +508,9 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 			.newpkg = newpkg,
 			.file = filename
 		};
+		if(durable && _alpm_durable_add(durable, filename, NULL) != 0) {
+			errors++;
+		}
 		/* "remove" the .pacnew suffix */
 		filename[filename_len] = '\0';
 		EVENT(handle, &event);
@@ -354,8 +522,8 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 
 		strncat(origfile, filename, filename_len);
 
-		hash_local = alpm_compute_md5sum(origfile);
-		hash_pkg = backup ? backup->hash : alpm_compute_md5sum(filename);
+		hash_local = _alpm_trans_file_md5(handle, origfile);
+		hash_pkg = backup ? backup->hash : hash_new;
 
 		_alpm_log(handle, ALPM_LOG_DEBUG, "checking hashes for %s\n", origfile);
 		_alpm_log(handle, ALPM_LOG_DEBUG, "current:  %s\n", hash_local);
@@ -367,7 +535,7 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 			 * correct timestamps */
 			_alpm_log(handle, ALPM_LOG_DEBUG, "action: installing new file: %s\n",
 					origfile);
-			if(try_rename(handle, filename, origfile)) {
+			if(install_file(handle, durable, filename, origfile)) {
 				errors++;
 			}
 		} else if(hash_orig && hash_pkg && strcmp(hash_orig, hash_pkg) == 0) {
@@ -383,7 +551,7 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 			 * update to the new version */
 			_alpm_log(handle, ALPM_LOG_DEBUG, "action: installing new file: %s\n",
 					origfile);
-			if(try_rename(handle, filename, origfile)) {
+			if(install_file(handle, durable, filename, origfile)) {
 				errors++;
 			}
 		} else {
@@ -399,66 +567,82 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 			_alpm_log(handle, ALPM_LOG_DEBUG,
 					"action: keeping current file and installing"
 					" new one with .pacnew ending\n");
+			if(durable && _alpm_durable_add(durable, filename, NULL) != 0) {
+				errors++;
+			}
 			EVENT(handle, &event);
 			alpm_logaction(handle, ALPM_CALLER_PREFIX,
 					"warning: %s installed as %s\n", origfile, filename);
 		}
 
 		free(hash_local);
-		if(!backup) {
-			free(hash_pkg);
-		}
 	}
+	free(hash_new);
 	return errors;
 }
 
-static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
-		size_t pkg_current, size_t pkg_count)
+/* A package on its way into the system. commit_pkg_start(),
+ * commit_pkg_extract() and commit_pkg_finish() take it through the steps
+ * of commit_single_pkg(), which _alpm_upgrade_packages() may also run for
+ * several packages at once. */
+struct pkg_commit {
+	alpm_pkg_t *newpkg;
+	alpm_pkg_t *oldpkg;
+	size_t pkg_current;
+	size_t pkg_count;
+	alpm_progress_t progress;
+	alpm_event_package_operation_t event;
+	int is_upgrade;
+	alpm_durable_t *durable; /* the files written, if the transaction is durable */
+	struct archive *archive; /* the opened package, see struct extract_pool */
+	int fd;
+	int errors; /* set by commit_pkg_extract() */
+	int done; /* the files were extracted, see struct extract_pool */
+};
+
+static int commit_pkg_start(alpm_handle_t *handle, struct pkg_commit *commit)
 {
-	int ret = 0, errors = 0;
-	int is_upgrade = 0;
+	alpm_pkg_t *newpkg = commit->newpkg;
 	alpm_pkg_t *oldpkg = NULL;
 	alpm_db_t *db = handle->db_local;
 	alpm_trans_t *trans = handle->trans;
-	alpm_progress_t progress = ALPM_PROGRESS_ADD_START;
-	alpm_event_package_operation_t event;
 	const char *log_msg = "adding";
 	const char *pkgfile;
-	struct archive *archive;
-	struct archive_entry *entry;
-	int fd, cwdfd;
-	struct stat buf;
+	int ret;
 
 	ASSERT(trans != NULL, return -1);
 
+	commit->progress = ALPM_PROGRESS_ADD_START;
+
 	/* see if this is an upgrade. if so, remove the old package first */
 	if(_alpm_db_get_pkgfromcache(db, newpkg->name) && (oldpkg = newpkg->oldpkg)) {
 		int cmp = _alpm_pkg_compare_versions(newpkg, oldpkg);
 		if(cmp < 0) {
 			log_msg = "downgrading";
-			progress = ALPM_PROGRESS_DOWNGRADE_START;
-			event.operation = ALPM_PACKAGE_DOWNGRADE;
+			commit->progress = ALPM_PROGRESS_DOWNGRADE_START;
+			commit->event.operation = ALPM_PACKAGE_DOWNGRADE;
 		} else if(cmp == 0) {
 			log_msg = "reinstalling";
-			progress = ALPM_PROGRESS_REINSTALL_START;
-			event.operation = ALPM_PACKAGE_REINSTALL;
+			commit->progress = ALPM_PROGRESS_REINSTALL_START;
+			commit->event.operation = ALPM_PACKAGE_REINSTALL;
 		} else {
 			log_msg = "upgrading";
-			progress = ALPM_PROGRESS_UPGRADE_START;
-			event.operation = ALPM_PACKAGE_UPGRADE;
+			commit->progress = ALPM_PROGRESS_UPGRADE_START;
+			commit->event.operation = ALPM_PACKAGE_UPGRADE;
 		}
-		is_upgrade = 1;
+		commit->is_upgrade = 1;
 
 		/* copy over the install reason */
 		newpkg->reason = alpm_pkg_get_reason(oldpkg);
 	} else {
-		event.operation = ALPM_PACKAGE_INSTALL;
+		commit->event.operation = ALPM_PACKAGE_INSTALL;
 	}
+	commit->oldpkg = oldpkg;
 
-	event.type = ALPM_EVENT_PACKAGE_OPERATION_START;
-	event.oldpkg = oldpkg;
-	event.newpkg = newpkg;
-	EVENT(handle, &event);
+	commit->event.type = ALPM_EVENT_PACKAGE_OPERATION_START;
+	commit->event.oldpkg = oldpkg;
+	commit->event.newpkg = newpkg;
+	EVENT(handle, &commit->event);
 
 	pkgfile = newpkg->origin_data.file;
 
@@ -467,7 +651,7 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 		/* pre_install/pre_upgrade scriptlet */
 	if(alpm_pkg_has_scriptlet(newpkg) &&
 			!(trans->flags & ALPM_TRANS_FLAG_NOSCRIPTLET)) {
-		const char *scriptlet_name = is_upgrade ? "pre_upgrade" : "pre_install";
+		const char *scriptlet_name = commit->is_upgrade ? "pre_upgrade" : "pre_install";
 
 		_alpm_runscriptlet(handle, pkgfile, scriptlet_name,
 				newpkg->version, oldpkg ? oldpkg->version : NULL, 1);
@@ -483,51 +667,58 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 	if(oldpkg) {
 		/* set up fake remove transaction */
 		if(_alpm_remove_single_package(handle, oldpkg, newpkg, 0, 0) == -1) {
-			handle->pm_errno = ALPM_ERR_TRANS_ABORT;
+			PM_ERRNO(handle) = ALPM_ERR_TRANS_ABORT;
 			return -1;
 		}
 	}
 
 	/* prepare directory for database entries so permissions are correct after
 	   changelog/install script installation */
-	if(_alpm_local_db_prepare(db, newpkg)) {
+	pthread_mutex_lock(&umask_lock);
+	ret = _alpm_local_db_prepare(db, newpkg);
+	pthread_mutex_unlock(&umask_lock);
+	if(ret) {
 		alpm_logaction(handle, ALPM_CALLER_PREFIX,
 				"error: could not create database entry %s-%s\n",
 				newpkg->name, newpkg->version);
-		handle->pm_errno = ALPM_ERR_DB_WRITE;
+		PM_ERRNO(handle) = ALPM_ERR_DB_WRITE;
 		return -1;
 	}
 
-	fd = _alpm_open_archive(db->handle, pkgfile, &buf,
-			&archive, ALPM_ERR_PKG_OPEN);
-	if(fd < 0) {
-		return -1;
+	if(handle->durability != ALPM_DURABILITY_NONE) {
+		char *pkgpath = _alpm_local_db_pkgpath(db, newpkg, NULL);
+		commit->durable = _alpm_durable_new(handle);
+		if(pkgpath == NULL || commit->durable == NULL
+				|| _alpm_durable_add(commit->durable, pkgpath, NULL) != 0) {
+			free(pkgpath);
+			_alpm_durable_free(commit->durable);
+			commit->durable = NULL;
+			return -1;
+		}
+		free(pkgpath);
 	}
 
-	/* save the cwd so we can restore it later */
-	OPEN(cwdfd, ".", O_RDONLY | O_CLOEXEC);
-	if(cwdfd < 0) {
-		_alpm_log(handle, ALPM_LOG_ERROR, _("could not get current working directory\n"));
-	}
+	return 0;
+}
 
-	/* libarchive requires this for extracting hard links */
-	if(chdir(handle->root) != 0) {
-		_alpm_log(handle, ALPM_LOG_ERROR, _("could not change directory to %s (%s)\n"),
-				handle->root, strerror(errno));
-		_alpm_archive_read_free(archive);
-		if(cwdfd >= 0) {
-			close(cwdfd);
-		}
-		close(fd);
-		return -1;
-	}
+/* Extract the files of an opened package archive, the current directory
+ * has to be the root. Progress is only reported if report_progress is set,
+ * as it has to come from the thread that started the transaction. */
+static void commit_pkg_extract(alpm_handle_t *handle, struct pkg_commit *commit,
+		struct archive *archive, int report_progress)
+{
+	alpm_pkg_t *newpkg = commit->newpkg;
+	struct archive *writer = NULL;
+	struct archive_entry *entry;
+	int errors = 0;
 
-	if(trans->flags & ALPM_TRANS_FLAG_DBONLY) {
+	if(handle->trans->flags & ALPM_TRANS_FLAG_DBONLY) {
 		_alpm_log(handle, ALPM_LOG_DEBUG, "extracting db files\n");
 		while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
 			const char *entryname = archive_entry_pathname(entry);
 			if(entryname[0] == '.') {
-				errors += extract_db_file(handle, archive, entry, newpkg, entryname);
+				errors += extract_db_file(handle, archive, entry, newpkg, entryname,
+						&writer, commit->durable);
 			} else {
 				archive_read_data_skip(archive);
 			}
@@ -536,46 +727,64 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 		_alpm_log(handle, ALPM_LOG_DEBUG, "extracting files\n");
 
 		/* call PROGRESS once with 0 percent, as we sort-of skip that here */
-		PROGRESS(handle, progress, newpkg->name, 0, pkg_count, pkg_current);
+		if(report_progress) {
+			PROGRESS(handle, commit->progress, newpkg->name, 0,
+					commit->pkg_count, commit->pkg_current);
+		}
 
 		while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-			int percent;
-
-			if(newpkg->size != 0) {
-				/* Using compressed size for calculations here, as newpkg->isize is not
-				 * exact when it comes to comparing to the ACTUAL uncompressed size
-				 * (missing metadata sizes) */
-				int64_t pos = _alpm_archive_compressed_ftell(archive);
-				percent = (pos * 100) / newpkg->size;
-				if(percent >= 100) {
-					percent = 100;
+			if(report_progress) {
+				int percent;
+
+				if(newpkg->size != 0) {
+					/* Using compressed size for calculations here, as newpkg->isize is not
+					 * exact when it comes to comparing to the ACTUAL uncompressed size
+					 * (missing metadata sizes) */
+					int64_t pos = _alpm_archive_compressed_ftell(archive);
+					percent = (pos * 100) / newpkg->size;
+					if(percent >= 100) {
+						percent = 100;
+					}
+				} else {
+					percent = 0;
 				}
-			} else {
-				percent = 0;
-			}
 
-			PROGRESS(handle, progress, newpkg->name, percent, pkg_count, pkg_current);
+				PROGRESS(handle, commit->progress, newpkg->name, percent,
+						commit->pkg_count, commit->pkg_current);
+			}
 
 			/* extract the next file from the archive */
-			errors += extract_single_file(handle, archive, entry, newpkg, oldpkg);
+			errors += extract_single_file(handle, archive, entry, newpkg,
+					commit->oldpkg, &writer, commit->durable);
 		}
 	}
 
-	_alpm_archive_read_free(archive);
-	close(fd);
+	if(writer) {
+		archive_write_free(writer);
+	}
+	commit->errors = errors;
+}
 
-	/* restore the old cwd if we have it */
-	if(cwdfd >= 0) {
-		if(fchdir(cwdfd) != 0) {
-			_alpm_log(handle, ALPM_LOG_ERROR,
-					_("could not restore working directory (%s)\n"), strerror(errno));
+static int commit_pkg_finish(alpm_handle_t *handle, struct pkg_commit *commit)
+{
+	alpm_pkg_t *newpkg = commit->newpkg;
+	alpm_pkg_t *oldpkg = commit->oldpkg;
+	alpm_db_t *db = handle->db_local;
+	alpm_trans_t *trans = handle->trans;
+	int ret = 0;
+
+	if(commit->durable) {
+		/* the database entry may only describe files that are on disk */
+		if(_alpm_durable_commit(commit->durable) != 0) {
+			commit->errors++;
 		}
-		close(cwdfd);
+		_alpm_durable_free(commit->durable);
+		commit->durable = NULL;
 	}
 
-	if(errors) {
+	if(commit->errors) {
 		ret = -1;
-		if(is_upgrade) {
+		if(commit->is_upgrade) {
 			_alpm_log(handle, ALPM_LOG_ERROR, _("problem occurred while upgrading %s\n"),
 					newpkg->name);
 			alpm_logaction(handle, ALPM_CALLER_PREFIX,
@@ -596,24 +805,28 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 	_alpm_log(handle, ALPM_LOG_DEBUG, "updating database\n");
 	_alpm_log(handle, ALPM_LOG_DEBUG, "adding database entry '%s'\n", newpkg->name);
 
+	pthread_mutex_lock(&umask_lock);
 	if(_alpm_local_db_write(db, newpkg, INFRQ_ALL)) {
+		pthread_mutex_unlock(&umask_lock);
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not update database entry %s-%s\n"),
 				newpkg->name, newpkg->version);
 		alpm_logaction(handle, ALPM_CALLER_PREFIX,
 				"error: could not update database entry %s-%s\n",
 				newpkg->name, newpkg->version);
-		handle->pm_errno = ALPM_ERR_DB_WRITE;
+		PM_ERRNO(handle) = ALPM_ERR_DB_WRITE;
 		return -1;
 	}
+	pthread_mutex_unlock(&umask_lock);
 
 	if(_alpm_db_add_pkgincache(db, newpkg) == -1) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not add entry '%s' in cache\n"),
 				newpkg->name);
 	}
 
-	PROGRESS(handle, progress, newpkg->name, 100, pkg_count, pkg_current);
+	PROGRESS(handle, commit->progress, newpkg->name, 100,
+			commit->pkg_count, commit->pkg_current);
 
-	switch(event.operation) {
+	switch(commit->event.operation) {
 		case ALPM_PACKAGE_INSTALL:
 			alpm_logaction(handle, ALPM_CALLER_PREFIX, "installed %s (%s)\n",
 					newpkg->name, newpkg->version);
@@ -639,16 +852,452 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 	if(alpm_pkg_has_scriptlet(newpkg)
 			&& !(trans->flags & ALPM_TRANS_FLAG_NOSCRIPTLET)) {
 		char *scriptlet = _alpm_local_db_pkgpath(db, newpkg, "install");
-		const char *scriptlet_name = is_upgrade ? "post_upgrade" : "post_install";
+		const char *scriptlet_name = commit->is_upgrade ? "post_upgrade" : "post_install";
 
 		_alpm_runscriptlet(handle, scriptlet, scriptlet_name,
 				newpkg->version, oldpkg ? oldpkg->version : NULL, 0);
 		free(scriptlet);
 	}
 
-	event.type = ALPM_EVENT_PACKAGE_OPERATION_DONE;
-	EVENT(handle, &event);
+	commit->event.type = ALPM_EVENT_PACKAGE_OPERATION_DONE;
+	EVENT(handle, &commit->event);
+
+	return ret;
+}
+
+static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
+		size_t pkg_current, size_t pkg_count)
+{
+	struct pkg_commit commit = {
+		.newpkg = newpkg,
+		.pkg_current = pkg_current,
+		.pkg_count = pkg_count,
+	};
+	struct archive *archive;
+	int fd, cwdfd;
+	struct stat buf;
+
+	if(commit_pkg_start(handle, &commit) != 0) {
+		return -1;
+	}
+
+	fd = _alpm_open_archive(handle, newpkg->origin_data.file, &buf,
+			&archive, ALPM_ERR_PKG_OPEN);
+	if(fd < 0) {
+		_alpm_durable_free(commit.durable);
+		return -1;
+	}
+
+	/* save the cwd so we can restore it later */
+	OPEN(cwdfd, ".", O_RDONLY | O_CLOEXEC);
+	if(cwdfd < 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not get current working directory\n"));
+	}
+
+	/* libarchive requires this for extracting hard links */
+	if(chdir(handle->root) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not change directory to %s (%s)\n"),
+				handle->root, strerror(errno));
+		_alpm_archive_read_free(archive);
+		if(cwdfd >= 0) {
+			close(cwdfd);
+		}
+		close(fd);
+		_alpm_durable_free(commit.durable);
+		return -1;
+	}
+
+	commit_pkg_extract(handle, &commit, archive, 1);
+
+	_alpm_archive_read_free(archive);
+	close(fd);
+
+	/* restore the old cwd if we have it */
+	if(cwdfd >= 0) {
+		if(fchdir(cwdfd) != 0) {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("could not restore working directory (%s)\n"), strerror(errno));
+		}
+		close(cwdfd);
+	}
+
+	return commit_pkg_finish(handle, &commit);
+}
+
+/* Extracts packages on a pool of threads while _alpm_upgrade_packages()
+ * starts and finishes them in transaction order. A package is only handed
+ * to the pool when nothing in its commit needs to happen between the
+ * extraction of its files and that of other packages: it has no install
+ * scriptlet, no file that could become a .pacnew or .pacsave, shares no
+ * file with a package still being extracted and does not depend on one.
+ * The current directory is the root while the pool exists. Threads of the
+ * pool leave pm_errno to the calling thread: packages are opened before
+ * they are handed over, and failures are reported in commit->errors. */
+struct extract_pool {
+	alpm_handle_t *handle;
+	alpm_list_t *queue; /* struct pkg_commit, waiting for a thread */
+	alpm_list_t *active; /* struct pkg_commit, handed to the pool, in order */
+	alpm_fileowners_t *files; /* files of the active packages */
+	size_t window; /* most packages active at once */
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t *threads;
+	size_t nthreads;
+	int stopping;
+	int cwdfd;
+};
+
+static void *extract_worker(void *arg)
+{
+	struct extract_pool *pool = arg;
+	alpm_handle_t *handle = pool->handle;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		struct pkg_commit *commit;
+
+		if(pool->queue == NULL) {
+			if(pool->stopping) {
+				break;
+			}
+			pthread_cond_wait(&pool->work, &pool->lock);
+			continue;
+		}
+		commit = pool->queue->data;
+		pool->queue = alpm_list_remove_item(pool->queue, pool->queue);
+		pthread_mutex_unlock(&pool->lock);
+
+		commit_pkg_extract(handle, commit, commit->archive, 0);
+		_alpm_archive_read_free(commit->archive);
+		close(commit->fd);
+
+		pthread_mutex_lock(&pool->lock);
+		commit->done = 1;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* Returns NULL if packages are better extracted by the calling thread. */
+static struct extract_pool *extract_pool_start(alpm_handle_t *handle)
+{
+	struct extract_pool *pool;
+	size_t nthreads = handle->parallel_extractions;
+
+	if(nthreads < 2 || (handle->trans->flags & ALPM_TRANS_FLAG_DBONLY)
+			|| alpm_list_count(handle->trans->add) < 2) {
+		return NULL;
+	}
+
+	CALLOC(pool, 1, sizeof(*pool), return NULL);
+	CALLOC(pool->threads, nthreads, sizeof(pthread_t), goto error);
+	if((pool->files = _alpm_fileowners_new(NULL)) == NULL) {
+		goto error;
+	}
+
+	/* libarchive requires this for extracting hard links */
+	OPEN(pool->cwdfd, ".", O_RDONLY | O_CLOEXEC);
+	if(pool->cwdfd < 0) {
+		goto error;
+	}
+	if(chdir(handle->root) != 0) {
+		close(pool->cwdfd);
+		goto error;
+	}
+
+	pool->handle = handle;
+	pool->window = 2 * nthreads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(; pool->nthreads < nthreads; pool->nthreads++) {
+		if(pthread_create(&pool->threads[pool->nthreads], NULL,
+					extract_worker, pool) != 0) {
+			break;
+		}
+	}
+	if(pool->nthreads < 2) {
+		pool->stopping = 1;
+		pthread_cond_broadcast(&pool->work);
+		while(pool->nthreads > 0) {
+			pthread_join(pool->threads[--pool->nthreads], NULL);
+		}
+		pthread_cond_destroy(&pool->done);
+		pthread_cond_destroy(&pool->work);
+		pthread_mutex_destroy(&pool->lock);
+		if(fchdir(pool->cwdfd) != 0) {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("could not restore working directory (%s)\n"), strerror(errno));
+		}
+		close(pool->cwdfd);
+		goto error;
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"extracting packages using %zu threads\n", pool->nthreads);
+	return pool;
+
+error:
+	_alpm_fileowners_free(pool->files);
+	free(pool->threads);
+	free(pool);
+	return NULL;
+}
+
+/* Whether nothing in the commit of pkg has to happen in order with the
+ * extraction of other packages, see struct extract_pool. */
+static int can_extract_in_pool(alpm_handle_t *handle, alpm_pkg_t *pkg)
+{
+	alpm_filelist_t *filelist;
+	size_t i;
+
+	/* the archive is opened from another directory than it was named in */
+	if(pkg->origin_data.file == NULL || pkg->origin_data.file[0] != '/') {
+		return 0;
+	}
+	if(alpm_pkg_has_scriptlet(pkg) || alpm_pkg_get_backup(pkg)
+			|| (pkg->oldpkg && alpm_pkg_get_backup(pkg->oldpkg))) {
+		return 0;
+	}
+	if(handle->noupgrade) {
+		filelist = alpm_pkg_get_files(pkg);
+		for(i = 0; i < filelist->count; i++) {
+			if(_alpm_fnmatch_patterns(handle->noupgrade, filelist->files[i].name) == 0) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/* Whether file, or the same path as a directory or not, belongs to an
+ * active package of the pool. Directories may be shared. */
+static int extract_pool_has_file(struct extract_pool *pool, const char *file)
+{
+	char path[PATH_MAX];
+	size_t len = strlen(file);
+
+	if(len == 0 || len + 2 > PATH_MAX) {
+		return 0;
+	}
+	if(file[len - 1] == '/') {
+		memcpy(path, file, len - 1);
+		path[len - 1] = '\0';
+	} else {
+		if(_alpm_fileowners_find(pool->files, file)) {
+			return 1;
+		}
+		memcpy(path, file, len);
+		path[len] = '/';
+		path[len + 1] = '\0';
+	}
+	return _alpm_fileowners_find(pool->files, path) != NULL;
+}
+
+/* Whether removing oldpkg may delete a directory an active package of the
+ * pool is extracting into, as it is left empty and owned by nothing else. */
+static int extract_pool_shares_dir(struct extract_pool *pool,
+		alpm_pkg_t *oldpkg, const char *dir)
+{
+	alpm_list_t *i;
+
+	if(_alpm_fileowners_find(pool->files, dir) == NULL) {
+		return 0;
+	}
+	for(i = _alpm_db_find_file_owners(pool->handle->db_local, dir); i; i = i->next) {
+		alpm_pkg_t *local_pkg = i->data;
+		if(oldpkg->name_hash != local_pkg->name_hash
+				|| strcmp(oldpkg->name, local_pkg->name) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Whether pkg has to wait for an active package of the pool, because it
+ * depends on it or one of them has a file of the other. Paths both have
+ * as a directory are fine, unless removing the package pkg replaces could
+ * find them empty. */
+static int extract_pool_blocks(struct extract_pool *pool, alpm_pkg_t *pkg)
+{
+	alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
+	alpm_list_t *i, *j;
+	size_t n;
+
+	for(i = alpm_pkg_get_depends(pkg); i; i = i->next) {
+		for(j = pool->active; j; j = j->next) {
+			struct pkg_commit *commit = j->data;
+			if(_alpm_depcmp(commit->newpkg, i->data)) {
+				return 1;
+			}
+		}
+	}
 
+	for(n = 0; n < filelist->count; n++) {
+		if(extract_pool_has_file(pool, filelist->files[n].name)) {
+			return 1;
+		}
+	}
+	if(pkg->oldpkg) {
+		filelist = alpm_pkg_get_files(pkg->oldpkg);
+		for(n = 0; n < filelist->count; n++) {
+			const char *file = filelist->files[n].name;
+			if(extract_pool_has_file(pool, file)
+					|| extract_pool_shares_dir(pool, pkg->oldpkg, file)) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Waits for the oldest active package and finishes it. */
+static int extract_pool_finish_one(struct extract_pool *pool)
+{
+	struct pkg_commit *commit = pool->active->data;
+	int ret;
+
+	pthread_mutex_lock(&pool->lock);
+	while(!commit->done) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	pool->active = alpm_list_remove_item(pool->active, pool->active);
+	_alpm_fileowners_remove(pool->files, commit->newpkg);
+
+	ret = commit_pkg_finish(pool->handle, commit);
+	free(commit);
+	return ret;
+}
+
+/* Starts the commit of pkg and hands it to the pool once the packages it
+ * has to wait for are finished. */
+static int extract_pool_add(struct extract_pool *pool, alpm_pkg_t *pkg,
+		size_t pkg_current, size_t pkg_count)
+{
+	struct pkg_commit *commit;
+	struct stat buf;
+	int ret = 0;
+
+	while(pool->active && (alpm_list_count(pool->active) >= pool->window
+				|| extract_pool_blocks(pool, pkg))) {
+		if(extract_pool_finish_one(pool) != 0) {
+			ret = -1;
+		}
+	}
+	if(ret != 0) {
+		return ret;
+	}
+
+	CALLOC(commit, 1, sizeof(*commit), RET_ERR(pool->handle, ALPM_ERR_MEMORY, -1));
+	commit->newpkg = pkg;
+	commit->pkg_current = pkg_current;
+	commit->pkg_count = pkg_count;
+	if(commit_pkg_start(pool->handle, commit) != 0) {
+		free(commit);
+		return -1;
+	}
+
+	commit->fd = _alpm_open_archive(pool->handle, pkg->origin_data.file, &buf,
+			&commit->archive, ALPM_ERR_PKG_OPEN);
+	if(commit->fd < 0 || _alpm_fileowners_add(pool->files, pkg) != 0
+			|| !alpm_list_append(&pool->active, commit)) {
+		/* extract it right here instead */
+		_alpm_fileowners_remove(pool->files, pkg);
+		if(commit->fd < 0) {
+			commit->errors = 1;
+		} else {
+			commit_pkg_extract(pool->handle, commit, commit->archive, 1);
+			_alpm_archive_read_free(commit->archive);
+			close(commit->fd);
+		}
+		ret = commit_pkg_finish(pool->handle, commit);
+		free(commit);
+		return ret;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->queue = alpm_list_add(pool->queue, commit);
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/* Finishes all active packages. */
+static int extract_pool_drain(struct extract_pool *pool)
+{
+	int ret = 0;
+
+	while(pool->active) {
+		if(extract_pool_finish_one(pool) != 0) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+/* Commits pkg on the calling thread, once all active packages are done. */
+static int extract_pool_commit_single(struct extract_pool *pool,
+		alpm_pkg_t *pkg, size_t pkg_current, size_t pkg_count)
+{
+	alpm_handle_t *handle = pool->handle;
+	int ret;
+
+	if(extract_pool_drain(pool) != 0) {
+		return -1;
+	}
+
+	/* the package file may be named relative to the working directory */
+	if(fchdir(pool->cwdfd) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR,
+				_("could not restore working directory (%s)\n"), strerror(errno));
+		return -1;
+	}
+	ret = commit_single_pkg(handle, pkg, pkg_current, pkg_count);
+	if(chdir(handle->root) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not change directory to %s (%s)\n"),
+				handle->root, strerror(errno));
+		return -1;
+	}
+	return ret;
+}
+
+static int extract_pool_free(struct extract_pool *pool)
+{
+	alpm_handle_t *handle;
+	int ret;
+
+	if(pool == NULL) {
+		return 0;
+	}
+	handle = pool->handle;
+	ret = extract_pool_drain(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	while(pool->nthreads > 0) {
+		pthread_join(pool->threads[--pool->nthreads], NULL);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+
+	/* restore the old cwd */
+	if(fchdir(pool->cwdfd) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR,
+				_("could not restore working directory (%s)\n"), strerror(errno));
+	}
+	close(pool->cwdfd);
+
+	_alpm_fileowners_free(pool->files);
+	free(pool->threads);
+	free(pool);
 	return ret;
 }
 
@@ -658,6 +1307,7 @@ int _alpm_upgrade_packages(alpm_handle_t *handle)
 	int skip_ldconfig = 0, ret = 0;
 	alpm_list_t *targ;
 	alpm_trans_t *trans = handle->trans;
+	struct extract_pool *pool;
 
 	if(trans->add == NULL) {
 		return 0;
@@ -666,18 +1316,29 @@ int _alpm_upgrade_packages(alpm_handle_t *handle)
 	pkg_count = alpm_list_count(trans->add);
 	pkg_current = 1;
 
+	pool = extract_pool_start(handle);
+
 	/* loop through our package list adding/upgrading one at a time */
 	for(targ = trans->add; targ; targ = targ->next) {
 		alpm_pkg_t *newpkg = targ->data;
+		int err;
 
 		if(handle->trans->state == STATE_INTERRUPTED) {
-			return ret;
+			break;
 		}
 
-		if(commit_single_pkg(handle, newpkg, pkg_current, pkg_count)) {
+		if(pool == NULL) {
+			err = commit_single_pkg(handle, newpkg, pkg_current, pkg_count);
+		} else if(can_extract_in_pool(handle, newpkg)) {
+			err = extract_pool_add(pool, newpkg, pkg_current, pkg_count);
+		} else {
+			err = extract_pool_commit_single(pool, newpkg, pkg_current, pkg_count);
+		}
+
+		if(err) {
 			/* something screwed up on the commit, abort the trans */
 			trans->state = STATE_INTERRUPTED;
-			handle->pm_errno = ALPM_ERR_TRANS_ABORT;
+			PM_ERRNO(handle) = ALPM_ERR_TRANS_ABORT;
 			/* running ldconfig at this point could possibly screw system */
 			skip_ldconfig = 1;
 			ret = -1;
@@ -686,6 +1347,18 @@ int _alpm_upgrade_packages(alpm_handle_t *handle)
 		pkg_current++;
 	}
 
+	/* packages already extracted are still recorded */
+	if(extract_pool_free(pool) != 0) {
+		trans->state = STATE_INTERRUPTED;
+		PM_ERRNO(handle) = ALPM_ERR_TRANS_ABORT;
+		skip_ldconfig = 1;
+		ret = -1;
+	}
+
+	if(handle->trans->state == STATE_INTERRUPTED) {
+		return ret;
+	}
+
 	if(!skip_ldconfig) {
 		/* run ldconfig if it exists */
 		_alpm_ldconfig(handle);
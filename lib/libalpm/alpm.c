@@ -67,7 +67,7 @@ alpm_handle_t SYMEXPORT *alpm_initialize(const char *root, const char *dbpath,
 	snprintf(myhandle->lockfile, lockfilelen, "%s%s", myhandle->dbpath, lf);
 
 	if(_alpm_db_register_local(myhandle) == NULL) {
-		myerr = myhandle->pm_errno;
+		myerr = PM_ERRNO(myhandle);
 		goto cleanup;
 	}
 
@@ -77,6 +77,9 @@ alpm_handle_t SYMEXPORT *alpm_initialize(const char *root, const char *dbpath,
 #endif
 
 	myhandle->parallel_downloads = 1;
+	myhandle->parallel_db_loads = 1;
+	myhandle->parallel_integrity_checks = 1;
+	myhandle->parallel_extractions = 1;
 
 #ifdef ENABLE_NLS
 	bindtextdomain("libalpm", LOCALEDIR);
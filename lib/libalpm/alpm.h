@@ -1173,7 +1173,11 @@ typedef enum _alpm_download_event_type_t {
 	/** Download will be retried */
 	ALPM_DOWNLOAD_RETRY,
 	/** A download completed */
-	ALPM_DOWNLOAD_COMPLETED
+	ALPM_DOWNLOAD_COMPLETED,
+	/** Transfer statistics of a host, reported once all downloads of a
+	 * batch are done. The file name is the name of the host. Only sent
+	 * when enabled with alpm_option_set_host_stats(). */
+	ALPM_DOWNLOAD_HOST_STATS
 } alpm_download_event_type_t;
 
 /** Context struct for when a download starts. */
@@ -1208,6 +1212,21 @@ typedef struct _alpm_download_event_completed_t {
 	int result;
 } alpm_download_event_completed_t;
 
+/** Context struct for the transfer statistics of a host. */
+typedef struct _alpm_download_event_host_stats_t {
+	/** Number of transfers made to the host */
+	unsigned int transfers;
+	/** Number of those transfers that failed */
+	unsigned int failures;
+	/** Number of connections opened to the host */
+	unsigned int connections;
+	/** Number of transfers made over HTTP/2 or later, which share
+	 * connections */
+	unsigned int multiplexed;
+	/** Amount of data received from the host */
+	off_t downloaded;
+} alpm_download_event_host_stats_t;
+
 /** Type of download progress callbacks.
  * @param ctx user-provided context
  * @param filename the name of the file being downloaded
@@ -1420,6 +1439,18 @@ alpm_pkg_t *alpm_db_get_pkg(alpm_db_t *db, const char *name);
  */
 alpm_list_t *alpm_db_get_pkgcache(alpm_db_t *db);
 
+/** Find the packages of a database owning a file.
+ * The first lookup indexes the file lists of all packages in the database,
+ * later lookups are O(1).
+ * @param db pointer to the package database to search in
+ * @param path path of the file relative to the root, directories
+ * end with a slash
+ * @return a list of the packages owning path, in package cache order,
+ * which should be freed with alpm_list_free(). NULL if no package owns
+ * path or on error (pm_errno is set accordingly)
+ */
+alpm_list_t *alpm_db_find_file_owners(alpm_db_t *db, const char *path);
+
 /** Get a group entry from a package database.
  * Looking up a group is O(1) and will be significantly faster than
  * iterating over the groupcahe.
@@ -2301,6 +2332,303 @@ int alpm_option_set_parallel_downloads(alpm_handle_t *handle, unsigned int num_s
 /** @} */
 
 
+/** @name Accessors for connections per host
+ * Downloads from a host are multiplexed over a shared connection where the
+ * server supports HTTP/2. This setting limits the number of connections
+ * opened to a single host. Further download streams to that host share
+ * the open connections, or wait for one of them to become free if the
+ * server does not multiplex, so the number of parallel download streams
+ * may exceed the number of connections.
+ *
+ * By default this value is set to 0, meaning the number of connections per
+ * host is only limited by the number of parallel downloads.
+ *
+ * @{
+ */
+
+/** Gets the maximum number of connections opened to a single host.
+ * @param handle the context handle
+ * @return the maximum number of connections per host, 0 for no limit
+ */
+int alpm_option_get_max_host_connections(alpm_handle_t *handle);
+
+/** Sets the maximum number of connections opened to a single host.
+ * @param handle the context handle
+ * @param num_connections maximum number of connections per host, 0 for no limit
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_max_host_connections(alpm_handle_t *handle,
+		unsigned int num_connections);
+/* End of max_host_connections accessors */
+/** @} */
+
+
+/** @name Accessors for per-host transfer statistics
+ *
+ * By default, no transfer statistics are reported to the download callback.
+ * @{
+ */
+
+/** Gets whether the transfer statistics of each host are reported.
+ * @param handle the context handle
+ * @return 1 if they are reported, 0 if not, -1 on error
+ */
+int alpm_option_get_host_stats(alpm_handle_t *handle);
+
+/** Enables/disables reporting the transfer statistics of each host as
+ * ALPM_DOWNLOAD_HOST_STATS events of the download callback.
+ * @param handle the context handle
+ * @param host_stats 0 for disabled, 1 for enabled
+ * @return 0 on success, -1 on error (pm_errno is set accordingly)
+ */
+int alpm_option_set_host_stats(alpm_handle_t *handle, unsigned short host_stats);
+/* End of host_stats accessors */
+/** @} */
+
+
+/** @name Accessors for segmented downloads
+ * Packages of at least this size can be split into byte ranges that are
+ * fetched concurrently, from different servers where possible, when
+ * parallel download streams would otherwise sit idle. The ranges are joined
+ * in the package's temporary download file before it is moved into place.
+ * Servers that do not honor range requests are handled by downloading the
+ * rest of the package as one stream.
+ *
+ * By default this value is set to 0, meaning packages are never split.
+ *
+ * @{
+ */
+
+/** Gets the size from which packages are downloaded in segments.
+ * @param handle the context handle
+ * @return the size in bytes, 0 if segmented downloads are disabled
+ */
+off_t alpm_option_get_segmented_download_size(alpm_handle_t *handle);
+
+/** Sets the size from which packages are downloaded in segments.
+ * @param handle the context handle
+ * @param size the size in bytes, 0 to disable segmented downloads
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_segmented_download_size(alpm_handle_t *handle, off_t size);
+/* End of segmented_download_size accessors */
+/** @} */
+
+
+/** Orders in which packages are downloaded. */
+typedef enum _alpm_download_order_t {
+	/** Largest files first, to keep parallel streams busy until the end */
+	ALPM_DOWNLOAD_ORDER_SIZE = 0,
+	/** The order in which the packages are installed */
+	ALPM_DOWNLOAD_ORDER_INSTALL
+} alpm_download_order_t;
+
+/** @name Accessors for the download order
+ * Downloads are started in this order as parallel streams become free.
+ * Starting the largest files first tends to finish a batch of downloads
+ * soonest. Following the install order instead makes the packages that are
+ * needed first available first, which lets work on them overlap with the
+ * remaining downloads.
+ *
+ * By default packages are downloaded largest first.
+ *
+ * @{
+ */
+
+/** Gets the order in which packages are downloaded.
+ * @param handle the context handle
+ * @return the download order
+ */
+alpm_download_order_t alpm_option_get_download_order(alpm_handle_t *handle);
+
+/** Sets the order in which packages are downloaded.
+ * @param handle the context handle
+ * @param order the download order
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_download_order(alpm_handle_t *handle, alpm_download_order_t order);
+/* End of download_order accessors */
+/** @} */
+
+
+/** @name Accessors for pipelined commits
+ * When enabled, alpm_trans_commit() verifies and loads each package file
+ * on a separate thread as soon as its download has completed, while the
+ * remaining packages are still being downloaded. Nothing is extracted
+ * before every package has been verified and loaded, and packages are
+ * still installed in dependency order, so the result of a transaction is
+ * the same as without this setting. Combining it with
+ * ALPM_DOWNLOAD_ORDER_INSTALL lets more of this work overlap.
+ *
+ * By default this is disabled.
+ *
+ * While packages are downloaded the log callback may be invoked from
+ * threads other than the calling one; invocations are serialized with each
+ * other and with the download callback.
+ *
+ * @{
+ */
+
+/** Get whether or not commits are pipelined.
+ * @param handle the context handle
+ * @return 0 if disabled, 1 if enabled
+ */
+int alpm_option_get_pipelined_commit(alpm_handle_t *handle);
+
+/** Enable/disable pipelined commits.
+ * @param handle the context handle
+ * @param enable 0 for disabled, 1 for enabled
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_pipelined_commit(alpm_handle_t *handle, int enable);
+/* End of pipelined_commit accessors */
+/** @} */
+
+
+/** @name Accessors for parallel database loads
+ * Sync databases are read lazily, the first time their package cache is
+ * needed. When this setting is greater than 1, the first such access to
+ * any sync database instead loads all registered sync databases that have
+ * not been loaded yet, using up to this many threads. The resulting package
+ * caches are the same as when loading one database at a time.
+ *
+ * By default this value is set to 1, meaning databases are loaded
+ * sequentially and only when used.
+ *
+ * While databases are loaded in parallel the log callback may be invoked
+ * from threads other than the calling one; invocations are serialized.
+ *
+ * @{
+ */
+
+/** Gets the number of threads used to load sync databases.
+ * @param handle the context handle
+ * @return the number of threads used to load sync databases
+ */
+int alpm_option_get_parallel_db_loads(alpm_handle_t *handle);
+
+/** Sets the number of threads used to load sync databases.
+ * @param handle the context handle
+ * @param num_threads number of threads loading sync databases
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_parallel_db_loads(alpm_handle_t *handle, unsigned int num_threads);
+/* End of parallel_db_loads accessors */
+/** @} */
+
+
+/** @name Accessors for parallel integrity checks
+ * Before packages are installed, their checksums and signatures are
+ * verified. When this setting is greater than 1, up to this many packages
+ * are verified at the same time, each on its own thread. Results are still
+ * reported in transaction order, with the same events and progress
+ * callbacks as when verifying one package at a time.
+ *
+ * By default this value is set to 1, meaning packages are verified
+ * sequentially.
+ *
+ * While packages are verified in parallel the log callback may be invoked
+ * from threads other than the calling one; invocations are serialized.
+ *
+ * @{
+ */
+
+/** Gets the number of threads used to verify packages.
+ * @param handle the context handle
+ * @return the number of threads used to verify packages
+ */
+int alpm_option_get_parallel_integrity_checks(alpm_handle_t *handle);
+
+/** Sets the number of threads used to verify packages.
+ * @param handle the context handle
+ * @param num_threads number of threads verifying packages
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_parallel_integrity_checks(alpm_handle_t *handle, unsigned int num_threads);
+/* End of parallel_integrity_checks accessors */
+/** @} */
+
+
+/** @name Accessors for parallel extractions
+ * Packages are installed one at a time by default. When this setting is
+ * greater than 1, the files of up to this many packages are extracted at
+ * the same time, each on its own thread. Only packages that share no files
+ * with and do not depend on any package being extracted alongside them
+ * are extracted in parallel. Packages with an install scriptlet or backup
+ * files, packages with files in NoUpgrade and packages loaded from a
+ * relative path are still installed on their own, in transaction order.
+ * The local database is updated and events and progress callbacks are
+ * invoked by the calling thread, in transaction order.
+ *
+ * By default this value is set to 1, meaning packages are extracted
+ * sequentially.
+ *
+ * While packages are extracted in parallel the log callback may be invoked
+ * from threads other than the calling one; invocations are serialized.
+ *
+ * @{
+ */
+
+/** Gets the number of threads used to extract packages.
+ * @param handle the context handle
+ * @return the number of threads used to extract packages
+ */
+int alpm_option_get_parallel_extractions(alpm_handle_t *handle);
+
+/** Sets the number of threads used to extract packages.
+ * @param handle the context handle
+ * @param num_threads number of threads extracting packages
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_parallel_extractions(alpm_handle_t *handle, unsigned int num_threads);
+/* End of parallel_extractions accessors */
+/** @} */
+
+
+/** How the files written by a transaction are made durable. */
+typedef enum _alpm_durability_t {
+	/** Leave writing files back to disk to the kernel */
+	ALPM_DURABILITY_NONE = 0,
+	/** Sync the files of each package together before moving them into place */
+	ALPM_DURABILITY_BATCH,
+	/** Sync every file as it is written before moving it into place */
+	ALPM_DURABILITY_FILE
+} alpm_durability_t;
+
+/** @name Accessors for durability
+ * Without durability a crash or power loss during a transaction may leave
+ * installed files and local database entries empty or truncated. With
+ * ALPM_DURABILITY_BATCH the files of a package and its database entry are
+ * written under temporary names, flushed to disk with one syncfs() for
+ * every filesystem written to, then renamed into place, after which the
+ * directories they were renamed in are synced. The database entry of a
+ * package only takes the place of the old one after its files did, so it
+ * never describes files that are not on disk. ALPM_DURABILITY_FILE gives
+ * the same guarantees, but syncs every file as it is written and every
+ * directory as a file is renamed in it, which is much slower for packages
+ * with many files.
+ *
+ * By default files are not synced.
+ *
+ * @{
+ */
+
+/** Gets how the files written by transactions are made durable.
+ * @param handle the context handle
+ * @return the durability
+ */
+alpm_durability_t alpm_option_get_durability(alpm_handle_t *handle);
+
+/** Sets how the files written by transactions are made durable.
+ * @param handle the context handle
+ * @param durability the durability
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_durability(alpm_handle_t *handle, alpm_durability_t durability);
+/* End of durability accessors */
+/** @} */
+
+
 /* End of libalpm_options */
 /** @} */
 
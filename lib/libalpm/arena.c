@@ -0,0 +1,266 @@
+/*
+ *  arena.c
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* libalpm */
+#include "arena.h"
+#include "util.h"
+
+/* size of the regular blocks; larger allocations get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	/* data follows, aligned to ARENA_ALIGN */
+};
+
+#define BLOCK_HEADER_SIZE \
+	((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct interned {
+	unsigned long hash;
+	char *str;
+};
+
+struct _alpm_arena_t {
+	struct arena_block *blocks;
+	/* open addressing table of interned strings, size is a power of two */
+	struct interned *interned;
+	size_t intern_size;
+	size_t intern_count;
+};
+
+/* sdbm, the same as _alpm_hash_sdbm() but bounded by length */
+static unsigned long hash_strn(const char *str, size_t len)
+{
+	unsigned long hash = 0;
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		hash = (unsigned char)str[i] + (hash << 6) + (hash << 16) - hash;
+	}
+	return hash;
+}
+
+alpm_arena_t *_alpm_arena_new(void)
+{
+	alpm_arena_t *arena;
+
+	CALLOC(arena, 1, sizeof(alpm_arena_t), return NULL);
+	return arena;
+}
+
+void _alpm_arena_free(alpm_arena_t *arena)
+{
+	struct arena_block *block, *next;
+
+	if(arena == NULL) {
+		return;
+	}
+
+	for(block = arena->blocks; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena->interned);
+	free(arena);
+}
+
+static struct arena_block *arena_new_block(size_t size)
+{
+	struct arena_block *block;
+
+	MALLOC(block, BLOCK_HEADER_SIZE + size, return NULL);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/* allocate len bytes, starting at a multiple of align */
+static void *arena_alloc(alpm_arena_t *arena, size_t len, size_t align)
+{
+	struct arena_block *block = arena->blocks;
+	size_t offset;
+
+	if(block) {
+		offset = (block->used + align - 1) & ~(align - 1);
+		if(offset + len <= block->size) {
+			block->used = offset + len;
+			return (char *)block + BLOCK_HEADER_SIZE + offset;
+		}
+	}
+
+	if(len > ARENA_BLOCK_SIZE / 4) {
+		/* keep using the current block for small allocations */
+		block = arena_new_block(len);
+		if(block == NULL) {
+			return NULL;
+		}
+		if(arena->blocks) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			arena->blocks = block;
+		}
+	} else {
+		block = arena_new_block(ARENA_BLOCK_SIZE);
+		if(block == NULL) {
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	block->used = len;
+	return (char *)block + BLOCK_HEADER_SIZE;
+}
+
+/** Allocate memory from an arena.
+ * The memory is suitably aligned for any of the structures libalpm stores
+ * in an arena, but not zeroed.
+ * @param arena the arena
+ * @param size number of bytes
+ * @return the memory, NULL on error
+ */
+void *_alpm_arena_alloc(alpm_arena_t *arena, size_t size)
+{
+	return arena_alloc(arena, size, ARENA_ALIGN);
+}
+
+/** Copy at most len bytes of a string into an arena.
+ * @param arena the arena
+ * @param str the string, copying NULL yields NULL
+ * @param len maximum number of bytes to copy
+ * @return the copy, NULL on error
+ */
+char *_alpm_arena_strndup(alpm_arena_t *arena, const char *str, size_t len)
+{
+	char *dup;
+
+	if(str == NULL) {
+		return NULL;
+	}
+	len = strnlen(str, len);
+	if((dup = arena_alloc(arena, len + 1, 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(dup, str, len);
+	dup[len] = '\0';
+	return dup;
+}
+
+/** Copy a string into an arena.
+ * @param arena the arena
+ * @param str the string, copying NULL yields NULL
+ * @return the copy, NULL on error
+ */
+char *_alpm_arena_strdup(alpm_arena_t *arena, const char *str)
+{
+	if(str == NULL) {
+		return NULL;
+	}
+	return _alpm_arena_strndup(arena, str, strlen(str));
+}
+
+static int arena_grow_interned(alpm_arena_t *arena)
+{
+	struct interned *table;
+	size_t newsize = arena->intern_size ? arena->intern_size * 2 : 256;
+	size_t i;
+
+	CALLOC(table, newsize, sizeof(struct interned), return -1);
+	for(i = 0; i < arena->intern_size; i++) {
+		struct interned *entry = arena->interned + i;
+		size_t pos;
+		if(entry->str == NULL) {
+			continue;
+		}
+		pos = entry->hash & (newsize - 1);
+		while(table[pos].str) {
+			pos = (pos + 1) & (newsize - 1);
+		}
+		table[pos] = *entry;
+	}
+
+	free(arena->interned);
+	arena->interned = table;
+	arena->intern_size = newsize;
+	return 0;
+}
+
+/** Intern at most len bytes of a string in an arena.
+ * @param arena the arena
+ * @param str the string, interning NULL yields NULL
+ * @param len maximum number of bytes to intern
+ * @return the shared copy, NULL on error
+ */
+char *_alpm_arena_internn(alpm_arena_t *arena, const char *str, size_t len)
+{
+	unsigned long hash;
+	size_t pos;
+
+	if(str == NULL) {
+		return NULL;
+	}
+	len = strnlen(str, len);
+
+	/* keep the load factor below 3/4 */
+	if((arena->intern_count + 1) * 4 > arena->intern_size * 3) {
+		if(arena_grow_interned(arena) != 0) {
+			return NULL;
+		}
+	}
+
+	hash = hash_strn(str, len);
+	pos = hash & (arena->intern_size - 1);
+	while(arena->interned[pos].str) {
+		struct interned *entry = arena->interned + pos;
+		if(entry->hash == hash && strncmp(entry->str, str, len) == 0
+				&& entry->str[len] == '\0') {
+			return entry->str;
+		}
+		pos = (pos + 1) & (arena->intern_size - 1);
+	}
+
+	if((arena->interned[pos].str = _alpm_arena_strndup(arena, str, len)) == NULL) {
+		return NULL;
+	}
+	arena->interned[pos].hash = hash;
+	arena->intern_count++;
+	return arena->interned[pos].str;
+}
+
+/** Intern a string in an arena.
+ * @param arena the arena
+ * @param str the string, interning NULL yields NULL
+ * @return the shared copy, NULL on error
+ */
+char *_alpm_arena_intern(alpm_arena_t *arena, const char *str)
+{
+	if(str == NULL) {
+		return NULL;
+	}
+	return _alpm_arena_internn(arena, str, strlen(str));
+}
@@ -0,0 +1,41 @@
+/*
+ *  arena.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_ARENA_H
+#define ALPM_ARENA_H
+
+#include <stddef.h>
+
+/* A bump allocator for data that lives exactly as long as its owner, such
+ * as the strings and dependencies of the packages in a sync database.
+ * Individual allocations are never freed; everything is released at once
+ * by _alpm_arena_free(). Interned strings are shared: interning the same
+ * string twice returns the same pointer, so they must never be modified. */
+
+typedef struct _alpm_arena_t alpm_arena_t;
+
+alpm_arena_t *_alpm_arena_new(void);
+void _alpm_arena_free(alpm_arena_t *arena);
+
+void *_alpm_arena_alloc(alpm_arena_t *arena, size_t size);
+char *_alpm_arena_strdup(alpm_arena_t *arena, const char *str);
+char *_alpm_arena_strndup(alpm_arena_t *arena, const char *str, size_t len);
+char *_alpm_arena_intern(alpm_arena_t *arena, const char *str);
+char *_alpm_arena_internn(alpm_arena_t *arena, const char *str, size_t len);
+
+#endif /* ALPM_ARENA_H */
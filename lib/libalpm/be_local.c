@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h> /* offsetof */
 #include <stdint.h> /* intmax_t */
 #include <sys/stat.h>
 #include <dirent.h>
@@ -34,6 +35,7 @@
 
 /* libalpm */
 #include "db.h"
+#include "durable.h"
 #include "alpm_list.h"
 #include "libarchive-compat.h"
 #include "log.h"
@@ -526,7 +528,7 @@ version_error:
 	closedir(dbdir);
 	db->status &= ~DB_STATUS_VALID;
 	db->status |= DB_STATUS_INVALID;
-	db->handle->pm_errno = ALPM_ERR_DB_VERSION;
+	PM_ERRNO(db->handle) = ALPM_ERR_DB_VERSION;
 	return -1;
 }
 
@@ -682,6 +684,27 @@ char *_alpm_local_db_pkgpath(alpm_db_t *db, alpm_pkg_t *info,
 	return pkgpath;
 }
 
+/* sections of local database entries that map directly to a package field */
+static const struct db_section_handler local_sections[DB_SECTION_COUNT] = {
+	[DB_SECTION_BASE]         = { DB_FIELD_STRING, offsetof(alpm_pkg_t, base) },
+	[DB_SECTION_DESC]         = { DB_FIELD_STRING, offsetof(alpm_pkg_t, desc) },
+	[DB_SECTION_GROUPS]       = { DB_FIELD_STRINGLIST, offsetof(alpm_pkg_t, groups) },
+	[DB_SECTION_URL]          = { DB_FIELD_STRING, offsetof(alpm_pkg_t, url) },
+	[DB_SECTION_LICENSE]      = { DB_FIELD_STRINGLIST, offsetof(alpm_pkg_t, licenses) },
+	[DB_SECTION_ARCH]         = { DB_FIELD_STRING, offsetof(alpm_pkg_t, arch) },
+	[DB_SECTION_BUILDDATE]    = { DB_FIELD_DATE, offsetof(alpm_pkg_t, builddate) },
+	[DB_SECTION_INSTALLDATE]  = { DB_FIELD_DATE, offsetof(alpm_pkg_t, installdate) },
+	[DB_SECTION_PACKAGER]     = { DB_FIELD_STRING, offsetof(alpm_pkg_t, packager) },
+	[DB_SECTION_SIZE]         = { DB_FIELD_SIZE, offsetof(alpm_pkg_t, isize) },
+	[DB_SECTION_REPLACES]     = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, replaces) },
+	[DB_SECTION_DEPENDS]      = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, depends) },
+	[DB_SECTION_OPTDEPENDS]   = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, optdepends) },
+	[DB_SECTION_MAKEDEPENDS]  = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, makedepends) },
+	[DB_SECTION_CHECKDEPENDS] = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, checkdepends) },
+	[DB_SECTION_CONFLICTS]    = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, conflicts) },
+	[DB_SECTION_PROVIDES]     = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, provides) },
+};
+
 #define READ_NEXT() do { \
 	if(safe_fgets(line, sizeof(line), fp) == NULL && !feof(fp)) goto error; \
 	_alpm_strip_newline(line, 0); \
@@ -714,6 +737,9 @@ static int local_db_read(alpm_pkg_t *info, int inforeq)
 {
 	FILE *fp = NULL;
 	char line[1024] = {0};
+	size_t len;
+	alpm_dbsection_t section;
+	const struct db_section_handler *handler;
 	alpm_db_t *db = info->origin_data.db;
 
 	/* bitmask logic here:
@@ -749,99 +775,98 @@ static int local_db_read(alpm_pkg_t *info, int inforeq)
 			if(safe_fgets(line, sizeof(line), fp) == NULL && !feof(fp)) {
 				goto error;
 			}
-			if(_alpm_strip_newline(line, 0) == 0) {
+			len = _alpm_strip_newline(line, 0);
+			if(len == 0) {
 				/* length of stripped line was zero */
 				continue;
 			}
-			if(strcmp(line, "%NAME%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, info->name) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
-								"mismatch on package %s\n"), db->treename, info->name);
-				}
-			} else if(strcmp(line, "%VERSION%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, info->version) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
-								"mismatch on package %s\n"), db->treename, info->name);
-				}
-			} else if(strcmp(line, "%BASE%") == 0) {
-				READ_AND_STORE(info->base);
-			} else if(strcmp(line, "%DESC%") == 0) {
-				READ_AND_STORE(info->desc);
-			} else if(strcmp(line, "%GROUPS%") == 0) {
-				READ_AND_STORE_ALL(info->groups);
-			} else if(strcmp(line, "%URL%") == 0) {
-				READ_AND_STORE(info->url);
-			} else if(strcmp(line, "%LICENSE%") == 0) {
-				READ_AND_STORE_ALL(info->licenses);
-			} else if(strcmp(line, "%ARCH%") == 0) {
-				READ_AND_STORE(info->arch);
-			} else if(strcmp(line, "%BUILDDATE%") == 0) {
-				READ_NEXT();
-				info->builddate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%INSTALLDATE%") == 0) {
-				READ_NEXT();
-				info->installdate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%PACKAGER%") == 0) {
-				READ_AND_STORE(info->packager);
-			} else if(strcmp(line, "%REASON%") == 0) {
-				READ_NEXT();
-				info->reason = _read_pkgreason(db->handle, info->name, line);
-			} else if(strcmp(line, "%VALIDATION%") == 0) {
-				alpm_list_t *i, *v = NULL;
-				READ_AND_STORE_ALL(v);
-				for(i = v; i; i = alpm_list_next(i))
-				{
-					if(strcmp(i->data, "none") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_NONE;
-					} else if(strcmp(i->data, "md5") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_MD5SUM;
-					} else if(strcmp(i->data, "sha256") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_SHA256SUM;
-					} else if(strcmp(i->data, "pgp") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_SIGNATURE;
-					} else {
-						_alpm_log(db->handle, ALPM_LOG_WARNING,
-								_("unknown validation type for package %s: %s\n"),
-								info->name, (const char *)i->data);
+
+			section = _alpm_db_section(line, len);
+			switch(section) {
+				case DB_SECTION_NAME:
+					READ_NEXT();
+					if(strcmp(line, info->name) != 0) {
+						_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
+									"mismatch on package %s\n"), db->treename, info->name);
+					}
+					break;
+				case DB_SECTION_VERSION:
+					READ_NEXT();
+					if(strcmp(line, info->version) != 0) {
+						_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
+									"mismatch on package %s\n"), db->treename, info->name);
 					}
+					break;
+				case DB_SECTION_REASON:
+					READ_NEXT();
+					info->reason = _read_pkgreason(db->handle, info->name, line);
+					break;
+				case DB_SECTION_VALIDATION: {
+					alpm_list_t *i, *v = NULL;
+					READ_AND_STORE_ALL(v);
+					for(i = v; i; i = alpm_list_next(i))
+					{
+						if(strcmp(i->data, "none") == 0) {
+							info->validation |= ALPM_PKG_VALIDATION_NONE;
+						} else if(strcmp(i->data, "md5") == 0) {
+							info->validation |= ALPM_PKG_VALIDATION_MD5SUM;
+						} else if(strcmp(i->data, "sha256") == 0) {
+							info->validation |= ALPM_PKG_VALIDATION_SHA256SUM;
+						} else if(strcmp(i->data, "pgp") == 0) {
+							info->validation |= ALPM_PKG_VALIDATION_SIGNATURE;
+						} else {
+							_alpm_log(db->handle, ALPM_LOG_WARNING,
+									_("unknown validation type for package %s: %s\n"),
+									info->name, (const char *)i->data);
+						}
+					}
+					FREELIST(v);
+					break;
 				}
-				FREELIST(v);
-			} else if(strcmp(line, "%SIZE%") == 0) {
-				READ_NEXT();
-				info->isize = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%REPLACES%") == 0) {
-				READ_AND_SPLITDEP(info->replaces);
-			} else if(strcmp(line, "%DEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->depends);
-			} else if(strcmp(line, "%OPTDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->optdepends);
-			} else if(strcmp(line, "%MAKEDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->makedepends);
-			} else if(strcmp(line, "%CHECKDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->checkdepends);
-			} else if(strcmp(line, "%CONFLICTS%") == 0) {
-				READ_AND_SPLITDEP(info->conflicts);
-			} else if(strcmp(line, "%PROVIDES%") == 0) {
-				READ_AND_SPLITDEP(info->provides);
-			} else if(strcmp(line, "%XDATA%") == 0) {
-				alpm_list_t *i, *lines = NULL;
-				READ_AND_STORE_ALL(lines);
-				for(i = lines; i; i = i->next) {
-					alpm_pkg_xdata_t *pd = _alpm_pkg_parse_xdata(i->data);
-					if(pd == NULL || !alpm_list_append(&info->xdata, pd)) {
-						_alpm_pkg_xdata_free(pd);
-						FREELIST(lines);
-						goto error;
+				case DB_SECTION_XDATA: {
+					alpm_list_t *i, *lines = NULL;
+					READ_AND_STORE_ALL(lines);
+					for(i = lines; i; i = i->next) {
+						alpm_pkg_xdata_t *pd = _alpm_pkg_parse_xdata(i->data);
+						if(pd == NULL || !alpm_list_append(&info->xdata, pd)) {
+							_alpm_pkg_xdata_free(pd);
+							FREELIST(lines);
+							goto error;
+						}
 					}
+					FREELIST(lines);
+					break;
 				}
-				FREELIST(lines);
-			} else {
-				_alpm_log(db->handle, ALPM_LOG_WARNING, _("%s: unknown key '%s' in local database\n"), info->name, line);
-				alpm_list_t *lines = NULL;
-				READ_AND_STORE_ALL(lines);
-				FREELIST(lines);
+				default:
+					handler = &local_sections[section];
+					switch(handler->type) {
+						case DB_FIELD_STRING:
+						case DB_FIELD_INTERNED:
+							READ_AND_STORE(*(char **)DB_SECTION_FIELD(info, handler));
+							break;
+						case DB_FIELD_STRINGLIST:
+							READ_AND_STORE_ALL(*(alpm_list_t **)DB_SECTION_FIELD(info, handler));
+							break;
+						case DB_FIELD_DEPLIST:
+							READ_AND_SPLITDEP(*(alpm_list_t **)DB_SECTION_FIELD(info, handler));
+							break;
+						case DB_FIELD_DATE:
+							READ_NEXT();
+							*(alpm_time_t *)DB_SECTION_FIELD(info, handler) = _alpm_parsedate(line);
+							break;
+						case DB_FIELD_SIZE:
+							READ_NEXT();
+							*(off_t *)DB_SECTION_FIELD(info, handler) = _alpm_strtoofft(line);
+							break;
+						default: {
+							alpm_list_t *lines = NULL;
+							_alpm_log(db->handle, ALPM_LOG_WARNING, _("%s: unknown key '%s' in local database\n"), info->name, line);
+							READ_AND_STORE_ALL(lines);
+							FREELIST(lines);
+							break;
+						}
+					}
+					break;
 			}
 		}
 		fclose(fp);
@@ -859,9 +884,10 @@ static int local_db_read(alpm_pkg_t *info, int inforeq)
 		}
 		free(path);
 		while(safe_fgets(line, sizeof(line), fp)) {
-			_alpm_strip_newline(line, 0);
-			if(strcmp(line, "%FILES%") == 0) {
-				size_t files_count = 0, files_size = 0, len;
+			len = _alpm_strip_newline(line, 0);
+			section = _alpm_db_section(line, len);
+			if(section == DB_SECTION_FILES) {
+				size_t files_count = 0, files_size = 0;
 				alpm_file_t *files = NULL;
 
 				while(safe_fgets(line, sizeof(line), fp) &&
@@ -893,7 +919,7 @@ nomem:
 				}
 				FREE(files);
 				goto error;
-			} else if(strcmp(line, "%BACKUP%") == 0) {
+			} else if(section == DB_SECTION_BACKUP) {
 				while(safe_fgets(line, sizeof(line), fp) && _alpm_strip_newline(line, 0)) {
 					alpm_backup_t *backup;
 					CALLOC(backup, 1, sizeof(alpm_backup_t), goto error);
@@ -971,17 +997,49 @@ static void write_deps(FILE *fp, const char *header, alpm_list_t *deplist)
 	fputc('\n', fp);
 }
 
+/* Opens a file of a database entry for writing, under a temporary name
+ * added to durable if the entry is written durably. */
+static FILE *open_entry_file(alpm_durable_t *durable, const char *path)
+{
+	char staged[PATH_MAX];
+	FILE *fp;
+
+	if(durable == NULL) {
+		return fopen(path, "w");
+	}
+	if(_alpm_durable_stage(path, staged, PATH_MAX) != 0) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if((fp = fopen(staged, "w")) == NULL) {
+		return NULL;
+	}
+	if(_alpm_durable_add(durable, staged, path) != 0) {
+		fclose(fp);
+		unlink(staged);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return fp;
+}
+
 int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 {
 	FILE *fp = NULL;
 	mode_t oldmask;
 	alpm_list_t *lp;
+	alpm_durable_t *durable = NULL;
 	int retval = 0;
 
 	if(db == NULL || info == NULL || !(db->status & DB_STATUS_LOCAL)) {
 		return -1;
 	}
 
+	if(db->handle->durability != ALPM_DURABILITY_NONE
+			&& (durable = _alpm_durable_new(db->handle)) == NULL) {
+		return -1;
+	}
+
 	/* make sure we have a sane umask */
 	oldmask = umask(0022);
 
@@ -992,7 +1050,7 @@ int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 				"writing %s-%s DESC information back to db\n",
 				info->name, info->version);
 		path = _alpm_local_db_pkgpath(db, info, "desc");
-		if(!path || (fp = fopen(path, "w")) == NULL) {
+		if(!path || (fp = open_entry_file(durable, path)) == NULL) {
 			_alpm_log(db->handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
 					path, strerror(errno));
 			retval = -1;
@@ -1098,7 +1156,7 @@ int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 				"writing %s-%s FILES information back to db\n",
 				info->name, info->version);
 		path = _alpm_local_db_pkgpath(db, info, "files");
-		if(!path || (fp = fopen(path, "w")) == NULL) {
+		if(!path || (fp = open_entry_file(durable, path)) == NULL) {
 			_alpm_log(db->handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
 					path, strerror(errno));
 			retval = -1;
@@ -1131,7 +1189,12 @@ int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 	/* INSTALL and MTREE */
 	/* nothing needed here (automatically extracted) */
 
+	if(durable && _alpm_durable_commit(durable) != 0) {
+		retval = -1;
+	}
+
 cleanup:
+	_alpm_durable_free(durable);
 	umask(oldmask);
 	return retval;
 }
@@ -1219,7 +1282,7 @@ alpm_db_t *_alpm_db_register_local(alpm_handle_t *handle)
 
 	db = _alpm_db_new("local", 1);
 	if(db == NULL) {
-		handle->pm_errno = ALPM_ERR_DB_CREATE;
+		PM_ERRNO(handle) = ALPM_ERR_DB_CREATE;
 		return NULL;
 	}
 	db->ops = &local_db_ops;
@@ -40,6 +40,7 @@
 #include "package.h"
 #include "deps.h"
 #include "filelist.h"
+#include "dload.h"
 #include "util.h"
 
 struct package_changelog {
@@ -76,7 +77,7 @@ static void *_package_changelog_open(alpm_pkg_t *pkg)
 		if(strcmp(entry_name, ".CHANGELOG") == 0) {
 			changelog = malloc(sizeof(struct package_changelog));
 			if(!changelog) {
-				pkg->handle->pm_errno = ALPM_ERR_MEMORY;
+				PM_ERRNO(pkg->handle) = ALPM_ERR_MEMORY;
 				_alpm_archive_read_free(archive);
 				close(fd);
 				return NULL;
@@ -266,6 +267,23 @@ static int parse_descfile(alpm_handle_t *handle, struct archive *a, alpm_pkg_t *
 	return 0;
 }
 
+/* Test a package file against the checksum of its sync package. A digest
+ * taken while the file was downloaded saves reading it again, as long as the
+ * file was not changed since. */
+static int pkg_test_checksum(alpm_handle_t *handle, const char *pkgfile,
+		alpm_pkg_t *syncpkg, alpm_pkgvalidation_t type)
+{
+	const char *expected = type == ALPM_PKG_VALIDATION_MD5SUM ?
+		syncpkg->md5sum : syncpkg->sha256sum;
+
+	if(_alpm_dload_digest_matches(syncpkg->download_digest, pkgfile, type)) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "using checksum computed while downloading %s\n",
+				pkgfile);
+		return strcmp(syncpkg->download_digest->hex, expected) == 0 ? 0 : 1;
+	}
+	return _alpm_test_checksum(pkgfile, expected, type);
+}
+
 /**
  * Validate a package.
  * @param handle the context handle
@@ -282,7 +300,7 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		alpm_siglist_t **sigdata, int *validation)
 {
 	int has_sig;
-	handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(handle) = ALPM_ERR_OK;
 
 	if(pkgfile == NULL || strlen(pkgfile) == 0) {
 		RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1);
@@ -291,11 +309,11 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 	/* attempt to access the package file, ensure it exists */
 	if(_alpm_access(handle, NULL, pkgfile, R_OK) != 0) {
 		if(errno == ENOENT) {
-			handle->pm_errno = ALPM_ERR_PKG_NOT_FOUND;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_NOT_FOUND;
 		} else if(errno == EACCES) {
-			handle->pm_errno = ALPM_ERR_BADPERMS;
+			PM_ERRNO(handle) = ALPM_ERR_BADPERMS;
 		} else {
-			handle->pm_errno = ALPM_ERR_PKG_OPEN;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_OPEN;
 		}
 		return -1;
 	}
@@ -318,7 +336,7 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		if(syncpkg->md5sum && !syncpkg->sha256sum) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "md5sum: %s\n", syncpkg->md5sum);
 			_alpm_log(handle, ALPM_LOG_DEBUG, "checking md5sum for %s\n", pkgfile);
-			if(_alpm_test_checksum(pkgfile, syncpkg->md5sum, ALPM_PKG_VALIDATION_MD5SUM) != 0) {
+			if(pkg_test_checksum(handle, pkgfile, syncpkg, ALPM_PKG_VALIDATION_MD5SUM) != 0) {
 				RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
 			}
 			if(validation) {
@@ -329,7 +347,7 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		if(syncpkg->sha256sum) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "sha256sum: %s\n", syncpkg->sha256sum);
 			_alpm_log(handle, ALPM_LOG_DEBUG, "checking sha256sum for %s\n", pkgfile);
-			if(_alpm_test_checksum(pkgfile, syncpkg->sha256sum, ALPM_PKG_VALIDATION_SHA256SUM) != 0) {
+			if(pkg_test_checksum(handle, pkgfile, syncpkg, ALPM_PKG_VALIDATION_SHA256SUM) != 0) {
 				RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
 			}
 			if(validation) {
@@ -343,13 +361,13 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		const char *sig = syncpkg ? syncpkg->base64_sig : NULL;
 		_alpm_log(handle, ALPM_LOG_DEBUG, "sig data: %s\n", sig ? sig : "<from .sig>");
 		if(!has_sig && !(level & ALPM_SIG_PACKAGE_OPTIONAL)) {
-			handle->pm_errno = ALPM_ERR_PKG_MISSING_SIG;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_MISSING_SIG;
 			return -1;
 		}
 		if(_alpm_check_pgp_helper(handle, pkgfile, sig,
 					level & ALPM_SIG_PACKAGE_OPTIONAL, level & ALPM_SIG_PACKAGE_MARGINAL_OK,
 					level & ALPM_SIG_PACKAGE_UNKNOWN_OK, sigdata)) {
-			handle->pm_errno = ALPM_ERR_PKG_INVALID_SIG;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_INVALID_SIG;
 			return -1;
 		}
 		if(validation && has_sig) {
@@ -571,11 +589,11 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 	fd = _alpm_open_archive(handle, pkgfile, &st, &archive, ALPM_ERR_PKG_OPEN);
 	if(fd < 0) {
 		if(errno == ENOENT) {
-			handle->pm_errno = ALPM_ERR_PKG_NOT_FOUND;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_NOT_FOUND;
 		} else if(errno == EACCES) {
-			handle->pm_errno = ALPM_ERR_BADPERMS;
+			PM_ERRNO(handle) = ALPM_ERR_BADPERMS;
 		} else {
-			handle->pm_errno = ALPM_ERR_PKG_OPEN;
+			PM_ERRNO(handle) = ALPM_ERR_PKG_OPEN;
 		}
 		return NULL;
 	}
@@ -684,7 +702,7 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 	return newpkg;
 
 pkg_invalid:
-	handle->pm_errno = ALPM_ERR_PKG_INVALID;
+	PM_ERRNO(handle) = ALPM_ERR_PKG_INVALID;
 error:
 	_alpm_pkg_free(newpkg);
 	_alpm_archive_read_free(archive);
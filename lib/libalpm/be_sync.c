@@ -19,6 +19,7 @@
  */
 
 #include <errno.h>
+#include <stddef.h> /* offsetof */
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -39,7 +40,8 @@
 #include "handle.h"
 #include "deps.h"
 #include "dload.h"
-#include "filelist.h"
+#include "dbcache.h"
+#include "arena.h"
 
 static char *get_sync_dir(alpm_handle_t *handle)
 {
@@ -77,7 +79,7 @@ static int sync_db_validate(alpm_db_t *db)
 		return 0;
 	}
 	if(db->status & DB_STATUS_INVALID) {
-		db->handle->pm_errno = ALPM_ERR_DB_INVALID_SIG;
+		PM_ERRNO(db->handle) = ALPM_ERR_DB_INVALID_SIG;
 		return -1;
 	}
 
@@ -125,7 +127,7 @@ static int sync_db_validate(alpm_db_t *db)
 		if(ret) {
 			db->status &= ~DB_STATUS_VALID;
 			db->status |= DB_STATUS_INVALID;
-			db->handle->pm_errno = ALPM_ERR_DB_INVALID_SIG;
+			PM_ERRNO(db->handle) = ALPM_ERR_DB_INVALID_SIG;
 			return 1;
 		}
 	}
@@ -149,7 +151,7 @@ int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force)
 	/* Sanity checks */
 	CHECK_HANDLE(handle, return -1);
 	ASSERT(dbs != NULL, return -1);
-	handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(handle) = ALPM_ERR_OK;
 
 	syncpath = get_sync_dir(handle);
 	ASSERT(syncpath != NULL, return -1);
@@ -259,9 +261,9 @@ cleanup:
 	if(ret == -1) {
 		/* pm_errno was set by the download code */
 		_alpm_log(handle, ALPM_LOG_DEBUG, "failed to sync dbs: %s\n",
-				alpm_strerror(handle->pm_errno));
+				alpm_strerror(PM_ERRNO(handle)));
 	} else {
-		handle->pm_errno = ALPM_ERR_OK;
+		PM_ERRNO(handle) = ALPM_ERR_OK;
 	}
 
 	if(payloads) {
@@ -302,6 +304,17 @@ static int _sync_get_validation(alpm_pkg_t *pkg)
 	return pkg->validation;
 }
 
+static alpm_filelist_t *_sync_get_files(alpm_pkg_t *pkg)
+{
+	_alpm_dbcache_files_load(pkg);
+	return &pkg->files;
+}
+
+static int _sync_force_load(alpm_pkg_t *pkg)
+{
+	return _alpm_dbcache_files_load(pkg);
+}
+
 /** Package sync operations struct accessor. We implement this as a method
  * because we want to reuse the majority of the default_pkg_ops struct and
  * add only a few operations of our own on top.
@@ -313,6 +326,8 @@ static const struct pkg_operations *get_sync_pkg_ops(void)
 	if(!sync_pkg_ops_initalized) {
 		sync_pkg_ops = default_pkg_ops;
 		sync_pkg_ops.get_validation = _sync_get_validation;
+		sync_pkg_ops.get_files = _sync_get_files;
+		sync_pkg_ops.force_load = _sync_force_load;
 		sync_pkg_ops_initalized = 1;
 	}
 	return &sync_pkg_ops;
@@ -349,12 +364,21 @@ static alpm_pkg_t *load_pkg_for_entry(alpm_db_t *db, const char *entryname,
 	if(pkg == NULL) {
 		pkg = _alpm_pkg_new();
 		if(pkg == NULL) {
+			free(pkgname);
+			free(pkgver);
 			RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL);
 		}
 
-		pkg->name = pkgname;
-		pkg->version = pkgver;
+		pkg->name = _alpm_arena_strdup(db->arena, pkgname);
+		pkg->version = _alpm_arena_strdup(db->arena, pkgver);
 		pkg->name_hash = pkgname_hash;
+		pkg->arena_backed = 1;
+		free(pkgname);
+		free(pkgver);
+		if(pkg->name == NULL || pkg->version == NULL) {
+			_alpm_pkg_free(pkg);
+			RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL);
+		}
 
 		pkg->origin = ALPM_PKG_FROM_SYNCDB;
 		pkg->origin_data.db = db;
@@ -420,6 +444,7 @@ static size_t estimate_package_count(struct stat *st, struct archive *archive)
 static int sync_db_populate(alpm_db_t *db)
 {
 	const char *dbpath;
+	char *dbhash;
 	size_t est_count, count;
 	int fd;
 	int ret = 0;
@@ -441,11 +466,19 @@ static int sync_db_populate(alpm_db_t *db)
 		return -1;
 	}
 
+	/* an unchanged database can be loaded from its sidecar cache */
+	dbhash = alpm_compute_sha256sum(dbpath);
+	if(_alpm_dbcache_load(db, dbpath, dbhash, get_sync_pkg_ops()) == 0) {
+		free(dbhash);
+		return 0;
+	}
+
 	fd = _alpm_open_archive(db->handle, dbpath, &buf,
 			&archive, ALPM_ERR_DB_OPEN);
 	if(fd < 0) {
 		db->status &= ~DB_STATUS_VALID;
 		db->status |= DB_STATUS_INVALID;
+		free(dbhash);
 		return -1;
 	}
 	est_count = estimate_package_count(&buf, archive);
@@ -457,7 +490,15 @@ static int sync_db_populate(alpm_db_t *db)
 	}
 
 	db->pkgcache = _alpm_pkghash_create(est_count);
-	if(db->pkgcache == NULL) {
+	db->filescache = _alpm_dbcache_files_new();
+	db->arena = _alpm_arena_new();
+	if(db->pkgcache == NULL || db->filescache == NULL || db->arena == NULL) {
+		_alpm_pkghash_free(db->pkgcache);
+		db->pkgcache = NULL;
+		_alpm_dbcache_files_free(db->filescache);
+		db->filescache = NULL;
+		_alpm_arena_free(db->arena);
+		db->arena = NULL;
 		ret = -1;
 		GOTO_ERR(db->handle, ALPM_ERR_MEMORY, cleanup);
 	}
@@ -499,11 +540,14 @@ static int sync_db_populate(alpm_db_t *db)
 			"added %zu packages to package cache for db '%s'\n",
 			count, db->treename);
 
+	_alpm_dbcache_write(db, dbpath, &buf, dbhash);
+
 cleanup:
 	_alpm_archive_read_free(archive);
 	if(fd >= 0) {
 		close(fd);
 	}
+	free(dbhash);
 	return ret;
 }
 
@@ -534,17 +578,55 @@ static int _alpm_validate_filename(alpm_db_t *db, const char *pkgname,
 	return 0;
 }
 
+/* sections of sync database entries that map directly to a package field */
+static const struct db_section_handler sync_sections[DB_SECTION_COUNT] = {
+	[DB_SECTION_BASE]         = { DB_FIELD_INTERNED, offsetof(alpm_pkg_t, base) },
+	[DB_SECTION_DESC]         = { DB_FIELD_STRING, offsetof(alpm_pkg_t, desc) },
+	[DB_SECTION_GROUPS]       = { DB_FIELD_STRINGLIST, offsetof(alpm_pkg_t, groups) },
+	[DB_SECTION_URL]          = { DB_FIELD_INTERNED, offsetof(alpm_pkg_t, url) },
+	[DB_SECTION_LICENSE]      = { DB_FIELD_STRINGLIST, offsetof(alpm_pkg_t, licenses) },
+	[DB_SECTION_ARCH]         = { DB_FIELD_INTERNED, offsetof(alpm_pkg_t, arch) },
+	[DB_SECTION_BUILDDATE]    = { DB_FIELD_DATE, offsetof(alpm_pkg_t, builddate) },
+	[DB_SECTION_PACKAGER]     = { DB_FIELD_INTERNED, offsetof(alpm_pkg_t, packager) },
+	[DB_SECTION_CSIZE]        = { DB_FIELD_SIZE, offsetof(alpm_pkg_t, size) },
+	[DB_SECTION_ISIZE]        = { DB_FIELD_SIZE, offsetof(alpm_pkg_t, isize) },
+	[DB_SECTION_MD5SUM]       = { DB_FIELD_STRING, offsetof(alpm_pkg_t, md5sum) },
+	[DB_SECTION_SHA256SUM]    = { DB_FIELD_STRING, offsetof(alpm_pkg_t, sha256sum) },
+	[DB_SECTION_PGPSIG]       = { DB_FIELD_STRING, offsetof(alpm_pkg_t, base64_sig) },
+	[DB_SECTION_REPLACES]     = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, replaces) },
+	[DB_SECTION_DEPENDS]      = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, depends) },
+	[DB_SECTION_OPTDEPENDS]   = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, optdepends) },
+	[DB_SECTION_MAKEDEPENDS]  = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, makedepends) },
+	[DB_SECTION_CHECKDEPENDS] = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, checkdepends) },
+	[DB_SECTION_CONFLICTS]    = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, conflicts) },
+	[DB_SECTION_PROVIDES]     = { DB_FIELD_DEPLIST, offsetof(alpm_pkg_t, provides) },
+};
+
 #define READ_NEXT() do { \
 	if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) goto error; \
 	line = buf.line; \
 	_alpm_strip_newline(line, buf.real_line_size); \
 } while(0)
 
+/* package strings and dependencies are allocated from the db arena */
 #define READ_AND_STORE(f) do { \
 	READ_NEXT(); \
-	STRDUP(f, line, goto error); \
+	if((f = _alpm_arena_strdup(db->arena, line)) == NULL) goto error; \
 } while(0)
 
+#define READ_AND_INTERN(f) do { \
+	READ_NEXT(); \
+	if((f = _alpm_arena_intern(db->arena, line)) == NULL) goto error; \
+} while(0)
+
+#define READ_AND_INTERN_ALL(f) do { \
+	char *interned; \
+	if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) goto error; \
+	if(_alpm_strip_newline(buf.line, buf.real_line_size) == 0) break; \
+	if((interned = _alpm_arena_intern(db->arena, buf.line)) == NULL) goto error; \
+	f = alpm_list_add(f, interned); \
+} while(1) /* note the while(1) and not (0) */
+
 #define READ_AND_STORE_ALL(f) do { \
 	char *linedup; \
 	if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) goto error; \
@@ -556,7 +638,7 @@ static int _alpm_validate_filename(alpm_db_t *db, const char *pkgname,
 #define READ_AND_SPLITDEP(f) do { \
 	if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) goto error; \
 	if(_alpm_strip_newline(buf.line, buf.real_line_size) == 0) break; \
-	f = alpm_list_add(f, alpm_dep_from_string(line)); \
+	f = alpm_list_add(f, _alpm_dep_parse(line, db->arena)); \
 } while(1) /* note the while(1) and not (0) */
 
 static int sync_db_read(alpm_db_t *db, struct archive *archive,
@@ -601,118 +683,99 @@ static int sync_db_read(alpm_db_t *db, struct archive *archive,
 		int ret;
 		while((ret = _alpm_archive_fgets(archive, &buf)) == ARCHIVE_OK) {
 			char *line = buf.line;
-			if(_alpm_strip_newline(line, buf.real_line_size) == 0) {
+			const struct db_section_handler *handler;
+			alpm_dbsection_t section;
+			size_t len = _alpm_strip_newline(line, buf.real_line_size);
+
+			if(len == 0) {
 				/* length of stripped line was zero */
 				continue;
 			}
 
-			if(strcmp(line, "%NAME%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, pkg->name) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
-								"mismatch on package %s\n"), db->treename, pkg->name);
-				}
-			} else if(strcmp(line, "%VERSION%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, pkg->version) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
-								"mismatch on package %s\n"), db->treename, pkg->name);
-				}
-			} else if(strcmp(line, "%FILENAME%") == 0) {
-				READ_AND_STORE(pkg->filename);
-				if(_alpm_validate_filename(db, pkg->name, pkg->filename) < 0) {
-					return -1;
-				}
-			} else if(strcmp(line, "%BASE%") == 0) {
-				READ_AND_STORE(pkg->base);
-			} else if(strcmp(line, "%DESC%") == 0) {
-				READ_AND_STORE(pkg->desc);
-			} else if(strcmp(line, "%GROUPS%") == 0) {
-				READ_AND_STORE_ALL(pkg->groups);
-			} else if(strcmp(line, "%URL%") == 0) {
-				READ_AND_STORE(pkg->url);
-			} else if(strcmp(line, "%LICENSE%") == 0) {
-				READ_AND_STORE_ALL(pkg->licenses);
-			} else if(strcmp(line, "%ARCH%") == 0) {
-				READ_AND_STORE(pkg->arch);
-			} else if(strcmp(line, "%BUILDDATE%") == 0) {
-				READ_NEXT();
-				pkg->builddate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%PACKAGER%") == 0) {
-				READ_AND_STORE(pkg->packager);
-			} else if(strcmp(line, "%CSIZE%") == 0) {
-				READ_NEXT();
-				pkg->size = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%ISIZE%") == 0) {
-				READ_NEXT();
-				pkg->isize = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%MD5SUM%") == 0) {
-				READ_AND_STORE(pkg->md5sum);
-			} else if(strcmp(line, "%SHA256SUM%") == 0) {
-				READ_AND_STORE(pkg->sha256sum);
-			} else if(strcmp(line, "%PGPSIG%") == 0) {
-				READ_AND_STORE(pkg->base64_sig);
-			} else if(strcmp(line, "%REPLACES%") == 0) {
-				READ_AND_SPLITDEP(pkg->replaces);
-			} else if(strcmp(line, "%DEPENDS%") == 0) {
-				READ_AND_SPLITDEP(pkg->depends);
-			} else if(strcmp(line, "%OPTDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(pkg->optdepends);
-			} else if(strcmp(line, "%MAKEDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(pkg->makedepends);
-			} else if(strcmp(line, "%CHECKDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(pkg->checkdepends);
-			} else if(strcmp(line, "%CONFLICTS%") == 0) {
-				READ_AND_SPLITDEP(pkg->conflicts);
-			} else if(strcmp(line, "%PROVIDES%") == 0) {
-				READ_AND_SPLITDEP(pkg->provides);
-			} else if(strcmp(line, "%FILES%") == 0) {
-				/* TODO: this could lazy load if there is future demand */
-				size_t files_count = 0, files_size = 0;
-				alpm_file_t *files = NULL;
-
-				while(1) {
-					if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) {
-						goto error;
+			section = _alpm_db_section(line, len);
+			switch(section) {
+				case DB_SECTION_NAME:
+					READ_NEXT();
+					if(strcmp(line, pkg->name) != 0) {
+						_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
+									"mismatch on package %s\n"), db->treename, pkg->name);
 					}
-					line = buf.line;
-					if(_alpm_strip_newline(line, buf.real_line_size) == 0) {
-						break;
+					break;
+				case DB_SECTION_VERSION:
+					READ_NEXT();
+					if(strcmp(line, pkg->version) != 0) {
+						_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
+									"mismatch on package %s\n"), db->treename, pkg->name);
 					}
-
-					if(!_alpm_greedy_grow((void **)&files, &files_size,
-								(files_count ? (files_count + 1) * sizeof(alpm_file_t) : 8 * sizeof(alpm_file_t)))) {
-						goto error;
+					break;
+				case DB_SECTION_FILENAME:
+					READ_AND_STORE(pkg->filename);
+					if(_alpm_validate_filename(db, pkg->name, pkg->filename) < 0) {
+						return -1;
 					}
-					STRDUP(files[files_count].name, line, goto error);
-					files_count++;
-				}
-				/* attempt to hand back any memory we don't need */
-				if(files_count > 0) {
-					REALLOC(files, sizeof(alpm_file_t) * files_count, (void)0);
-				} else {
-					FREE(files);
-				}
-				pkg->files.count = files_count;
-				pkg->files.files = files;
-				_alpm_filelist_sort(&pkg->files);
-			} else if(strcmp(line, "%DATA%") == 0) {
-				alpm_list_t *i, *lines = NULL;
-				READ_AND_STORE_ALL(lines);
-				for(i = lines; i; i = i->next) {
-					alpm_pkg_xdata_t *pd = _alpm_pkg_parse_xdata(i->data);
-					if(pd == NULL || !alpm_list_append(&pkg->xdata, pd)) {
-						_alpm_pkg_xdata_free(pd);
-						FREELIST(lines);
-						goto error;
+					break;
+				case DB_SECTION_FILES:
+					/* file lists are only recorded here and loaded on first access */
+					_alpm_dbcache_files_begin(db->filescache, pkg);
+					while(1) {
+						if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) {
+							goto error;
+						}
+						line = buf.line;
+						if(_alpm_strip_newline(line, buf.real_line_size) == 0) {
+							break;
+						}
+						if(_alpm_dbcache_files_add(db->filescache, pkg, line) != 0) {
+							goto error;
+						}
 					}
+					break;
+				case DB_SECTION_DATA: {
+					alpm_list_t *i, *lines = NULL;
+					READ_AND_STORE_ALL(lines);
+					for(i = lines; i; i = i->next) {
+						alpm_pkg_xdata_t *pd = _alpm_pkg_parse_xdata(i->data);
+						if(pd == NULL || !alpm_list_append(&pkg->xdata, pd)) {
+							_alpm_pkg_xdata_free(pd);
+							FREELIST(lines);
+							goto error;
+						}
+					}
+					FREELIST(lines);
+					break;
 				}
-				FREELIST(lines);
-			} else {
-				_alpm_log(db->handle, ALPM_LOG_WARNING, _("%s: unknown key '%s' in sync database\n"), pkg->name, line);
-				alpm_list_t *lines = NULL;
-				READ_AND_STORE_ALL(lines);
-				FREELIST(lines);
+				default:
+					handler = &sync_sections[section];
+					switch(handler->type) {
+						case DB_FIELD_STRING:
+							READ_AND_STORE(*(char **)DB_SECTION_FIELD(pkg, handler));
+							break;
+						case DB_FIELD_INTERNED:
+							READ_AND_INTERN(*(char **)DB_SECTION_FIELD(pkg, handler));
+							break;
+						case DB_FIELD_STRINGLIST:
+							READ_AND_INTERN_ALL(*(alpm_list_t **)DB_SECTION_FIELD(pkg, handler));
+							break;
+						case DB_FIELD_DEPLIST:
+							READ_AND_SPLITDEP(*(alpm_list_t **)DB_SECTION_FIELD(pkg, handler));
+							break;
+						case DB_FIELD_DATE:
+							READ_NEXT();
+							*(alpm_time_t *)DB_SECTION_FIELD(pkg, handler) = _alpm_parsedate(line);
+							break;
+						case DB_FIELD_SIZE:
+							READ_NEXT();
+							*(off_t *)DB_SECTION_FIELD(pkg, handler) = _alpm_strtoofft(line);
+							break;
+						default: {
+							alpm_list_t *lines = NULL;
+							_alpm_log(db->handle, ALPM_LOG_WARNING, _("%s: unknown key '%s' in sync database\n"), pkg->name, line);
+							READ_AND_STORE_ALL(lines);
+							FREELIST(lines);
+							break;
+						}
+					}
+					break;
 			}
 		}
 		if(ret != ARCHIVE_EOF) {
@@ -758,6 +821,9 @@ alpm_db_t *_alpm_db_register_sync(alpm_handle_t *handle, const char *treename,
 	db->handle = handle;
 	db->siglevel = level;
 
+	/* set up the package operations before any db can be loaded, possibly
+	 * from several threads at once */
+	get_sync_pkg_ops();
 	sync_db_validate(db);
 
 	handle->dbs_sync = alpm_list_add(handle->dbs_sync, db);
@@ -38,7 +38,10 @@
 #include "util.h"
 #include "log.h"
 #include "deps.h"
+#include "db.h"
 #include "filelist.h"
+#include "fileowners.h"
+#include "fsprobe.h"
 
 /**
  * @brief Creates a new conflict.
@@ -195,6 +198,60 @@ static void check_conflict(alpm_handle_t *handle,
 	}
 }
 
+/**
+ * @brief Check if packages from a list conflict with packages from a db.
+ *
+ * @details Same as check_conflict(handle, packages, dblist, baddeps, 1) where
+ * dblist holds the packages of db not in packages, sorted by name. Instead of
+ * testing every conflict against the whole database, only the package named
+ * like the conflict and the packages providing it are looked at.
+ * Like check_conflict(), each target's conflicts are walked in the order it
+ * declares them, and each conflict against the matching packages in name
+ * order, so conflicts are reported in the same order.
+ *
+ * @param db database to check against
+ * @param packages list of packages to check
+ * @param baddeps list to store conflicts
+ */
+static void check_db_conflict(alpm_db_t *db, alpm_list_t *packages,
+		alpm_list_t **baddeps)
+{
+	alpm_list_t *i;
+
+	for(i = packages; i; i = i->next) {
+		alpm_pkg_t *pkg1 = i->data;
+		alpm_list_t *j;
+
+		for(j = alpm_pkg_get_conflicts(pkg1); j; j = j->next) {
+			alpm_depend_t *conflict = j->data;
+			alpm_list_t *candidates, *k;
+			alpm_pkg_t *literal;
+
+			candidates = alpm_list_copy(_alpm_db_get_providers(db, conflict));
+			literal = _alpm_db_get_pkgfromcache(db, conflict->name);
+			if(literal && !alpm_list_find_ptr(candidates, literal)) {
+				candidates = alpm_list_add(candidates, literal);
+			}
+			candidates = alpm_list_msort(candidates,
+					alpm_list_count(candidates), _alpm_pkg_cmp);
+
+			for(k = candidates; k; k = k->next) {
+				alpm_pkg_t *pkg2 = k->data;
+
+				if(alpm_pkg_find(packages, pkg2->name)) {
+					/* not part of the database once the targets are in */
+					continue;
+				}
+
+				if(_alpm_depcmp(pkg2, conflict)) {
+					add_conflict(db->handle, baddeps, pkg1, pkg2, conflict);
+				}
+			}
+			alpm_list_free(candidates);
+		}
+	}
+}
+
 /**
  * @brief Check for inter-conflicts in a list of packages.
  *
@@ -229,7 +286,7 @@ alpm_list_t *_alpm_outerconflicts(alpm_db_t *db, alpm_list_t *packages)
 
 	/* two checks to be done here for conflicts */
 	_alpm_log(db->handle, ALPM_LOG_DEBUG, "check targets vs db\n");
-	check_conflict(db->handle, packages, dblist, &baddeps, 1);
+	check_db_conflict(db, packages, &baddeps);
 	_alpm_log(db->handle, ALPM_LOG_DEBUG, "check db vs targets\n");
 	check_conflict(db->handle, dblist, packages, &baddeps, -1);
 
@@ -360,32 +417,136 @@ static int dir_belongsto_pkgs(alpm_handle_t *handle, const char *dirpath,
 	return 1;
 }
 
-static alpm_list_t *alpm_db_find_file_owners(alpm_db_t* db, const char *path)
+static alpm_pkg_t *_alpm_find_file_owner(alpm_handle_t *handle, const char *path)
 {
-	alpm_list_t *i, *owners = NULL;
-	for(i = alpm_db_get_pkgcache(db); i; i = i->next) {
-		if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
-			owners = alpm_list_add(owners, i->data);
+	alpm_list_t *owners = _alpm_db_find_file_owners(handle->db_local, path);
+	return owners ? owners->data : NULL;
+}
+
+static int _alpm_can_overwrite_file(alpm_handle_t *handle, const char *path, const char *rootedpath)
+{
+	return _alpm_fnmatch_patterns(handle->overwrite_files, path) == 0
+		|| _alpm_fnmatch_patterns(handle->overwrite_files, rootedpath) == 0;
+}
+
+/* A path of a target that is also in the file list of another target */
+struct file_claim {
+	alpm_pkg_t *pkg;
+	const char *file;
+};
+
+static int add_file_claims(alpm_list_t **claims, alpm_list_t *owners,
+		const char *file)
+{
+	alpm_list_t *i;
+
+	for(i = owners; i; i = i->next) {
+		struct file_claim *claim;
+		alpm_list_t *added;
+
+		MALLOC(claim, sizeof(struct file_claim), return -1);
+		claim->pkg = i->data;
+		claim->file = file;
+		if((added = alpm_list_add(*claims, claim)) == NULL) {
+			free(claim);
+			return -1;
 		}
+		*claims = added;
 	}
-	return owners;
+	return 0;
 }
 
-static alpm_pkg_t *_alpm_find_file_owner(alpm_handle_t *handle, const char *path)
+/**
+ * @brief Find the files of a target claimed by the targets in an index.
+ *
+ * @details A path is claimed if another target has it as well, ignoring a
+ * trailing slash, unless both have it as a directory.
+ *
+ * @param index file owners of the other targets
+ * @param pkg the target
+ * @param claims list to store the file_claim of each claimant and path in,
+ * in the order of the file list of pkg
+ *
+ * @return 0 on success, -1 on error
+ */
+static int find_file_claims(alpm_fileowners_t *index, alpm_pkg_t *pkg,
+		alpm_list_t **claims)
 {
-	alpm_list_t *i;
-	for(i = alpm_db_get_pkgcache(handle->db_local); i; i = i->next) {
-		if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
-			return i->data;
+	alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
+	char path[PATH_MAX];
+	size_t i;
+
+	for(i = 0; i < filelist->count; i++) {
+		const char *file = filelist->files[i].name;
+		size_t len = strlen(file);
+
+		if(len == 0 || len + 2 > PATH_MAX) {
+			continue;
+		}
+
+		/* directories do not conflict with each other */
+		if(file[len - 1] == '/') {
+			memcpy(path, file, len - 1);
+			path[len - 1] = '\0';
+		} else {
+			if(add_file_claims(claims, _alpm_fileowners_find(index, file), file) != 0) {
+				return -1;
+			}
+			memcpy(path, file, len);
+			path[len] = '/';
+			path[len + 1] = '\0';
+		}
+		if(add_file_claims(claims, _alpm_fileowners_find(index, path), file) != 0) {
+			return -1;
 		}
 	}
-	return NULL;
+	return 0;
 }
 
-static int _alpm_can_overwrite_file(alpm_handle_t *handle, const char *path, const char *rootedpath)
+/* Returns the files of the claims made by pkg, free the list but NOT the
+ * contained data. */
+static alpm_list_t *claimed_files(alpm_list_t *claims, alpm_pkg_t *pkg)
 {
-	return _alpm_fnmatch_patterns(handle->overwrite_files, path) == 0
-		|| _alpm_fnmatch_patterns(handle->overwrite_files, rootedpath) == 0;
+	alpm_list_t *i, *files = NULL;
+
+	for(i = claims; i; i = i->next) {
+		struct file_claim *claim = i->data;
+		if(claim->pkg == pkg) {
+			files = alpm_list_add(files, (char *)claim->file);
+		}
+	}
+	return files;
+}
+
+/**
+ * @brief Find the files of a target that may not exist on the filesystem yet.
+ *
+ * @details If the package is currently installed, these are the files that
+ * are new in the new package, otherwise it is the whole file list.
+ *
+ * @param handle the context handle
+ * @param pkg the target
+ *
+ * @return the list of files, free the list but NOT the contained data
+ */
+static alpm_list_t *find_new_files(alpm_handle_t *handle, alpm_pkg_t *pkg)
+{
+	alpm_pkg_t *dbpkg = _alpm_db_get_pkgfromcache(handle->db_local, pkg->name);
+	alpm_list_t *newfiles = NULL;
+
+	if(dbpkg) {
+		/* older ver of package currently installed */
+		newfiles = _alpm_filelist_difference(alpm_pkg_get_files(pkg),
+				alpm_pkg_get_files(dbpkg));
+	} else {
+		/* no version of package currently installed */
+		alpm_filelist_t *fl = alpm_pkg_get_files(pkg);
+		size_t filenum;
+		for(filenum = 0; filenum < fl->count; filenum++) {
+			newfiles = alpm_list_add(newfiles, fl->files[filenum].name);
+		}
+	}
+	return newfiles;
 }
 
 /**
@@ -405,8 +566,12 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 		alpm_list_t *upgrade, alpm_list_t *rem)
 {
 	alpm_list_t *i, *conflicts = NULL;
+	alpm_list_t **newfiles_of = NULL;
+	alpm_fileowners_t *targets = NULL;
+	alpm_fsprobe_t *probe = NULL;
+	const char **probe_files = NULL;
 	size_t numtargs = alpm_list_count(upgrade);
-	size_t current;
+	size_t current, numfiles = 0;
 	size_t rootlen;
 
 	if(!upgrade) {
@@ -415,6 +580,34 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 
 	rootlen = strlen(handle->root);
 
+	/* paths of all targets, each target is dropped once it was checked so
+	 * only the ones after it are left */
+	targets = _alpm_fileowners_new(upgrade);
+	if(targets == NULL) {
+		GOTO_ERR(handle, ALPM_ERR_MEMORY, error);
+	}
+
+	/* the files CHECK 2 looks at are known up front, so start stat'ing all of
+	 * them while the targets are checked */
+	CALLOC(newfiles_of, numtargs, sizeof(alpm_list_t *),
+			GOTO_ERR(handle, ALPM_ERR_MEMORY, error));
+	for(current = 0, i = upgrade; i; i = i->next, current++) {
+		newfiles_of[current] = find_new_files(handle, i->data);
+		numfiles += alpm_list_count(newfiles_of[current]);
+	}
+	if(numfiles > 0) {
+		MALLOC(probe_files, numfiles * sizeof(char *),
+				GOTO_ERR(handle, ALPM_ERR_MEMORY, error));
+		numfiles = 0;
+		for(current = 0; current < numtargs; current++) {
+			alpm_list_t *j;
+			for(j = newfiles_of[current]; j; j = j->next) {
+				probe_files[numfiles++] = j->data;
+			}
+		}
+		probe = _alpm_fsprobe_new(handle, probe_files, numfiles);
+	}
+
 	/* TODO this whole function needs a huge change, which hopefully will
 	 * be possible with real transactions. Right now we only do half as much
 	 * here as we do when we actually extract files in add.c with our 12
@@ -422,7 +615,7 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 	for(current = 0, i = upgrade; i; i = i->next, current++) {
 		alpm_pkg_t *p1 = i->data;
 		alpm_list_t *j;
-		alpm_list_t *newfiles = NULL;
+		alpm_list_t *newfiles = newfiles_of[current], *claims = NULL;
 		alpm_pkg_t *dbpkg;
 
 		int percent = (current * 100) / numtargs;
@@ -432,14 +625,20 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 		/* CHECK 1: check every target against every target */
 		_alpm_log(handle, ALPM_LOG_DEBUG, "searching for file conflicts: %s\n",
 				p1->name);
-		for(j = i->next; j; j = j->next) {
+		_alpm_fileowners_remove(targets, p1);
+		if(find_file_claims(targets, p1, &claims) != 0) {
+			alpm_list_free_inner(claims, free);
+			alpm_list_free(claims);
+			GOTO_ERR(handle, ALPM_ERR_MEMORY, error);
+		}
+		/* report the conflicts by target, then in file list order */
+		for(j = i->next; j && claims; j = j->next) {
 			alpm_list_t *common_files;
 			alpm_pkg_t *p2 = j->data;
 
-			alpm_filelist_t *p1_files = alpm_pkg_get_files(p1);
 			alpm_filelist_t *p2_files = alpm_pkg_get_files(p2);
 
-			common_files = _alpm_filelist_intersection(p1_files, p2_files);
+			common_files = claimed_files(claims, p2);
 
 			if(common_files) {
 				alpm_list_t *k;
@@ -462,41 +661,24 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 					}
 
 					conflicts = add_fileconflict(handle, conflicts, path, p1, p2);
-					if(handle->pm_errno == ALPM_ERR_MEMORY) {
-						alpm_list_free_inner(conflicts,
-								(alpm_list_fn_free) alpm_conflict_free);
-						alpm_list_free(conflicts);
+					if(PM_ERRNO(handle) == ALPM_ERR_MEMORY) {
 						alpm_list_free(common_files);
-						return NULL;
+						alpm_list_free_inner(claims, free);
+						alpm_list_free(claims);
+						goto error;
 					}
 				}
 				alpm_list_free(common_files);
 			}
 		}
+		alpm_list_free_inner(claims, free);
+		alpm_list_free(claims);
 
 		/* CHECK 2: check every target against the filesystem */
 		_alpm_log(handle, ALPM_LOG_DEBUG, "searching for filesystem conflicts: %s\n",
 				p1->name);
 		dbpkg = _alpm_db_get_pkgfromcache(handle->db_local, p1->name);
 
-		/* Do two different checks here. If the package is currently installed,
-		 * then only check files that are new in the new package. If the package
-		 * is not currently installed, then simply stat the whole filelist. Note
-		 * that the former list needs to be freed while the latter list should NOT
-		 * be freed. */
-		if(dbpkg) {
-			/* older ver of package currently installed */
-			newfiles = _alpm_filelist_difference(alpm_pkg_get_files(p1),
-					alpm_pkg_get_files(dbpkg));
-		} else {
-			/* no version of package currently installed */
-			alpm_filelist_t *fl = alpm_pkg_get_files(p1);
-			size_t filenum;
-			for(filenum = 0; filenum < fl->count; filenum++) {
-				newfiles = alpm_list_add(newfiles, fl->files[filenum].name);
-			}
-		}
-
 		for(j = newfiles; j; j = j->next) {
 			const char *filestr = j->data;
 			const char *relative_path;
@@ -512,7 +694,7 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 			relative_path = path + rootlen;
 
 			/* stat the file - if it exists, do some checks */
-			if(llstat(path, &lsbuf) != 0) {
+			if(_alpm_fsprobe_lstat(probe, filestr, path, &lsbuf) != 0) {
 				continue;
 			}
 
@@ -616,7 +798,7 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 				char *dir = malloc(dir_len);
 				snprintf(dir, dir_len, "%s/", relative_path);
 
-				owners = alpm_db_find_file_owners(handle->db_local, dir);
+				owners = _alpm_db_find_file_owners(handle->db_local, dir);
 				if(owners) {
 					alpm_list_t *pkgs = NULL, *diff;
 
@@ -636,21 +818,13 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 						resolved_conflict = dir_belongsto_pkgs(handle, dir, owners);
 					}
 					alpm_list_free(pkgs);
-					alpm_list_free(owners);
 				}
 				free(dir);
 			}
 
 			/* is the file unowned and in the backup list of the new package? */
 			if(!resolved_conflict && _alpm_needbackup(relative_path, p1)) {
-				alpm_list_t *local_pkgs = _alpm_db_get_pkgcache(handle->db_local);
-				int found = 0;
-				for(k = local_pkgs; k && !found; k = k->next) {
-					if(alpm_filelist_contains(alpm_pkg_get_files(k->data), relative_path)) {
-							found = 1;
-					}
-				}
-				if(!found) {
+				if(!_alpm_find_file_owner(handle, relative_path)) {
 					_alpm_log(handle, ALPM_LOG_DEBUG,
 							"file was unowned but in new backup list\n");
 					resolved_conflict = 1;
@@ -668,19 +842,34 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 			if(!resolved_conflict) {
 				conflicts = add_fileconflict(handle, conflicts, path, p1,
 						_alpm_find_file_owner(handle, relative_path));
-				if(handle->pm_errno == ALPM_ERR_MEMORY) {
-					alpm_list_free_inner(conflicts,
-							(alpm_list_fn_free) alpm_conflict_free);
-					alpm_list_free(conflicts);
-					alpm_list_free(newfiles);
-					return NULL;
+				if(PM_ERRNO(handle) == ALPM_ERR_MEMORY) {
+					goto error;
 				}
 			}
 		}
 		alpm_list_free(newfiles);
+		newfiles_of[current] = NULL;
 	}
 	PROGRESS(handle, ALPM_PROGRESS_CONFLICTS_START, "", 100,
 			numtargs, current);
 
+	_alpm_fsprobe_free(probe);
+	free(probe_files);
+	free(newfiles_of);
+	_alpm_fileowners_free(targets);
 	return conflicts;
+
+error:
+	_alpm_fsprobe_free(probe);
+	free(probe_files);
+	if(newfiles_of) {
+		for(current = 0; current < numtargs; current++) {
+			alpm_list_free(newfiles_of[current]);
+		}
+		free(newfiles_of);
+	}
+	_alpm_fileowners_free(targets);
+	alpm_list_free_inner(conflicts, (alpm_list_fn_free) alpm_fileconflict_free);
+	alpm_list_free(conflicts);
+	return NULL;
 }
@@ -26,9 +26,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <regex.h>
+#include <pthread.h>
 
 /* libalpm */
 #include "db.h"
+#include "dbcache.h"
+#include "arena.h"
+#include "fileowners.h"
 #include "alpm_list.h"
 #include "log.h"
 #include "util.h"
@@ -104,7 +108,7 @@ int SYMEXPORT alpm_db_unregister(alpm_db_t *db)
 	ASSERT(db != NULL, return -1);
 	/* Do not unregister a database if a transaction is on-going */
 	handle = db->handle;
-	handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(handle) = ALPM_ERR_OK;
 	ASSERT(handle->trans == NULL, RET_ERR(handle, ALPM_ERR_TRANS_NOT_NULL, -1));
 
 	if(db == handle->db_local) {
@@ -190,7 +194,7 @@ int SYMEXPORT alpm_db_add_cache_server(alpm_db_t *db, const char *url)
 
 	/* Sanity checks */
 	ASSERT(db != NULL, return -1);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	ASSERT(url != NULL && strlen(url) != 0, RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
 
 	newurl = sanitize_url(url);
@@ -209,7 +213,7 @@ int SYMEXPORT alpm_db_add_server(alpm_db_t *db, const char *url)
 
 	/* Sanity checks */
 	ASSERT(db != NULL, return -1);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	ASSERT(url != NULL && strlen(url) != 0, RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
 
 	newurl = sanitize_url(url);
@@ -229,7 +233,7 @@ int SYMEXPORT alpm_db_remove_cache_server(alpm_db_t *db, const char *url)
 
 	/* Sanity checks */
 	ASSERT(db != NULL, return -1);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	ASSERT(url != NULL && strlen(url) != 0, RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
 
 	newurl = sanitize_url(url);
@@ -255,7 +259,7 @@ int SYMEXPORT alpm_db_remove_server(alpm_db_t *db, const char *url)
 
 	/* Sanity checks */
 	ASSERT(db != NULL, return -1);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	ASSERT(url != NULL && strlen(url) != 0, RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
 
 	newurl = sanitize_url(url);
@@ -299,7 +303,7 @@ int SYMEXPORT alpm_db_get_siglevel(alpm_db_t *db)
 int SYMEXPORT alpm_db_get_valid(alpm_db_t *db)
 {
 	ASSERT(db != NULL, return -1);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	return db->ops->validate(db);
 }
 
@@ -307,7 +311,7 @@ alpm_pkg_t SYMEXPORT *alpm_db_get_pkg(alpm_db_t *db, const char *name)
 {
 	alpm_pkg_t *pkg;
 	ASSERT(db != NULL, return NULL);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	ASSERT(name != NULL && strlen(name) != 0,
 			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, NULL));
 
@@ -321,14 +325,23 @@ alpm_pkg_t SYMEXPORT *alpm_db_get_pkg(alpm_db_t *db, const char *name)
 alpm_list_t SYMEXPORT *alpm_db_get_pkgcache(alpm_db_t *db)
 {
 	ASSERT(db != NULL, return NULL);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 	return _alpm_db_get_pkgcache(db);
 }
 
+alpm_list_t SYMEXPORT *alpm_db_find_file_owners(alpm_db_t *db, const char *path)
+{
+	ASSERT(db != NULL, return NULL);
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
+	ASSERT(path != NULL && strlen(path) != 0,
+			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, NULL));
+	return alpm_list_copy(_alpm_db_find_file_owners(db, path));
+}
+
 alpm_group_t SYMEXPORT *alpm_db_get_group(alpm_db_t *db, const char *name)
 {
 	ASSERT(db != NULL, return NULL);
-	db->handle->pm_errno = 0;
+	PM_ERRNO(db->handle) = 0;
 	ASSERT(name != NULL && strlen(name) != 0,
 			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, NULL));
 
@@ -338,7 +351,7 @@ alpm_group_t SYMEXPORT *alpm_db_get_group(alpm_db_t *db, const char *name)
 alpm_list_t SYMEXPORT *alpm_db_get_groupcache(alpm_db_t *db)
 {
 	ASSERT(db != NULL, return NULL);
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 
 	return _alpm_db_get_groupcache(db);
 }
@@ -348,7 +361,7 @@ int SYMEXPORT alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 {
 	ASSERT(db != NULL && ret != NULL && *ret == NULL,
 			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 
 	return _alpm_db_search(db, needles, ret);
 }
@@ -432,6 +445,97 @@ const char *_alpm_db_path(alpm_db_t *db)
 	return db->_path;
 }
 
+#define SECTION(key, section) \
+	if(len == sizeof(key) - 1 && memcmp(line, key, sizeof(key) - 1) == 0) { \
+		return section; \
+	}
+
+/** Identify a section header line of a database entry.
+ * The first character of the key picks at most three candidates, which are
+ * then compared in full.
+ * @param line the line, without the trailing newline
+ * @param len the length of line
+ * @return the section, or DB_SECTION_UNKNOWN if line is not a known header
+ */
+alpm_dbsection_t _alpm_db_section(const char *line, size_t len)
+{
+	if(len < 5 || line[0] != '%' || line[len - 1] != '%') {
+		return DB_SECTION_UNKNOWN;
+	}
+
+	switch(line[1]) {
+		case 'A':
+			SECTION("%ARCH%", DB_SECTION_ARCH);
+			break;
+		case 'B':
+			SECTION("%BASE%", DB_SECTION_BASE);
+			SECTION("%BUILDDATE%", DB_SECTION_BUILDDATE);
+			SECTION("%BACKUP%", DB_SECTION_BACKUP);
+			break;
+		case 'C':
+			SECTION("%CSIZE%", DB_SECTION_CSIZE);
+			SECTION("%CONFLICTS%", DB_SECTION_CONFLICTS);
+			SECTION("%CHECKDEPENDS%", DB_SECTION_CHECKDEPENDS);
+			break;
+		case 'D':
+			SECTION("%DESC%", DB_SECTION_DESC);
+			SECTION("%DEPENDS%", DB_SECTION_DEPENDS);
+			SECTION("%DATA%", DB_SECTION_DATA);
+			break;
+		case 'F':
+			SECTION("%FILENAME%", DB_SECTION_FILENAME);
+			SECTION("%FILES%", DB_SECTION_FILES);
+			break;
+		case 'G':
+			SECTION("%GROUPS%", DB_SECTION_GROUPS);
+			break;
+		case 'I':
+			SECTION("%ISIZE%", DB_SECTION_ISIZE);
+			SECTION("%INSTALLDATE%", DB_SECTION_INSTALLDATE);
+			break;
+		case 'L':
+			SECTION("%LICENSE%", DB_SECTION_LICENSE);
+			break;
+		case 'M':
+			SECTION("%MD5SUM%", DB_SECTION_MD5SUM);
+			SECTION("%MAKEDEPENDS%", DB_SECTION_MAKEDEPENDS);
+			break;
+		case 'N':
+			SECTION("%NAME%", DB_SECTION_NAME);
+			break;
+		case 'O':
+			SECTION("%OPTDEPENDS%", DB_SECTION_OPTDEPENDS);
+			break;
+		case 'P':
+			SECTION("%PROVIDES%", DB_SECTION_PROVIDES);
+			SECTION("%PACKAGER%", DB_SECTION_PACKAGER);
+			SECTION("%PGPSIG%", DB_SECTION_PGPSIG);
+			break;
+		case 'R':
+			SECTION("%REPLACES%", DB_SECTION_REPLACES);
+			SECTION("%REASON%", DB_SECTION_REASON);
+			break;
+		case 'S':
+			SECTION("%SHA256SUM%", DB_SECTION_SHA256SUM);
+			SECTION("%SIZE%", DB_SECTION_SIZE);
+			break;
+		case 'U':
+			SECTION("%URL%", DB_SECTION_URL);
+			break;
+		case 'V':
+			SECTION("%VERSION%", DB_SECTION_VERSION);
+			SECTION("%VALIDATION%", DB_SECTION_VALIDATION);
+			break;
+		case 'X':
+			SECTION("%XDATA%", DB_SECTION_XDATA);
+			break;
+	}
+
+	return DB_SECTION_UNKNOWN;
+}
+
+#undef SECTION
+
 int _alpm_db_cmp(const void *d1, const void *d2)
 {
 	const alpm_db_t *db1 = d1;
@@ -463,7 +567,7 @@ int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 		_alpm_log(db->handle, ALPM_LOG_DEBUG, "searching for target '%s'\n", targ);
 
 		if(regcomp(&reg, targ, REG_EXTENDED | REG_NOSUB | REG_ICASE | REG_NEWLINE) != 0) {
-			db->handle->pm_errno = ALPM_ERR_INVALID_REGEX;
+			PM_ERRNO(db->handle) = ALPM_ERR_INVALID_REGEX;
 			alpm_list_free(list);
 			alpm_list_free(*ret);
 			return -1;
@@ -542,6 +646,90 @@ static int load_pkgcache(alpm_db_t *db)
 	return 0;
 }
 
+struct populate_queue {
+	pthread_mutex_t lock;
+	alpm_list_t *next;
+};
+
+static void *populate_worker(void *arg)
+{
+	struct populate_queue *queue = arg;
+	alpm_db_t *db;
+
+	while(1) {
+		pthread_mutex_lock(&queue->lock);
+		if(queue->next == NULL) {
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		db = queue->next->data;
+		queue->next = queue->next->next;
+		pthread_mutex_unlock(&queue->lock);
+
+		/* failures are reported when the db is next accessed */
+		load_pkgcache(db);
+	}
+
+	return NULL;
+}
+
+/* Load the package cache of every usable sync db that does not have one yet,
+ * using up to handle->parallel_db_loads threads including the calling one.
+ * Each db is only ever touched by a single thread, so the resulting caches
+ * are the same as those from sequential loads. A db that fails to load is
+ * left without a package cache. */
+static void load_syncdbs_parallel(alpm_handle_t *handle)
+{
+	struct populate_queue queue;
+	alpm_list_t *i, *pending = NULL;
+	pthread_t *threads = NULL;
+	size_t count, nthreads, started;
+	alpm_errno_t err = PM_ERRNO(handle);
+
+	for(i = handle->dbs_sync; i; i = i->next) {
+		alpm_db_t *db = i->data;
+		if((db->status & DB_STATUS_VALID)
+				&& !(db->status & (DB_STATUS_PKGCACHE | DB_STATUS_MISSING))) {
+			pending = alpm_list_add(pending, db);
+		}
+	}
+
+	count = alpm_list_count(pending);
+	if(count < 2) {
+		alpm_list_free(pending);
+		return;
+	}
+	nthreads = handle->parallel_db_loads < count ? handle->parallel_db_loads : count;
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"loading %zu sync databases using %zu threads\n", count, nthreads);
+
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.next = pending;
+
+	/* if threads can not be created the calling thread does all the work */
+	started = 0;
+	threads = calloc(nthreads - 1, sizeof(pthread_t));
+	if(threads) {
+		for(; started < nthreads - 1; started++) {
+			if(pthread_create(&threads[started], NULL, populate_worker, &queue) != 0) {
+				break;
+			}
+		}
+	}
+	populate_worker(&queue);
+	while(started > 0) {
+		pthread_join(threads[--started], NULL);
+	}
+
+	free(threads);
+	pthread_mutex_destroy(&queue.lock);
+	alpm_list_free(pending);
+
+	/* workers may have clobbered pm_errno for dbs the caller did not ask for */
+	PM_ERRNO(handle) = err;
+}
+
 static void free_groupcache(alpm_db_t *db)
 {
 	alpm_list_t *lg;
@@ -561,6 +749,38 @@ static void free_groupcache(alpm_db_t *db)
 	db->status &= ~DB_STATUS_GRPCACHE;
 }
 
+static void free_fileowners(alpm_db_t *db)
+{
+	if(db == NULL || db->fileowners == NULL) {
+		return;
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"freeing file owner index for repository '%s'\n", db->treename);
+
+	_alpm_fileowners_free(db->fileowners);
+	db->fileowners = NULL;
+}
+
+static void free_provcache(alpm_db_t *db)
+{
+	unsigned int i;
+
+	if(db == NULL || !(db->status & DB_STATUS_PROVCACHE)) {
+		return;
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"freeing provider cache for repository '%s'\n", db->treename);
+
+	for(i = 0; i < db->provcache->size; i++) {
+		alpm_list_free(db->provcache->entries[i].pkgs);
+	}
+	free(db->provcache->entries);
+	FREE(db->provcache);
+	db->status &= ~DB_STATUS_PROVCACHE;
+}
+
 void _alpm_db_free_pkgcache(alpm_db_t *db)
 {
 	if(db == NULL || db->pkgcache == NULL) {
@@ -570,13 +790,19 @@ void _alpm_db_free_pkgcache(alpm_db_t *db)
 	_alpm_log(db->handle, ALPM_LOG_DEBUG,
 			"freeing package cache for repository '%s'\n", db->treename);
 
+	free_fileowners(db);
 	alpm_list_free_inner(db->pkgcache->list,
 			(alpm_list_fn_free)_alpm_pkg_free);
 	_alpm_pkghash_free(db->pkgcache);
 	db->pkgcache = NULL;
+	_alpm_dbcache_files_free(db->filescache);
+	db->filescache = NULL;
+	_alpm_arena_free(db->arena);
+	db->arena = NULL;
 	db->status &= ~DB_STATUS_PKGCACHE;
 
 	free_groupcache(db);
+	free_provcache(db);
 }
 
 alpm_pkghash_t *_alpm_db_get_pkgcache_hash(alpm_db_t *db)
@@ -589,6 +815,11 @@ alpm_pkghash_t *_alpm_db_get_pkgcache_hash(alpm_db_t *db)
 		RET_ERR(db->handle, ALPM_ERR_DB_INVALID, NULL);
 	}
 
+	if(!(db->status & DB_STATUS_PKGCACHE) && !(db->status & DB_STATUS_LOCAL)
+			&& db->handle->parallel_db_loads > 1) {
+		load_syncdbs_parallel(db->handle);
+	}
+
 	if(!(db->status & DB_STATUS_PKGCACHE)) {
 		if(load_pkgcache(db)) {
 			/* handle->error set in local/sync-db-populate */
@@ -639,7 +870,13 @@ int _alpm_db_add_pkgincache(alpm_db_t *db, alpm_pkg_t *pkg)
 		RET_ERR(db->handle, ALPM_ERR_MEMORY, -1);
 	}
 
+	if(db->fileowners && _alpm_fileowners_add(db->fileowners, newpkg) != 0) {
+		/* rebuilt on next use */
+		free_fileowners(db);
+	}
+
 	free_groupcache(db);
+	free_provcache(db);
 
 	return 0;
 }
@@ -663,9 +900,11 @@ int _alpm_db_remove_pkgfromcache(alpm_db_t *db, alpm_pkg_t *pkg)
 		return -1;
 	}
 
+	_alpm_fileowners_remove(db->fileowners, data);
 	_alpm_pkg_free(data);
 
 	free_groupcache(db);
+	free_provcache(db);
 
 	return 0;
 }
@@ -684,6 +923,157 @@ alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target)
 	return _alpm_pkghash_find(pkgcache, target);
 }
 
+/* Returns the packages of db owning path, in package cache order. The file
+ * owner index is built on first use and kept up to date as packages are
+ * added to and removed from the package cache. */
+alpm_list_t *_alpm_db_find_file_owners(alpm_db_t *db, const char *path)
+{
+	if(db == NULL || path == NULL) {
+		return NULL;
+	}
+
+	if(db->fileowners == NULL) {
+		alpm_list_t *pkgs = _alpm_db_get_pkgcache(db);
+		if(pkgs == NULL) {
+			return NULL;
+		}
+
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"loading file owner index for repository '%s'\n", db->treename);
+		db->fileowners = _alpm_fileowners_new(pkgs);
+		if(db->fileowners == NULL) {
+			RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL);
+		}
+	}
+
+	return _alpm_fileowners_find(db->fileowners, path);
+}
+
+/* Find the entry for a provision name in the provider cache, or the empty
+ * slot it would be stored in. */
+static struct db_provcache_entry *provcache_slot(struct db_provcache *cache,
+		const char *name, unsigned long name_hash)
+{
+	unsigned int mask = cache->size - 1;
+	unsigned int pos = name_hash & mask;
+
+	while(cache->entries[pos].name != NULL) {
+		struct db_provcache_entry *entry = &cache->entries[pos];
+		if(entry->name_hash == name_hash && strcmp(entry->name, name) == 0) {
+			break;
+		}
+		pos = (pos + 1) & mask;
+	}
+	return &cache->entries[pos];
+}
+
+static int provcache_grow(struct db_provcache *cache)
+{
+	struct db_provcache_entry *old = cache->entries;
+	unsigned int i, oldsize = cache->size;
+
+	CALLOC(cache->entries, oldsize * 2, sizeof(struct db_provcache_entry),
+			cache->entries = old; return -1);
+	cache->size = oldsize * 2;
+
+	for(i = 0; i < oldsize; i++) {
+		if(old[i].name != NULL) {
+			*provcache_slot(cache, old[i].name, old[i].name_hash) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+/* Builds the provider cache of db: for every provision name, the packages
+ * providing it in the order of the package cache. The names are borrowed
+ * from the packages, so the cache is dropped whenever the package cache
+ * changes. */
+static int load_provcache(alpm_db_t *db)
+{
+	struct db_provcache *cache;
+	alpm_list_t *lp;
+
+	if(db == NULL) {
+		return -1;
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG, "loading provider cache for repository '%s'\n",
+			db->treename);
+
+	CALLOC(cache, 1, sizeof(struct db_provcache), RET_ERR(db->handle, ALPM_ERR_MEMORY, -1));
+	cache->size = 64;
+	CALLOC(cache->entries, cache->size, sizeof(struct db_provcache_entry),
+			free(cache); RET_ERR(db->handle, ALPM_ERR_MEMORY, -1));
+	db->provcache = cache;
+	db->status |= DB_STATUS_PROVCACHE;
+
+	for(lp = _alpm_db_get_pkgcache(db); lp; lp = lp->next) {
+		alpm_pkg_t *pkg = lp->data;
+		alpm_list_t *i;
+
+		for(i = alpm_pkg_get_provides(pkg); i; i = i->next) {
+			alpm_depend_t *provision = i->data;
+			struct db_provcache_entry *entry;
+			alpm_list_t *last;
+
+			entry = provcache_slot(cache, provision->name, provision->name_hash);
+			if(entry->name == NULL) {
+				if((cache->count + 1) * 4 > cache->size * 3) {
+					if(provcache_grow(cache) != 0) {
+						goto error;
+					}
+					entry = provcache_slot(cache, provision->name, provision->name_hash);
+				}
+				entry->name = provision->name;
+				entry->name_hash = provision->name_hash;
+				cache->count++;
+			}
+
+			/* a package may provide the same name more than once */
+			last = alpm_list_last(entry->pkgs);
+			if(last == NULL || last->data != pkg) {
+				alpm_list_t *pkgs = alpm_list_add(entry->pkgs, pkg);
+				if(pkgs == NULL) {
+					goto error;
+				}
+				entry->pkgs = pkgs;
+			}
+		}
+	}
+
+	return 0;
+
+error:
+	free_provcache(db);
+	RET_ERR(db->handle, ALPM_ERR_MEMORY, -1);
+}
+
+/* Returns the packages of db that list a provision named like dep, in the
+ * order of the package cache. The versions are not compared and packages
+ * whose own name matches are only included if they also provide it. */
+alpm_list_t *_alpm_db_get_providers(alpm_db_t *db, alpm_depend_t *dep)
+{
+	struct db_provcache_entry *entry;
+
+	if(db == NULL || dep == NULL) {
+		return NULL;
+	}
+
+	if(!(db->status & DB_STATUS_VALID)) {
+		RET_ERR(db->handle, ALPM_ERR_DB_INVALID, NULL);
+	}
+
+	if(!(db->status & DB_STATUS_PROVCACHE)) {
+		if(load_provcache(db) != 0) {
+			return NULL;
+		}
+	}
+
+	entry = provcache_slot(db->provcache, dep->name, dep->name_hash);
+	return entry->pkgs;
+}
+
 /* Returns a new group cache from db.
  */
 static int load_grpcache(alpm_db_t *db)
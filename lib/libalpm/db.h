@@ -52,7 +52,8 @@ enum _alpm_dbstatus_t {
 
 	DB_STATUS_LOCAL = (1 << 10),
 	DB_STATUS_PKGCACHE = (1 << 11),
-	DB_STATUS_GRPCACHE = (1 << 12)
+	DB_STATUS_GRPCACHE = (1 << 12),
+	DB_STATUS_PROVCACHE = (1 << 13)
 };
 
 struct db_operations {
@@ -61,6 +62,90 @@ struct db_operations {
 	void (*unregister) (alpm_db_t *);
 };
 
+/** Section headers of the desc, depends and files entries in databases. */
+typedef enum _alpm_dbsection_t {
+	DB_SECTION_UNKNOWN = 0,
+	DB_SECTION_NAME,
+	DB_SECTION_VERSION,
+	DB_SECTION_FILENAME,
+	DB_SECTION_BASE,
+	DB_SECTION_DESC,
+	DB_SECTION_GROUPS,
+	DB_SECTION_URL,
+	DB_SECTION_LICENSE,
+	DB_SECTION_ARCH,
+	DB_SECTION_BUILDDATE,
+	DB_SECTION_INSTALLDATE,
+	DB_SECTION_PACKAGER,
+	DB_SECTION_REASON,
+	DB_SECTION_VALIDATION,
+	DB_SECTION_SIZE,
+	DB_SECTION_CSIZE,
+	DB_SECTION_ISIZE,
+	DB_SECTION_MD5SUM,
+	DB_SECTION_SHA256SUM,
+	DB_SECTION_PGPSIG,
+	DB_SECTION_REPLACES,
+	DB_SECTION_DEPENDS,
+	DB_SECTION_OPTDEPENDS,
+	DB_SECTION_MAKEDEPENDS,
+	DB_SECTION_CHECKDEPENDS,
+	DB_SECTION_CONFLICTS,
+	DB_SECTION_PROVIDES,
+	DB_SECTION_FILES,
+	DB_SECTION_BACKUP,
+	DB_SECTION_DATA,
+	DB_SECTION_XDATA,
+	DB_SECTION_COUNT
+} alpm_dbsection_t;
+
+/** How the value of a section is stored in a package. */
+typedef enum _alpm_dbfield_t {
+	/* not a section of this kind of database */
+	DB_FIELD_UNKNOWN = 0,
+	/* char *, a single line */
+	DB_FIELD_STRING,
+	/* char *, a single line that many packages share */
+	DB_FIELD_INTERNED,
+	/* alpm_list_t * of char *, one per line */
+	DB_FIELD_STRINGLIST,
+	/* alpm_list_t * of alpm_depend_t *, one per line */
+	DB_FIELD_DEPLIST,
+	/* alpm_time_t, a single line */
+	DB_FIELD_DATE,
+	/* off_t, a single line */
+	DB_FIELD_SIZE
+} alpm_dbfield_t;
+
+/* Each backend describes the sections it understands with a table indexed
+ * by alpm_dbsection_t, giving the type and offset of the package field the
+ * section is stored in. */
+struct db_section_handler {
+	alpm_dbfield_t type;
+	size_t offset;
+};
+
+#define DB_SECTION_FIELD(pkg, handler) ((void *)((char *)(pkg) + (handler)->offset))
+
+/* Packages of a database by the names they provide. */
+struct db_provcache_entry {
+	unsigned long name_hash;
+	/* borrowed from the first provision with this name */
+	const char *name;
+	alpm_list_t *pkgs;
+};
+
+struct db_provcache {
+	/* open addressing, size is a power of two */
+	struct db_provcache_entry *entries;
+	unsigned int size;
+	unsigned int count;
+};
+
+struct dbcache_files;
+struct _alpm_arena_t;
+struct _alpm_fileowners_t;
+
 /* Database */
 struct _alpm_db_t {
 	alpm_handle_t *handle;
@@ -68,7 +153,14 @@ struct _alpm_db_t {
 	/* do not access directly, use _alpm_db_path(db) for lazy access */
 	char *_path;
 	alpm_pkghash_t *pkgcache;
+	/* sync dbs: storage of the not yet loaded package file lists */
+	struct dbcache_files *filescache;
+	/* sync dbs: storage of the strings and dependencies of cached packages */
+	struct _alpm_arena_t *arena;
 	alpm_list_t *grpcache;
+	struct db_provcache *provcache;
+	/* packages by the paths in their file lists, built on first use */
+	struct _alpm_fileowners_t *fileowners;
 	alpm_list_t *cache_servers;
 	alpm_list_t *servers;
 	const struct db_operations *ops;
@@ -88,6 +180,7 @@ alpm_db_t *_alpm_db_new(const char *treename, int is_local);
 void _alpm_db_free(alpm_db_t *db);
 const char *_alpm_db_path(alpm_db_t *db);
 int _alpm_db_cmp(const void *d1, const void *d2);
+alpm_dbsection_t _alpm_db_section(const char *line, size_t len);
 int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 		alpm_list_t **ret);
 alpm_db_t *_alpm_db_register_local(alpm_handle_t *handle);
@@ -112,5 +205,9 @@ alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target);
 /* groups */
 alpm_list_t *_alpm_db_get_groupcache(alpm_db_t *db);
 alpm_group_t *_alpm_db_get_groupfromcache(alpm_db_t *db, const char *target);
+/* file owners */
+alpm_list_t *_alpm_db_find_file_owners(alpm_db_t *db, const char *path);
+/* providers */
+alpm_list_t *_alpm_db_get_providers(alpm_db_t *db, alpm_depend_t *dep);
 
 #endif /* ALPM_DB_H */
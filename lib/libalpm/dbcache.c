@@ -0,0 +1,984 @@
+/*
+ *  dbcache.c : binary sidecar caches for sync databases
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* libalpm */
+#include "dbcache.h"
+#include "alpm_list.h"
+#include "alpm.h"
+#include "arena.h"
+#include "db.h"
+#include "deps.h"
+#include "filelist.h"
+#include "log.h"
+#include "package.h"
+#include "pkghash.h"
+#include "util.h"
+
+#define DBCACHE_MAGIC "ALPMDBC\n"
+/* bump whenever the on-disk layout changes */
+#define DBCACHE_VERSION 1
+#define DBCACHE_BYTEORDER 0x01020304u
+
+/* string fields of a package record, in on-disk order */
+enum {
+	CACHE_STR_NAME = 0,
+	CACHE_STR_VERSION,
+	CACHE_STR_FILENAME,
+	CACHE_STR_BASE,
+	CACHE_STR_DESC,
+	CACHE_STR_URL,
+	CACHE_STR_ARCH,
+	CACHE_STR_PACKAGER,
+	CACHE_STR_MD5SUM,
+	CACHE_STR_SHA256SUM,
+	CACHE_STR_PGPSIG,
+	CACHE_STR_COUNT
+};
+
+/* list fields of a package record, in on-disk order. String lists index into
+ * the reference table, dependency lists into the dependency table. */
+enum {
+	CACHE_LIST_LICENSES = 0,
+	CACHE_LIST_GROUPS,
+	CACHE_LIST_XDATA,
+	CACHE_LIST_FILES,
+	CACHE_LIST_REPLACES,
+	CACHE_LIST_DEPENDS,
+	CACHE_LIST_OPTDEPENDS,
+	CACHE_LIST_MAKEDEPENDS,
+	CACHE_LIST_CHECKDEPENDS,
+	CACHE_LIST_CONFLICTS,
+	CACHE_LIST_PROVIDES,
+	CACHE_LIST_COUNT
+};
+#define CACHE_LIST_FIRST_DEP CACHE_LIST_REPLACES
+
+/* All offsets stored in records are relative to the start of their table.
+ * A string offset of 0 denotes a NULL string. */
+struct dbcache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint64_t db_size;
+	int64_t db_mtime;
+	char db_sha256[64];
+	uint32_t pkg_count;
+	uint32_t dep_count;
+	uint32_t ref_count;
+	uint32_t str_size;
+	uint64_t pkg_offset;
+	uint64_t dep_offset;
+	uint64_t ref_offset;
+	uint64_t str_offset;
+};
+
+struct dbcache_list {
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct dbcache_pkg {
+	uint32_t str[CACHE_STR_COUNT];
+	uint32_t reserved;
+	int64_t builddate;
+	int64_t size;
+	int64_t isize;
+	struct dbcache_list lists[CACHE_LIST_COUNT];
+};
+
+struct dbcache_dep {
+	uint32_t name;
+	uint32_t version;
+	uint32_t desc;
+	uint32_t mod;
+};
+
+/* A mapped and validated cache file */
+struct dbcache_map {
+	void *addr;
+	size_t len;
+	const struct dbcache_header *hdr;
+	const struct dbcache_pkg *pkgs;
+	const struct dbcache_dep *deps;
+	const uint32_t *refs;
+	const char *strtab;
+	int corrupt;
+};
+
+/* A growable byte buffer used while writing a cache */
+struct dbcache_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+/* State used while writing a cache. Strings are deduplicated through a
+ * simple open-addressed table of string table offsets. */
+struct dbcache_writer {
+	struct dbcache_buffer pkgs;
+	struct dbcache_buffer deps;
+	struct dbcache_buffer refs;
+	struct dbcache_buffer strtab;
+	uint32_t *interned;
+	size_t interned_size;
+	size_t interned_count;
+};
+
+/* Backing store for lazily loaded sync package file lists. Either wraps the
+ * mapping of a cache file, where a package's file list is a run of entries
+ * in the reference table, or a heap buffer filled while parsing the database
+ * archive, where it is a run of consecutive NUL terminated names. */
+struct dbcache_files {
+	void *addr;
+	size_t len;
+	const uint32_t *refs;
+	uint32_t ref_count;
+	const char *strtab;
+	uint32_t str_size;
+	struct dbcache_buffer names;
+};
+
+static char **pkg_str_field(alpm_pkg_t *pkg, int idx)
+{
+	switch(idx) {
+		case CACHE_STR_NAME: return &pkg->name;
+		case CACHE_STR_VERSION: return &pkg->version;
+		case CACHE_STR_FILENAME: return &pkg->filename;
+		case CACHE_STR_BASE: return &pkg->base;
+		case CACHE_STR_DESC: return &pkg->desc;
+		case CACHE_STR_URL: return &pkg->url;
+		case CACHE_STR_ARCH: return &pkg->arch;
+		case CACHE_STR_PACKAGER: return &pkg->packager;
+		case CACHE_STR_MD5SUM: return &pkg->md5sum;
+		case CACHE_STR_SHA256SUM: return &pkg->sha256sum;
+		case CACHE_STR_PGPSIG: return &pkg->base64_sig;
+	}
+	return NULL;
+}
+
+/* fields that are interned when parsing a database, see sync_sections */
+static int pkg_str_shared(int idx)
+{
+	return idx == CACHE_STR_BASE || idx == CACHE_STR_URL
+		|| idx == CACHE_STR_ARCH || idx == CACHE_STR_PACKAGER;
+}
+
+static alpm_list_t **pkg_list_field(alpm_pkg_t *pkg, int idx)
+{
+	switch(idx) {
+		case CACHE_LIST_LICENSES: return &pkg->licenses;
+		case CACHE_LIST_GROUPS: return &pkg->groups;
+		case CACHE_LIST_XDATA: return &pkg->xdata;
+		case CACHE_LIST_REPLACES: return &pkg->replaces;
+		case CACHE_LIST_DEPENDS: return &pkg->depends;
+		case CACHE_LIST_OPTDEPENDS: return &pkg->optdepends;
+		case CACHE_LIST_MAKEDEPENDS: return &pkg->makedepends;
+		case CACHE_LIST_CHECKDEPENDS: return &pkg->checkdepends;
+		case CACHE_LIST_CONFLICTS: return &pkg->conflicts;
+		case CACHE_LIST_PROVIDES: return &pkg->provides;
+	}
+	return NULL;
+}
+
+static int buffer_append(struct dbcache_buffer *buf, const void *data, size_t len)
+{
+	if(buf->len + len > buf->size) {
+		size_t newsize = buf->size ? buf->size * 2 : 4096;
+		while(newsize < buf->len + len) {
+			newsize *= 2;
+		}
+		if(!_alpm_realloc((void **)&buf->data, &buf->size, newsize)) {
+			return -1;
+		}
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+static char *dbcache_path(const char *dbpath)
+{
+	return _alpm_get_fullpath("", dbpath, ALPM_DBCACHE_SUFFIX);
+}
+
+/* Returns the string at offset, or NULL for offset 0. Offsets outside of the
+ * string table mark the whole map as corrupt. */
+static const char *map_str(struct dbcache_map *map, uint32_t offset)
+{
+	if(offset == 0) {
+		return NULL;
+	}
+	if(offset >= map->hdr->str_size) {
+		map->corrupt = 1;
+		return NULL;
+	}
+	return map->strtab + offset;
+}
+
+static int map_list_valid(struct dbcache_map *map, const struct dbcache_list *list,
+		uint32_t limit, uint32_t per_entry)
+{
+	uint64_t end = (uint64_t)list->offset + (uint64_t)list->count * per_entry;
+	if(end > limit) {
+		map->corrupt = 1;
+		return 0;
+	}
+	return 1;
+}
+
+static int section_fits(size_t len, uint64_t offset, uint64_t count,
+		size_t entry_size, size_t align)
+{
+	if(offset > len || offset % align != 0) {
+		return 0;
+	}
+	return count <= (len - offset) / entry_size;
+}
+
+static void map_close(struct dbcache_map *map)
+{
+	if(map->addr) {
+		munmap(map->addr, map->len);
+		map->addr = NULL;
+	}
+}
+
+/* Map the cache file for dbpath and check that it is well-formed and was
+ * built from the current database file. */
+static int map_open(alpm_db_t *db, struct dbcache_map *map, const char *dbpath,
+		const char *dbhash)
+{
+	const struct dbcache_header *hdr;
+	struct stat dbst, st;
+	char *cachepath;
+	int fd;
+
+	memset(map, 0, sizeof(*map));
+
+	if(dbhash == NULL || strlen(dbhash) != sizeof(map->hdr->db_sha256)
+			|| stat(dbpath, &dbst) != 0) {
+		return -1;
+	}
+
+	cachepath = dbcache_path(dbpath);
+	if(cachepath == NULL) {
+		return -1;
+	}
+	OPEN(fd, cachepath, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG, "no package cache file for db '%s'\n",
+				db->treename);
+		free(cachepath);
+		return -1;
+	}
+	free(cachepath);
+
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct dbcache_header)) {
+		close(fd);
+		return -1;
+	}
+
+	map->len = st.st_size;
+	map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		return -1;
+	}
+
+	hdr = map->hdr = map->addr;
+	if(memcmp(hdr->magic, DBCACHE_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->version != DBCACHE_VERSION
+			|| hdr->byteorder != DBCACHE_BYTEORDER) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"package cache file for db '%s' has an unknown format\n", db->treename);
+		goto stale;
+	}
+
+	if(hdr->db_size != (uint64_t)dbst.st_size
+			|| hdr->db_mtime != (int64_t)dbst.st_mtime
+			|| memcmp(hdr->db_sha256, dbhash, sizeof(hdr->db_sha256)) != 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"package cache file for db '%s' is out of date\n", db->treename);
+		goto stale;
+	}
+
+	/* package records hold 64-bit fields, the others 32-bit ones */
+	if(!section_fits(map->len, hdr->pkg_offset, hdr->pkg_count,
+				sizeof(struct dbcache_pkg), sizeof(int64_t))
+			|| !section_fits(map->len, hdr->dep_offset, hdr->dep_count,
+				sizeof(struct dbcache_dep), sizeof(uint32_t))
+			|| !section_fits(map->len, hdr->ref_offset, hdr->ref_count,
+				sizeof(uint32_t), sizeof(uint32_t))
+			|| !section_fits(map->len, hdr->str_offset, hdr->str_size, 1, 1)
+			|| hdr->str_size == 0) {
+		goto corrupt;
+	}
+
+	map->pkgs = (const struct dbcache_pkg *)((const char *)map->addr + hdr->pkg_offset);
+	map->deps = (const struct dbcache_dep *)((const char *)map->addr + hdr->dep_offset);
+	map->refs = (const uint32_t *)((const char *)map->addr + hdr->ref_offset);
+	map->strtab = (const char *)map->addr + hdr->str_offset;
+
+	/* every string offset below str_size is then NUL terminated */
+	if(map->strtab[hdr->str_size - 1] != '\0') {
+		goto corrupt;
+	}
+
+	return 0;
+
+corrupt:
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"package cache file for db '%s' is corrupt\n", db->treename);
+stale:
+	map_close(map);
+	return -1;
+}
+
+static alpm_list_t *map_strlist(struct dbcache_map *map, alpm_arena_t *arena,
+		const struct dbcache_list *list)
+{
+	alpm_list_t *ret = NULL;
+	uint32_t i;
+
+	if(!map_list_valid(map, list, map->hdr->ref_count, 1)) {
+		return NULL;
+	}
+	for(i = 0; i < list->count; i++) {
+		const char *str = map_str(map, map->refs[list->offset + i]);
+		char *interned;
+		if(str == NULL) {
+			map->corrupt = 1;
+			break;
+		}
+		if((interned = _alpm_arena_intern(arena, str)) == NULL) {
+			goto error;
+		}
+		ret = alpm_list_add(ret, interned);
+	}
+	return ret;
+
+error:
+	map->corrupt = 1;
+	return ret;
+}
+
+static alpm_list_t *map_xdatalist(struct dbcache_map *map, const struct dbcache_list *list)
+{
+	alpm_list_t *ret = NULL;
+	uint32_t i;
+
+	if(!map_list_valid(map, list, map->hdr->ref_count, 2)) {
+		return NULL;
+	}
+	for(i = 0; i < list->count; i++) {
+		const char *name = map_str(map, map->refs[list->offset + 2 * i]);
+		const char *value = map_str(map, map->refs[list->offset + 2 * i + 1]);
+		alpm_pkg_xdata_t *pd;
+		if(name == NULL || value == NULL) {
+			map->corrupt = 1;
+			break;
+		}
+		CALLOC(pd, 1, sizeof(alpm_pkg_xdata_t), goto error);
+		ret = alpm_list_add(ret, pd);
+		STRDUP(pd->name, name, goto error);
+		STRDUP(pd->value, value, goto error);
+	}
+	return ret;
+
+error:
+	map->corrupt = 1;
+	return ret;
+}
+
+static alpm_list_t *map_deplist(struct dbcache_map *map, alpm_arena_t *arena,
+		const struct dbcache_list *list)
+{
+	alpm_list_t *ret = NULL;
+	uint32_t i;
+
+	if(!map_list_valid(map, list, map->hdr->dep_count, 1)) {
+		return NULL;
+	}
+	for(i = 0; i < list->count; i++) {
+		const struct dbcache_dep *cdep = map->deps + list->offset + i;
+		const char *name = map_str(map, cdep->name);
+		alpm_depend_t *dep;
+		if(name == NULL) {
+			map->corrupt = 1;
+			break;
+		}
+		if((dep = _alpm_arena_alloc(arena, sizeof(alpm_depend_t))) == NULL) {
+			goto error;
+		}
+		ret = alpm_list_add(ret, dep);
+		dep->name_hash = _alpm_hash_sdbm(name);
+		dep->mod = cdep->mod;
+		dep->name = _alpm_arena_intern(arena, name);
+		dep->version = _alpm_arena_intern(arena, map_str(map, cdep->version));
+		dep->desc = _alpm_arena_intern(arena, map_str(map, cdep->desc));
+		if(dep->name == NULL || (cdep->version && dep->version == NULL)
+				|| (cdep->desc && dep->desc == NULL)) {
+			goto error;
+		}
+	}
+	return ret;
+
+error:
+	map->corrupt = 1;
+	return ret;
+}
+
+static alpm_pkg_t *map_pkg(alpm_db_t *db, struct dbcache_map *map,
+		const struct dbcache_pkg *cpkg, const struct pkg_operations *ops)
+{
+	alpm_pkg_t *pkg;
+	int i;
+
+	pkg = _alpm_pkg_new();
+	if(pkg == NULL) {
+		return NULL;
+	}
+	pkg->arena_backed = 1;
+
+	for(i = 0; i < CACHE_STR_COUNT; i++) {
+		char **field = pkg_str_field(pkg, i);
+		const char *str = map_str(map, cpkg->str[i]);
+		if(cpkg->str[i] == 0) {
+			continue;
+		}
+		if(pkg_str_shared(i)) {
+			*field = _alpm_arena_intern(db->arena, str);
+		} else {
+			*field = _alpm_arena_strdup(db->arena, str);
+		}
+		if(*field == NULL) {
+			goto error;
+		}
+	}
+	pkg->builddate = cpkg->builddate;
+	pkg->size = cpkg->size;
+	pkg->isize = cpkg->isize;
+
+	for(i = 0; i < CACHE_LIST_COUNT; i++) {
+		const struct dbcache_list *list = cpkg->lists + i;
+		if(i == CACHE_LIST_FILES) {
+			/* file lists are loaded on first access */
+			if(map_list_valid(map, list, map->hdr->ref_count, 1)) {
+				pkg->files_offset = list->offset;
+				pkg->files_count = list->count;
+			}
+		} else if(i == CACHE_LIST_XDATA) {
+			pkg->xdata = map_xdatalist(map, list);
+		} else if(i >= CACHE_LIST_FIRST_DEP) {
+			*pkg_list_field(pkg, i) = map_deplist(map, db->arena, list);
+		} else {
+			*pkg_list_field(pkg, i) = map_strlist(map, db->arena, list);
+		}
+	}
+	if(map->corrupt) {
+		goto error;
+	}
+
+	pkg->name_hash = _alpm_hash_sdbm(pkg->name);
+	pkg->origin = ALPM_PKG_FROM_SYNCDB;
+	pkg->origin_data.db = db;
+	pkg->ops = ops;
+	pkg->handle = db->handle;
+
+	if(_alpm_pkg_check_meta(pkg) != 0) {
+		goto error;
+	}
+
+	return pkg;
+
+error:
+	_alpm_pkg_free(pkg);
+	return NULL;
+}
+
+/** Populate the package cache of a sync database from its sidecar cache.
+ * File lists are not read; the mapping is kept as the database's files
+ * cache instead and they are loaded on demand by _alpm_dbcache_files_load().
+ * @param db the sync database, with an empty package cache
+ * @param dbpath path of the database file
+ * @param dbhash SHA-256 digest of the database file
+ * @param ops package operations to assign to the loaded packages
+ * @return 0 if the package cache was populated, -1 if the sidecar cache is
+ * missing, stale or unusable and the database has to be parsed
+ */
+int _alpm_dbcache_load(alpm_db_t *db, const char *dbpath, const char *dbhash,
+		const struct pkg_operations *ops)
+{
+	struct dbcache_map map;
+	struct dbcache_files *files = NULL;
+	uint32_t i;
+	int have_files = 0;
+
+	if(map_open(db, &map, dbpath, dbhash) != 0) {
+		return -1;
+	}
+
+	db->pkgcache = _alpm_pkghash_create(map.hdr->pkg_count);
+	db->arena = _alpm_arena_new();
+	if(db->pkgcache == NULL || db->arena == NULL) {
+		_alpm_pkghash_free(db->pkgcache);
+		db->pkgcache = NULL;
+		_alpm_arena_free(db->arena);
+		db->arena = NULL;
+		map_close(&map);
+		return -1;
+	}
+
+	/* records are stored sorted, so the list needs no sorting afterwards */
+	for(i = 0; i < map.hdr->pkg_count; i++) {
+		alpm_pkg_t *pkg = map_pkg(db, &map, map.pkgs + i, ops);
+		if(pkg == NULL || _alpm_pkghash_add(&db->pkgcache, pkg) == NULL) {
+			_alpm_log(db->handle, ALPM_LOG_DEBUG,
+					"could not load package cache file for db '%s'\n", db->treename);
+			_alpm_pkg_free(pkg);
+			_alpm_db_free_pkgcache(db);
+			map_close(&map);
+			return -1;
+		}
+		have_files |= (pkg->files_count > 0);
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"loaded %u packages from package cache file for db '%s'\n",
+			map.hdr->pkg_count, db->treename);
+
+	if(have_files) {
+		CALLOC(files, 1, sizeof(struct dbcache_files),
+				_alpm_db_free_pkgcache(db); map_close(&map); return -1);
+		files->addr = map.addr;
+		files->len = map.len;
+		files->refs = map.refs;
+		files->ref_count = map.hdr->ref_count;
+		files->strtab = map.strtab;
+		files->str_size = map.hdr->str_size;
+		db->filescache = files;
+	} else {
+		/* nothing to load lazily, mark all file lists as loaded */
+		alpm_list_t *lp;
+		for(lp = db->pkgcache->list; lp; lp = lp->next) {
+			alpm_pkg_t *pkg = lp->data;
+			pkg->files_count = 0;
+			pkg->infolevel |= INFRQ_FILES;
+		}
+		map_close(&map);
+	}
+	return 0;
+}
+
+/** Create an empty files cache, to be filled while parsing a database.
+ * @return the new files cache, NULL on error
+ */
+struct dbcache_files *_alpm_dbcache_files_new(void)
+{
+	struct dbcache_files *files;
+	CALLOC(files, 1, sizeof(struct dbcache_files), return NULL);
+	return files;
+}
+
+/** Start recording the file list of a package, discarding any list that was
+ * recorded for it before.
+ * @param files the files cache of the package's database
+ * @param pkg the package
+ */
+void _alpm_dbcache_files_begin(struct dbcache_files *files, alpm_pkg_t *pkg)
+{
+	pkg->files_offset = files->names.len;
+	pkg->files_count = 0;
+}
+
+/** Append a file name to the file list of a package being recorded.
+ * @param files the files cache of the package's database
+ * @param pkg the package
+ * @param name the file name
+ * @return 0 on success, -1 on error
+ */
+int _alpm_dbcache_files_add(struct dbcache_files *files, alpm_pkg_t *pkg,
+		const char *name)
+{
+	if(buffer_append(&files->names, name, strlen(name) + 1) != 0) {
+		return -1;
+	}
+	pkg->files_count++;
+	return 0;
+}
+
+/** Load the file list of a sync package from its database's files cache.
+ * @param pkg the package
+ * @return 0 on success, -1 on error
+ */
+int _alpm_dbcache_files_load(alpm_pkg_t *pkg)
+{
+	struct dbcache_files *files = pkg->origin_data.db->filescache;
+	alpm_file_t *list;
+	size_t i, offset = pkg->files_offset;
+
+	if(pkg->infolevel & INFRQ_FILES) {
+		return 0;
+	}
+	if(files == NULL || pkg->files_count == 0) {
+		pkg->infolevel |= INFRQ_FILES;
+		return 0;
+	}
+
+	CALLOC(list, pkg->files_count, sizeof(alpm_file_t),
+			RET_ERR(pkg->handle, ALPM_ERR_MEMORY, -1));
+	for(i = 0; i < pkg->files_count; i++) {
+		const char *name;
+		if(files->addr) {
+			uint32_t ref = files->refs[offset + i];
+			if(ref == 0 || ref >= files->str_size) {
+				goto error;
+			}
+			name = files->strtab + ref;
+		} else {
+			name = files->names.data + offset;
+			offset += strlen(name) + 1;
+		}
+		STRDUP(list[i].name, name, goto error);
+	}
+
+	pkg->files.files = list;
+	pkg->files.count = pkg->files_count;
+	_alpm_filelist_sort(&pkg->files);
+	pkg->infolevel |= INFRQ_FILES;
+	return 0;
+
+error:
+	while(i > 0) {
+		free(list[--i].name);
+	}
+	free(list);
+	_alpm_log(pkg->handle, ALPM_LOG_ERROR,
+			_("could not load file list of package %s-%s\n"), pkg->name, pkg->version);
+	RET_ERR(pkg->handle, ALPM_ERR_PKG_INVALID, -1);
+}
+
+/** Release a files cache. File lists that were not loaded yet are lost.
+ * @param files the files cache
+ */
+void _alpm_dbcache_files_free(struct dbcache_files *files)
+{
+	if(files == NULL) {
+		return;
+	}
+	if(files->addr) {
+		munmap(files->addr, files->len);
+	}
+	free(files->names.data);
+	free(files);
+}
+
+static int writer_grow_interned(struct dbcache_writer *w)
+{
+	size_t newsize = w->interned_size ? w->interned_size * 2 : 4096;
+	uint32_t *table;
+	size_t i;
+
+	CALLOC(table, newsize, sizeof(uint32_t), return -1);
+	for(i = 0; i < w->interned_size; i++) {
+		uint32_t offset = w->interned[i];
+		if(offset != 0) {
+			size_t pos = _alpm_hash_sdbm(w->strtab.data + offset) & (newsize - 1);
+			while(table[pos] != 0) {
+				pos = (pos + 1) & (newsize - 1);
+			}
+			table[pos] = offset;
+		}
+	}
+	free(w->interned);
+	w->interned = table;
+	w->interned_size = newsize;
+	return 0;
+}
+
+/* Returns the string table offset of str, adding it if needed. */
+static int writer_str(struct dbcache_writer *w, const char *str, uint32_t *offset)
+{
+	size_t pos, len;
+
+	if(str == NULL) {
+		*offset = 0;
+		return 0;
+	}
+
+	if(w->interned_count * 2 >= w->interned_size && writer_grow_interned(w) != 0) {
+		return -1;
+	}
+
+	pos = _alpm_hash_sdbm(str) & (w->interned_size - 1);
+	while(w->interned[pos] != 0) {
+		if(strcmp(w->strtab.data + w->interned[pos], str) == 0) {
+			*offset = w->interned[pos];
+			return 0;
+		}
+		pos = (pos + 1) & (w->interned_size - 1);
+	}
+
+	len = strlen(str) + 1;
+	if(w->strtab.len + len > UINT32_MAX) {
+		return -1;
+	}
+	*offset = w->strtab.len;
+	if(buffer_append(&w->strtab, str, len) != 0) {
+		return -1;
+	}
+	w->interned[pos] = *offset;
+	w->interned_count++;
+	return 0;
+}
+
+static int writer_ref(struct dbcache_writer *w, const char *str)
+{
+	uint32_t offset;
+	if(writer_str(w, str, &offset) != 0) {
+		return -1;
+	}
+	return buffer_append(&w->refs, &offset, sizeof(offset));
+}
+
+static int writer_list(struct dbcache_writer *w, alpm_pkg_t *pkg, int idx,
+		struct dbcache_list *list)
+{
+	alpm_list_t *i;
+
+	if(idx >= CACHE_LIST_FIRST_DEP) {
+		list->offset = w->deps.len / sizeof(struct dbcache_dep);
+		for(i = *pkg_list_field(pkg, idx); i; i = i->next) {
+			alpm_depend_t *dep = i->data;
+			struct dbcache_dep cdep;
+			if(writer_str(w, dep->name, &cdep.name) != 0
+					|| writer_str(w, dep->version, &cdep.version) != 0
+					|| writer_str(w, dep->desc, &cdep.desc) != 0) {
+				return -1;
+			}
+			cdep.mod = dep->mod;
+			if(buffer_append(&w->deps, &cdep, sizeof(cdep)) != 0) {
+				return -1;
+			}
+			list->count++;
+		}
+		return 0;
+	}
+
+	list->offset = w->refs.len / sizeof(uint32_t);
+	if(idx == CACHE_LIST_FILES && !(pkg->infolevel & INFRQ_FILES)) {
+		struct dbcache_files *files = pkg->origin_data.db->filescache;
+		size_t f, offset = pkg->files_offset;
+		for(f = 0; files && !files->addr && f < pkg->files_count; f++) {
+			const char *name = files->names.data + offset;
+			if(writer_ref(w, name) != 0) {
+				return -1;
+			}
+			offset += strlen(name) + 1;
+			list->count++;
+		}
+	} else if(idx == CACHE_LIST_FILES) {
+		size_t f;
+		for(f = 0; f < pkg->files.count; f++) {
+			if(writer_ref(w, pkg->files.files[f].name) != 0) {
+				return -1;
+			}
+			list->count++;
+		}
+	} else if(idx == CACHE_LIST_XDATA) {
+		for(i = pkg->xdata; i; i = i->next) {
+			alpm_pkg_xdata_t *pd = i->data;
+			if(writer_ref(w, pd->name) != 0 || writer_ref(w, pd->value) != 0) {
+				return -1;
+			}
+			list->count++;
+		}
+	} else {
+		for(i = *pkg_list_field(pkg, idx); i; i = i->next) {
+			if(writer_ref(w, i->data) != 0) {
+				return -1;
+			}
+			list->count++;
+		}
+	}
+	return 0;
+}
+
+static int writer_pkg(struct dbcache_writer *w, alpm_pkg_t *pkg)
+{
+	struct dbcache_pkg cpkg;
+	int i;
+
+	memset(&cpkg, 0, sizeof(cpkg));
+	for(i = 0; i < CACHE_STR_COUNT; i++) {
+		if(writer_str(w, *pkg_str_field(pkg, i), &cpkg.str[i]) != 0) {
+			return -1;
+		}
+	}
+	cpkg.builddate = pkg->builddate;
+	cpkg.size = pkg->size;
+	cpkg.isize = pkg->isize;
+	for(i = 0; i < CACHE_LIST_COUNT; i++) {
+		if(writer_list(w, pkg, i, &cpkg.lists[i]) != 0) {
+			return -1;
+		}
+	}
+	return buffer_append(&w->pkgs, &cpkg, sizeof(cpkg));
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	while(len > 0) {
+		ssize_t n = write(fd, p, len);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void writer_free(struct dbcache_writer *w)
+{
+	free(w->pkgs.data);
+	free(w->deps.data);
+	free(w->refs.data);
+	free(w->strtab.data);
+	free(w->interned);
+}
+
+/** Write the sidecar cache for a freshly populated sync database.
+ * Failure is not an error for the caller; the database simply gets parsed
+ * again next time. The cache is written to a temporary file and renamed
+ * into place so concurrent readers never see a partial file.
+ * @param db the sync database with a populated package cache
+ * @param dbpath path of the database file
+ * @param st stat of the database file the package cache was read from
+ * @param dbhash SHA-256 digest of the database file
+ * @return 0 on success, -1 on error
+ */
+int _alpm_dbcache_write(alpm_db_t *db, const char *dbpath,
+		const struct stat *st, const char *dbhash)
+{
+	struct dbcache_writer w;
+	struct dbcache_header hdr;
+	alpm_list_t *i;
+	char *cachepath = NULL, *temppath = NULL;
+	int fd = -1, ret = -1, created = 0;
+	size_t len;
+
+	if(db->pkgcache == NULL || dbhash == NULL || strlen(dbhash) != sizeof(hdr.db_sha256)) {
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	/* offset 0 is reserved for NULL strings */
+	if(buffer_append(&w.strtab, "", 1) != 0) {
+		goto cleanup;
+	}
+	for(i = db->pkgcache->list; i; i = i->next) {
+		if(writer_pkg(&w, i->data) != 0) {
+			goto cleanup;
+		}
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DBCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = DBCACHE_VERSION;
+	hdr.byteorder = DBCACHE_BYTEORDER;
+	hdr.db_size = st->st_size;
+	hdr.db_mtime = st->st_mtime;
+	memcpy(hdr.db_sha256, dbhash, sizeof(hdr.db_sha256));
+	hdr.pkg_count = w.pkgs.len / sizeof(struct dbcache_pkg);
+	hdr.dep_count = w.deps.len / sizeof(struct dbcache_dep);
+	hdr.ref_count = w.refs.len / sizeof(uint32_t);
+	hdr.str_size = w.strtab.len;
+	hdr.pkg_offset = sizeof(hdr);
+	hdr.dep_offset = hdr.pkg_offset + w.pkgs.len;
+	hdr.ref_offset = hdr.dep_offset + w.deps.len;
+	hdr.str_offset = hdr.ref_offset + w.refs.len;
+
+	cachepath = dbcache_path(dbpath);
+	if(cachepath == NULL) {
+		goto cleanup;
+	}
+	len = strlen(cachepath) + 8;
+	MALLOC(temppath, len, goto cleanup);
+	snprintf(temppath, len, "%s.XXXXXX", cachepath);
+
+	fd = mkstemp(temppath);
+	if(fd < 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not create package cache file for db '%s': %s\n",
+				db->treename, strerror(errno));
+		goto cleanup;
+	}
+	created = 1;
+	if(fchmod(fd, 0644) != 0
+			|| write_all(fd, &hdr, sizeof(hdr)) != 0
+			|| write_all(fd, w.pkgs.data, w.pkgs.len) != 0
+			|| write_all(fd, w.deps.data, w.deps.len) != 0
+			|| write_all(fd, w.refs.data, w.refs.len) != 0
+			|| write_all(fd, w.strtab.data, w.strtab.len) != 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not write package cache file for db '%s': %s\n",
+				db->treename, strerror(errno));
+		goto cleanup;
+	}
+	if(close(fd) != 0) {
+		fd = -1;
+		goto cleanup;
+	}
+	fd = -1;
+	if(rename(temppath, cachepath) != 0) {
+		goto cleanup;
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"wrote package cache file for db '%s'\n", db->treename);
+	ret = 0;
+
+cleanup:
+	if(fd >= 0) {
+		close(fd);
+	}
+	if(ret != 0 && created) {
+		unlink(temppath);
+	}
+	free(temppath);
+	free(cachepath);
+	writer_free(&w);
+	return ret;
+}
@@ -0,0 +1,58 @@
+/*
+ *  dbcache.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_DBCACHE_H
+#define ALPM_DBCACHE_H
+
+#include <sys/stat.h>
+
+#include "alpm.h"
+#include "package.h"
+
+/* Binary sidecar caches for sync databases.
+ *
+ * After a sync database has been parsed from its archive, the resulting
+ * package cache is written next to it as '<db file>.cache'. The cache is
+ * keyed on the size, mtime and SHA-256 digest of the database file it was
+ * built from and is designed to be mmap()ed: a fixed header is followed by
+ * fixed-size package and dependency records, a table of string references
+ * and a single string table. Later populates of an unchanged database build
+ * the package cache from the mapping without decompressing or parsing.
+ *
+ * Package file lists are not part of the package cache proper. They are kept
+ * in a per-database files cache, either the mapping itself or a buffer
+ * filled while parsing the archive, and only copied into a package on first
+ * access. */
+
+#define ALPM_DBCACHE_SUFFIX ".cache"
+
+struct dbcache_files;
+
+int _alpm_dbcache_load(alpm_db_t *db, const char *dbpath, const char *dbhash,
+		const struct pkg_operations *ops);
+int _alpm_dbcache_write(alpm_db_t *db, const char *dbpath,
+		const struct stat *st, const char *dbhash);
+
+struct dbcache_files *_alpm_dbcache_files_new(void);
+void _alpm_dbcache_files_begin(struct dbcache_files *files, alpm_pkg_t *pkg);
+int _alpm_dbcache_files_add(struct dbcache_files *files, alpm_pkg_t *pkg,
+		const char *name);
+int _alpm_dbcache_files_load(alpm_pkg_t *pkg);
+void _alpm_dbcache_files_free(struct dbcache_files *files);
+
+#endif /* ALPM_DBCACHE_H */
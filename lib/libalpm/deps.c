@@ -455,7 +455,25 @@ int _alpm_depcmp(alpm_pkg_t *pkg, alpm_depend_t *dep)
 		|| _alpm_depcmp_provides(dep, alpm_pkg_get_provides(pkg));
 }
 
-alpm_depend_t SYMEXPORT *alpm_dep_from_string(const char *depstring)
+/* copy part of a dependency string, interned if an arena is given */
+static char *dep_strndup(alpm_arena_t *arena, const char *str, size_t len)
+{
+	char *dup;
+
+	if(arena) {
+		return _alpm_arena_internn(arena, str, len);
+	}
+	STRNDUP(dup, str, len, return NULL);
+	return dup;
+}
+
+/** Parse a dependency string.
+ * @param depstring the dependency string
+ * @param arena if not NULL, the dependency and its strings are allocated
+ * from this arena and must not be freed with alpm_dep_free()
+ * @return the dependency, NULL on error
+ */
+alpm_depend_t *_alpm_dep_parse(const char *depstring, alpm_arena_t *arena)
 {
 	alpm_depend_t *depend;
 	const char *ptr, *version, *desc;
@@ -465,11 +483,20 @@ alpm_depend_t SYMEXPORT *alpm_dep_from_string(const char *depstring)
 		return NULL;
 	}
 
-	CALLOC(depend, 1, sizeof(alpm_depend_t), return NULL);
+	if(arena) {
+		if((depend = _alpm_arena_alloc(arena, sizeof(alpm_depend_t))) == NULL) {
+			return NULL;
+		}
+		memset(depend, 0, sizeof(alpm_depend_t));
+	} else {
+		CALLOC(depend, 1, sizeof(alpm_depend_t), return NULL);
+	}
 
 	/* Note the extra space in ": " to avoid matching the epoch */
 	if((desc = strstr(depstring, ": ")) != NULL) {
-		STRDUP(depend->desc, desc + 2, goto error);
+		if((depend->desc = dep_strndup(arena, desc + 2, strlen(desc + 2))) == NULL) {
+			goto error;
+		}
 		deplen = desc - depstring;
 	} else {
 		/* no description- point desc at NULL at end of string for later use */
@@ -509,19 +536,30 @@ alpm_depend_t SYMEXPORT *alpm_dep_from_string(const char *depstring)
 	}
 
 	/* copy the right parts to the right places */
-	STRNDUP(depend->name, depstring, ptr - depstring, goto error);
+	if((depend->name = dep_strndup(arena, depstring, ptr - depstring)) == NULL) {
+		goto error;
+	}
 	depend->name_hash = _alpm_hash_sdbm(depend->name);
 	if(version) {
-		STRNDUP(depend->version, version, desc - version, goto error);
+		if((depend->version = dep_strndup(arena, version, desc - version)) == NULL) {
+			goto error;
+		}
 	}
 
 	return depend;
 
 error:
-	alpm_dep_free(depend);
+	if(!arena) {
+		alpm_dep_free(depend);
+	}
 	return NULL;
 }
 
+alpm_depend_t SYMEXPORT *alpm_dep_from_string(const char *depstring)
+{
+	return _alpm_dep_parse(depstring, NULL);
+}
+
 alpm_depend_t *_alpm_dep_dup(const alpm_depend_t *dep)
 {
 	alpm_depend_t *newdep;
@@ -680,7 +718,8 @@ static alpm_pkg_t *resolvedep(alpm_handle_t *handle, alpm_depend_t *dep,
 		if(!(db->usage & (ALPM_DB_USAGE_INSTALL|ALPM_DB_USAGE_UPGRADE))) {
 			continue;
 		}
-		for(j = _alpm_db_get_pkgcache(db); j; j = j->next) {
+		/* only packages providing the name can satisfy the dependency */
+		for(j = _alpm_db_get_providers(db, dep); j; j = j->next) {
 			alpm_pkg_t *pkg = j->data;
 			if((pkg->name_hash != dep->name_hash || strcmp(pkg->name, dep->name) != 0)
 					&& _alpm_depcmp_provides(dep, alpm_pkg_get_provides(pkg))
@@ -741,9 +780,9 @@ static alpm_pkg_t *resolvedep(alpm_handle_t *handle, alpm_depend_t *dep,
 	}
 
 	if(ignored) { /* resolvedeps will override these */
-		handle->pm_errno = ALPM_ERR_PKG_IGNORED;
+		PM_ERRNO(handle) = ALPM_ERR_PKG_IGNORED;
 	} else {
-		handle->pm_errno = ALPM_ERR_PKG_NOT_FOUND;
+		PM_ERRNO(handle) = ALPM_ERR_PKG_NOT_FOUND;
 	}
 	return NULL;
 }
@@ -836,7 +875,7 @@ int _alpm_resolvedeps(alpm_handle_t *handle, alpm_list_t *localpkgs,
 		} else if(resolvedep(handle, missdep, (targ = alpm_list_add(NULL, handle->db_local)), rem, 0)) {
 			alpm_depmissing_free(miss);
 		} else {
-			handle->pm_errno = ALPM_ERR_UNSATISFIED_DEPS;
+			PM_ERRNO(handle) = ALPM_ERR_UNSATISFIED_DEPS;
 			char *missdepstring = alpm_dep_compute_string(missdep);
 			_alpm_log(handle, ALPM_LOG_WARNING,
 					_("cannot resolve \"%s\", a dependency of \"%s\"\n"),
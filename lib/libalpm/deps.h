@@ -26,7 +26,9 @@
 #include "sync.h"
 #include "package.h"
 #include "alpm.h"
+#include "arena.h"
 
+alpm_depend_t *_alpm_dep_parse(const char *depstring, alpm_arena_t *arena);
 alpm_depend_t *_alpm_dep_dup(const alpm_depend_t *dep);
 alpm_list_t *_alpm_sortbydeps(alpm_handle_t *handle,
 		alpm_list_t *targets, alpm_list_t *ignore, int reverse);
@@ -87,6 +87,26 @@ static int finalize_download_file(const char *filename)
 	return 0;
 }
 
+/* Record a digest for the file described by st, or NULL if it does not fit */
+static struct dload_digest *dload_digest_new(alpm_pkgvalidation_t type,
+		const char *hex, const struct stat *st)
+{
+	struct dload_digest *digest;
+
+	if(strlen(hex) >= sizeof(digest->hex)) {
+		return NULL;
+	}
+	CALLOC(digest, 1, sizeof(*digest), return NULL);
+	digest->type = type;
+	strcpy(digest->hex, hex);
+	digest->dev = st->st_dev;
+	digest->ino = st->st_ino;
+	digest->size = st->st_size;
+	digest->mtim = st->st_mtim;
+	digest->ctim = st->st_ctim;
+	return digest;
+}
+
 static FILE *create_tempfile(struct dload_payload *payload, const char *localpath)
 {
 	int fd;
@@ -132,29 +152,49 @@ static int curl_gethost(const char *url, char *buffer, size_t buf_len);
  * server blacklisting */
 const int server_error_limit = 3;
 
-struct server_error_count {
+/* weight of the newest sample in a server's rolling statistics */
+#define SERVER_STATS_WEIGHT 0.25
+/* transfers smaller than this say more about latency than throughput */
+#define SERVER_SPEED_MIN_BYTES (64 * 1024)
+/* throughput assumed for every server until one has been measured */
+#define SERVER_SPEED_GUESS (1024.0 * 1024.0)
+/* seconds a transfer runs before it may be moved to a faster server */
+#define SERVER_STALL_GRACE 5.0
+/* buffer used to join the segments of a payload */
+#define SEGMENT_COPY_SIZE (256 * 1024)
+
+struct server_stats {
 	char server[HOSTNAME_SIZE];
 	int errors;
+	/* rolling transfer statistics, 0 until the first sample */
+	double ttfb;            /* seconds until the first byte arrived */
+	double speed;           /* bytes per second */
+	unsigned int requests;
+	unsigned int failures;
+	int active;             /* transfers currently using this server */
+	/* totals of the running curl_download_internal() call, reported to
+	 * the download callback at its end */
+	alpm_download_event_host_stats_t batch;
 };
 
-static struct server_error_count *find_server_errors(alpm_handle_t *handle, const char *server)
+static struct server_stats *find_server_stats(alpm_handle_t *handle, const char *server)
 {
 	alpm_list_t *i;
-	struct server_error_count *h;
+	struct server_stats *h;
 	char hostname[HOSTNAME_SIZE];
 	/* key off the hostname because a host may serve multiple repos under
 	 * different url's and errors are likely to be host-wide */
 	if(curl_gethost(server, hostname, sizeof(hostname)) != 0) {
 		return NULL;
 	}
-	for(i = handle->server_errors; i; i = i->next) {
+	for(i = handle->server_stats; i; i = i->next) {
 		h = i->data;
 		if(strcmp(hostname, h->server) == 0) {
 			return h;
 		}
 	}
-	if((h = calloc(sizeof(struct server_error_count), 1))
-			&& alpm_list_append(&handle->server_errors, h)) {
+	if((h = calloc(sizeof(struct server_stats), 1))
+			&& alpm_list_append(&handle->server_stats, h)) {
 		strcpy(h->server, hostname);
 		h->errors = 0;
 		return h;
@@ -167,8 +207,8 @@ static struct server_error_count *find_server_errors(alpm_handle_t *handle, cons
 /* skip for hard errors or too many soft errors */
 static int should_skip_server(alpm_handle_t *handle, const char *server)
 {
-	struct server_error_count *h;
-	if(server_error_limit && (h = find_server_errors(handle, server)) ) {
+	struct server_stats *h;
+	if(server_error_limit && (h = find_server_stats(handle, server)) ) {
 		return h->errors < 0 || h->errors >= server_error_limit;
 	}
 	return 0;
@@ -177,8 +217,8 @@ static int should_skip_server(alpm_handle_t *handle, const char *server)
 /* only skip for hard errors */
 static int should_skip_cache_server(alpm_handle_t *handle, const char *server)
 {
-	struct server_error_count *h;
-	if(server_error_limit && (h = find_server_errors(handle, server)) ) {
+	struct server_stats *h;
+	if(server_error_limit && (h = find_server_stats(handle, server)) ) {
 		return h->errors < 0;
 	}
 	return 0;
@@ -187,9 +227,9 @@ static int should_skip_cache_server(alpm_handle_t *handle, const char *server)
 /* block normal servers after too many errors */
 static void server_soft_error(alpm_handle_t *handle, const char *server)
 {
-	struct server_error_count *h;
+	struct server_stats *h;
 	if(server_error_limit
-			&& (h = find_server_errors(handle, server))
+			&& (h = find_server_stats(handle, server))
 			&& !should_skip_server(handle, server) ) {
 		h->errors++;
 
@@ -204,8 +244,8 @@ static void server_soft_error(alpm_handle_t *handle, const char *server)
 /* immediate block for both servers and cache servers */
 static void server_hard_error(alpm_handle_t *handle, const char *server)
 {
-	struct server_error_count *h;
-	if(server_error_limit && (h = find_server_errors(handle, server))) {
+	struct server_stats *h;
+	if(server_error_limit && (h = find_server_stats(handle, server))) {
 		if(h->errors != -1) {
 			/* always set even if already skipped for soft errors
 			 * to disable cache servers too */
@@ -218,37 +258,258 @@ static void server_hard_error(alpm_handle_t *handle, const char *server)
 	}
 }
 
+static double server_stats_update(double avg, double sample)
+{
+	return avg > 0 ? avg + (sample - avg) * SERVER_STATS_WEIGHT : sample;
+}
+
+static void server_transfer_start(alpm_handle_t *handle, const char *url)
+{
+	struct server_stats *h = find_server_stats(handle, url);
+	if(h) {
+		h->active++;
+	}
+}
+
+/* fold a finished (or abandoned) transfer into the statistics of its server */
+static void server_transfer_done(alpm_handle_t *handle, struct dload_payload *payload,
+		int failed)
+{
+	struct server_stats *h = find_server_stats(handle, payload->fileurl);
+	double ttfb = 0;
+	curl_off_t speed = 0, bytes = 0;
+	long connects = 0, version = 0;
+
+	if(h == NULL) {
+		return;
+	}
+	if(h->active > 0) {
+		h->active--;
+	}
+
+	curl_easy_getinfo(payload->curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+	curl_easy_getinfo(payload->curl, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(payload->curl, CURLINFO_HTTP_VERSION, &version);
+	h->batch.transfers++;
+	h->batch.connections += connects;
+	h->batch.downloaded += bytes;
+	if(version >= CURL_HTTP_VERSION_2_0) {
+		h->batch.multiplexed++;
+	}
+
+	h->requests++;
+	if(failed) {
+		h->failures++;
+		h->batch.failures++;
+		return;
+	}
+
+	curl_easy_getinfo(payload->curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+	curl_easy_getinfo(payload->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+	if(ttfb > 0) {
+		h->ttfb = server_stats_update(h->ttfb, ttfb);
+	}
+	if(bytes >= SERVER_SPEED_MIN_BYTES && speed > 0) {
+		h->speed = server_stats_update(h->speed, (double)speed);
+	}
+}
+
+/* hand the totals of every host used since the last report to the front end,
+ * if it asked for them */
+static void server_stats_report(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+
+	for(i = handle->server_stats; i; i = i->next) {
+		struct server_stats *h = i->data;
+		if(h->batch.transfers == 0) {
+			continue;
+		}
+		if(handle->dlcb && handle->host_stats) {
+			handle->dlcb(handle->dlcb_ctx, h->server, ALPM_DOWNLOAD_HOST_STATS, &h->batch);
+		}
+		memset(&h->batch, 0, sizeof(h->batch));
+	}
+}
+
+/* Estimate the seconds needed to fetch the given number of bytes from a
+ * server. Servers without samples are assumed to be as good as the best one
+ * seen so far, and bandwidth is shared between the transfers already running
+ * against a server. Failed requests make a server proportionally more
+ * expensive. */
+static double server_expected_time(alpm_handle_t *handle, struct server_stats *h,
+		off_t bytes)
+{
+	double ttfb = 0, speed = SERVER_SPEED_GUESS, t;
+	int measured = 0;
+	alpm_list_t *i;
+
+	for(i = handle->server_stats; i; i = i->next) {
+		struct server_stats *s = i->data;
+		if(s->ttfb > 0 && (ttfb == 0 || s->ttfb < ttfb)) {
+			ttfb = s->ttfb;
+		}
+		if(s->speed > 0 && (!measured || s->speed > speed)) {
+			speed = s->speed;
+			measured = 1;
+		}
+	}
+	if(h == NULL) {
+		return ttfb + bytes / speed;
+	}
+
+	if(h->ttfb > 0) {
+		ttfb = h->ttfb;
+	}
+	if(h->speed > 0) {
+		speed = h->speed;
+	}
+	t = ttfb + bytes * (h->active + 1) / speed;
+	return t * (h->requests + 1) / (h->requests - h->failures + 1);
+}
+
+static int server_measured(struct server_stats *h)
+{
+	return h && h->speed > 0;
+}
+
+/* Pick the untried server to fetch the payload from. Servers are taken in
+ * the configured order; one is only passed over once it has been measured
+ * to take at least twice as long as a later server that has been measured
+ * as well. Unmeasured servers are reached in order, or when a running
+ * transfer stalls, see payload_stalled(). */
+static const char *payload_best_server(struct dload_payload *payload, off_t bytes,
+		struct server_stats **stats, double *expected)
+{
+	alpm_handle_t *handle = payload->handle;
+	const char *best = NULL;
+	struct server_stats *best_stats = NULL;
+	double best_time = 0;
+	alpm_list_t *i;
+
+	for(i = payload->servers; i; i = i->next) {
+		const char *server = i->data;
+		struct server_stats *h;
+		double t;
+
+		if(alpm_list_find_ptr(payload->servers_tried, server)
+				|| should_skip_server(handle, server)) {
+			continue;
+		}
+		h = find_server_stats(handle, server);
+		if(best != NULL && !(server_measured(best_stats) && server_measured(h))) {
+			continue;
+		}
+		t = server_expected_time(handle, h, bytes);
+		if(best == NULL || 2 * t < best_time) {
+			best = server;
+			best_stats = h;
+			best_time = t;
+		}
+	}
+
+	if(stats) {
+		*stats = best_stats;
+	}
+	if(expected) {
+		*expected = best_time;
+	}
+	return best;
+}
+
 static const char *payload_next_server(struct dload_payload *payload)
 {
+	const char *server;
+	double expected;
+
 	while(payload->cache_servers
 			&& should_skip_cache_server(payload->handle, payload->cache_servers->data)) {
 		payload->cache_servers = payload->cache_servers->next;
 	}
 	if(payload->cache_servers) {
-		const char *server = payload->cache_servers->data;
+		server = payload->cache_servers->data;
 		payload->cache_servers = payload->cache_servers->next;
 		payload->request_errors_ok = 1;
 		return server;
 	}
-	while(payload->servers
-			&& should_skip_server(payload->handle, payload->servers->data)) {
-		payload->servers = payload->servers->next;
-	}
-	if(payload->servers) {
-		const char *server = payload->servers->data;
-		payload->servers = payload->servers->next;
+	server = payload_best_server(payload, payload->max_size, NULL, &expected);
+	if(server) {
+		if(!alpm_list_append(&payload->servers_tried, (void *)server)) {
+			return NULL;
+		}
+		_alpm_log(payload->handle, ALPM_LOG_DEBUG,
+				"%s: using server %s (expected %.1fs)\n",
+				payload->remote_name, server, expected);
 		payload->request_errors_ok = payload->errors_ok;
 		return server;
 	}
 	return NULL;
 }
 
+/* Decide whether a running transfer should be abandoned for another server.
+ * It is moved once finishing it here is expected to take more than twice as
+ * long as fetching what is left from the next server. A server without
+ * samples is assumed to be as fast as the best one measured so far. */
+static int payload_stalled(struct dload_payload *payload, curl_off_t dltotal,
+		curl_off_t dlnow)
+{
+	curl_off_t speed = 0;
+	double elapsed = 0, remaining, expected;
+	off_t bytes;
+
+	if(payload->cache_servers) {
+		return 0;
+	}
+	curl_easy_getinfo(payload->curl, CURLINFO_TOTAL_TIME, &elapsed);
+	if(elapsed < SERVER_STALL_GRACE || elapsed - payload->stall_checked < 1.0) {
+		return 0;
+	}
+	payload->stall_checked = elapsed;
+
+	curl_easy_getinfo(payload->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+	remaining = (double)(dltotal - dlnow) / (speed > 0 ? speed : 1);
+	bytes = payload->allow_resume ? dltotal - dlnow : payload->initial_size + dltotal;
+	/* no untried server left */
+	if(payload_best_server(payload, bytes, NULL, &expected) == NULL) {
+		return 0;
+	}
+	return remaining > 2 * expected + SERVER_STALL_GRACE;
+}
+
 enum {
 	ABORT_OVER_MAXFILESIZE = 1,
 };
 
 static int dload_interrupted;
 
+/* set in a sandboxed download process, see curl_download_internal_sandboxed() */
+static _alpm_sandbox_callback_context *sandbox_callbacks;
+
+/* report the transfers of a segmented payload as a single download */
+static int dload_segments_progress(struct dload_payload *payload, curl_off_t dlnow)
+{
+	struct dload_payload *owner = payload->parent ? payload->parent : payload;
+	alpm_download_event_progress_t cb_data = {0};
+	alpm_list_t *i;
+
+	payload->dlnow = dlnow;
+	cb_data.total = owner->max_size - owner->segment_base;
+	cb_data.downloaded = owner->initial_size - owner->segment_base + owner->dlnow;
+	for(i = owner->segments; i; i = i->next) {
+		struct dload_payload *seg = i->data;
+		cb_data.downloaded += seg->initial_size + seg->dlnow;
+	}
+
+	if(owner->prevprogress == cb_data.downloaded) {
+		return 0;
+	}
+	owner->handle->dlcb(owner->handle->dlcb_ctx,
+			owner->remote_name, ALPM_DOWNLOAD_PROGRESS, &cb_data);
+	owner->prevprogress = cb_data.downloaded;
+
+	return 0;
+}
+
 static int dload_progress_cb(void *file, curl_off_t dltotal, curl_off_t dlnow,
 		curl_off_t UNUSED ultotal, curl_off_t UNUSED ulnow)
 {
@@ -279,11 +540,21 @@ static int dload_progress_cb(void *file, curl_off_t dltotal, curl_off_t dlnow,
 		return 1;
 	}
 
+	/* is another server likely to finish this sooner? */
+	if(payload_stalled(payload, dltotal, dlnow)) {
+		payload->stalled = 1;
+		return 1;
+	}
+
 	/* none of what follows matters if the front end has no callback */
 	if(payload->handle->dlcb == NULL) {
 		return 0;
 	}
 
+	if(payload->parent || payload->segments) {
+		return dload_segments_progress(payload, dlnow);
+	}
+
 	total_size = payload->initial_size + dltotal;
 
 	if(payload->prevprogress == total_size) {
@@ -365,9 +636,77 @@ static size_t dload_parseheader_cb(void *ptr, size_t size, size_t nmemb, void *u
 		payload->respcode = respcode;
 	}
 
+	/* the server ignored the range and would send the whole file, stop
+	 * before any of it ends up in the middle of the tempfile */
+	if(payload->range_end && respcode == 200
+			&& strncmp(payload->fileurl, "http", 4) == 0) {
+		payload->range_ignored = 1;
+		return 0;
+	}
+
 	return realsize;
 }
 
+/* Start the digest of a payload over the first 'size' bytes of its tempfile.
+ * Data written to the tempfile afterwards is added by dload_write_cb(). */
+static void payload_digest_start(struct dload_payload *payload, off_t size)
+{
+	int fd;
+
+	_alpm_digest_free(payload->digest_ctx);
+	payload->digest_ctx = NULL;
+	payload->digest_size = 0;
+
+	if(!payload->digest_type || payload->parent) {
+		return;
+	}
+	payload->digest_ctx = _alpm_digest_new(payload->digest_type);
+	if(payload->digest_ctx == NULL || size == 0) {
+		return;
+	}
+
+	/* resuming, the existing part of the file has to be hashed first */
+	OPEN(fd, payload->tempfile_name, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || _alpm_digest_update_fd(payload->digest_ctx, fd, size) != size) {
+		_alpm_digest_free(payload->digest_ctx);
+		payload->digest_ctx = NULL;
+	} else {
+		payload->digest_size = size;
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+}
+
+static size_t dload_write_cb(char *ptr, size_t size, size_t nmemb, void *user)
+{
+	struct dload_payload *payload = user;
+	size_t written = fwrite(ptr, size, nmemb, payload->localf);
+
+	if(payload->digest_ctx) {
+		_alpm_digest_update(payload->digest_ctx, ptr, written * size);
+		payload->digest_size += written * size;
+	}
+	return written * size;
+}
+
+/* limit the request of a segment to what is missing from its range */
+static void curl_set_range(CURL *curl, struct dload_payload *payload)
+{
+	char range[64];
+
+	if(payload->range_end == 0) {
+		return;
+	}
+	snprintf(range, sizeof(range), "%jd-%jd",
+			(intmax_t)(payload->range_start + payload->initial_size),
+			(intmax_t)(payload->range_end - 1));
+	curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)0);
+	curl_easy_setopt(curl, CURLOPT_RANGE, range);
+	_alpm_log(payload->handle, ALPM_LOG_DEBUG, "%s: requesting range %s\n",
+			payload->remote_name, range);
+}
+
 static void curl_set_handle_opts(CURL *curl, struct dload_payload *payload)
 {
 	alpm_handle_t *handle = payload->handle;
@@ -398,6 +737,12 @@ static void curl_set_handle_opts(CURL *curl, struct dload_payload *payload)
 	curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 60L);
 	curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
 	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)payload);
+	if(handle->max_host_connections) {
+		/* prefer HTTP/2 and wait for a connection to the host that can be
+		 * multiplexed over, instead of opening one per transfer */
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	}
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "%s: url is %s\n",
 		payload->remote_name, payload->fileurl);
@@ -430,6 +775,8 @@ static void curl_set_handle_opts(CURL *curl, struct dload_payload *payload)
 				payload->remote_name, (intmax_t)st.st_size);
 		payload->initial_size = st.st_size;
 	}
+
+	curl_set_range(curl, payload);
 }
 
 /* Return 0 if retry was successful, -1 otherwise */
@@ -471,6 +818,7 @@ static int curl_retry_next_server(CURLM *curlm, CURL *curl, struct dload_payload
 			RET_ERR(handle, ALPM_ERR_SYSTEM, -1);
 		}
 		fseek(payload->localf, 0, SEEK_SET);
+		payload_digest_start(payload, 0);
 	}
 
 	if(handle->dlcb) {
@@ -479,8 +827,13 @@ static int curl_retry_next_server(CURLM *curlm, CURL *curl, struct dload_payload
 		handle->dlcb(handle->dlcb_ctx, payload->remote_name, ALPM_DOWNLOAD_RETRY, &cb_data);
 	}
 
+	curl_set_range(curl, payload);
+
 	/* Set curl with the new URL */
 	curl_easy_setopt(curl, CURLOPT_URL, payload->fileurl);
+	payload->stall_checked = 0;
+	payload->dlnow = 0;
+	server_transfer_start(handle, payload->fileurl);
 
 	curl_multi_remove_handle(curlm, curl);
 	curl_multi_add_handle(curlm, curl);
@@ -488,7 +841,199 @@ static int curl_retry_next_server(CURLM *curlm, CURL *curl, struct dload_payload
 	return 0;
 }
 
-/* Returns 2 if download retry happened
+/* Keep the digest of a completed download, if it covers the whole file.
+ * Its ctime is taken again once the file is in place, see
+ * payload_digest_settle(). */
+static void payload_digest_finish(struct dload_payload *payload)
+{
+	const char *path = payload->destfile_name ? payload->destfile_name : payload->tempfile_name;
+	struct stat st;
+	char *hex;
+
+	hex = _alpm_digest_final(payload->digest_ctx);
+	payload->digest_ctx = NULL;
+	if(hex == NULL) {
+		return;
+	}
+	free(payload->digest);
+	payload->digest = NULL;
+	if(stat(path, &st) == 0 && st.st_size == payload->digest_size) {
+		payload->digest = dload_digest_new(payload->digest_type, hex, &st);
+	}
+	free(hex);
+}
+
+/* Move a downloaded payload into place and report its completion. Returns
+ * the final result of the payload, see curl_check_finished_download(). */
+static int payload_finish(alpm_handle_t *handle, struct dload_payload *payload,
+		int ret, curl_off_t bytes_dl)
+{
+	if(ret == 0) {
+		if(payload->destfile_name) {
+			if(rename(payload->tempfile_name, payload->destfile_name)) {
+				_alpm_log(handle, ALPM_LOG_ERROR, _("could not rename %s to %s (%s)\n"),
+						payload->tempfile_name, payload->destfile_name, strerror(errno));
+				ret = -1;
+			}
+		}
+	}
+
+	if(ret == 0 && payload->digest_ctx) {
+		payload_digest_finish(payload);
+	}
+	_alpm_digest_free(payload->digest_ctx);
+	payload->digest_ctx = NULL;
+
+	if((ret == -1 || dload_interrupted) && payload->unlink_on_fail &&
+			payload->tempfile_name) {
+		unlink(payload->tempfile_name);
+	}
+
+	if(handle->dlcb) {
+		alpm_download_event_completed_t cb_data = {0};
+		cb_data.total = bytes_dl;
+		cb_data.result = ret;
+		handle->dlcb(handle->dlcb_ctx, payload->remote_name, ALPM_DOWNLOAD_COMPLETED, &cb_data);
+	}
+
+	if(ret == -1 && payload->errors_ok) {
+		ret = -2;
+	}
+
+	if(payload->signature) {
+		/* free signature payload memory that was allocated earlier in dload.c */
+		_alpm_dload_payload_reset(payload);
+		FREE(payload);
+	}
+
+	return ret;
+}
+
+/* Append the content of src to dest and to the digest of dest, if any. */
+static int append_file(const char *dest, const char *src,
+		struct dload_payload *payload)
+{
+	char *buf;
+	int in = -1, out = -1, ret = -1;
+	ssize_t nread;
+
+	MALLOC(buf, SEGMENT_COPY_SIZE, return -1);
+	OPEN(in, src, O_RDONLY | O_CLOEXEC);
+	OPEN(out, dest, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if(in < 0 || out < 0) {
+		goto cleanup;
+	}
+
+	while((nread = read(in, buf, SEGMENT_COPY_SIZE)) != 0) {
+		char *p = buf;
+		if(nread < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			goto cleanup;
+		}
+		if(payload->digest_ctx) {
+			_alpm_digest_update(payload->digest_ctx, buf, nread);
+			payload->digest_size += nread;
+		}
+		while(nread > 0) {
+			ssize_t nwrite = write(out, p, nread);
+			if(nwrite < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				goto cleanup;
+			}
+			p += nwrite;
+			nread -= nwrite;
+		}
+	}
+	ret = 0;
+
+cleanup:
+	free(buf);
+	if(in >= 0) {
+		close(in);
+	}
+	if(out >= 0) {
+		close(out);
+	}
+	return ret;
+}
+
+/* All transfers of a segmented payload are done. Join the segments that
+ * arrived onto the tempfile, which already holds the first range, and
+ * finish the payload. If a segment is missing only because of a server
+ * error or a server that does not honor ranges, the rest of the payload is
+ * fetched as a single stream, resuming from what was joined. */
+static int payload_segments_finish(alpm_handle_t *handle, CURLM *curlm,
+		struct dload_payload *payload, int *active_downloads_num)
+{
+	alpm_list_t *i;
+	int ret = payload->result, joined = (ret == 0), write_error = 0;
+
+	for(i = payload->segments; i; i = i->next) {
+		struct dload_payload *seg = i->data;
+		if(joined && seg->result == 0) {
+			if(append_file(payload->tempfile_name, seg->tempfile_name, payload) != 0) {
+				_alpm_log(handle, ALPM_LOG_ERROR, _("could not write to file '%s': %s\n"),
+						payload->tempfile_name, strerror(errno));
+				joined = 0;
+				write_error = 1;
+			}
+		} else {
+			joined = 0;
+		}
+		if(seg->range_ignored) {
+			payload->range_ignored = 1;
+		}
+		unlink(seg->tempfile_name);
+		_alpm_dload_payload_reset(seg);
+		FREE(seg);
+	}
+	alpm_list_free(payload->segments);
+	payload->segments = NULL;
+	payload->range_end = 0;
+
+	if(!joined) {
+		if(!dload_interrupted && !write_error && (ret == 0 || payload->range_ignored)) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"%s: downloading the rest without segments\n", payload->remote_name);
+			payload->range_ignored = 0;
+			alpm_list_free(payload->servers_tried);
+			payload->servers_tried = NULL;
+			if(handle->dlcb) {
+				alpm_download_event_retry_t cb_data;
+				cb_data.resume = 1;
+				handle->dlcb(handle->dlcb_ctx, payload->remote_name, ALPM_DOWNLOAD_RETRY, &cb_data);
+			}
+			if(curl_add_payload(handle, curlm, payload) == 0) {
+				(*active_downloads_num)++;
+				return 2;
+			}
+		}
+		ret = -1;
+	}
+
+	return payload_finish(handle, payload, ret, payload->max_size - payload->segment_base);
+}
+
+/* One transfer of a segmented payload is done, finish the payload once
+ * it was the last one */
+static int payload_segment_done(alpm_handle_t *handle, CURLM *curlm,
+		struct dload_payload *payload, int ret, int *active_downloads_num)
+{
+	struct dload_payload *owner = payload->parent ? payload->parent : payload;
+
+	payload->result = ret;
+	if(--owner->pending > 0) {
+		return 2;
+	}
+	return payload_segments_finish(handle, curlm, owner, active_downloads_num);
+}
+
+/* Returns 2 if download retry happened or other transfers of the payload
+ *   are still running
  * Returns 1 if the file is up-to-date
  * Returns 0 if current payload is completed successfully
  * Returns -1 if an error happened for a required file
@@ -517,6 +1062,18 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 	_alpm_log(handle, ALPM_LOG_DEBUG, "%s: %s returned result %d from transfer\n",
 			payload->remote_name, "curl", curlerr);
 
+	server_transfer_done(handle, payload, !payload->request_errors_ok
+			&& !payload->range_ignored
+			&& (curlerr == CURLE_OK ? payload->respcode >= 400
+				: curlerr != CURLE_ABORTED_BY_CALLBACK));
+
+	if(payload->range_ignored) {
+		/* not the server's fault, the payload continues without segments */
+		_alpm_log(handle, ALPM_LOG_DEBUG, "%s: %s does not support ranges\n",
+				payload->remote_name, hostname);
+		goto cleanup;
+	}
+
 	/* was it a success? */
 	switch(curlerr) {
 		case CURLE_OK:
@@ -525,7 +1082,7 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 					payload->remote_name, payload->respcode);
 			if(payload->respcode >= 400) {
 				if(!payload->request_errors_ok) {
-					handle->pm_errno = ALPM_ERR_RETRIEVE;
+					PM_ERRNO(handle) = ALPM_ERR_RETRIEVE;
 					/* non-translated message is same as libcurl */
 					snprintf(payload->error_buffer, sizeof(payload->error_buffer),
 							"The requested URL returned error: %ld", payload->respcode);
@@ -542,6 +1099,7 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 						RET_ERR(handle, ALPM_ERR_SYSTEM, -1);
 					}
 					fseek(payload->localf, payload->initial_size, SEEK_SET);
+					payload_digest_start(payload, payload->initial_size);
 				}
 
 				if(curl_retry_next_server(curlm, curl, payload) == 0) {
@@ -554,11 +1112,22 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 			}
 			break;
 		case CURLE_ABORTED_BY_CALLBACK:
+			if(payload->stalled && !dload_interrupted) {
+				payload->stalled = 0;
+				_alpm_log(handle, ALPM_LOG_DEBUG,
+						"%s: transfer from %s is too slow, trying another server\n",
+						payload->remote_name, hostname);
+				if(curl_retry_next_server(curlm, curl, payload) == 0) {
+					(*active_downloads_num)++;
+					return 2;
+				}
+				goto cleanup;
+			}
 			/* handle the interrupt accordingly */
 			if(dload_interrupted == ABORT_OVER_MAXFILESIZE) {
 				curlerr = CURLE_FILESIZE_EXCEEDED;
 				payload->unlink_on_fail = 1;
-				handle->pm_errno = ALPM_ERR_LIBCURL;
+				PM_ERRNO(handle) = ALPM_ERR_LIBCURL;
 				_alpm_log(handle, ALPM_LOG_ERROR,
 						_("failed retrieving file '%s' from %s : expected download size exceeded\n"),
 						payload->remote_name, hostname);
@@ -566,7 +1135,7 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 			}
 			goto cleanup;
 		case CURLE_COULDNT_RESOLVE_HOST:
-			handle->pm_errno = ALPM_ERR_SERVER_BAD_URL;
+			PM_ERRNO(handle) = ALPM_ERR_SERVER_BAD_URL;
 			_alpm_log(handle, ALPM_LOG_ERROR,
 					_("failed retrieving file '%s' from %s : %s\n"),
 					payload->remote_name, hostname, payload->error_buffer);
@@ -579,7 +1148,7 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 			}
 		default:
 			if(!payload->request_errors_ok) {
-				handle->pm_errno = ALPM_ERR_LIBCURL;
+				PM_ERRNO(handle) = ALPM_ERR_LIBCURL;
 				_alpm_log(handle, ALPM_LOG_ERROR,
 						_("failed retrieving file '%s' from %s : %s\n"),
 						payload->remote_name, hostname, payload->error_buffer);
@@ -609,7 +1178,8 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
 
 	/* Let's check if client requested downloading accompanion *.sig file */
-	if(!payload->signature && payload->download_signature && curlerr == CURLE_OK && payload->respcode < 400) {
+	if(!payload->signature && payload->download_signature && !payload->signature_queued
+			&& curlerr == CURLE_OK && payload->respcode < 400) {
 		struct dload_payload *sig = NULL;
 		char *url = payload->fileurl;
 		char *_effective_filename;
@@ -666,6 +1236,7 @@ static int curl_check_finished_download(alpm_handle_t *handle, CURLM *curlm, CUR
 
 		curl_add_payload(handle, curlm, sig);
 		(*active_downloads_num)++;
+		payload->signature_queued = 1;
 	}
 
 	/* time condition was met and we didn't download anything. we need to
@@ -699,48 +1270,21 @@ cleanup:
 
 	if(payload->localf != NULL) {
 		fclose(payload->localf);
+		payload->localf = NULL;
 		utimes_long(payload->tempfile_name, remote_time);
 	}
 
-	if(ret == 0) {
-		if(payload->destfile_name) {
-			if(rename(payload->tempfile_name, payload->destfile_name)) {
-				_alpm_log(handle, ALPM_LOG_ERROR, _("could not rename %s to %s (%s)\n"),
-						payload->tempfile_name, payload->destfile_name, strerror(errno));
-				ret = -1;
-			}
-		}
-	}
-
-	if((ret == -1 || dload_interrupted) && payload->unlink_on_fail &&
-			payload->tempfile_name) {
-		unlink(payload->tempfile_name);
-	}
-
-	if(handle->dlcb) {
-		alpm_download_event_completed_t cb_data = {0};
-		cb_data.total = bytes_dl;
-		cb_data.result = ret;
-		handle->dlcb(handle->dlcb_ctx, payload->remote_name, ALPM_DOWNLOAD_COMPLETED, &cb_data);
-	}
-
 	curl_multi_remove_handle(curlm, curl);
 	curl_easy_cleanup(curl);
 	payload->curl = NULL;
 
 	FREE(payload->fileurl);
 
-	if(ret == -1 && payload->errors_ok) {
-		ret = -2;
+	if(payload->parent || payload->segments) {
+		return payload_segment_done(handle, curlm, payload, ret, active_downloads_num);
 	}
 
-	if(payload->signature) {
-		/* free signature payload memory that was allocated earlier in dload.c */
-		_alpm_dload_payload_reset(payload);
-		FREE(payload);
-	}
-
-	return ret;
+	return payload_finish(handle, payload, ret, bytes_dl);
 }
 
 /* Returns 0 in case if a new download transaction has been successfully started
@@ -752,6 +1296,7 @@ static int curl_add_payload(alpm_handle_t *handle, CURLM *curlm,
 	size_t len;
 	CURL *curl = NULL;
 	char hostname[HOSTNAME_SIZE];
+	struct stat st;
 	int ret = -1;
 
 	curl = curl_easy_init();
@@ -802,13 +1347,20 @@ static int curl_add_payload(alpm_handle_t *handle, CURLM *curlm,
 			payload->tempfile_name,
 			payload->tempfile_openmode);
 
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, payload->localf);
+	if(fstat(fileno(payload->localf), &st) == 0) {
+		payload_digest_start(payload, st.st_size);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dload_write_cb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)payload);
 	curl_multi_add_handle(curlm, curl);
+	server_transfer_start(handle, payload->fileurl);
 
-	if(handle->dlcb) {
+	if(handle->dlcb && !payload->announced && !payload->parent) {
 		alpm_download_event_init_t cb_data = {.optional = payload->errors_ok};
 		handle->dlcb(handle->dlcb_ctx, payload->remote_name, ALPM_DOWNLOAD_INIT, &cb_data);
 	}
+	payload->announced = 1;
 
 	return 0;
 
@@ -817,6 +1369,129 @@ cleanup:
 	return ret;
 }
 
+/* Returns the number of ranges a payload should be fetched in, given the
+ * number of download streams that would otherwise be left idle. Only
+ * resumable payloads that have at least the configured size left to fetch
+ * are split, at most once per usable server. */
+static int payload_segment_count(alpm_handle_t *handle, struct dload_payload *payload,
+		int idle_streams)
+{
+	struct stat st;
+	off_t have = 0;
+	alpm_list_t *i;
+	int servers = 0;
+
+	if(handle->segmented_download_size == 0 || idle_streams < 2
+			|| !payload->allow_resume || payload->fileurl
+			|| payload->cache_servers || payload->max_size == 0) {
+		return 1;
+	}
+	if(stat(payload->tempfile_name, &st) == 0) {
+		have = st.st_size;
+	}
+	if(payload->max_size - have < handle->segmented_download_size) {
+		return 1;
+	}
+	for(i = payload->servers; i && servers < idle_streams; i = i->next) {
+		if(!should_skip_server(handle, i->data)) {
+			servers++;
+		}
+	}
+	return servers > 1 ? servers : 1;
+}
+
+/* Start a payload split into the given number of byte ranges. The payload
+ * fetches the first range into its tempfile, every other range is a segment
+ * payload with a tempfile of its own; they are joined once all transfers
+ * are done. Returns the number of transfers started, -1 if the payload
+ * itself could not be started. */
+static int curl_add_segmented_payload(alpm_handle_t *handle, CURLM *curlm,
+		struct dload_payload *payload, int count)
+{
+	struct dload_payload *last = payload;
+	struct stat st;
+	off_t start = 0, len;
+	alpm_list_t *i;
+	int n, started = 1;
+
+	if(stat(payload->tempfile_name, &st) == 0) {
+		start = st.st_size;
+	}
+	len = (payload->max_size - start) / count;
+	payload->segment_base = start;
+	payload->range_start = 0;
+	payload->range_end = start + len;
+
+	for(n = 1; n < count; n++) {
+		struct dload_payload *seg;
+		size_t namelen = strlen(payload->tempfile_name) + 12;
+
+		CALLOC(seg, 1, sizeof(*seg), goto segments_done);
+		seg->handle = handle;
+		seg->parent = payload;
+		seg->servers = payload->servers;
+		seg->errors_ok = payload->errors_ok;
+		seg->allow_resume = 1;
+		seg->unlink_on_fail = 1;
+		seg->range_start = start + n * len;
+		seg->range_end = start + (n + 1) * len;
+		seg->max_size = len;
+		STRDUP(seg->remote_name, payload->remote_name, goto segment_error);
+		STRDUP(seg->filepath, payload->filepath, goto segment_error);
+		MALLOC(seg->tempfile_name, namelen, goto segment_error);
+		snprintf(seg->tempfile_name, namelen, "%s.%d", payload->tempfile_name, n);
+		if(alpm_list_append(&payload->segments, seg) == NULL) {
+			goto segment_error;
+		}
+		/* left behind by an interrupted run, with an unknown range */
+		unlink(seg->tempfile_name);
+		last = seg;
+		continue;
+
+segment_error:
+		_alpm_dload_payload_reset(seg);
+		FREE(seg);
+		break;
+	}
+
+segments_done:
+	/* whatever range ends last covers the rest of the file */
+	last->range_end = payload->max_size;
+	if(last != payload) {
+		last->max_size = last->range_end - last->range_start;
+	} else {
+		payload->range_end = 0;
+	}
+
+	if(curl_add_payload(handle, curlm, payload) != 0) {
+		for(i = payload->segments; i; i = i->next) {
+			_alpm_dload_payload_reset(i->data);
+			free(i->data);
+		}
+		alpm_list_free(payload->segments);
+		payload->segments = NULL;
+		payload->range_end = 0;
+		return -1;
+	}
+
+	payload->pending = 1;
+	for(i = payload->segments; i; i = i->next) {
+		struct dload_payload *seg = i->data;
+		if(curl_add_payload(handle, curlm, seg) == 0) {
+			payload->pending++;
+			started++;
+		} else {
+			seg->result = -1;
+		}
+	}
+
+	if(payload->segments) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "%s: downloading in %d segments\n",
+				payload->remote_name, started);
+	}
+	return started;
+}
+
 /*
  * Use to sort payloads by max size in decending order (largest -> smallest)
  */
@@ -827,7 +1502,7 @@ static int compare_dload_payload_sizes(const void *left_ptr, const void *right_p
 	left = (struct dload_payload *) left_ptr;
 	right = (struct dload_payload *) right_ptr;
 
-	return right->max_size - left->max_size;
+	return (right->max_size > left->max_size) - (right->max_size < left->max_size);
 }
 
 /* Returns -1 if an error happened for a required file
@@ -843,18 +1518,46 @@ static int curl_download_internal(alpm_handle_t *handle,
 	int updated = 0; /* was a file actually updated */
 	CURLM *curlm = handle->curlm;
 	size_t payloads_size = alpm_list_count(payloads);
+	size_t queued = payloads_size;
+	alpm_list_t *sorted = NULL;
+
+	curl_multi_setopt(curlm, CURLMOPT_MAX_HOST_CONNECTIONS,
+			(long)handle->max_host_connections);
+	if(handle->max_host_connections) {
+		/* let downloads from the same host share an HTTP/2 connection */
+		curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	}
 
-	/* Sort payloads by package size */
-	payloads = alpm_list_msort(payloads, payloads_size, &compare_dload_payload_sizes);
+	/* Sort payloads by package size, unless they are to be started in the
+	 * order they were given in. The caller's list is left as it is. */
+	if(handle->download_order == ALPM_DOWNLOAD_ORDER_SIZE && payloads_size > 1) {
+		sorted = alpm_list_copy(payloads);
+		if(sorted == NULL) {
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1);
+		}
+		payloads = sorted = alpm_list_msort(sorted, payloads_size, &compare_dload_payload_sizes);
+	}
 
 	while(active_downloads_num > 0 || payloads) {
 		CURLMcode mc;
 
 		for(; active_downloads_num < max_streams && payloads; active_downloads_num++) {
 			struct dload_payload *payload = payloads->data;
+			/* streams no queued payload is going to use */
+			int idle = max_streams - active_downloads_num - (int)(queued - 1);
+			int segments = payload_segment_count(handle, payload, idle);
+			int started;
 
-			if(curl_add_payload(handle, curlm, payload) == 0) {
+			if(segments > 1) {
+				started = curl_add_segmented_payload(handle, curlm, payload, segments);
+			} else {
+				started = curl_add_payload(handle, curlm, payload) == 0 ? 1 : -1;
+			}
+
+			if(started > 0) {
 				payloads = payloads->next;
+				queued--;
+				active_downloads_num += started - 1;
 			} else {
 				/* The payload failed to start. Do not start any new downloads.
 				 * Wait until all active downloads complete.
@@ -900,17 +1603,21 @@ static int curl_download_internal(alpm_handle_t *handle,
 		}
 	}
 
+	alpm_list_free(sorted);
+	server_stats_report(handle);
+
 	int ret = err ? -1 : updated ? 0 : 1;
 	_alpm_log(handle, ALPM_LOG_DEBUG, "curl_download_internal return code is %d\n", ret);
 	return ret;
 }
 
-/* Download the requested files by launching a process inside a sandbox.
+/* Download the requested files by launching a process inside a sandbox
+ * just for them. Used for payloads the download worker cannot take.
  * Returns -1 if an error happened for a required file
  * Returns 0 if a payload was actually downloaded
  * Returns 1 if no files were downloaded and all errors were non-fatal
  */
-static int curl_download_internal_sandboxed(alpm_handle_t *handle,
+static int curl_download_internal_forked(alpm_handle_t *handle,
 		alpm_list_t *payloads /* struct dload_payload */,
 		const char *localpath)
 {
@@ -943,6 +1650,7 @@ static int curl_download_internal_sandboxed(alpm_handle_t *handle,
 		close(callbacks_fd[0]);
 		fcntl(callbacks_fd[1], F_SETFD, FD_CLOEXEC);
 		callbacks_ctx.callback_pipe = callbacks_fd[1];
+		sandbox_callbacks = &callbacks_ctx;
 		alpm_option_set_logcb(handle, _alpm_sandbox_cb_log, &callbacks_ctx);
 		alpm_option_set_dlcb(handle, _alpm_sandbox_cb_dl, &callbacks_ctx);
 		alpm_option_set_fetchcb(handle, NULL, NULL);
@@ -956,7 +1664,7 @@ static int curl_download_internal_sandboxed(alpm_handle_t *handle,
 		/* cwd to the download directory */
 		ret = chdir(localpath);
 		if(ret != 0) {
-			handle->pm_errno = ALPM_ERR_NOT_A_DIR;
+			PM_ERRNO(handle) = ALPM_ERR_NOT_A_DIR;
 			_alpm_log(handle, ALPM_LOG_ERROR, _("could not chdir to download directory %s\n"), localpath);
 			ret = -1;
 		} else {
@@ -1028,11 +1736,11 @@ static int curl_download_internal_sandboxed(alpm_handle_t *handle,
 				if(ret != 0) {
 					if(ret == 2) {
 						/* an error happened for a required file, or unexpected exit status */
-						handle->pm_errno = ALPM_ERR_RETRIEVE;
+						PM_ERRNO(handle) = ALPM_ERR_RETRIEVE;
 						ret = -1;
 					}
 					else {
-						handle->pm_errno = ALPM_ERR_RETRIEVE;
+						PM_ERRNO(handle) = ALPM_ERR_RETRIEVE;
 						ret = 1;
 					}
 				}
@@ -1057,6 +1765,255 @@ static int curl_download_internal_sandboxed(alpm_handle_t *handle,
 	return ret;
 }
 
+/* A sandboxed process that is kept for the lifetime of the handle and runs
+ * the downloads of every _alpm_download() call, so that the process, the
+ * switch to the sandbox user and the connections and server statistics of
+ * libcurl are not set up again for each batch of downloads. As the worker
+ * is still running while downloaded files are verified and used, these are
+ * first copied out of its reach by finalize_download_location(). */
+struct dload_worker {
+	pid_t pid;
+	int fd; /* socket batches are sent and callbacks received on */
+	char *user; /* sandbox user the worker runs as */
+};
+
+/* Main loop of the download worker, never returns. Batches of downloads are
+ * read from fd and run one at a time, each reported back with a done
+ * callback. The worker exits once the parent closes its end of the socket. */
+static void dload_worker_run(alpm_handle_t *handle, int fd)
+{
+	_alpm_sandbox_callback_context callbacks_ctx;
+	struct sigaction sa;
+
+	callbacks_ctx.callback_pipe = fd;
+	sandbox_callbacks = &callbacks_ctx;
+	alpm_option_set_logcb(handle, _alpm_sandbox_cb_log, &callbacks_ctx);
+	alpm_option_set_dlcb(handle, _alpm_sandbox_cb_dl, &callbacks_ctx);
+	alpm_option_set_fetchcb(handle, NULL, NULL);
+	alpm_option_set_eventcb(handle, NULL, NULL);
+	alpm_option_set_questioncb(handle, NULL, NULL);
+	alpm_option_set_progresscb(handle, NULL, NULL);
+
+	_alpm_reset_signals();
+	/* another thread may have held the lock when the worker was forked */
+	_alpm_log_lock_init(handle);
+
+	if(alpm_sandbox_setup_child(handle->sandboxuser) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("switching to sandbox user '%s' failed!\n"), handle->sandboxuser);
+		_Exit(2);
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+
+	while(true) {
+		_alpm_sandbox_batch batch;
+		int ret;
+
+		/* an interrupt between batches is for the parent to handle, it
+		 * closes the socket on its way out */
+		sa.sa_handler = SIG_IGN;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGQUIT, &sa, NULL);
+
+		if(!_alpm_sandbox_recv_batch(handle, fd, &batch)) {
+			_Exit(0);
+		}
+
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGQUIT, &sa, NULL);
+
+		/* cwd to the download directory */
+		if(chdir(batch.localpath) != 0) {
+			PM_ERRNO(handle) = ALPM_ERR_NOT_A_DIR;
+			_alpm_log(handle, ALPM_LOG_ERROR, _("could not chdir to download directory %s\n"), batch.localpath);
+			ret = -1;
+		} else {
+			ret = curl_download_internal(handle, batch.payloads);
+		}
+
+		_alpm_sandbox_batch_free(&batch);
+		_alpm_sandbox_cb_done(&callbacks_ctx, ret);
+	}
+}
+
+static struct dload_worker *dload_worker_start(alpm_handle_t *handle)
+{
+	struct dload_worker *worker;
+	int fds[2];
+
+	CALLOC(worker, 1, sizeof(*worker), RET_ERR(handle, ALPM_ERR_MEMORY, NULL));
+	STRDUP(worker->user, handle->sandboxuser, FREE(worker); RET_ERR(handle, ALPM_ERR_MEMORY, NULL));
+
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "could not create download worker socket: %s\n",
+				strerror(errno));
+		goto error;
+	}
+
+	worker->pid = fork();
+	if(worker->pid == -1) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "could not fork download worker: %s\n",
+				strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		goto error;
+	}
+
+	if(worker->pid == 0) {
+		close(fds[0]);
+		dload_worker_run(handle, fds[1]);
+	}
+
+	close(fds[1]);
+	worker->fd = fds[0];
+	_alpm_log(handle, ALPM_LOG_DEBUG, "started download worker %ld as user %s\n",
+			(long)worker->pid, worker->user);
+	return worker;
+
+error:
+	FREE(worker->user);
+	FREE(worker);
+	RET_ERR(handle, ALPM_ERR_RETRIEVE, NULL);
+}
+
+/* Kill a worker that died or can no longer be trusted to be in step with
+ * us and wait for it. */
+static void dload_worker_kill(alpm_handle_t *handle)
+{
+	kill(handle->dload_worker->pid, SIGTERM);
+	_alpm_dload_worker_stop(handle);
+}
+
+/* Hand a batch to the download worker, starting one if there is none for
+ * the current sandbox user yet. A worker that went away in between is
+ * replaced once. */
+static struct dload_worker *dload_worker_send(alpm_handle_t *handle,
+		alpm_list_t *payloads, const char *localpath)
+{
+	int attempt;
+
+	if(handle->dload_worker && strcmp(handle->dload_worker->user, handle->sandboxuser) != 0) {
+		_alpm_dload_worker_stop(handle);
+	}
+
+	for(attempt = 0; attempt < 2; attempt++) {
+		if(handle->dload_worker == NULL) {
+			handle->dload_worker = dload_worker_start(handle);
+			if(handle->dload_worker == NULL) {
+				return NULL;
+			}
+		}
+		if(_alpm_sandbox_send_batch(handle, handle->dload_worker->fd, payloads, localpath)) {
+			return handle->dload_worker;
+		}
+		_alpm_log(handle, ALPM_LOG_DEBUG, "download worker %ld went away\n",
+				(long)handle->dload_worker->pid);
+		dload_worker_kill(handle);
+	}
+
+	RET_ERR(handle, ALPM_ERR_RETRIEVE, NULL);
+}
+
+/* Download the requested files in the sandboxed download worker.
+ * Returns -1 if an error happened for a required file
+ * Returns 0 if a payload was actually downloaded
+ * Returns 1 if no files were downloaded and all errors were non-fatal
+ */
+static int curl_download_internal_sandboxed(alpm_handle_t *handle,
+		alpm_list_t *payloads /* struct dload_payload */,
+		const char *localpath)
+{
+	struct dload_worker *worker;
+	struct sigaction sa_ign, oldint, oldquit;
+	bool had_error = false;
+	alpm_list_t *i;
+	int ret = -1;
+
+	for(i = payloads; i; i = i->next) {
+		struct dload_payload *payload = i->data;
+		if(payload->localf) {
+			/* an open file cannot be handed over to the worker */
+			return curl_download_internal_forked(handle, payloads, localpath);
+		}
+	}
+
+	worker = dload_worker_send(handle, payloads, localpath);
+	if(worker == NULL) {
+		return -1;
+	}
+
+	sigemptyset(&sa_ign.sa_mask);
+	sa_ign.sa_handler = SIG_IGN;
+	sa_ign.sa_flags = 0;
+	sigaction(SIGINT, &sa_ign, &oldint);
+	sigaction(SIGQUIT, &sa_ign, &oldquit);
+
+	while(true) {
+		_alpm_sandbox_callback_t callback_type;
+		ssize_t got = read(worker->fd, &callback_type, sizeof(callback_type));
+		if(got < 0 || (size_t)got != sizeof(callback_type)) {
+			had_error = true;
+			break;
+		}
+
+		if(callback_type == ALPM_SANDBOX_CB_DOWNLOAD) {
+			if(!_alpm_sandbox_process_cb_download(handle, worker->fd)) {
+				had_error = true;
+				break;
+			}
+		}
+		else if(callback_type == ALPM_SANDBOX_CB_LOG) {
+			if(!_alpm_sandbox_process_cb_log(handle, worker->fd)) {
+				had_error = true;
+				break;
+			}
+		}
+		else if(callback_type == ALPM_SANDBOX_CB_DONE) {
+			if(!_alpm_sandbox_process_cb_done(worker->fd, &ret)) {
+				had_error = true;
+			}
+			break;
+		}
+		else {
+			had_error = true;
+			break;
+		}
+	}
+
+	sigaction(SIGINT, &oldint, NULL);
+	sigaction(SIGQUIT, &oldquit, NULL);
+
+	if(had_error) {
+		dload_worker_kill(handle);
+		PM_ERRNO(handle) = ALPM_ERR_RETRIEVE;
+		return -1;
+	}
+
+	if(ret != 0) {
+		PM_ERRNO(handle) = ALPM_ERR_RETRIEVE;
+		ret = ret == 1 ? 1 : -1;
+	}
+	return ret;
+}
+
+void _alpm_dload_worker_stop(alpm_handle_t *handle)
+{
+	struct dload_worker *worker = handle->dload_worker;
+
+	if(worker == NULL) {
+		return;
+	}
+
+	/* the worker exits once it reads the end of the socket */
+	close(worker->fd);
+	while(waitpid(worker->pid, NULL, 0) == -1 && errno == EINTR);
+	FREE(worker->user);
+	FREE(worker);
+	handle->dload_worker = NULL;
+}
+
 #endif
 
 static int payload_download_fetchcb(struct dload_payload *payload,
@@ -1076,22 +2033,193 @@ static int payload_download_fetchcb(struct dload_payload *payload,
 	return ret;
 }
 
-static int move_file(const char *filepath, const char *directory)
+/* Copy a file written by the download user into a new root-owned file at
+ * dest. The sandboxed download worker lives on after a batch and may still
+ * hold the file it wrote open, so only the copy may be verified and used.
+ * The copy is made next to dest, where the download user cannot write. If
+ * digest is given, the data is added to it on the way and the copy is
+ * described in copied. */
+static int copy_download_file(const char *filepath, const char *dest,
+		alpm_digest_t *digest, struct stat *copied)
+{
+	char *tmpname = NULL, *buf = NULL;
+	int in, out = -1, ret = -1;
+	ssize_t nread;
+	struct stat st;
+	size_t len;
+
+	OPEN(in, filepath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if(in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+		goto cleanup;
+	}
+	if(st.st_size == 0) {
+		unlink(filepath);
+		ret = 1;
+		goto cleanup;
+	}
+
+	len = strlen(dest) + 8;
+	MALLOC(tmpname, len, goto cleanup);
+	snprintf(tmpname, len, "%s.XXXXXX", dest);
+	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, goto cleanup);
+	out = mkstemp(tmpname);
+	if(out < 0) {
+		FREE(tmpname);
+		goto cleanup;
+	}
+
+	while((nread = read(in, buf, ALPM_BUFFER_SIZE)) != 0) {
+		ssize_t nwrite, off = 0;
+		if(nread < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			goto cleanup;
+		}
+		if(digest) {
+			_alpm_digest_update(digest, buf, nread);
+		}
+		while(off < nread) {
+			nwrite = write(out, buf + off, nread - off);
+			if(nwrite < 0 && errno != EINTR) {
+				goto cleanup;
+			} else if(nwrite > 0) {
+				off += nwrite;
+			}
+		}
+	}
+
+	if(fchmod(out, ~(_getumask()) & 0666) != 0
+			|| (digest && fstat(out, copied) != 0)) {
+		goto cleanup;
+	}
+	ret = close(out);
+	out = -1;
+	if(ret != 0 || rename(tmpname, dest) != 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	FREE(tmpname);
+	unlink(filepath);
+	ret = 0;
+
+cleanup:
+	if(out >= 0) {
+		close(out);
+	}
+	if(tmpname) {
+		unlink(tmpname);
+		free(tmpname);
+	}
+	if(in >= 0) {
+		close(in);
+	}
+	free(buf);
+	return ret;
+}
+
+/* Make the digest of a payload describe its file at path, once it is in
+ * place: chown(), chmod() and rename() all change the ctime of the file.
+ * A digest computed while the file was copied to path is taken from ctx,
+ * with copied describing the copy. The digest is dropped if path is not
+ * the file that was hashed. */
+static void payload_digest_settle(struct dload_payload *payload, const char *path,
+		alpm_digest_t *ctx, const struct stat *copied)
+{
+	struct dload_digest *digest = payload->digest;
+	struct stat st;
+
+	if(ctx) {
+		char *hex = _alpm_digest_final(ctx);
+		FREE(payload->digest);
+		if(hex && stat(path, &st) == 0
+				&& st.st_dev == copied->st_dev && st.st_ino == copied->st_ino) {
+			payload->digest = dload_digest_new(payload->digest_type, hex, &st);
+		}
+		free(hex);
+		return;
+	}
+	if(digest == NULL) {
+		return;
+	}
+	if(stat(path, &st) == 0 && st.st_dev == digest->dev && st.st_ino == digest->ino
+			&& st.st_size == digest->size
+			&& st.st_mtim.tv_sec == digest->mtim.tv_sec
+			&& st.st_mtim.tv_nsec == digest->mtim.tv_nsec) {
+		digest->ctim = st.st_ctim;
+	} else {
+		FREE(payload->digest);
+	}
+}
+
+/* Move a downloaded file into directory. For the file of a payload itself
+ * the payload is given, and its digest follows the file. */
+static int move_file(const char *filepath, const char *directory, int copy,
+		struct dload_payload *payload)
 {
 	ASSERT(filepath != NULL, return -1);
 	ASSERT(directory != NULL, return -1);
-	int ret = finalize_download_file(filepath);
-	if(ret != 0) {
-		return ret;
-	}
 	const char *filename = mbasename(filepath);
 	char *dest = _alpm_get_fullpath(directory, filename, "");
-	if(rename(filepath, dest)) {
-		FREE(dest);
-		return -1;
+	alpm_digest_t *ctx = NULL;
+	struct stat copied;
+	int ret;
+	if(copy) {
+		/* the parent never saw the download, so the copy is hashed */
+		if(payload && payload->digest_type) {
+			ctx = _alpm_digest_new(payload->digest_type);
+		}
+		ret = copy_download_file(filepath, dest, ctx, &copied);
+	} else {
+		ret = finalize_download_file(filepath);
+		if(ret == 0 && rename(filepath, dest)) {
+			ret = -1;
+		}
+	}
+	if(payload && ret == 0) {
+		payload_digest_settle(payload, dest, ctx, &copied);
+	} else {
+		_alpm_digest_free(ctx);
+		if(payload) {
+			FREE(payload->digest);
+		}
 	}
 	FREE(dest);
-	return 0;
+	return ret;
+}
+
+static int finalize_download_location(struct dload_payload *payload,
+		const char *localpath)
+{
+	int returnvalue = 0;
+	/* files written as the download user are not trusted as they are */
+	int copy = payload->handle->sandboxuser != NULL;
+
+	if(payload->finalized) {
+		return 0;
+	}
+	if(payload->tempfile_name) {
+		move_file(payload->tempfile_name, localpath, copy, NULL);
+	}
+	if(payload->destfile_name) {
+		int ret = move_file(payload->destfile_name, localpath, copy, payload);
+
+		if(ret == -1) {
+			returnvalue = -1;
+		}
+
+		if (payload->download_signature) {
+			const char sig_suffix[] = ".sig";
+			char *sig_filename = NULL;
+			size_t sig_filename_len = strlen(payload->destfile_name) + sizeof(sig_suffix);
+			MALLOC(sig_filename, sig_filename_len, return returnvalue);
+			snprintf(sig_filename, sig_filename_len, "%s%s", payload->destfile_name, sig_suffix);
+			move_file(sig_filename, localpath, copy, NULL);
+			FREE(sig_filename);
+		}
+	}
+	payload->finalized = (returnvalue == 0);
+	return returnvalue;
 }
 
 static int finalize_download_locations(alpm_list_t *payloads, const char *localpath)
@@ -1101,29 +2229,90 @@ static int finalize_download_locations(alpm_list_t *payloads, const char *localp
 	alpm_list_t *p;
 	int returnvalue = 0;
 	for(p = payloads; p; p = p->next) {
-		struct dload_payload *payload = p->data;
-		if(payload->tempfile_name) {
-			move_file(payload->tempfile_name, localpath);
+		if(finalize_download_location(p->data, localpath) == -1) {
+			returnvalue = -1;
 		}
-		if(payload->destfile_name) {
-			int ret = move_file(payload->destfile_name, localpath);
+	}
+	return returnvalue;
+}
 
-			if(ret == -1) {
-				returnvalue = -1;
-			}
+/* State for reporting the completion of single payloads while the others
+ * are still downloading. */
+struct dload_done_ctx {
+	alpm_list_t *payloads;
+	const char *localpath;
+	alpm_cb_download dlcb;
+	void *dlcb_ctx;
+};
+
+/* Moves a completed payload into place and hands it to its done_cb. */
+static void payload_done(struct dload_done_ctx *ctx, struct dload_payload *payload,
+		int result)
+{
+	if(payload->done_cb == NULL || payload->done) {
+		return;
+	}
+	payload->done = 1;
+	if(result >= 0 && finalize_download_location(payload, ctx->localpath) != 0) {
+		result = -1;
+	}
+	payload->done_cb(payload->done_ctx, payload, result);
+}
+
+/* Downloads report their completion through the download callback, also
+ * when they run in a sandboxed process, so completions are picked up there.
+ * The callback is identified by the remote name of the file or of its
+ * signature. A payload is done once both have completed, or as soon as the
+ * file itself failed. */
+static void dload_done_dlcb(void *cb_ctx, const char *filename,
+		alpm_download_event_type_t event, void *data)
+{
+	struct dload_done_ctx *ctx = cb_ctx;
+	alpm_list_t *p;
+
+	if(ctx->dlcb) {
+		ctx->dlcb(ctx->dlcb_ctx, filename, event, data);
+	}
+	if(event != ALPM_DOWNLOAD_COMPLETED) {
+		return;
+	}
+
+	for(p = ctx->payloads; p; p = p->next) {
+		struct dload_payload *payload = p->data;
+		alpm_download_event_completed_t *completed = data;
+		size_t len;
+
+		if(payload->done_cb == NULL || payload->done || !payload->remote_name) {
+			continue;
+		}
+		len = strlen(payload->remote_name);
+		if(strncmp(filename, payload->remote_name, len) != 0) {
+			continue;
+		}
+		if(filename[len] == '\0') {
+			payload->file_done = 1;
+			payload->file_result = completed->result;
+		} else if(strcmp(filename + len, ".sig") == 0) {
+			payload->sig_done = 1;
+			payload->sig_result = completed->result;
+		} else {
+			continue;
+		}
 
-			if (payload->download_signature) {
-				const char sig_suffix[] = ".sig";
-				char *sig_filename = NULL;
-				size_t sig_filename_len = strlen(payload->destfile_name) + sizeof(sig_suffix);
-				MALLOC(sig_filename, sig_filename_len, continue);
-				snprintf(sig_filename, sig_filename_len, "%s%s", payload->destfile_name, sig_suffix);
-				move_file(sig_filename, localpath);
-				FREE(sig_filename);
+		if(!payload->file_done) {
+			return;
+		}
+		if(payload->file_result < 0 || !payload->download_signature) {
+			payload_done(ctx, payload, payload->file_result);
+		} else if(payload->sig_done) {
+			int result = payload->file_result;
+			if(payload->sig_result < 0 && !payload->signature_optional) {
+				result = -1;
 			}
+			payload_done(ctx, payload, result);
 		}
+		return;
 	}
-	return returnvalue;
 }
 
 static void prepare_resumable_downloads(alpm_list_t *payloads, const char *localpath,
@@ -1159,7 +2348,91 @@ static void prepare_resumable_downloads(alpm_list_t *payloads, const char *local
 	}
 }
 
-/* Returns -1 if an error happened for a required file
+/* Download the requested files through the front end's fetch callback.
+ * Returns -1 if an error happened for a required file
+ * Returns 0 if a payload was actually downloaded
+ * Returns 1 if no files were downloaded and all errors were non-fatal
+ */
+static int fetchcb_download_internal(alpm_handle_t *handle,
+		alpm_list_t *payloads /* struct dload_payload */,
+		const char *temporary_localpath, struct dload_done_ctx *done_ctx)
+{
+	alpm_list_t *p;
+	int ret, updated = 0;
+
+	for(p = payloads; p; p = p->next) {
+		struct dload_payload *payload = p->data;
+		alpm_list_t *s;
+		ret = -1;
+
+		if(payload->fileurl) {
+			ret = handle->fetchcb(handle->fetchcb_ctx, payload->fileurl, temporary_localpath, payload->force);
+			if (ret != -1 && payload->download_signature) {
+				/* Download signature if requested */
+				char *sig_fileurl;
+				size_t sig_len = strlen(payload->fileurl) + 5;
+				int retsig = -1;
+
+				MALLOC(sig_fileurl, sig_len, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+				snprintf(sig_fileurl, sig_len, "%s.sig", payload->fileurl);
+
+				retsig = handle->fetchcb(handle->fetchcb_ctx, sig_fileurl, temporary_localpath,  payload->force);
+				free(sig_fileurl);
+
+				if(!payload->signature_optional) {
+					ret = retsig;
+				}
+			}
+		} else {
+			for(s = payload->cache_servers; s; s = s->next) {
+				ret = payload_download_fetchcb(payload, s->data, temporary_localpath);
+				if (ret != -1) {
+					goto download_signature;
+				}
+			}
+			for(s = payload->servers; s; s = s->next) {
+				ret = payload_download_fetchcb(payload, s->data, temporary_localpath);
+				if (ret != -1) {
+					goto download_signature;
+				}
+			}
+
+download_signature:
+			if (ret != -1 && payload->download_signature) {
+				/* Download signature if requested */
+				char *sig_fileurl;
+				size_t sig_len = strlen(s->data) + strlen(payload->filepath) + 6;
+				int retsig = -1;
+
+				MALLOC(sig_fileurl, sig_len, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+				snprintf(sig_fileurl, sig_len, "%s/%s.sig", (const char *)(s->data), payload->filepath);
+
+				retsig = handle->fetchcb(handle->fetchcb_ctx, sig_fileurl, temporary_localpath, payload->force);
+				free(sig_fileurl);
+
+				if(!payload->signature_optional) {
+					ret = retsig;
+				}
+			}
+		}
+
+		payload_done(done_ctx, payload, ret);
+
+		if(ret == -1 && !payload->errors_ok) {
+			RET_ERR(handle, ALPM_ERR_EXTERNAL_DOWNLOAD, -1);
+		} else if(ret == 0) {
+			updated = 1;
+		}
+	}
+	return updated ? 0 : 1;
+}
+
+/* Payloads with a done_cb are reported one by one as they and their
+ * signatures arrive in localpath, while the remaining downloads continue.
+ * Every such payload is reported exactly once, also when downloading it
+ * failed, before this returns.
+ *
+ * Returns -1 if an error happened for a required file
  * Returns 0 if a payload was actually downloaded
  * Returns 1 if no files were downloaded and all errors were non-fatal
  */
@@ -1169,8 +2442,25 @@ int _alpm_download(alpm_handle_t *handle,
 		const char *temporary_localpath)
 {
 	int ret;
+	alpm_list_t *p;
+	struct dload_done_ctx done_ctx = {
+		.payloads = payloads,
+		.localpath = localpath,
+		.dlcb = handle->dlcb,
+		.dlcb_ctx = handle->dlcb_ctx,
+	};
+
 	prepare_resumable_downloads(payloads, localpath, handle->sandboxuser);
 
+	for(p = payloads; p; p = p->next) {
+		struct dload_payload *payload = p->data;
+		if(payload->done_cb) {
+			handle->dlcb = dload_done_dlcb;
+			handle->dlcb_ctx = &done_ctx;
+			break;
+		}
+	}
+
 	if(handle->fetchcb == NULL) {
 #ifdef HAVE_LIBCURL
 		if(handle->sandboxuser) {
@@ -1179,78 +2469,30 @@ int _alpm_download(alpm_handle_t *handle,
 			ret = curl_download_internal(handle, payloads);
 		}
 #else
-		RET_ERR(handle, ALPM_ERR_EXTERNAL_DOWNLOAD, -1);
+		PM_ERRNO(handle) = ALPM_ERR_EXTERNAL_DOWNLOAD;
+		ret = -1;
 #endif
 	} else {
-		alpm_list_t *p;
-		int updated = 0;
-		for(p = payloads; p; p = p->next) {
-			struct dload_payload *payload = p->data;
-			alpm_list_t *s;
-			ret = -1;
-
-			if(payload->fileurl) {
-				ret = handle->fetchcb(handle->fetchcb_ctx, payload->fileurl, temporary_localpath, payload->force);
-				if (ret != -1 && payload->download_signature) {
-					/* Download signature if requested */
-					char *sig_fileurl;
-					size_t sig_len = strlen(payload->fileurl) + 5;
-					int retsig = -1;
-
-					MALLOC(sig_fileurl, sig_len, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
-					snprintf(sig_fileurl, sig_len, "%s.sig", payload->fileurl);
-
-					retsig = handle->fetchcb(handle->fetchcb_ctx, sig_fileurl, temporary_localpath,  payload->force);
-					free(sig_fileurl);
-
-					if(!payload->signature_optional) {
-						ret = retsig;
-					}
-				}
-			} else {
-				for(s = payload->cache_servers; s; s = s->next) {
-					ret = payload_download_fetchcb(payload, s->data, temporary_localpath);
-					if (ret != -1) {
-						goto download_signature;
-					}
-				}
-				for(s = payload->servers; s; s = s->next) {
-					ret = payload_download_fetchcb(payload, s->data, temporary_localpath);
-					if (ret != -1) {
-						goto download_signature;
-					}
-				}
-
-download_signature:
-				if (ret != -1 && payload->download_signature) {
-					/* Download signature if requested */
-					char *sig_fileurl;
-					size_t sig_len = strlen(s->data) + strlen(payload->filepath) + 6;
-					int retsig = -1;
-
-					MALLOC(sig_fileurl, sig_len, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
-					snprintf(sig_fileurl, sig_len, "%s/%s.sig", (const char *)(s->data), payload->filepath);
-
-					retsig = handle->fetchcb(handle->fetchcb_ctx, sig_fileurl, temporary_localpath, payload->force);
-					free(sig_fileurl);
+		ret = fetchcb_download_internal(handle, payloads, temporary_localpath, &done_ctx);
+	}
 
-					if(!payload->signature_optional) {
-						ret = retsig;
-					}
-				}
-			}
+	if(finalize_download_locations(payloads, localpath) != 0) {
+		ret = -1;
+	}
 
-			if(ret == -1 && !payload->errors_ok) {
-				RET_ERR(handle, ALPM_ERR_EXTERNAL_DOWNLOAD, -1);
-			} else if(ret == 0) {
-				updated = 1;
+	if(handle->dlcb == dload_done_dlcb) {
+		handle->dlcb = done_ctx.dlcb;
+		handle->dlcb_ctx = done_ctx.dlcb_ctx;
+		/* anything not reported yet did not arrive in full */
+		for(p = payloads; p; p = p->next) {
+			struct dload_payload *payload = p->data;
+			int result = payload->file_done ? payload->file_result : -1;
+			if(payload->download_signature && !payload->signature_optional
+					&& (!payload->sig_done || payload->sig_result < 0)) {
+				result = -1;
 			}
+			payload_done(&done_ctx, payload, result);
 		}
-		ret = updated ? 0 : 1;
-	}
-
-	if (finalize_download_locations(payloads, localpath) != 0) {
-		return -1;
 	}
 	return ret;
 }
@@ -1393,6 +2635,11 @@ void _alpm_dload_payload_reset(struct dload_payload *payload)
 {
 	ASSERT(payload, return);
 
+#ifdef HAVE_LIBCURL
+	alpm_list_free(payload->servers_tried);
+	_alpm_digest_free(payload->digest_ctx);
+#endif
+	FREE(payload->digest);
 	FREE(payload->remote_name);
 	FREE(payload->tempfile_name);
 	FREE(payload->destfile_name);
@@ -1400,3 +2647,21 @@ void _alpm_dload_payload_reset(struct dload_payload *payload)
 	FREE(payload->filepath);
 	*payload = (struct dload_payload){0};
 }
+
+/* Whether a digest taken while downloading applies to the file at path,
+ * i.e. the file was not replaced or changed since. */
+int _alpm_dload_digest_matches(const struct dload_digest *digest,
+		const char *path, alpm_pkgvalidation_t type)
+{
+	struct stat st;
+
+	if(digest == NULL || digest->type != type || stat(path, &st) != 0) {
+		return 0;
+	}
+	return st.st_dev == digest->dev && st.st_ino == digest->ino
+		&& st.st_size == digest->size
+		&& st.st_mtim.tv_sec == digest->mtim.tv_sec
+		&& st.st_mtim.tv_nsec == digest->mtim.tv_nsec
+		&& st.st_ctim.tv_sec == digest->ctim.tv_sec
+		&& st.st_ctim.tv_nsec == digest->ctim.tv_nsec;
+}
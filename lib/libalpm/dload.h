@@ -20,8 +20,25 @@
 #ifndef ALPM_DLOAD_H
 #define ALPM_DLOAD_H
 
+#include <sys/types.h>
+
 #include "alpm_list.h"
 #include "alpm.h"
+#include "util.h"
+
+/* Digest of a file, computed while it was downloaded, and what the file
+ * looked like once it was in place. Only files the process itself wrote
+ * carry one: a sandboxed download is hashed while it is copied out of the
+ * sandbox's reach, as the sandbox could report anything. */
+struct dload_digest {
+	alpm_pkgvalidation_t type;
+	char hex[65];
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtim;
+	struct timespec ctim;
+};
 
 struct dload_payload {
 	alpm_handle_t *handle;
@@ -51,20 +68,57 @@ struct dload_payload {
 	int unlink_on_fail;
 	int download_signature; /* specifies if an accompanion *.sig file need to be downloaded*/
 	int signature_optional; /* *.sig file is optional */
+	/* if set, called as soon as the file, and its signature if one was
+	 * requested, are in the download directory, see _alpm_download() */
+	void (*done_cb)(void *ctx, struct dload_payload *payload, int result);
+	void *done_ctx;
+	int done; /* done_cb was called */
+	int finalized; /* the file was moved to the download directory */
+	int file_done, file_result; /* outcome of the file download */
+	int sig_done, sig_result; /* outcome of the signature download */
+	/* digest to compute while the file is written, 0 for none. If the whole
+	 * file passed through the download, the result is left in 'digest'. */
+	alpm_pkgvalidation_t digest_type;
+	struct dload_digest *digest;
 #ifdef HAVE_LIBCURL
 	CURL *curl;
 	char error_buffer[CURL_ERROR_SIZE];
 	int signature; /* specifies if this payload is for a signature file */
 	int request_errors_ok; /* per-request errors-ok */
+	alpm_list_t *servers_tried; /* entries of servers already used */
+	double stall_checked; /* transfer time of the last stall check */
+	int stalled; /* transfer was abandoned for a faster server */
+	int announced; /* the front end was told about this download */
+	int signature_queued; /* the accompanying *.sig download was started */
+	/* a large payload may be split into byte ranges, see
+	 * curl_add_segmented_payload(). The payload itself fetches the first
+	 * range into its tempfile, the others are separate payloads. */
+	struct dload_payload *parent; /* payload this is a segment of */
+	alpm_list_t *segments; /* struct dload_payload, in range order */
+	off_t range_start; /* remote offset of the start of the tempfile */
+	off_t range_end; /* end of the range to fetch, 0 for the whole file */
+	off_t segment_base; /* tempfile size when the segments were set up */
+	curl_off_t dlnow; /* bytes received by the running request */
+	int pending; /* running transfers of a segmented payload */
+	int result; /* outcome of the last transfer of a segment */
+	int range_ignored; /* a server answered a range request in full */
+	alpm_digest_t *digest_ctx; /* digest of the tempfile so far */
+	off_t digest_size; /* bytes of the tempfile in digest_ctx */
 #endif
 	FILE *localf; /* temp download file */
 };
 
 void _alpm_dload_payload_reset(struct dload_payload *payload);
+int _alpm_dload_digest_matches(const struct dload_digest *digest,
+		const char *path, alpm_pkgvalidation_t type);
 
 int _alpm_download(alpm_handle_t *handle,
 		alpm_list_t *payloads /* struct dload_payload */,
 		const char *localpath,
 		const char *temporary_localpath);
 
+#ifdef HAVE_LIBCURL
+void _alpm_dload_worker_stop(alpm_handle_t *handle);
+#endif
+
 #endif /* ALPM_DLOAD_H */
@@ -0,0 +1,354 @@
+/*
+ *  durable.c
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* libalpm */
+#include "durable.h"
+#include "alpm_list.h"
+#include "handle.h"
+#include "log.h"
+#include "util.h"
+
+struct durable_file {
+	char *path; /* where the file was written */
+	char *dest; /* the name to rename it to, NULL to keep it */
+	dev_t dev;
+};
+
+struct _alpm_durable_t {
+	alpm_handle_t *handle;
+	alpm_durability_t mode;
+	struct durable_file *files;
+	size_t count;
+	size_t size; /* in bytes */
+};
+
+/* Returns NULL if files are not made durable, or on error. */
+alpm_durable_t *_alpm_durable_new(alpm_handle_t *handle)
+{
+	alpm_durable_t *durable;
+
+	if(handle->durability == ALPM_DURABILITY_NONE) {
+		return NULL;
+	}
+
+	CALLOC(durable, 1, sizeof(alpm_durable_t), RET_ERR(handle, ALPM_ERR_MEMORY, NULL));
+	durable->handle = handle;
+	durable->mode = handle->durability;
+	return durable;
+}
+
+/* Writes the temporary name path is written under to staged. */
+int _alpm_durable_stage(const char *path, char *staged, size_t size)
+{
+	int len = snprintf(staged, size, "%s" ALPM_DURABLE_SUFFIX, path);
+	if(len < 0 || (size_t)len >= size) {
+		return -1;
+	}
+	return 0;
+}
+
+static int parent_dir(const char *path, char *dir)
+{
+	const char *slash = strrchr(path, '/');
+	size_t len;
+
+	/* the parent of a directory named with a trailing slash */
+	if(slash && slash[1] == '\0') {
+		while(slash > path && slash[-1] == '/') {
+			slash--;
+		}
+		while(slash > path && slash[-1] != '/') {
+			slash--;
+		}
+		slash = slash > path ? slash - 1 : NULL;
+	}
+
+	if(slash == NULL) {
+		strcpy(dir, ".");
+		return 0;
+	}
+	len = slash == path ? 1 : (size_t)(slash - path);
+	if(len >= PATH_MAX) {
+		return -1;
+	}
+	memcpy(dir, path, len);
+	dir[len] = '\0';
+	return 0;
+}
+
+static int sync_path(alpm_handle_t *handle, const char *path, int dir)
+{
+	int fd, ret;
+
+	OPEN(fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | (dir ? O_DIRECTORY : 0));
+	if(fd < 0 && errno == ELOOP) {
+		/* a symlink, which lives in its directory */
+		char parent[PATH_MAX];
+		if(parent_dir(path, parent) != 0) {
+			return -1;
+		}
+		return sync_path(handle, parent, 1);
+	}
+	if(fd < 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
+				path, strerror(errno));
+		return -1;
+	}
+	ret = dir ? fsync(fd) : fdatasync(fd);
+	if(ret != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not sync %s: %s\n"),
+				path, strerror(errno));
+	}
+	close(fd);
+	return ret;
+}
+
+static int sync_file(alpm_handle_t *handle, struct durable_file *file)
+{
+	struct stat buf;
+	int dir = lstat(file->path, &buf) == 0 && S_ISDIR(buf.st_mode);
+	return sync_path(handle, file->path, dir);
+}
+
+/* Adds a file written at path to the set, to be renamed to dest once it
+ * is on disk. Directories and files already written under their final name
+ * are added without a dest. Leaves pm_errno alone, as packages are also
+ * extracted on other threads than the one that owns it. */
+int _alpm_durable_add(alpm_durable_t *durable, const char *path, const char *dest)
+{
+	alpm_handle_t *handle = durable->handle;
+	struct durable_file *file;
+	struct stat st;
+
+	if(!_alpm_greedy_grow((void **)&durable->files, &durable->size,
+				(durable->count + 1) * sizeof(struct durable_file))) {
+		return -1;
+	}
+	file = durable->files + durable->count;
+	memset(file, 0, sizeof(struct durable_file));
+	STRDUP(file->path, path, return -1);
+	if(dest) {
+		STRDUP(file->dest, dest, free(file->path); return -1);
+	}
+	durable->count++;
+
+	if(durable->mode == ALPM_DURABILITY_FILE) {
+		return sync_file(handle, file);
+	}
+
+	if(lstat(path, &st) == 0) {
+		file->dev = st.st_dev;
+	}
+	return 0;
+}
+
+/* Returns the name the file meant to be named dest was written under. */
+const char *_alpm_durable_find(alpm_durable_t *durable, const char *dest)
+{
+	size_t i;
+
+	for(i = durable->count; i > 0; i--) {
+		struct durable_file *file = durable->files + i - 1;
+		if(file->dest && strcmp(file->dest, dest) == 0) {
+			return file->path;
+		}
+	}
+	return NULL;
+}
+
+static int sync_filesystem(alpm_durable_t *durable, struct durable_file *file)
+{
+#ifdef HAVE_SYNCFS
+	char dir[PATH_MAX];
+	int fd, ret;
+
+	if(parent_dir(file->path, dir) != 0) {
+		return -1;
+	}
+	OPEN(fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd < 0) {
+		return -1;
+	}
+	ret = syncfs(fd);
+	close(fd);
+	return ret;
+#else
+	(void)durable;
+	(void)file;
+	return -1;
+#endif
+}
+
+static int flush_files(alpm_durable_t *durable)
+{
+	alpm_handle_t *handle = durable->handle;
+	struct durable_file *first[16]; /* a file on each filesystem */
+	size_t nfs = 0, i, j;
+	int ret = 0;
+
+	for(i = 0; i < durable->count; i++) {
+		struct durable_file *file = durable->files + i;
+
+		for(j = 0; j < nfs && first[j]->dev != file->dev; j++);
+		if(j == nfs) {
+			/* with this many filesystems, one syncfs() each is not cheaper */
+			if(nfs == sizeof(first) / sizeof(first[0])) {
+				nfs = 0;
+				break;
+			}
+			first[nfs++] = file;
+		}
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG, "syncing %zu files on %zu filesystems\n",
+			durable->count, nfs);
+	for(j = 0; j < nfs; j++) {
+		if(sync_filesystem(durable, first[j]) == 0) {
+			continue;
+		}
+		/* sync the files on this filesystem one by one instead */
+		for(i = 0; i < durable->count; i++) {
+			struct durable_file *file = durable->files + i;
+			if(file->dev == first[j]->dev && sync_file(handle, file) != 0) {
+				ret = -1;
+			}
+		}
+	}
+	if(nfs == 0) {
+		for(i = 0; i < durable->count; i++) {
+			if(sync_file(handle, durable->files + i) != 0) {
+				ret = -1;
+			}
+		}
+	}
+	return ret;
+}
+
+static int sync_dirs(alpm_durable_t *durable)
+{
+	alpm_list_t *dirs = NULL, *i;
+	size_t n;
+	int ret = 0;
+
+	for(n = 0; n < durable->count; n++) {
+		struct durable_file *file = durable->files + n;
+		char dir[PATH_MAX], *copy;
+
+		if(parent_dir(file->dest ? file->dest : file->path, dir) != 0) {
+			continue;
+		}
+		/* files of a directory tend to follow each other */
+		if(dirs && strcmp(alpm_list_last(dirs)->data, dir) == 0) {
+			continue;
+		}
+		STRDUP(copy, dir, FREELIST(dirs); RET_ERR(durable->handle, ALPM_ERR_MEMORY, -1));
+		dirs = alpm_list_add(dirs, copy);
+	}
+
+	dirs = alpm_list_msort(dirs, alpm_list_count(dirs), _alpm_str_cmp);
+	for(i = dirs; i; i = i->next) {
+		if(i->next && strcmp(i->data, i->next->data) == 0) {
+			continue;
+		}
+		if(sync_path(durable->handle, i->data, 1) != 0) {
+			ret = -1;
+		}
+	}
+	FREELIST(dirs);
+	return ret;
+}
+
+/* Puts the files of the set on disk under their final names and empties
+ * the set. */
+int _alpm_durable_commit(alpm_durable_t *durable)
+{
+	alpm_handle_t *handle = durable->handle;
+	size_t i;
+	int ret = 0;
+
+	if(durable->count == 0) {
+		return 0;
+	}
+
+	if(durable->mode == ALPM_DURABILITY_BATCH && flush_files(durable) != 0) {
+		ret = -1;
+	}
+
+	for(i = 0; i < durable->count; i++) {
+		struct durable_file *file = durable->files + i;
+		if(file->dest == NULL) {
+			continue;
+		}
+		if(rename(file->path, file->dest) != 0) {
+			_alpm_log(handle, ALPM_LOG_ERROR, _("could not rename %s to %s (%s)\n"),
+					file->path, file->dest, strerror(errno));
+			alpm_logaction(handle, ALPM_CALLER_PREFIX,
+					"error: could not rename %s to %s (%s)\n",
+					file->path, file->dest, strerror(errno));
+			ret = -1;
+		} else if(durable->mode == ALPM_DURABILITY_FILE) {
+			char dir[PATH_MAX];
+			if(parent_dir(file->dest, dir) != 0 || sync_path(handle, dir, 1) != 0) {
+				ret = -1;
+			}
+		}
+	}
+
+	if(durable->mode == ALPM_DURABILITY_BATCH && sync_dirs(durable) != 0) {
+		ret = -1;
+	}
+
+	for(i = 0; i < durable->count; i++) {
+		free(durable->files[i].path);
+		free(durable->files[i].dest);
+	}
+	durable->count = 0;
+
+	return ret;
+}
+
+/* Removes the files of the set left under a temporary name. */
+void _alpm_durable_free(alpm_durable_t *durable)
+{
+	size_t i;
+
+	if(durable == NULL) {
+		return;
+	}
+
+	for(i = 0; i < durable->count; i++) {
+		struct durable_file *file = durable->files + i;
+		if(file->dest) {
+			unlink(file->path);
+		}
+		free(file->path);
+		free(file->dest);
+	}
+	free(durable->files);
+	free(durable);
+}
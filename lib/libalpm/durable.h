@@ -0,0 +1,45 @@
+/*
+ *  durable.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_DURABLE_H
+#define ALPM_DURABLE_H
+
+#include "alpm.h"
+
+/* A set of files written by a transaction that are made durable together.
+ *
+ * Files are written under a temporary name, see _alpm_durable_stage(), and
+ * added to the set along with the name they are meant to have. Committing
+ * the set flushes all of them to disk, with one syncfs() per filesystem
+ * for ALPM_DURABILITY_BATCH, and only then renames them into place and
+ * syncs the directories they were renamed in. With ALPM_DURABILITY_FILE
+ * every file is synced as it is added instead. A set is used by one thread
+ * at a time. */
+
+#define ALPM_DURABLE_SUFFIX ".alpmtmp"
+
+typedef struct _alpm_durable_t alpm_durable_t;
+
+alpm_durable_t *_alpm_durable_new(alpm_handle_t *handle);
+int _alpm_durable_stage(const char *path, char *staged, size_t size);
+int _alpm_durable_add(alpm_durable_t *durable, const char *path, const char *dest);
+const char *_alpm_durable_find(alpm_durable_t *durable, const char *dest);
+int _alpm_durable_commit(alpm_durable_t *durable);
+void _alpm_durable_free(alpm_durable_t *durable);
+
+#endif /* ALPM_DURABLE_H */
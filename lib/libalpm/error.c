@@ -29,7 +29,7 @@
 
 alpm_errno_t SYMEXPORT alpm_errno(alpm_handle_t *handle)
 {
-	return handle->pm_errno;
+	return PM_ERRNO(handle);
 }
 
 const char SYMEXPORT *alpm_strerror(alpm_errno_t err)
@@ -24,9 +24,6 @@
 alpm_list_t *_alpm_filelist_difference(alpm_filelist_t *filesA,
 		alpm_filelist_t *filesB);
 
-alpm_list_t *_alpm_filelist_intersection(alpm_filelist_t *filesA,
-		alpm_filelist_t *filesB);
-
 void _alpm_filelist_sort(alpm_filelist_t *filelist);
 
 #endif /* ALPM_FILELIST_H */
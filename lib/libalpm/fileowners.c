@@ -0,0 +1,235 @@
+/*
+ *  fileowners.c
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* libalpm */
+#include "fileowners.h"
+#include "alpm_list.h"
+#include "package.h"
+#include "util.h"
+
+static unsigned int home_position(const alpm_fileowners_t *index,
+		unsigned long path_hash)
+{
+	uint64_t h = (uint64_t)path_hash * UINT64_C(0x9E3779B97F4A7C15);
+	return (unsigned int)(h >> 32) & (index->size - 1);
+}
+
+/* Position of path in the index, or of the empty slot it would take */
+static unsigned int find_position(const alpm_fileowners_t *index,
+		const char *path, unsigned long path_hash)
+{
+	unsigned int position = home_position(index, path_hash);
+
+	while(index->slots[position].path != NULL) {
+		const struct _alpm_fileowners_slot_t *slot = &index->slots[position];
+		if(slot->path_hash == path_hash && strcmp(slot->path, path) == 0) {
+			break;
+		}
+		position = (position + 1) & (index->size - 1);
+	}
+
+	return position;
+}
+
+static int resize(alpm_fileowners_t *index, unsigned int size)
+{
+	struct _alpm_fileowners_slot_t *old_slots = index->slots;
+	unsigned int old_size = index->size, i;
+
+	CALLOC(index->slots, size, sizeof(struct _alpm_fileowners_slot_t),
+			index->slots = old_slots; return -1);
+	index->size = size;
+
+	for(i = 0; i < old_size; i++) {
+		if(old_slots[i].path != NULL) {
+			unsigned int position = find_position(index, old_slots[i].path,
+					old_slots[i].path_hash);
+			index->slots[position] = old_slots[i];
+		}
+	}
+
+	free(old_slots);
+	return 0;
+}
+
+static int index_pkg(alpm_fileowners_t *index, alpm_pkg_t *pkg, int sorted)
+{
+	alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
+	size_t i;
+
+	if(filelist == NULL) {
+		return 0;
+	}
+
+	/* keep the load factor under 3/4 */
+	while((index->entries + filelist->count) * 4 > index->size * 3) {
+		if(resize(index, index->size * 2) != 0) {
+			return -1;
+		}
+	}
+
+	for(i = 0; i < filelist->count; i++) {
+		const char *path = filelist->files[i].name;
+		unsigned long path_hash = _alpm_hash_sdbm(path);
+		struct _alpm_fileowners_slot_t *slot;
+		alpm_list_t *owners;
+
+		/* file lists are sorted, skip duplicate entries */
+		if(i > 0 && strcmp(filelist->files[i - 1].name, path) == 0) {
+			continue;
+		}
+
+		slot = &index->slots[find_position(index, path, path_hash)];
+		if(sorted) {
+			owners = alpm_list_add_sorted(slot->owners, pkg, _alpm_pkg_cmp);
+		} else {
+			owners = alpm_list_add(slot->owners, pkg);
+		}
+		if(owners == NULL) {
+			return -1;
+		}
+		if(slot->path == NULL) {
+			slot->path = path;
+			slot->path_hash = path_hash;
+			index->entries++;
+		}
+		slot->owners = owners;
+	}
+
+	return 0;
+}
+
+/* Remove the slot at position, shifting back the entries of its probe
+ * sequence so that no tombstones are needed. */
+static void remove_position(alpm_fileowners_t *index, unsigned int position)
+{
+	unsigned int mask = index->size - 1;
+	unsigned int next = (position + 1) & mask;
+
+	while(index->slots[next].path != NULL) {
+		unsigned int home = home_position(index, index->slots[next].path_hash);
+		/* move the entry if its home is not cyclically in (position, next] */
+		if(((next - home) & mask) >= ((next - position) & mask)) {
+			index->slots[position] = index->slots[next];
+			position = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	index->slots[position].path = NULL;
+	index->slots[position].path_hash = 0;
+	index->slots[position].owners = NULL;
+	index->entries--;
+}
+
+/* Index the file lists of pkgs, loading them if needed */
+alpm_fileowners_t *_alpm_fileowners_new(alpm_list_t *pkgs)
+{
+	alpm_fileowners_t *index;
+	alpm_list_t *i;
+
+	CALLOC(index, 1, sizeof(alpm_fileowners_t), return NULL);
+	CALLOC(index->slots, 1024, sizeof(struct _alpm_fileowners_slot_t),
+			free(index); return NULL);
+	index->size = 1024;
+
+	for(i = pkgs; i; i = i->next) {
+		if(index_pkg(index, i->data, 0) != 0) {
+			_alpm_fileowners_free(index);
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+int _alpm_fileowners_add(alpm_fileowners_t *index, alpm_pkg_t *pkg)
+{
+	if(index == NULL || pkg == NULL) {
+		return -1;
+	}
+	return index_pkg(index, pkg, 1);
+}
+
+/* Drop pkg from the owners of its files. Only the file list already in
+ * memory is looked at, which is the one the package was indexed with. */
+void _alpm_fileowners_remove(alpm_fileowners_t *index, alpm_pkg_t *pkg)
+{
+	size_t i;
+
+	if(index == NULL || pkg == NULL) {
+		return;
+	}
+
+	for(i = 0; i < pkg->files.count; i++) {
+		const char *path = pkg->files.files[i].name;
+		struct _alpm_fileowners_slot_t *slot;
+		unsigned int position;
+		alpm_list_t *item;
+
+		if(i > 0 && strcmp(pkg->files.files[i - 1].name, path) == 0) {
+			continue;
+		}
+
+		position = find_position(index, path, _alpm_hash_sdbm(path));
+		slot = &index->slots[position];
+		for(item = slot->owners; item && item->data != pkg; item = item->next);
+		if(item == NULL) {
+			continue;
+		}
+		slot->owners = alpm_list_remove_item(slot->owners, item);
+		free(item);
+
+		if(slot->owners == NULL) {
+			remove_position(index, position);
+		} else if(slot->path == path) {
+			/* the path is borrowed from pkg, take it from the next owner */
+			alpm_pkg_t *owner = slot->owners->data;
+			slot->path = alpm_filelist_contains(&owner->files, path)->name;
+		}
+	}
+}
+
+/* Returns the packages owning path, in index order */
+alpm_list_t *_alpm_fileowners_find(alpm_fileowners_t *index, const char *path)
+{
+	if(index == NULL || path == NULL) {
+		return NULL;
+	}
+	return index->slots[find_position(index, path, _alpm_hash_sdbm(path))].owners;
+}
+
+void _alpm_fileowners_free(alpm_fileowners_t *index)
+{
+	unsigned int i;
+
+	if(index == NULL) {
+		return;
+	}
+
+	for(i = 0; i < index->size; i++) {
+		alpm_list_free(index->slots[i].owners);
+	}
+	free(index->slots);
+	free(index);
+}
@@ -0,0 +1,49 @@
+/*
+ *  fileowners.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_FILEOWNERS_H
+#define ALPM_FILEOWNERS_H
+
+#include "alpm.h"
+#include "alpm_list.h"
+
+/* Index from the paths in the file lists of a set of packages to the
+ * packages owning them. The owners of a path are kept in the order the
+ * packages were indexed in, or by name for packages added afterwards. The
+ * paths are borrowed from the file lists of the packages, so a package must
+ * be removed from the index before it is freed. */
+
+struct _alpm_fileowners_slot_t {
+	unsigned long path_hash;
+	const char *path;
+	alpm_list_t *owners;
+};
+
+typedef struct _alpm_fileowners_t {
+	struct _alpm_fileowners_slot_t *slots;
+	unsigned int size;
+	unsigned int entries;
+} alpm_fileowners_t;
+
+alpm_fileowners_t *_alpm_fileowners_new(alpm_list_t *pkgs);
+int _alpm_fileowners_add(alpm_fileowners_t *index, alpm_pkg_t *pkg);
+void _alpm_fileowners_remove(alpm_fileowners_t *index, alpm_pkg_t *pkg);
+alpm_list_t *_alpm_fileowners_find(alpm_fileowners_t *index, const char *path);
+void _alpm_fileowners_free(alpm_fileowners_t *index);
+
+#endif /* ALPM_FILEOWNERS_H */
@@ -0,0 +1,446 @@
+/*
+ *  fsprobe.c
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBURING
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#include <liburing.h>
+#endif
+
+/* libalpm */
+#include "fsprobe.h"
+#include "handle.h"
+#include "log.h"
+#include "util.h"
+
+#ifdef ENABLE_FSPROBE
+
+/* fewer files are stat'ed in place, starting a probe costs more than it saves */
+#define FSPROBE_MIN_FILES 1024
+/* number of results kept ahead of the consumer */
+#define FSPROBE_WINDOW 256
+/* number of threads of the fallback pool */
+#define FSPROBE_THREADS 8
+/* number of files a thread takes at once */
+#define FSPROBE_CHUNK 16
+
+struct fsprobe_slot {
+	int done;
+	int ret;
+	int err;
+	struct stat st;
+#ifdef HAVE_LIBURING
+	char path[PATH_MAX];
+	struct statx stx;
+#endif
+};
+
+struct _alpm_fsprobe_t {
+	alpm_handle_t *handle;
+	const char **files;
+	size_t count;
+	/* next file to consume */
+	size_t cursor;
+	/* next file to probe */
+	size_t next;
+	/* FSPROBE_WINDOW slots, file i uses slot i % FSPROBE_WINDOW */
+	struct fsprobe_slot *slots;
+	/* set when probing failed, lookups are done in place from then on */
+	int broken;
+#ifdef HAVE_LIBURING
+	int uring;
+	unsigned int inflight;
+	struct io_uring ring;
+#endif
+	pthread_mutex_t lock;
+	/* signalled when a slot was consumed and threads are idle */
+	pthread_cond_t space;
+	unsigned int idle;
+	/* signalled when a slot was probed and the consumer waits */
+	pthread_cond_t probed;
+	int waiting;
+	int stop;
+	pthread_t *threads;
+	unsigned int nthreads;
+};
+
+static int root_path(alpm_fsprobe_t *probe, const char *file, char *path)
+{
+	int len = snprintf(path, PATH_MAX, "%s%s", probe->handle->root, file);
+	if(len < 0 || len >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(struct stat));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/* Queue statx requests for the files that fit in the window */
+static void uring_submit(alpm_fsprobe_t *probe)
+{
+	unsigned int queued = 0;
+
+	while(probe->next < probe->count
+			&& probe->next < probe->cursor + FSPROBE_WINDOW) {
+		struct fsprobe_slot *slot = &probe->slots[probe->next % FSPROBE_WINDOW];
+		struct io_uring_sqe *sqe;
+		size_t len;
+
+		if(root_path(probe, probe->files[probe->next], slot->path) != 0) {
+			slot->ret = -1;
+			slot->err = errno;
+			slot->done = 1;
+			probe->next++;
+			continue;
+		}
+		/* like llstat(), do not follow a symlink to a directory */
+		len = strlen(slot->path);
+		while(len > 1 && slot->path[len - 1] == '/') {
+			slot->path[--len] = '\0';
+		}
+
+		if((sqe = io_uring_get_sqe(&probe->ring)) == NULL) {
+			break;
+		}
+		io_uring_prep_statx(sqe, AT_FDCWD, slot->path, AT_SYMLINK_NOFOLLOW,
+				STATX_BASIC_STATS, &slot->stx);
+		io_uring_sqe_set_data(sqe, slot);
+		probe->next++;
+		queued++;
+	}
+
+	if(queued) {
+		io_uring_submit(&probe->ring);
+		probe->inflight += queued;
+	}
+}
+
+/* Reap completions until the slot was probed */
+static int uring_wait(alpm_fsprobe_t *probe, struct fsprobe_slot *slot)
+{
+	while(!slot->done) {
+		struct io_uring_cqe *cqe;
+		struct fsprobe_slot *completed;
+		int ret;
+
+		uring_submit(probe);
+		if(probe->inflight == 0) {
+			return -1;
+		}
+		ret = io_uring_wait_cqe(&probe->ring, &cqe);
+		if(ret == -EINTR) {
+			continue;
+		} else if(ret < 0) {
+			return -1;
+		}
+
+		completed = io_uring_cqe_get_data(cqe);
+		if(cqe->res < 0) {
+			completed->ret = -1;
+			completed->err = -cqe->res;
+		} else {
+			completed->ret = 0;
+			statx_to_stat(&completed->stx, &completed->st);
+		}
+		completed->done = 1;
+		io_uring_cqe_seen(&probe->ring, cqe);
+		probe->inflight--;
+	}
+	return 0;
+}
+#endif
+
+static void *probe_worker(void *arg)
+{
+	alpm_fsprobe_t *probe = arg;
+	char path[PATH_MAX];
+
+	pthread_mutex_lock(&probe->lock);
+	for(;;) {
+		size_t idx, first, last;
+
+		while(!probe->stop && (probe->next >= probe->count
+					|| probe->next >= probe->cursor + FSPROBE_WINDOW)) {
+			probe->idle++;
+			pthread_cond_wait(&probe->space, &probe->lock);
+			probe->idle--;
+		}
+		if(probe->stop) {
+			break;
+		}
+		first = probe->next;
+		last = first + FSPROBE_CHUNK;
+		if(last > probe->count) {
+			last = probe->count;
+		}
+		if(last > probe->cursor + FSPROBE_WINDOW) {
+			last = probe->cursor + FSPROBE_WINDOW;
+		}
+		probe->next = last;
+		pthread_mutex_unlock(&probe->lock);
+
+		/* the slots are ours until they are marked done */
+		for(idx = first; idx < last; idx++) {
+			struct fsprobe_slot *slot = &probe->slots[idx % FSPROBE_WINDOW];
+			if((slot->ret = root_path(probe, probe->files[idx], path)) == 0) {
+				slot->ret = llstat(path, &slot->st);
+			}
+			slot->err = slot->ret != 0 ? errno : 0;
+		}
+
+		pthread_mutex_lock(&probe->lock);
+		for(idx = first; idx < last; idx++) {
+			probe->slots[idx % FSPROBE_WINDOW].done = 1;
+		}
+		if(probe->waiting) {
+			pthread_cond_signal(&probe->probed);
+		}
+	}
+	pthread_mutex_unlock(&probe->lock);
+
+	return NULL;
+}
+
+static int start_workers(alpm_fsprobe_t *probe)
+{
+	unsigned int nthreads = FSPROBE_THREADS;
+
+	if(probe->count < nthreads) {
+		nthreads = probe->count;
+	}
+
+	CALLOC(probe->threads, nthreads, sizeof(pthread_t), return -1);
+	for(; probe->nthreads < nthreads; probe->nthreads++) {
+		if(pthread_create(&probe->threads[probe->nthreads], NULL,
+					probe_worker, probe) != 0) {
+			break;
+		}
+	}
+	return probe->nthreads > 0 ? 0 : -1;
+}
+
+/** Start probing files.
+ * @param handle the context handle
+ * @param files paths relative to the root, in the order they will be
+ * looked up in; the array and the strings must outlive the probe
+ * @param count number of files
+ * @return the probe, NULL if the files have to be stat'ed in place, as are
+ * sets of fewer than FSPROBE_MIN_FILES files
+ */
+alpm_fsprobe_t *_alpm_fsprobe_new(alpm_handle_t *handle, const char **files,
+		size_t count)
+{
+	alpm_fsprobe_t *probe;
+
+	if(count < FSPROBE_MIN_FILES) {
+		return NULL;
+	}
+
+	CALLOC(probe, 1, sizeof(alpm_fsprobe_t), return NULL);
+	CALLOC(probe->slots, FSPROBE_WINDOW, sizeof(struct fsprobe_slot),
+			free(probe); return NULL);
+	probe->handle = handle;
+	probe->files = files;
+	probe->count = count;
+	pthread_mutex_init(&probe->lock, NULL);
+	pthread_cond_init(&probe->space, NULL);
+	pthread_cond_init(&probe->probed, NULL);
+
+#ifdef HAVE_LIBURING
+	if(io_uring_queue_init(FSPROBE_WINDOW, &probe->ring, 0) == 0) {
+		probe->uring = 1;
+		uring_submit(probe);
+		_alpm_log(handle, ALPM_LOG_DEBUG, "probing %zu files with io_uring\n", count);
+		return probe;
+	}
+	_alpm_log(handle, ALPM_LOG_DEBUG, "io_uring unavailable, using threads\n");
+#endif
+
+	if(start_workers(probe) != 0) {
+		_alpm_fsprobe_free(probe);
+		return NULL;
+	}
+	_alpm_log(handle, ALPM_LOG_DEBUG, "probing %zu files with %u threads\n",
+			count, probe->nthreads);
+	return probe;
+}
+
+/* Wait for the file at the cursor and move past it */
+static int consume(alpm_fsprobe_t *probe, struct stat *buf)
+{
+	struct fsprobe_slot *slot = &probe->slots[probe->cursor % FSPROBE_WINDOW];
+	int ret;
+
+#ifdef HAVE_LIBURING
+	if(probe->uring) {
+		if(uring_wait(probe, slot) != 0) {
+			probe->broken = 1;
+			return -1;
+		}
+		ret = slot->ret;
+		errno = slot->err;
+		if(buf) {
+			*buf = slot->st;
+		}
+		slot->done = 0;
+		probe->cursor++;
+		return ret;
+	}
+#endif
+
+	pthread_mutex_lock(&probe->lock);
+	while(!slot->done) {
+		probe->waiting = 1;
+		pthread_cond_wait(&probe->probed, &probe->lock);
+		probe->waiting = 0;
+	}
+	ret = slot->ret;
+	errno = slot->err;
+	if(buf) {
+		*buf = slot->st;
+	}
+	slot->done = 0;
+	probe->cursor++;
+	/* wake idle threads once there is room for a whole chunk */
+	if(probe->idle && probe->cursor % FSPROBE_CHUNK == 0) {
+		pthread_cond_broadcast(&probe->space);
+	}
+	pthread_mutex_unlock(&probe->lock);
+
+	return ret;
+}
+
+/** Look up the result for a file, with the semantics of llstat().
+ * @param probe the probe, may be NULL
+ * @param file the file, by identity with the array the probe was started on
+ * @param path the file below the root, stat'ed in place if the file was
+ * not probed
+ * @param buf where to store the result
+ * @return 0 on success, -1 on error with errno set
+ */
+int _alpm_fsprobe_lstat(alpm_fsprobe_t *probe, const char *file, char *path,
+		struct stat *buf)
+{
+	int ret;
+
+	if(probe == NULL || probe->broken) {
+		return llstat(path, buf);
+	}
+
+	/* files skipped by the caller */
+	while(probe->cursor < probe->count && probe->files[probe->cursor] != file) {
+		consume(probe, NULL);
+		if(probe->broken) {
+			return llstat(path, buf);
+		}
+	}
+	if(probe->cursor == probe->count) {
+		return llstat(path, buf);
+	}
+
+	ret = consume(probe, buf);
+	if(probe->broken) {
+		return llstat(path, buf);
+	}
+	return ret;
+}
+
+void _alpm_fsprobe_free(alpm_fsprobe_t *probe)
+{
+	unsigned int i;
+
+	if(probe == NULL) {
+		return;
+	}
+
+#ifdef HAVE_LIBURING
+	if(probe->uring) {
+		io_uring_queue_exit(&probe->ring);
+	}
+#endif
+
+	pthread_mutex_lock(&probe->lock);
+	probe->stop = 1;
+	pthread_cond_broadcast(&probe->space);
+	pthread_mutex_unlock(&probe->lock);
+	for(i = 0; i < probe->nthreads; i++) {
+		pthread_join(probe->threads[i], NULL);
+	}
+
+	free(probe->threads);
+	pthread_cond_destroy(&probe->probed);
+	pthread_cond_destroy(&probe->space);
+	pthread_mutex_destroy(&probe->lock);
+	free(probe->slots);
+	free(probe);
+}
+
+#else /* !ENABLE_FSPROBE */
+
+alpm_fsprobe_t *_alpm_fsprobe_new(alpm_handle_t *handle, const char **files,
+		size_t count)
+{
+	(void)handle;
+	(void)files;
+	(void)count;
+	return NULL;
+}
+
+int _alpm_fsprobe_lstat(alpm_fsprobe_t *probe, const char *file, char *path,
+		struct stat *buf)
+{
+	(void)probe;
+	(void)file;
+	return llstat(path, buf);
+}
+
+void _alpm_fsprobe_free(alpm_fsprobe_t *probe)
+{
+	(void)probe;
+}
+
+#endif /* ENABLE_FSPROBE */
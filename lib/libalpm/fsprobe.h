@@ -0,0 +1,44 @@
+/*
+ *  fsprobe.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_FSPROBE_H
+#define ALPM_FSPROBE_H
+
+#include <sys/stat.h>
+
+#include "alpm.h"
+
+/* Stats a known sequence of files below the root ahead of their use.
+ *
+ * The files are given up front and probed in the background, through
+ * io_uring when libalpm was built with it and the kernel allows it, or a
+ * small pool of threads otherwise. Results are consumed in the same order;
+ * files may be skipped. Only a bounded window of results is kept ahead of
+ * the consumer. Small sets of files are not worth the hand-off and are
+ * stat'ed in place. Built with -Dfsprobe=sync, the default, no probe is
+ * ever created and every lookup is a plain llstat(). */
+
+typedef struct _alpm_fsprobe_t alpm_fsprobe_t;
+
+alpm_fsprobe_t *_alpm_fsprobe_new(alpm_handle_t *handle, const char **files,
+		size_t count);
+int _alpm_fsprobe_lstat(alpm_fsprobe_t *probe, const char *file, char *path,
+		struct stat *buf);
+void _alpm_fsprobe_free(alpm_fsprobe_t *probe);
+
+#endif /* ALPM_FSPROBE_H */
@@ -37,6 +37,8 @@
 #include "trans.h"
 #include "alpm.h"
 #include "deps.h"
+#include "signing.h"
+#include "dload.h"
 
 alpm_handle_t *_alpm_handle_new(void)
 {
@@ -44,6 +46,7 @@ alpm_handle_t *_alpm_handle_new(void)
 
 	CALLOC(handle, 1, sizeof(alpm_handle_t), return NULL);
 	handle->lockfd = -1;
+	_alpm_log_lock_init(handle);
 
 	return handle;
 }
@@ -82,12 +85,14 @@ void _alpm_handle_free(alpm_handle_t *handle)
 
 #ifdef HAVE_LIBGPGME
 	FREELIST(handle->known_keys);
+	_alpm_gpgme_session_free(handle);
 #endif
 
 #ifdef HAVE_LIBCURL
+	_alpm_dload_worker_stop(handle);
 	curl_multi_cleanup(handle->curlm);
 	curl_global_cleanup();
-	FREELIST(handle->server_errors);
+	FREELIST(handle->server_stats);
 #endif
 
 	/* free memory */
@@ -111,9 +116,41 @@ void _alpm_handle_free(alpm_handle_t *handle)
 	alpm_list_free_inner(handle->assumeinstalled, (alpm_list_fn_free)alpm_dep_free);
 	alpm_list_free(handle->assumeinstalled);
 
+	pthread_mutex_destroy(&handle->log_lock);
 	FREE(handle);
 }
 
+static pthread_key_t errno_key;
+static pthread_once_t errno_key_once = PTHREAD_ONCE_INIT;
+
+static void errno_key_create(void)
+{
+	pthread_key_create(&errno_key, NULL);
+}
+
+/** Where the calling thread keeps its error code for a handle.
+ * Worker threads keep theirs apart, see _alpm_errno_redirect().
+ */
+alpm_errno_t *_alpm_errno_location(alpm_handle_t *handle)
+{
+	alpm_errno_t *slot;
+
+	pthread_once(&errno_key_once, errno_key_create);
+	slot = pthread_getspecific(errno_key);
+	return slot ? slot : &handle->pm_errno;
+}
+
+/** Keep the calling thread's error code in slot instead of the handle.
+ * Threads working next to the one driving the handle use this so that
+ * they neither race with nor clobber its pm_errno. Passing NULL goes back
+ * to the handle.
+ */
+void _alpm_errno_redirect(alpm_errno_t *slot)
+{
+	pthread_once(&errno_key_once, errno_key_create);
+	pthread_setspecific(errno_key, slot);
+}
+
 /** Lock the database */
 int _alpm_handle_lock(alpm_handle_t *handle)
 {
@@ -365,6 +402,60 @@ int SYMEXPORT alpm_option_get_parallel_downloads(alpm_handle_t *handle)
 	return handle->parallel_downloads;
 }
 
+int SYMEXPORT alpm_option_get_max_host_connections(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->max_host_connections;
+}
+
+int SYMEXPORT alpm_option_get_host_stats(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->host_stats;
+}
+
+off_t SYMEXPORT alpm_option_get_segmented_download_size(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->segmented_download_size;
+}
+
+alpm_download_order_t SYMEXPORT alpm_option_get_download_order(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->download_order;
+}
+
+int SYMEXPORT alpm_option_get_pipelined_commit(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->pipelined_commit;
+}
+
+int SYMEXPORT alpm_option_get_parallel_db_loads(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->parallel_db_loads;
+}
+
+int SYMEXPORT alpm_option_get_parallel_integrity_checks(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->parallel_integrity_checks;
+}
+
+int SYMEXPORT alpm_option_get_parallel_extractions(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->parallel_extractions;
+}
+
+alpm_durability_t SYMEXPORT alpm_option_get_durability(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->durability;
+}
+
 int SYMEXPORT alpm_option_set_logcb(alpm_handle_t *handle, alpm_cb_log cb, void *ctx)
 {
 	CHECK_HANDLE(handle, return -1);
@@ -572,7 +663,7 @@ int SYMEXPORT alpm_option_set_logfile(alpm_handle_t *handle, const char *logfile
 
 	CHECK_HANDLE(handle, return -1);
 	if(!logfile) {
-		handle->pm_errno = ALPM_ERR_WRONG_ARGS;
+		PM_ERRNO(handle) = ALPM_ERR_WRONG_ARGS;
 		return -1;
 	}
 
@@ -951,3 +1042,83 @@ int SYMEXPORT alpm_option_set_parallel_downloads(alpm_handle_t *handle,
 	handle->parallel_downloads = num_streams;
 	return 0;
 }
+
+int SYMEXPORT alpm_option_set_max_host_connections(alpm_handle_t *handle,
+		unsigned int num_connections)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->max_host_connections = num_connections;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_host_stats(alpm_handle_t *handle,
+		unsigned short host_stats)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->host_stats = host_stats;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_segmented_download_size(alpm_handle_t *handle,
+		off_t size)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(size >= 0, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->segmented_download_size = size;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_download_order(alpm_handle_t *handle,
+		alpm_download_order_t order)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(order == ALPM_DOWNLOAD_ORDER_SIZE || order == ALPM_DOWNLOAD_ORDER_INSTALL,
+			RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->download_order = order;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_pipelined_commit(alpm_handle_t *handle, int enable)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->pipelined_commit = enable ? 1 : 0;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_parallel_db_loads(alpm_handle_t *handle,
+		unsigned int num_threads)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(num_threads >= 1, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->parallel_db_loads = num_threads;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_parallel_integrity_checks(alpm_handle_t *handle,
+		unsigned int num_threads)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(num_threads >= 1, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->parallel_integrity_checks = num_threads;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_parallel_extractions(alpm_handle_t *handle,
+		unsigned int num_threads)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(num_threads >= 1, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->parallel_extractions = num_threads;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_durability(alpm_handle_t *handle,
+		alpm_durability_t durability)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(durability == ALPM_DURABILITY_NONE || durability == ALPM_DURABILITY_BATCH
+			|| durability == ALPM_DURABILITY_FILE,
+			RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	handle->durability = durability;
+	return 0;
+}
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <regex.h>
+#include <pthread.h>
 
 #include "alpm_list.h"
 #include "alpm.h"
@@ -56,19 +57,32 @@ struct _alpm_handle_t {
 	alpm_db_t *db_local;    /* local db pointer */
 	alpm_list_t *dbs_sync;  /* List of (alpm_db_t *) */
 	FILE *logstream;        /* log file stream pointer */
+	pthread_mutex_t log_lock; /* serializes logging and frontend callbacks, recursive */
 	alpm_trans_t *trans;
 
 #ifdef HAVE_LIBCURL
 	/* libcurl handle */
 	CURLM *curlm;
-	alpm_list_t *server_errors;
+	alpm_list_t *server_stats; /* struct server_stats, see dload.c */
+	struct dload_worker *dload_worker; /* sandboxed download process, see dload.c */
 #endif
 
 	unsigned short disable_dl_timeout;
 	unsigned int parallel_downloads; /* number of download streams */
+	unsigned int max_host_connections; /* connections per host, 0 for no limit */
+	unsigned short host_stats; /* report ALPM_DOWNLOAD_HOST_STATS events */
+	off_t segmented_download_size; /* split larger payloads, 0 to disable */
+	alpm_download_order_t download_order; /* order downloads are started in */
+	int pipelined_commit; /* verify and load packages while downloading */
+	unsigned int parallel_db_loads; /* number of threads populating sync dbs */
+	unsigned int parallel_integrity_checks; /* number of threads verifying packages */
+	unsigned int parallel_extractions; /* number of threads extracting packages */
+	alpm_durability_t durability; /* how transactions sync the files they write */
+	struct _alpm_verifycache_t *verifycache; /* set while loading sync targets */
 
 #ifdef HAVE_LIBGPGME
 	alpm_list_t *known_keys;  /* keys verified to be in our keychain */
+	struct _alpm_gpgme_session_t *gpgme_session; /* see signing.c */
 #endif
 
 	/* callback functions */
@@ -114,19 +128,25 @@ struct _alpm_handle_t {
 	int remotefilesiglevel;  /* Signature verification level for remote file
 	                                       upgrade operations */
 
-	/* error code */
+	/* error code, accessed through PM_ERRNO() */
 	alpm_errno_t pm_errno;
 
 	/* lock file descriptor */
 	int lockfd;
 };
 
+/* the calling thread's error code for handle, see _alpm_errno_redirect() */
+#define PM_ERRNO(handle) (*_alpm_errno_location(handle))
+
 alpm_handle_t *_alpm_handle_new(void);
 void _alpm_handle_free(alpm_handle_t *handle);
 
 int _alpm_handle_lock(alpm_handle_t *handle);
 int _alpm_handle_unlock(alpm_handle_t *handle);
 
+alpm_errno_t *_alpm_errno_location(alpm_handle_t *handle);
+void _alpm_errno_redirect(alpm_errno_t *slot);
+
 alpm_errno_t _alpm_set_directory_option(const char *value,
 		char **storage, int must_exist);
 
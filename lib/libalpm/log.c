@@ -33,12 +33,13 @@
 static int _alpm_log_leader(FILE *f, const char *prefix)
 {
 	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
+	struct tm tm;
 	int length = 32;
 	char timestamp[length];
 
+	localtime_r(&t, &tm);
 	/* Use ISO-8601 date format */
-	strftime(timestamp,length,"%FT%T%z", tm);
+	strftime(timestamp,length,"%FT%T%z", &tm);
 	return fprintf(f, "[%s] [%s] ", timestamp, prefix);
 }
 
@@ -54,6 +55,9 @@ int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
 		prefix = "UNKNOWN";
 	}
 
+	/* packages may be extracted on several threads */
+	pthread_mutex_lock(&handle->log_lock);
+
 	/* check if the logstream is open already, opening it if needed */
 	if(handle->logstream == NULL && handle->logfile != NULL) {
 		int fd;
@@ -64,11 +68,11 @@ int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
 		/* if we couldn't open it, we have an issue */
 		if(fd < 0 || (handle->logstream = fdopen(fd, "a")) == NULL) {
 			if(errno == EACCES) {
-				handle->pm_errno = ALPM_ERR_BADPERMS;
+				PM_ERRNO(handle) = ALPM_ERR_BADPERMS;
 			} else if(errno == ENOENT) {
-				handle->pm_errno = ALPM_ERR_NOT_A_DIR;
+				PM_ERRNO(handle) = ALPM_ERR_NOT_A_DIR;
 			} else {
-				handle->pm_errno = ALPM_ERR_SYSTEM;
+				PM_ERRNO(handle) = ALPM_ERR_SYSTEM;
 			}
 			ret = -1;
 		}
@@ -89,15 +93,31 @@ int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
 		if(_alpm_log_leader(handle->logstream, prefix) < 0
 				|| vfprintf(handle->logstream, fmt, args) < 0) {
 			ret = -1;
-			handle->pm_errno = ALPM_ERR_SYSTEM;
+			PM_ERRNO(handle) = ALPM_ERR_SYSTEM;
 		}
 		fflush(handle->logstream);
 	}
 
 	va_end(args);
+	pthread_mutex_unlock(&handle->log_lock);
 	return ret;
 }
 
+/** Initialize the lock serializing the log file and frontend callbacks.
+ * It is recursive so that a callback may call back into libalpm, e.g.
+ * alpm_logaction(), from the thread holding it.
+ * @param handle the context handle
+ */
+void _alpm_log_lock_init(alpm_handle_t *handle)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&handle->log_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
 void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag, const char *fmt, ...)
 {
 	va_list args;
@@ -106,7 +126,10 @@ void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag, const char *fmt, ...
 		return;
 	}
 
+	/* sync databases may be populated from several threads at once */
+	pthread_mutex_lock(&handle->log_lock);
 	va_start(args, fmt);
 	handle->logcb(handle->logcb_ctx, flag, fmt, args);
 	va_end(args);
+	pthread_mutex_unlock(&handle->log_lock);
 }
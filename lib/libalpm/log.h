@@ -26,5 +26,6 @@
 
 void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag,
 		const char *fmt, ...) __attribute__((format(printf,3,4)));
+void _alpm_log_lock_init(alpm_handle_t *handle);
 
 #endif /* ALPM_LOG_H */
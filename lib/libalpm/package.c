@@ -53,7 +53,7 @@ int SYMEXPORT alpm_pkg_checkmd5sum(alpm_pkg_t *pkg)
 	int retval;
 
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	/* We only inspect packages from sync repositories */
 	ASSERT(pkg->origin == ALPM_PKG_FROM_SYNCDB,
 			RET_ERR(pkg->handle, ALPM_ERR_WRONG_ARGS, -1));
@@ -65,7 +65,7 @@ int SYMEXPORT alpm_pkg_checkmd5sum(alpm_pkg_t *pkg)
 	FREE(fpath);
 
 	if(retval == 1) {
-		pkg->handle->pm_errno = ALPM_ERR_PKG_INVALID;
+		PM_ERRNO(pkg->handle) = ALPM_ERR_PKG_INVALID;
 		retval = -1;
 	}
 
@@ -183,14 +183,14 @@ const struct pkg_operations default_pkg_ops = {
 const char SYMEXPORT *alpm_pkg_get_filename(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->filename;
 }
 
 const char SYMEXPORT *alpm_pkg_get_base(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_base(pkg);
 }
 
@@ -203,77 +203,77 @@ alpm_handle_t SYMEXPORT *alpm_pkg_get_handle(alpm_pkg_t *pkg)
 const char SYMEXPORT *alpm_pkg_get_name(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->name;
 }
 
 const char SYMEXPORT *alpm_pkg_get_version(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->version;
 }
 
 alpm_pkgfrom_t SYMEXPORT alpm_pkg_get_origin(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->origin;
 }
 
 const char SYMEXPORT *alpm_pkg_get_desc(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_desc(pkg);
 }
 
 const char SYMEXPORT *alpm_pkg_get_url(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_url(pkg);
 }
 
 alpm_time_t SYMEXPORT alpm_pkg_get_builddate(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_builddate(pkg);
 }
 
 alpm_time_t SYMEXPORT alpm_pkg_get_installdate(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_installdate(pkg);
 }
 
 const char SYMEXPORT *alpm_pkg_get_packager(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_packager(pkg);
 }
 
 const char SYMEXPORT *alpm_pkg_get_md5sum(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->md5sum;
 }
 
 const char SYMEXPORT *alpm_pkg_get_sha256sum(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->sha256sum;
 }
 
 const char SYMEXPORT *alpm_pkg_get_base64_sig(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->base64_sig;
 }
 
@@ -318,112 +318,112 @@ cleanup:
 const char SYMEXPORT *alpm_pkg_get_arch(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_arch(pkg);
 }
 
 off_t SYMEXPORT alpm_pkg_get_size(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->size;
 }
 
 off_t SYMEXPORT alpm_pkg_get_isize(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_isize(pkg);
 }
 
 alpm_pkgreason_t SYMEXPORT alpm_pkg_get_reason(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_reason(pkg);
 }
 
 int SYMEXPORT alpm_pkg_get_validation(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_validation(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_licenses(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_licenses(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_groups(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_groups(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_depends(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_depends(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_optdepends(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_optdepends(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_checkdepends(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_checkdepends(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_makedepends(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_makedepends(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_conflicts(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_conflicts(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_provides(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_provides(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_replaces(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_replaces(pkg);
 }
 
 alpm_filelist_t SYMEXPORT *alpm_pkg_get_files(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_files(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_backup(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_backup(pkg);
 }
 
@@ -432,7 +432,7 @@ alpm_db_t SYMEXPORT *alpm_pkg_get_db(alpm_pkg_t *pkg)
 	/* Sanity checks */
 	ASSERT(pkg != NULL, return NULL);
 	ASSERT(pkg->origin != ALPM_PKG_FROM_FILE, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 
 	return pkg->origin_data.db;
 }
@@ -440,7 +440,7 @@ alpm_db_t SYMEXPORT *alpm_pkg_get_db(alpm_pkg_t *pkg)
 void SYMEXPORT *alpm_pkg_changelog_open(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->changelog_open(pkg);
 }
 
@@ -448,21 +448,21 @@ size_t SYMEXPORT alpm_pkg_changelog_read(void *ptr, size_t size,
 		const alpm_pkg_t *pkg, void *fp)
 {
 	ASSERT(pkg != NULL, return 0);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->changelog_read(ptr, size, pkg, fp);
 }
 
 int SYMEXPORT alpm_pkg_changelog_close(const alpm_pkg_t *pkg, void *fp)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->changelog_close(pkg, fp);
 }
 
 struct archive SYMEXPORT *alpm_pkg_mtree_open(alpm_pkg_t * pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->mtree_open(pkg);
 }
 
@@ -470,28 +470,28 @@ int SYMEXPORT alpm_pkg_mtree_next(const alpm_pkg_t * pkg, struct archive *archiv
 	struct archive_entry **entry)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->mtree_next(pkg, archive, entry);
 }
 
 int SYMEXPORT alpm_pkg_mtree_close(const alpm_pkg_t * pkg, struct archive *archive)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->mtree_close(pkg, archive);
 }
 
 int SYMEXPORT alpm_pkg_has_scriptlet(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return -1);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->has_scriptlet(pkg);
 }
 
 alpm_list_t SYMEXPORT *alpm_pkg_get_xdata(alpm_pkg_t *pkg)
 {
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 	return pkg->ops->get_xdata(pkg);
 }
 
@@ -499,7 +499,7 @@ static void find_requiredby(alpm_pkg_t *pkg, alpm_db_t *db, alpm_list_t **reqs,
 		int optional)
 {
 	const alpm_list_t *i;
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 
 	for(i = _alpm_db_get_pkgcache(db); i; i = i->next) {
 		alpm_pkg_t *cachepkg = i->data;
@@ -529,7 +529,7 @@ static alpm_list_t *compute_requiredby(alpm_pkg_t *pkg, int optional)
 	alpm_db_t *db;
 
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 
 	if(pkg->origin == ALPM_PKG_FROM_FILE) {
 		/* The sane option; search locally for things that require this. */
@@ -614,7 +614,7 @@ int _alpm_pkg_dup(alpm_pkg_t *pkg, alpm_pkg_t **new_ptr)
 				_("could not fully load metadata for package %s-%s\n"),
 				pkg->name, pkg->version);
 		ret = 1;
-		pkg->handle->pm_errno = ALPM_ERR_PKG_INVALID;
+		PM_ERRNO(pkg->handle) = ALPM_ERR_PKG_INVALID;
 	}
 
 	CALLOC(newpkg, 1, sizeof(alpm_pkg_t), goto cleanup);
@@ -717,21 +717,40 @@ void _alpm_pkg_free(alpm_pkg_t *pkg)
 		return;
 	}
 
-	FREE(pkg->filename);
-	FREE(pkg->base);
-	FREE(pkg->name);
-	FREE(pkg->version);
-	FREE(pkg->desc);
-	FREE(pkg->url);
-	FREE(pkg->packager);
-	FREE(pkg->md5sum);
-	FREE(pkg->sha256sum);
-	FREE(pkg->base64_sig);
-	FREE(pkg->arch);
-
-	FREELIST(pkg->licenses);
-	free_deplist(pkg->replaces);
-	FREELIST(pkg->groups);
+	if(pkg->arena_backed) {
+		/* released in bulk along with the arena of the origin db */
+		alpm_list_free(pkg->licenses);
+		alpm_list_free(pkg->replaces);
+		alpm_list_free(pkg->groups);
+		alpm_list_free(pkg->depends);
+		alpm_list_free(pkg->optdepends);
+		alpm_list_free(pkg->checkdepends);
+		alpm_list_free(pkg->makedepends);
+		alpm_list_free(pkg->conflicts);
+		alpm_list_free(pkg->provides);
+	} else {
+		FREE(pkg->filename);
+		FREE(pkg->base);
+		FREE(pkg->name);
+		FREE(pkg->version);
+		FREE(pkg->desc);
+		FREE(pkg->url);
+		FREE(pkg->packager);
+		FREE(pkg->md5sum);
+		FREE(pkg->sha256sum);
+		FREE(pkg->base64_sig);
+		FREE(pkg->arch);
+
+		FREELIST(pkg->licenses);
+		free_deplist(pkg->replaces);
+		FREELIST(pkg->groups);
+		free_deplist(pkg->depends);
+		free_deplist(pkg->optdepends);
+		free_deplist(pkg->checkdepends);
+		free_deplist(pkg->makedepends);
+		free_deplist(pkg->conflicts);
+		free_deplist(pkg->provides);
+	}
 	if(pkg->files.count) {
 		size_t i;
 		for(i = 0; i < pkg->files.count; i++) {
@@ -743,14 +762,9 @@ void _alpm_pkg_free(alpm_pkg_t *pkg)
 	alpm_list_free(pkg->backup);
 	alpm_list_free_inner(pkg->xdata, (alpm_list_fn_free)_alpm_pkg_xdata_free);
 	alpm_list_free(pkg->xdata);
-	free_deplist(pkg->depends);
-	free_deplist(pkg->optdepends);
-	free_deplist(pkg->checkdepends);
-	free_deplist(pkg->makedepends);
-	free_deplist(pkg->conflicts);
-	free_deplist(pkg->provides);
 	alpm_list_free(pkg->removes);
 	_alpm_pkg_free(pkg->oldpkg);
+	free(pkg->download_digest);
 
 	if(pkg->origin == ALPM_PKG_FROM_FILE) {
 		FREE(pkg->origin_data.file);
@@ -778,6 +792,7 @@ void _alpm_pkg_free_trans(alpm_pkg_t *pkg)
 	pkg->removes = NULL;
 	_alpm_pkg_free(pkg->oldpkg);
 	pkg->oldpkg = NULL;
+	FREE(pkg->download_digest);
 }
 
 /* Is spkg an upgrade for localpkg? */
@@ -87,6 +87,8 @@ struct pkg_operations {
  */
 extern const struct pkg_operations default_pkg_ops;
 
+struct dload_digest;
+
 struct _alpm_pkg_t {
 	unsigned long name_hash;
 	char *filename;
@@ -122,10 +124,15 @@ struct _alpm_pkg_t {
 	alpm_list_t *provides;
 	alpm_list_t *removes; /* in transaction targets only */
 	alpm_pkg_t *oldpkg; /* in transaction targets only */
+	struct dload_digest *download_digest; /* in transaction targets only */
 
 	const struct pkg_operations *ops;
 
 	alpm_filelist_t files;
+	/* sync packages: location of the file list in the db files cache, see
+	 * _alpm_dbcache_files_load() */
+	size_t files_offset;
+	size_t files_count;
 
 	/* origin == PKG_FROM_FILE, use pkg->origin_data.file
 	 * origin == PKG_FROM_*DB, use pkg->origin_data.db */
@@ -144,6 +151,8 @@ struct _alpm_pkg_t {
 	int infolevel;
 	/* Bitfield from alpm_pkgvalidation_t */
 	int validation;
+	/* strings and dependencies are owned by origin_data.db->arena */
+	int arena_backed;
 };
 
 alpm_file_t *_alpm_file_copy(alpm_file_t *dest, const alpm_file_t *src);
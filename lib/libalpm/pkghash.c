@@ -18,141 +18,104 @@
  */
 
 #include <errno.h>
+#include <stdint.h>
 
 #include "pkghash.h"
 #include "util.h"
 
-/* List of primes for possible sizes of hash tables.
- *
- * The maximum table size is the last prime under 1,000,000.  That is
- * more than an order of magnitude greater than the number of packages
- * in any Linux distribution, and well under UINT_MAX.
- */
-static const unsigned int prime_list[] =
-{
-	11u, 13u, 17u, 19u, 23u, 29u, 31u, 37u, 41u, 43u, 47u,
-	53u, 59u, 61u, 67u, 71u, 73u, 79u, 83u, 89u, 97u, 103u,
-	109u, 113u, 127u, 137u, 139u, 149u, 157u, 167u, 179u, 193u,
-	199u, 211u, 227u, 241u, 257u, 277u, 293u, 313u, 337u, 359u,
-	383u, 409u, 439u, 467u, 503u, 541u, 577u, 619u, 661u, 709u,
-	761u, 823u, 887u, 953u, 1031u, 1109u, 1193u, 1289u, 1381u,
-	1493u, 1613u, 1741u, 1879u, 2029u, 2179u, 2357u, 2549u,
-	2753u, 2971u, 3209u, 3469u, 3739u, 4027u, 4349u, 4703u,
-	5087u, 5503u, 5953u, 6427u, 6949u, 7517u, 8123u, 8783u,
-	9497u, 10273u, 11113u, 12011u, 12983u, 14033u, 15173u,
-	16411u, 17749u, 19183u, 20753u, 22447u, 24281u, 26267u,
-	28411u, 30727u, 33223u, 35933u, 38873u, 42043u, 45481u,
-	49201u, 53201u, 57557u, 62233u, 67307u, 72817u, 78779u,
-	85229u, 92203u, 99733u, 107897u, 116731u, 126271u, 136607u,
-	147793u, 159871u, 172933u, 187091u, 202409u, 218971u, 236897u,
-	256279u, 277261u, 299951u, 324503u, 351061u, 379787u, 410857u,
-	444487u, 480881u, 520241u, 562841u, 608903u, 658753u, 712697u,
-	771049u, 834181u, 902483u, 976369u
-};
-
-/* How far forward do we look when linear probing for a spot? */
-static const unsigned int stride = 1;
+/* The maximum table size. That is more than an order of magnitude greater
+ * than the number of packages in any Linux distribution, and well under
+ * UINT_MAX. */
+static const unsigned int max_buckets = 1u << 21;
 /* What is the maximum load percentage of our hash table? */
 static const double max_hash_load = 0.68;
 /* Initial load percentage given a certain size */
 static const double initial_hash_load = 0.58;
 
+static int alloc_table(alpm_pkghash_t *hash, unsigned int size)
+{
+	unsigned int buckets = 16;
+
+	while(buckets <= size && buckets < max_buckets) {
+		buckets *= 2;
+	}
+	if(buckets <= size) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	CALLOC(hash->hash_table, buckets, sizeof(struct _alpm_pkghash_slot_t),
+			return -1);
+	hash->buckets = buckets;
+	hash->limit = buckets * max_hash_load;
+	return 0;
+}
+
 /* Allocate a hash table with space for at least "size" elements */
 alpm_pkghash_t *_alpm_pkghash_create(unsigned int size)
 {
 	alpm_pkghash_t *hash = NULL;
-	unsigned int i, loopsize;
 
 	CALLOC(hash, 1, sizeof(alpm_pkghash_t), return NULL);
-	size = size / initial_hash_load + 1;
-
-	loopsize = ARRAYSIZE(prime_list);
-	for(i = 0; i < loopsize; i++) {
-		if(prime_list[i] > size) {
-			hash->buckets = prime_list[i];
-			hash->limit = hash->buckets * max_hash_load;
-			break;
-		}
-	}
-
-	if(hash->buckets < size) {
-		errno = ERANGE;
+	if(alloc_table(hash, size / initial_hash_load + 1) != 0) {
 		free(hash);
 		return NULL;
 	}
 
-	CALLOC(hash->hash_table, hash->buckets, sizeof(alpm_list_t *), \
-				free(hash); return NULL);
-
 	return hash;
 }
 
+/* The home bucket of a name hash. sdbm does not mix its low bits well, so
+ * they are spread with a multiplicative hash before masking. */
+static unsigned int home_position(const alpm_pkghash_t *hash,
+		unsigned long name_hash)
+{
+	uint64_t h = (uint64_t)name_hash * UINT64_C(0x9E3779B97F4A7C15);
+	return (unsigned int)(h >> 32) & (hash->buckets - 1);
+}
+
+static unsigned int next_position(const alpm_pkghash_t *hash,
+		unsigned int position)
+{
+	return (position + 1) & (hash->buckets - 1);
+}
+
 static unsigned int get_hash_position(unsigned long name_hash,
 		alpm_pkghash_t *hash)
 {
-	unsigned int position;
-
-	position = name_hash % hash->buckets;
+	unsigned int position = home_position(hash, name_hash);
 
 	/* collision resolution using open addressing with linear probing */
-	while(hash->hash_table[position] != NULL) {
-		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
-		}
+	while(hash->hash_table[position].node != NULL) {
+		position = next_position(hash, position);
 	}
 
 	return position;
 }
 
-/* Expand the hash table size to the next increment and rebin the entries */
-static alpm_pkghash_t *rehash(alpm_pkghash_t *oldhash)
+/* Double the hash table size and rebin the entries */
+static alpm_pkghash_t *rehash(alpm_pkghash_t *hash)
 {
-	alpm_pkghash_t *newhash;
-	unsigned int newsize, i;
+	struct _alpm_pkghash_slot_t *old_table = hash->hash_table;
+	unsigned int old_buckets = hash->buckets, i;
 
 	/* Hash tables will need resized in two cases:
 	 *  - adding packages to the local database
-	 *  - poor estimation of the number of packages in sync database
-	 *
-	 * For small hash tables sizes (<500) the increase in size is by a
-	 * minimum of a factor of 2 for optimal rehash efficiency.  For
-	 * larger database sizes, this increase is reduced to avoid excess
-	 * memory allocation as both scenarios requiring a rehash should not
-	 * require a table size increase that large. */
-	if(oldhash->buckets < 500) {
-		newsize = oldhash->buckets * 2;
-	} else if(oldhash->buckets < 2000) {
-		newsize = oldhash->buckets * 3 / 2;
-	} else if(oldhash->buckets < 5000) {
-		newsize = oldhash->buckets * 4 / 3;
-	} else {
-		newsize = oldhash->buckets + 1;
-	}
-
-	newhash = _alpm_pkghash_create(newsize);
-	if(newhash == NULL) {
+	 *  - poor estimation of the number of packages in sync database */
+	if(alloc_table(hash, old_buckets) != 0) {
+		hash->hash_table = old_table;
 		return NULL;
 	}
 
-	newhash->list = oldhash->list;
-	oldhash->list = NULL;
-
-	for(i = 0; i < oldhash->buckets; i++) {
-		if(oldhash->hash_table[i] != NULL) {
-			alpm_pkg_t *package = oldhash->hash_table[i]->data;
-			unsigned int position = get_hash_position(package->name_hash, newhash);
-
-			newhash->hash_table[position] = oldhash->hash_table[i];
-			oldhash->hash_table[i] = NULL;
+	for(i = 0; i < old_buckets; i++) {
+		if(old_table[i].node != NULL) {
+			unsigned int position = get_hash_position(old_table[i].name_hash, hash);
+			hash->hash_table[position] = old_table[i];
 		}
 	}
 
-	newhash->entries = oldhash->entries;
-
-	_alpm_pkghash_free(oldhash);
-
-	return newhash;
+	free(old_table);
+	return hash;
 }
 
 static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg,
@@ -168,11 +131,10 @@ static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg
 	hash = *hashref;
 
 	if(hash->entries >= hash->limit) {
-		if((hash = rehash(hash)) == NULL) {
+		if(rehash(hash) == NULL) {
 			/* resizing failed and there are no more open buckets */
 			return NULL;
 		}
-		*hashref = hash;
 	}
 
 	position = get_hash_position(pkg->name_hash, hash);
@@ -183,7 +145,9 @@ static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg
 	ptr->prev = ptr;
 	ptr->next = NULL;
 
-	hash->hash_table[position] = ptr;
+	hash->hash_table[position].name_hash = pkg->name_hash;
+	hash->hash_table[position].pkg = pkg;
+	hash->hash_table[position].node = ptr;
 	if(!sorted) {
 		hash->list = alpm_list_join(hash->list, ptr);
 	} else {
@@ -204,33 +168,21 @@ alpm_pkghash_t *_alpm_pkghash_add_sorted(alpm_pkghash_t **hash, alpm_pkg_t *pkg)
 	return pkghash_add_pkg(hash, pkg, 1);
 }
 
-static unsigned int move_one_entry(alpm_pkghash_t *hash,
-		unsigned int start, unsigned int end)
+/* Find the slot holding a package with the given name, or -1 */
+static long find_position(alpm_pkghash_t *hash, unsigned long name_hash,
+		const char *name)
 {
-	/* Iterate backwards from 'end' to 'start', seeing if any of the items
-	 * would hash to 'start'. If we find one, we move it there and break.  If
-	 * we get all the way back to position and find none that hash to it, we
-	 * also end iteration. Iterating backwards helps prevent needless shuffles;
-	 * we will never need to move more than one item per function call.  The
-	 * return value is our current iteration location; if this is equal to
-	 * 'start' we can stop this madness. */
-	while(end != start) {
-		alpm_list_t *i = hash->hash_table[end];
-		alpm_pkg_t *info = i->data;
-		unsigned int new_position = get_hash_position(info->name_hash, hash);
-
-		if(new_position == start) {
-			hash->hash_table[start] = i;
-			hash->hash_table[end] = NULL;
-			break;
-		}
+	unsigned int position = home_position(hash, name_hash);
+	struct _alpm_pkghash_slot_t *slot;
 
-		/* the odd math ensures we are always positive, e.g.
-		 * e.g. (0 - 1) % 47      == -1
-		 * e.g. (47 + 0 - 1) % 47 == 46 */
-		end = (hash->buckets + end - stride) % hash->buckets;
+	while((slot = hash->hash_table + position)->node != NULL) {
+		if(slot->name_hash == name_hash && strcmp(slot->pkg->name, name) == 0) {
+			return position;
+		}
+		position = next_position(hash, position);
 	}
-	return end;
+
+	return -1;
 }
 
 /**
@@ -246,7 +198,8 @@ alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
 		alpm_pkg_t **data)
 {
 	alpm_list_t *i;
-	unsigned int position;
+	long found;
+	unsigned int hole, position;
 
 	if(data) {
 		*data = NULL;
@@ -256,54 +209,43 @@ alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
 		return hash;
 	}
 
-	position = pkg->name_hash % hash->buckets;
-	while((i = hash->hash_table[position]) != NULL) {
-		alpm_pkg_t *info = i->data;
-
-		if(info->name_hash == pkg->name_hash &&
-					strcmp(info->name, pkg->name) == 0) {
-			unsigned int stop, prev;
-
-			/* remove from list and hash */
-			hash->list = alpm_list_remove_item(hash->list, i);
-			if(data) {
-				*data = info;
-			}
-			hash->hash_table[position] = NULL;
-			free(i);
-			hash->entries -= 1;
-
-			/* Potentially move entries following removed entry to keep open
-			 * addressing collision resolution working. We start by finding the
-			 * next null bucket to know how far we have to look. */
-			stop = position + stride;
-			while(stop >= hash->buckets) {
-				stop -= hash->buckets;
-			}
-			while(hash->hash_table[stop] != NULL && stop != position) {
-				stop += stride;
-				while(stop >= hash->buckets) {
-					stop -= hash->buckets;
-				}
-			}
-			stop = (hash->buckets + stop - stride) % hash->buckets;
-
-			/* We now search backwards from stop to position. If we find an
-			 * item that now hashes to position, we will move it, and then try
-			 * to plug the new hole we just opened up, until we finally don't
-			 * move anything. */
-			while((prev = move_one_entry(hash, position, stop)) != position) {
-				position = prev;
-			}
-
-			return hash;
-		}
+	found = find_position(hash, pkg->name_hash, pkg->name);
+	if(found < 0) {
+		return hash;
+	}
+	hole = found;
 
-		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
+	/* remove from list and hash */
+	i = hash->hash_table[hole].node;
+	hash->list = alpm_list_remove_item(hash->list, i);
+	if(data) {
+		*data = i->data;
+	}
+	free(i);
+	hash->entries -= 1;
+
+	/* Shift back the following entries of the cluster that can not be
+	 * reached from their home bucket anymore, so no tombstone is needed. */
+	position = hole;
+	while(1) {
+		unsigned int home;
+
+		position = next_position(hash, position);
+		if(hash->hash_table[position].node == NULL) {
+			break;
+		}
+		home = home_position(hash, hash->hash_table[position].name_hash);
+		/* the entry stays if its home lies cyclically in (hole, position] */
+		if(hole <= position ? (hole < home && home <= position)
+				: (hole < home || home <= position)) {
+			continue;
 		}
+		hash->hash_table[hole] = hash->hash_table[position];
+		hole = position;
 	}
+	hash->hash_table[hole].name_hash = 0;
+	hash->hash_table[hole].pkg = NULL;
+	hash->hash_table[hole].node = NULL;
 
 	return hash;
 }
@@ -313,7 +255,7 @@ void _alpm_pkghash_free(alpm_pkghash_t *hash)
 	if(hash != NULL) {
 		unsigned int i;
 		for(i = 0; i < hash->buckets; i++) {
-			free(hash->hash_table[i]);
+			free(hash->hash_table[i].node);
 		}
 		free(hash->hash_table);
 	}
@@ -322,30 +264,16 @@ void _alpm_pkghash_free(alpm_pkghash_t *hash)
 
 alpm_pkg_t *_alpm_pkghash_find(alpm_pkghash_t *hash, const char *name)
 {
-	alpm_list_t *lp;
-	unsigned long name_hash;
-	unsigned int position;
+	long position;
 
 	if(name == NULL || hash == NULL) {
 		return NULL;
 	}
 
-	name_hash = _alpm_hash_sdbm(name);
-
-	position = name_hash % hash->buckets;
-
-	while((lp = hash->hash_table[position]) != NULL) {
-		alpm_pkg_t *info = lp->data;
-
-		if(info->name_hash == name_hash && strcmp(info->name, name) == 0) {
-			return info;
-		}
-
-		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
-		}
+	position = find_position(hash, _alpm_hash_sdbm(name), name);
+	if(position < 0) {
+		return NULL;
 	}
 
-	return NULL;
+	return hash->hash_table[position].pkg;
 }
@@ -26,6 +26,16 @@
 #include "alpm_list.h"
 
 
+/** A slot of the hash table, NULL node when empty */
+struct _alpm_pkghash_slot_t {
+	/** name_hash of the package, compared before touching the package */
+	unsigned long name_hash;
+	/** the package */
+	alpm_pkg_t *pkg;
+	/** the package's node in the list */
+	alpm_list_t *node;
+};
+
 /**
  * @brief A hash table for holding alpm_pkg_t objects.
  *
@@ -33,8 +43,8 @@
  * by package name but also iteration over the packages.
  */
 struct _alpm_pkghash_t {
-	/** data held by the hash table */
-	alpm_list_t **hash_table;
+	/** open addressed table with linear probing, size is a power of two */
+	struct _alpm_pkghash_slot_t *hash_table;
 	/** head node of the hash table data in normal list format */
 	alpm_list_t *list;
 	/** number of buckets in hash table */
@@ -29,6 +29,7 @@
 #include <dirent.h>
 #include <regex.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -268,41 +269,208 @@ int _alpm_remove_prepare(alpm_handle_t *handle, alpm_list_t **data)
 	return 0;
 }
 
+/* Number of open directory descriptors kept while removing a package. */
+#define DIRFD_CACHE_SIZE 16
+
+#ifdef O_PATH
+#define DIRFD_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIRFD_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+/* Package file lists are sorted, so removing them forward or backward visits
+ * every directory's entries in a single run. Rather than making the kernel
+ * walk each path from the root again, files are looked up relative to their
+ * parent directory, whose descriptor is kept in a small LRU cache keyed on
+ * its path below the root. */
+struct dirfd_entry {
+	char *path;
+	size_t len;
+	int fd;
+	unsigned long used;
+};
+
+struct dirfd_cache {
+	alpm_handle_t *handle;
+	int rootfd;
+	unsigned long tick;
+	struct dirfd_entry entries[DIRFD_CACHE_SIZE];
+};
+
+static int dirfd_cache_init(alpm_handle_t *handle, struct dirfd_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->handle = handle;
+	OPEN(cache->rootfd, handle->root, DIRFD_FLAGS);
+	if(cache->rootfd < 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not open directory: %s: %s\n"),
+				handle->root, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void dirfd_entry_close(struct dirfd_entry *entry)
+{
+	if(entry->path) {
+		close(entry->fd);
+		FREE(entry->path);
+	}
+}
+
+static void dirfd_cache_free(struct dirfd_cache *cache)
+{
+	int i;
+	for(i = 0; i < DIRFD_CACHE_SIZE; i++) {
+		dirfd_entry_close(cache->entries + i);
+	}
+	if(cache->rootfd >= 0) {
+		close(cache->rootfd);
+	}
+}
+
+/**
+ * @brief Get a descriptor for a directory below the root.
+ *
+ * @param cache the directory cache
+ * @param path directory relative to the root, including a trailing '/', or
+ * the empty string for the root itself
+ * @param len length of @a path
+ *
+ * @return a descriptor owned by the cache, -1 on error with errno set
+ */
+static int dirfd_cache_get(struct dirfd_cache *cache, const char *path,
+		size_t len)
+{
+	struct dirfd_entry *entry = NULL;
+	size_t parent_len;
+	char *name;
+	int i, parentfd, fd;
+
+	if(len == 0) {
+		return cache->rootfd;
+	}
+
+	for(i = 0; i < DIRFD_CACHE_SIZE; i++) {
+		struct dirfd_entry *e = cache->entries + i;
+		if(e->path && e->len == len && memcmp(e->path, path, len) == 0) {
+			e->used = ++cache->tick;
+			return e->fd;
+		}
+	}
+
+	/* open the directory relative to its parent, which is most likely cached
+	 * as well since its other entries have just been visited */
+	for(parent_len = len - 1; parent_len > 0 && path[parent_len - 1] != '/';
+			parent_len--);
+	if((parentfd = dirfd_cache_get(cache, path, parent_len)) < 0) {
+		return -1;
+	}
+
+	STRNDUP(name, path + parent_len, len - parent_len - 1,
+			RET_ERR(cache->handle, ALPM_ERR_MEMORY, -1));
+	OPENAT(fd, parentfd, name, DIRFD_FLAGS);
+	free(name);
+	if(fd < 0) {
+		return -1;
+	}
+
+	for(i = 0; i < DIRFD_CACHE_SIZE; i++) {
+		struct dirfd_entry *e = cache->entries + i;
+		if(!e->path) {
+			entry = e;
+			break;
+		}
+		if(!entry || e->used < entry->used) {
+			entry = e;
+		}
+	}
+	dirfd_entry_close(entry);
+	STRNDUP(entry->path, path, len, close(fd);
+			RET_ERR(cache->handle, ALPM_ERR_MEMORY, -1));
+	entry->len = len;
+	entry->fd = fd;
+	entry->used = ++cache->tick;
+	return fd;
+}
+
+/**
+ * @brief Drop a removed directory and everything below it from the cache.
+ *
+ * @param cache the directory cache
+ * @param path directory relative to the root, including a trailing '/'
+ */
+static void dirfd_cache_evict(struct dirfd_cache *cache, const char *path)
+{
+	size_t len = strlen(path);
+	int i;
+
+	for(i = 0; i < DIRFD_CACHE_SIZE; i++) {
+		struct dirfd_entry *e = cache->entries + i;
+		if(e->path && e->len >= len && memcmp(e->path, path, len) == 0) {
+			dirfd_entry_close(e);
+		}
+	}
+}
+
+/**
+ * @brief Look up the parent directory of a package file.
+ *
+ * @param cache the directory cache
+ * @param name file path relative to the root, directories include a trailing
+ * '/'
+ * @param base set to the file name within its parent, including the trailing
+ * '/' of directories
+ *
+ * @return a descriptor owned by the cache, -1 on error with errno set
+ */
+static int dirfd_cache_parent(struct dirfd_cache *cache, const char *name,
+		const char **base)
+{
+	size_t len = strlen(name);
+
+	if(len > 0 && name[len - 1] == '/') {
+		len--;
+	}
+	while(len > 0 && name[len - 1] != '/') {
+		len--;
+	}
+	*base = name + len;
+	return dirfd_cache_get(cache, name, len);
+}
+
 /**
  * @brief Test if a directory is being used as a mountpoint.
  *
- * @param handle context handle
- * @param directory path to test, must be absolute and include trailing '/'
+ * @param cache the directory cache
+ * @param directory path to test relative to the root, must include trailing
+ * '/'
  * @param stbuf stat result for @a directory, may be NULL
  *
  * @return 0 if @a directory is not a mountpoint or on error, 1 if @a directory
  * is a mountpoint
  */
-static int dir_is_mountpoint(alpm_handle_t *handle, const char *directory,
+static int dir_is_mountpoint(struct dirfd_cache *cache, const char *directory,
 		const struct stat *stbuf)
 {
-	char parent_dir[PATH_MAX];
-	struct stat parent_stbuf;
+	alpm_handle_t *handle = cache->handle;
+	struct stat dir_stbuf, parent_stbuf;
 	dev_t dir_st_dev;
+	int fd;
 
-	if(stbuf == NULL) {
-		struct stat dir_stbuf;
-		if(stat(directory, &dir_stbuf) < 0) {
-			_alpm_log(handle, ALPM_LOG_DEBUG,
-					"failed to stat directory %s: %s\n",
-					directory, strerror(errno));
-			return 0;
-		}
-		dir_st_dev = dir_stbuf.st_dev;
-	} else {
-		dir_st_dev = stbuf->st_dev;
+	fd = dirfd_cache_get(cache, directory, strlen(directory));
+	if(fd < 0 || (stbuf == NULL && fstat(fd, &dir_stbuf) < 0)) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"failed to stat directory %s%s: %s\n",
+				handle->root, directory, strerror(errno));
+		return 0;
 	}
+	dir_st_dev = stbuf ? stbuf->st_dev : dir_stbuf.st_dev;
 
-	snprintf(parent_dir, PATH_MAX, "%s..", directory);
-	if(stat(parent_dir, &parent_stbuf) < 0) {
+	if(fstatat(fd, "..", &parent_stbuf, 0) < 0) {
 		_alpm_log(handle, ALPM_LOG_DEBUG,
-				"failed to stat parent of %s: %s: %s\n",
-				directory, parent_dir, strerror(errno));
+				"failed to stat parent of %s%s: %s\n",
+				handle->root, directory, strerror(errno));
 		return 0;
 	}
 
@@ -312,31 +480,41 @@ static int dir_is_mountpoint(alpm_handle_t *handle, const char *directory,
 /**
  * @brief Check if alpm can delete a file.
  *
- * @param handle the context handle
+ * @param cache the directory cache
  * @param file file to be removed
  *
  * @return 1 if the file can be deleted, 0 if it cannot be deleted
  */
-static int can_remove_file(alpm_handle_t *handle, const alpm_file_t *file)
+static int can_remove_file(struct dirfd_cache *cache, const alpm_file_t *file)
 {
-	char filepath[PATH_MAX];
-
-	snprintf(filepath, PATH_MAX, "%s%s", handle->root, file->name);
+	alpm_handle_t *handle = cache->handle;
+	const char *base;
+	int fd;
 
 	if(file->name[strlen(file->name) - 1] == '/' &&
-			dir_is_mountpoint(handle, filepath, NULL)) {
+			dir_is_mountpoint(cache, file->name, NULL)) {
 		/* we do not remove mountpoints */
 		return 1;
 	}
 
+	/* a missing or inaccessible parent is covered somewhere else, the same as
+	 * the file itself */
+	if((fd = dirfd_cache_parent(cache, file->name, &base)) < 0) {
+		return 1;
+	}
+
 	/* If we fail write permissions due to a read-only filesystem, abort.
 	 * Assume all other possible failures are covered somewhere else */
-	if(_alpm_access(handle, NULL, filepath, W_OK) == -1) {
-		if(errno != EACCES && errno != ETXTBSY && _alpm_access(handle, NULL, filepath, F_OK) == 0) {
+	if(faccessat(fd, base, W_OK, AT_SYMLINK_NOFOLLOW) == -1) {
+		if(errno != EACCES && errno != ETXTBSY
+				&& faccessat(fd, base, F_OK, AT_SYMLINK_NOFOLLOW) == 0) {
 			/* only return failure if the file ACTUALLY exists and we can't write to
 			 * it - ignore "chmod -w" simple permission failures */
+			char filepath[PATH_MAX];
+			int errsv = errno;
+			snprintf(filepath, PATH_MAX, "%s%s", handle->root, file->name);
 			_alpm_log(handle, ALPM_LOG_ERROR, _("cannot remove file '%s': %s\n"),
-					filepath, strerror(errno));
+					filepath, strerror(errsv));
 			return 0;
 		}
 	}
@@ -429,7 +607,7 @@ cleanup:
 /**
  * @brief Unlink a package file, backing it up if necessary.
  *
- * @param handle the context handle
+ * @param cache the directory cache
  * @param oldpkg the package being removed
  * @param newpkg the package replacing \a oldpkg
  * @param fileobj file to remove
@@ -438,12 +616,16 @@ cleanup:
  * @return 0 on success, -1 if there was an error unlinking the file, 1 if the
  * file was skipped or did not exist
  */
-static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
+static int unlink_file(struct dirfd_cache *cache, alpm_pkg_t *oldpkg,
 		alpm_pkg_t *newpkg, const alpm_file_t *fileobj, int nosave)
 {
+	alpm_handle_t *handle = cache->handle;
 	struct stat buf;
 	char file[PATH_MAX];
-	int file_len;
+	char base[PATH_MAX];
+	const char *name;
+	int file_len, fd;
+	size_t base_len;
 
 	file_len = snprintf(file, PATH_MAX, "%s%s", handle->root, fileobj->name);
 	if(file_len <= 0 || file_len >= PATH_MAX) {
@@ -458,7 +640,15 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 		file_len--;
 	}
 
-	if(llstat(file, &buf)) {
+	/* trailing slashes are dropped from the name within the parent as well */
+	fd = dirfd_cache_parent(cache, fileobj->name, &name);
+	base_len = strlen(name);
+	memcpy(base, name, base_len + 1);
+	if(base_len > 0 && base[base_len - 1] == '/') {
+		base[base_len - 1] = '\0';
+	}
+
+	if(fd < 0 || fstatat(fd, base, &buf, AT_SYMLINK_NOFOLLOW)) {
 		_alpm_log(handle, ALPM_LOG_DEBUG, "file %s does not exist\n", file);
 		return 1;
 	}
@@ -477,7 +667,7 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 			return -1;
 		}
 
-		files = _alpm_files_in_directory(handle, file, 0);
+		files = _alpm_files_in_directory_at(handle, fd, base, 0);
 		if(files > 0) {
 			/* if we have files, no need to remove the directory */
 			_alpm_log(handle, ALPM_LOG_DEBUG, "keeping directory %s (contains files)\n",
@@ -489,17 +679,16 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 					fileobj->name)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG,
 					"keeping directory %s (in new package)\n", file);
-		} else if(dir_is_mountpoint(handle, file, &buf)) {
+		} else if(dir_is_mountpoint(cache, fileobj->name, &buf)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG,
 					"keeping directory %s (mountpoint)\n", file);
 		} else {
 			/* one last check- does any other package own this file? */
-			alpm_list_t *local, *local_pkgs;
+			alpm_list_t *local;
 			int found = 0;
-			local_pkgs = _alpm_db_get_pkgcache(handle->db_local);
-			for(local = local_pkgs; local && !found; local = local->next) {
+			local = _alpm_db_find_file_owners(handle->db_local, fileobj->name);
+			for(; local && !found; local = local->next) {
 				alpm_pkg_t *local_pkg = local->data;
-				alpm_filelist_t *filelist;
 
 				/* we duplicated the package when we put it in the removal list, so we
 				 * so we can't use direct pointer comparison here. */
@@ -507,15 +696,13 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 						&& strcmp(oldpkg->name, local_pkg->name) == 0) {
 					continue;
 				}
-				filelist = alpm_pkg_get_files(local_pkg);
-				if(alpm_filelist_contains(filelist, fileobj->name)) {
-					_alpm_log(handle, ALPM_LOG_DEBUG,
-							"keeping directory %s (owned by %s)\n", file, local_pkg->name);
-					found = 1;
-				}
+				_alpm_log(handle, ALPM_LOG_DEBUG,
+						"keeping directory %s (owned by %s)\n", file, local_pkg->name);
+				found = 1;
 			}
 			if(!found) {
-				if(rmdir(file)) {
+				dirfd_cache_evict(cache, fileobj->name);
+				if(unlinkat(fd, base, AT_REMOVEDIR)) {
 					_alpm_log(handle, ALPM_LOG_DEBUG,
 							"directory removal of %s failed: %s\n", file, strerror(errno));
 					return -1;
@@ -532,7 +719,7 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 			if(nosave) {
 				_alpm_log(handle, ALPM_LOG_DEBUG, "transaction is set to NOSAVE, not backing up '%s'\n", file);
 			} else {
-				char *filehash = alpm_compute_md5sum(file);
+				char *filehash = _alpm_trans_file_md5(handle, file);
 				int cmp = filehash ? strcmp(filehash, backup->hash) : 0;
 				FREE(filehash);
 				if(cmp != 0) {
@@ -566,7 +753,7 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 
 		_alpm_log(handle, ALPM_LOG_DEBUG, "unlinking %s\n", file);
 
-		if(unlink(file) == -1) {
+		if(unlinkat(fd, base, 0) == -1) {
 			_alpm_log(handle, ALPM_LOG_ERROR, _("cannot remove %s (%s)\n"),
 					file, strerror(errno));
 			alpm_logaction(handle, ALPM_CALLER_PREFIX,
@@ -614,17 +801,23 @@ static int remove_package_files(alpm_handle_t *handle,
 {
 	alpm_filelist_t *filelist;
 	size_t i;
+	struct dirfd_cache cache;
 	int err = 0;
 	int nosave = handle->trans->flags & ALPM_TRANS_FLAG_NOSAVE;
 
+	if(dirfd_cache_init(handle, &cache) != 0) {
+		RET_ERR(handle, ALPM_ERR_PKG_CANT_REMOVE, -1);
+	}
+
 	filelist = alpm_pkg_get_files(oldpkg);
 	for(i = 0; i < filelist->count; i++) {
 		alpm_file_t *file = filelist->files + i;
 		if(!should_skip_file(handle, newpkg, file->name)
-				&& !can_remove_file(handle, file)) {
+				&& !can_remove_file(&cache, file)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG,
 					"not removing package '%s', can't remove all files\n",
 					oldpkg->name);
+			dirfd_cache_free(&cache);
 			RET_ERR(handle, ALPM_ERR_PKG_CANT_REMOVE, -1);
 		}
 	}
@@ -650,7 +843,7 @@ static int remove_package_files(alpm_handle_t *handle,
 			continue;
 		}
 
-		if(unlink_file(handle, oldpkg, newpkg, file, nosave) < 0) {
+		if(unlink_file(&cache, oldpkg, newpkg, file, nosave) < 0) {
 			err++;
 		}
 
@@ -662,6 +855,8 @@ static int remove_package_files(alpm_handle_t *handle,
 		}
 	}
 
+	dirfd_cache_free(&cache);
+
 	if(!newpkg) {
 		/* set progress to 100% after we finish unlinking files */
 		PROGRESS(handle, ALPM_PROGRESS_REMOVE_START, oldpkg->name, 100,
@@ -780,7 +975,7 @@ int _alpm_remove_packages(alpm_handle_t *handle, int run_ldconfig)
 
 		if(_alpm_remove_single_package(handle, pkg, NULL,
 					targ_count, pkg_count) == -1) {
-			handle->pm_errno = ALPM_ERR_TRANS_ABORT;
+			PM_ERRNO(handle) = ALPM_ERR_TRANS_ABORT;
 			/* running ldconfig at this point could possibly screw system */
 			run_ldconfig = 0;
 			ret = -1;
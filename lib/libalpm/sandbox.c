@@ -20,14 +20,55 @@
 #include <errno.h>
 #include <grp.h>
 #include <pwd.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "alpm.h"
+#include "dload.h"
+#include "handle.h"
 #include "log.h"
 #include "sandbox.h"
 #include "util.h"
 
+/* Wire format of a batch of downloads: a batch header and the download
+ * directory, then for each payload a payload header, its names and urls
+ * and its servers. Strings are a length followed by the bytes, without a
+ * terminator. */
+#define SANDBOX_STRING_NULL UINT32_MAX
+
+struct sandbox_batch_header {
+	uint32_t count;
+	uint32_t parallel_downloads;
+	int64_t segmented_download_size;
+	int32_t download_order;
+	int32_t disable_dl_timeout;
+	uint32_t max_host_connections;
+	int32_t host_stats;
+};
+
+struct sandbox_payload_header {
+	int64_t max_size;
+	int32_t force;
+	int32_t allow_resume;
+	int32_t errors_ok;
+	int32_t unlink_on_fail;
+	int32_t download_signature;
+	int32_t signature_optional;
+	uint32_t cache_servers;
+	uint32_t servers;
+	uint32_t reserved;
+};
+
+/* A growable buffer a batch is written to before it is sent */
+struct sandbox_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+	bool failed;
+};
+
 int SYMEXPORT alpm_sandbox_setup_child(const char* sandboxuser)
 {
 	struct passwd const *pw = NULL;
@@ -134,7 +175,8 @@ void _alpm_sandbox_cb_dl(void *ctx, const char *filename, alpm_download_event_ty
 	}
 
 	ASSERT(filename != NULL, return);
-	ASSERT(event == ALPM_DOWNLOAD_INIT || event == ALPM_DOWNLOAD_PROGRESS || event == ALPM_DOWNLOAD_RETRY || event == ALPM_DOWNLOAD_COMPLETED, return);
+	ASSERT(event == ALPM_DOWNLOAD_INIT || event == ALPM_DOWNLOAD_PROGRESS || event == ALPM_DOWNLOAD_RETRY || event == ALPM_DOWNLOAD_COMPLETED
+			|| event == ALPM_DOWNLOAD_HOST_STATS, return);
 
 	filename_len = strlen(filename);
 
@@ -153,11 +195,28 @@ void _alpm_sandbox_cb_dl(void *ctx, const char *filename, alpm_download_event_ty
 		case ALPM_DOWNLOAD_COMPLETED:
 			write_to_pipe(context->callback_pipe, data, sizeof(alpm_download_event_completed_t));
 			break;
+		case ALPM_DOWNLOAD_HOST_STATS:
+			write_to_pipe(context->callback_pipe, data, sizeof(alpm_download_event_host_stats_t));
+			break;
 	}
 	write_to_pipe(context->callback_pipe, &filename_len, sizeof(filename_len));
 	write_to_pipe(context->callback_pipe, filename, filename_len);
 }
 
+/* Tells the parent that the download worker has finished a batch */
+void _alpm_sandbox_cb_done(void *ctx, int result)
+{
+	_alpm_sandbox_callback_t type = ALPM_SANDBOX_CB_DONE;
+	_alpm_sandbox_callback_context *context = ctx;
+
+	if(!context || context->callback_pipe == -1) {
+		return;
+	}
+
+	write_to_pipe(context->callback_pipe, &type, sizeof(type));
+	write_to_pipe(context->callback_pipe, &result, sizeof(result));
+}
+
 
 bool _alpm_sandbox_process_cb_log(alpm_handle_t *handle, int callback_pipe) {
 	alpm_loglevel_t level;
@@ -186,6 +245,7 @@ bool _alpm_sandbox_process_cb_download(alpm_handle_t *handle, int callback_pipe)
 		alpm_download_event_progress_t progress;
 		alpm_download_event_retry_t retry;
 		alpm_download_event_completed_t completed;
+		alpm_download_event_host_stats_t host_stats;
 	} cb_data;
 
 	ASSERT(read_from_pipe(callback_pipe, &type, sizeof(type)) != -1, return false);
@@ -207,6 +267,10 @@ bool _alpm_sandbox_process_cb_download(alpm_handle_t *handle, int callback_pipe)
 			cb_data_size = sizeof(alpm_download_event_completed_t);
 			ASSERT(read_from_pipe(callback_pipe, &cb_data.completed, cb_data_size) != -1, return false);
 			break;
+		case ALPM_DOWNLOAD_HOST_STATS:
+			cb_data_size = sizeof(alpm_download_event_host_stats_t);
+			ASSERT(read_from_pipe(callback_pipe, &cb_data.host_stats, cb_data_size) != -1, return false);
+			break;
 		default:
 			return false;
 	}
@@ -222,3 +286,224 @@ bool _alpm_sandbox_process_cb_download(alpm_handle_t *handle, int callback_pipe)
 	FREE(filename);
 	return true;
 }
+
+bool _alpm_sandbox_process_cb_done(int callback_pipe, int *result) {
+	ASSERT(read_from_pipe(callback_pipe, result, sizeof(*result)) != -1, return false);
+	return true;
+}
+
+
+static void buffer_append(struct sandbox_buffer *buf, const void *data, size_t len)
+{
+	if(buf->failed) {
+		return;
+	}
+	if(!_alpm_greedy_grow((void **)&buf->data, &buf->size, buf->len + len)) {
+		buf->failed = true;
+		return;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void buffer_append_string(struct sandbox_buffer *buf, const char *str)
+{
+	uint32_t len = str ? strlen(str) : SANDBOX_STRING_NULL;
+
+	buffer_append(buf, &len, sizeof(len));
+	if(str) {
+		buffer_append(buf, str, len);
+	}
+}
+
+static void buffer_append_list(struct sandbox_buffer *buf, alpm_list_t *list)
+{
+	for(; list; list = list->next) {
+		buffer_append_string(buf, list->data);
+	}
+}
+
+static int read_string(int fd, char **str)
+{
+	uint32_t len;
+
+	*str = NULL;
+	if(read_from_pipe(fd, &len, sizeof(len)) != 0) {
+		return -1;
+	}
+	if(len == SANDBOX_STRING_NULL) {
+		return 0;
+	}
+	MALLOC(*str, (size_t)len + 1, return -1);
+	if(len > 0 && read_from_pipe(fd, *str, len) != 0) {
+		FREE(*str);
+		return -1;
+	}
+	(*str)[len] = '\0';
+	return 0;
+}
+
+static int read_list(int fd, uint32_t count, alpm_list_t **list)
+{
+	*list = NULL;
+	while(count-- > 0) {
+		char *str;
+		if(read_string(fd, &str) != 0 || str == NULL) {
+			return -1;
+		}
+		*list = alpm_list_add(*list, str);
+	}
+	return 0;
+}
+
+/** Send a batch of downloads to a sandboxed download worker.
+ * Only what the worker needs to fetch the files is sent, together with the
+ * download options of the handle, which may have changed since the worker
+ * was started.
+ * @param handle the context handle
+ * @param fd socket of the worker
+ * @param payloads the payloads to download
+ * @param localpath directory to download to
+ * @return true if the batch was sent
+ */
+bool _alpm_sandbox_send_batch(alpm_handle_t *handle, int fd,
+		alpm_list_t *payloads, const char *localpath)
+{
+	struct sandbox_buffer buf = {0};
+	struct sandbox_batch_header hdr;
+	alpm_list_t *i;
+	size_t sent = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.count = alpm_list_count(payloads);
+	hdr.parallel_downloads = handle->parallel_downloads;
+	hdr.segmented_download_size = handle->segmented_download_size;
+	hdr.download_order = handle->download_order;
+	hdr.disable_dl_timeout = handle->disable_dl_timeout;
+	hdr.max_host_connections = handle->max_host_connections;
+	hdr.host_stats = handle->host_stats;
+	buffer_append(&buf, &hdr, sizeof(hdr));
+	buffer_append_string(&buf, localpath);
+
+	for(i = payloads; i; i = i->next) {
+		struct dload_payload *payload = i->data;
+		struct sandbox_payload_header phdr;
+
+		memset(&phdr, 0, sizeof(phdr));
+		phdr.max_size = payload->max_size;
+		phdr.force = payload->force;
+		phdr.allow_resume = payload->allow_resume;
+		phdr.errors_ok = payload->errors_ok;
+		phdr.unlink_on_fail = payload->unlink_on_fail;
+		phdr.download_signature = payload->download_signature;
+		phdr.signature_optional = payload->signature_optional;
+		phdr.cache_servers = alpm_list_count(payload->cache_servers);
+		phdr.servers = alpm_list_count(payload->servers);
+		buffer_append(&buf, &phdr, sizeof(phdr));
+		buffer_append_string(&buf, payload->remote_name);
+		buffer_append_string(&buf, payload->tempfile_name);
+		buffer_append_string(&buf, payload->destfile_name);
+		buffer_append_string(&buf, payload->fileurl);
+		buffer_append_string(&buf, payload->filepath);
+		buffer_append_list(&buf, payload->cache_servers);
+		buffer_append_list(&buf, payload->servers);
+	}
+
+	if(buf.failed) {
+		free(buf.data);
+		RET_ERR(handle, ALPM_ERR_MEMORY, false);
+	}
+
+	/* the worker may be gone, which must not raise SIGPIPE */
+	while(sent < buf.len) {
+		ssize_t r = send(fd, buf.data + sent, buf.len - sent, MSG_NOSIGNAL);
+		if(r < 0) {
+			if(should_retry(errno)) {
+				continue;
+			}
+			break;
+		}
+		sent += r;
+	}
+	free(buf.data);
+	return sent == buf.len;
+}
+
+/** Receive a batch of downloads in a sandboxed download worker.
+ * The download options of the batch are applied to the handle.
+ * @param handle the context handle of the worker
+ * @param fd socket to the parent
+ * @param batch the batch to fill, freed with _alpm_sandbox_batch_free()
+ * @return true if a batch was received, false on errors or once the parent
+ * has closed the socket
+ */
+bool _alpm_sandbox_recv_batch(alpm_handle_t *handle, int fd,
+		_alpm_sandbox_batch *batch)
+{
+	struct sandbox_batch_header hdr;
+	uint32_t i;
+
+	memset(batch, 0, sizeof(*batch));
+	if(read_from_pipe(fd, &hdr, sizeof(hdr)) != 0
+			|| read_string(fd, &batch->localpath) != 0 || batch->localpath == NULL) {
+		goto error;
+	}
+
+	handle->parallel_downloads = hdr.parallel_downloads;
+	handle->segmented_download_size = hdr.segmented_download_size;
+	handle->download_order = hdr.download_order;
+	handle->disable_dl_timeout = hdr.disable_dl_timeout;
+	handle->max_host_connections = hdr.max_host_connections;
+	handle->host_stats = hdr.host_stats;
+
+	for(i = 0; i < hdr.count; i++) {
+		struct sandbox_payload_header phdr;
+		struct dload_payload *payload;
+
+		CALLOC(payload, 1, sizeof(*payload), goto error);
+		batch->payloads = alpm_list_add(batch->payloads, payload);
+		payload->handle = handle;
+
+		if(read_from_pipe(fd, &phdr, sizeof(phdr)) != 0
+				|| read_string(fd, &payload->remote_name) != 0
+				|| read_string(fd, &payload->tempfile_name) != 0
+				|| read_string(fd, &payload->destfile_name) != 0
+				|| read_string(fd, &payload->fileurl) != 0
+				|| read_string(fd, &payload->filepath) != 0
+				|| read_list(fd, phdr.cache_servers, &payload->cache_servers) != 0
+				|| (batch->server_lists = alpm_list_add(batch->server_lists,
+						payload->cache_servers)) == NULL
+				|| read_list(fd, phdr.servers, &payload->servers) != 0
+				|| (batch->server_lists = alpm_list_add(batch->server_lists,
+						payload->servers)) == NULL) {
+			goto error;
+		}
+		payload->max_size = phdr.max_size;
+		payload->force = phdr.force;
+		payload->allow_resume = phdr.allow_resume;
+		payload->errors_ok = phdr.errors_ok;
+		payload->unlink_on_fail = phdr.unlink_on_fail;
+		payload->download_signature = phdr.download_signature;
+		payload->signature_optional = phdr.signature_optional;
+	}
+
+	return true;
+
+error:
+	_alpm_sandbox_batch_free(batch);
+	return false;
+}
+
+void _alpm_sandbox_batch_free(_alpm_sandbox_batch *batch)
+{
+	alpm_list_t *i;
+
+	alpm_list_free_inner(batch->payloads, (alpm_list_fn_free)_alpm_dload_payload_reset);
+	FREELIST(batch->payloads);
+	for(i = batch->server_lists; i; i = i->next) {
+		alpm_list_t *servers = i->data;
+		FREELIST(servers);
+	}
+	alpm_list_free(batch->server_lists);
+	FREE(batch->localpath);
+}
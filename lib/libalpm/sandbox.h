@@ -26,7 +26,8 @@
 /* The type of callbacks that can happen during a sandboxed operation */
 typedef enum {
 	ALPM_SANDBOX_CB_LOG,
-	ALPM_SANDBOX_CB_DOWNLOAD
+	ALPM_SANDBOX_CB_DOWNLOAD,
+	ALPM_SANDBOX_CB_DONE
 } _alpm_sandbox_callback_t;
 
 typedef struct {
@@ -41,11 +42,29 @@ void _alpm_sandbox_cb_log(void *ctx, alpm_loglevel_t level, const char *fmt, va_
 
 void _alpm_sandbox_cb_dl(void *ctx, const char *filename, alpm_download_event_type_t event, void *data);
 
+void _alpm_sandbox_cb_done(void *ctx, int result);
+
 
 /* Functions to capture sandbox callbacks and convert them to alpm callbacks */
 
 bool _alpm_sandbox_process_cb_log(alpm_handle_t *handle, int callback_pipe);
 bool _alpm_sandbox_process_cb_download(alpm_handle_t *handle, int callback_pipe);
+bool _alpm_sandbox_process_cb_done(int callback_pipe, int *result);
+
+
+/* Batches of downloads handed to a persistent sandboxed download worker */
+
+typedef struct {
+	char *localpath;
+	alpm_list_t *payloads; /* struct dload_payload */
+	alpm_list_t *server_lists; /* server lists of the payloads */
+} _alpm_sandbox_batch;
+
+bool _alpm_sandbox_send_batch(alpm_handle_t *handle, int fd,
+		alpm_list_t *payloads, const char *localpath);
+bool _alpm_sandbox_recv_batch(alpm_handle_t *handle, int fd,
+		_alpm_sandbox_batch *batch);
+void _alpm_sandbox_batch_free(_alpm_sandbox_batch *batch);
 
 
 #endif /* ALPM_SANDBOX_H */
@@ -23,6 +23,9 @@
 
 #ifdef HAVE_LIBGPGME
 #include <locale.h> /* setlocale() */
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 #include <gpgme.h>
 #endif
 
@@ -135,29 +138,17 @@ static alpm_list_t *list_sigsum(gpgme_sigsum_t sigsum)
 	return summary;
 }
 
-/**
- * Initialize the GPGME library.
- * This can be safely called multiple times; however it is not thread-safe.
- * @param handle the context handle
- * @return 0 on success, -1 on error
- */
-static int init_gpgme(alpm_handle_t *handle)
+static int do_init_gpgme(alpm_handle_t *handle)
 {
-	static int init = 0;
 	const char *version, *sigdir;
 	gpgme_error_t gpg_err;
 	gpgme_engine_info_t enginfo;
 
-	if(init) {
-		/* we already successfully initialized the library */
-		return 0;
-	}
-
 	sigdir = handle->gpgdir;
 
 	if(_alpm_access(handle, sigdir, "pubring.gpg", R_OK)
 			|| _alpm_access(handle, sigdir, "trustdb.gpg", R_OK)) {
-		handle->pm_errno = ALPM_ERR_NOT_A_FILE;
+		PM_ERRNO(handle) = ALPM_ERR_NOT_A_FILE;
 		_alpm_log(handle, ALPM_LOG_DEBUG, "Signature verification will fail!\n");
 		_alpm_log(handle, ALPM_LOG_WARNING,
 				_("Public keyring not found; have you run '%s'?\n"),
@@ -192,7 +183,6 @@ static int init_gpgme(alpm_handle_t *handle)
 	_alpm_log(handle, ALPM_LOG_DEBUG, "GPGME engine info: file=%s, home=%s\n",
 			enginfo->file_name, enginfo->home_dir);
 
-	init = 1;
 	return 0;
 
 gpg_error:
@@ -200,6 +190,177 @@ gpg_error:
 	RET_ERR(handle, ALPM_ERR_GPGME, -1);
 }
 
+/* Steps of signature verification whose cost is recorded by a session */
+enum {
+	SESSION_STEP_INIT = 0,
+	SESSION_STEP_KEYLIST,
+	SESSION_STEP_VERIFY,
+	SESSION_STEP_COUNT
+};
+
+static const char *const session_step_names[SESSION_STEP_COUNT] = {
+	"context setup", "key lookup", "signature check"
+};
+
+/* Signature verification state shared by all checks made with a handle.
+ * A gpgme context may only be used by one thread at a time, so contexts are
+ * handed out to one caller at a time and kept for reuse afterwards. */
+typedef struct _alpm_gpgme_session_t {
+	pthread_mutex_t lock;
+	alpm_list_t *idle; /* gpgme_ctx_t not currently in use */
+	struct {
+		uint64_t ns;
+		size_t count;
+	} steps[SESSION_STEP_COUNT];
+} alpm_gpgme_session_t;
+
+static uint64_t session_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void session_account(alpm_handle_t *handle, int step, uint64_t start)
+{
+	alpm_gpgme_session_t *session = handle->gpgme_session;
+	uint64_t end = session_clock();
+
+	pthread_mutex_lock(&session->lock);
+	session->steps[step].ns += end - start;
+	session->steps[step].count++;
+	pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Initialize the GPGME library and the verification session of a handle.
+ * This can be safely called multiple times, also from several threads.
+ * @param handle the context handle
+ * @return 0 on success, -1 on error
+ */
+static int init_gpgme(alpm_handle_t *handle)
+{
+	static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+	static int init = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&init_lock);
+	if(!init) {
+		ret = do_init_gpgme(handle);
+		/* once successful the library is not initialized again */
+		init = (ret == 0);
+	}
+	if(ret == 0 && handle->gpgme_session == NULL) {
+		alpm_gpgme_session_t *session;
+		CALLOC(session, 1, sizeof(*session),
+				pthread_mutex_unlock(&init_lock); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+		pthread_mutex_init(&session->lock, NULL);
+		handle->gpgme_session = session;
+	}
+	pthread_mutex_unlock(&init_lock);
+	return ret;
+}
+
+/**
+ * Take a gpgme context of the verification session for exclusive use.
+ * It is returned with session_release_ctx().
+ * @param handle the context handle
+ * @param ctx set to the context on success
+ * @return 0 on success, -1 on error
+ */
+static int session_acquire_ctx(alpm_handle_t *handle, gpgme_ctx_t *ctx)
+{
+	alpm_gpgme_session_t *session;
+	gpgme_error_t gpg_err;
+	uint64_t start = session_clock();
+
+	if(init_gpgme(handle)) {
+		/* pm_errno was set in gpgme_init() */
+		return -1;
+	}
+	session = handle->gpgme_session;
+
+	*ctx = NULL;
+	pthread_mutex_lock(&session->lock);
+	if(session->idle) {
+		alpm_list_t *item = session->idle;
+		session->idle = alpm_list_remove_item(session->idle, item);
+		*ctx = item->data;
+		free(item);
+	}
+	pthread_mutex_unlock(&session->lock);
+	if(*ctx) {
+		return 0;
+	}
+
+	gpg_err = gpgme_new(ctx);
+	if(gpg_err_code(gpg_err) != GPG_ERR_NO_ERROR) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("GPGME error: %s\n"), gpgme_strerror(gpg_err));
+		RET_ERR(handle, ALPM_ERR_GPGME, -1);
+	}
+	session_account(handle, SESSION_STEP_INIT, start);
+	return 0;
+}
+
+/**
+ * Hand a context back to the verification session. A context that saw an
+ * error is released instead of being reused.
+ * @param handle the context handle
+ * @param ctx the context
+ * @param failed whether an operation on the context failed
+ */
+static void session_release_ctx(alpm_handle_t *handle, gpgme_ctx_t ctx,
+		int failed)
+{
+	alpm_gpgme_session_t *session = handle->gpgme_session;
+
+	if(ctx == NULL) {
+		return;
+	}
+	if(failed) {
+		gpgme_release(ctx);
+		return;
+	}
+	pthread_mutex_lock(&session->lock);
+	session->idle = alpm_list_add(session->idle, ctx);
+	pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Log the time spent in each step of signature verification so far.
+ * @param handle the context handle
+ */
+void _alpm_gpgme_session_log(alpm_handle_t *handle)
+{
+	alpm_gpgme_session_t *session = handle->gpgme_session;
+	int i;
+
+	if(session == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&session->lock);
+	for(i = 0; i < SESSION_STEP_COUNT; i++) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "gpgme %s: %zu times, %.3f ms\n",
+				session_step_names[i], session->steps[i].count,
+				session->steps[i].ns / 1e6);
+	}
+	pthread_mutex_unlock(&session->lock);
+}
+
+void _alpm_gpgme_session_free(alpm_handle_t *handle)
+{
+	alpm_gpgme_session_t *session = handle->gpgme_session;
+
+	if(session == NULL) {
+		return;
+	}
+	alpm_list_free_inner(session->idle, (alpm_list_fn_free)gpgme_release);
+	alpm_list_free(session->idle);
+	pthread_mutex_destroy(&session->lock);
+	free(session);
+	handle->gpgme_session = NULL;
+}
+
 /**
  * Determine if we have a key is known in our local keyring.
  * @param handle the context handle
@@ -209,8 +370,9 @@ gpg_error:
 int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr)
 {
 	gpgme_error_t gpg_err;
-	gpgme_ctx_t ctx = {0};
-	gpgme_key_t key;
+	gpgme_ctx_t ctx = NULL;
+	gpgme_key_t key = NULL;
+	uint64_t start;
 	int ret = -1;
 
 	if(alpm_list_find_str(handle->known_keys, fpr)) {
@@ -218,17 +380,16 @@ int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr)
 		return 1;
 	}
 
-	if(init_gpgme(handle)) {
-		/* pm_errno was set in gpgme_init() */
-		goto error;
+	if(session_acquire_ctx(handle, &ctx)) {
+		/* pm_errno was set in session_acquire_ctx() */
+		return -1;
 	}
 
-	gpg_err = gpgme_new(&ctx);
-	CHECK_ERR();
-
 	_alpm_log(handle, ALPM_LOG_DEBUG, "looking up key %s locally\n", fpr);
 
+	start = session_clock();
 	gpg_err = gpgme_get_key(ctx, fpr, &key, 0);
+	session_account(handle, SESSION_STEP_KEYLIST, start);
 	if(gpg_err_code(gpg_err) == GPG_ERR_EOF) {
 		_alpm_log(handle, ALPM_LOG_DEBUG, "key lookup failed, unknown key\n");
 		ret = 0;
@@ -240,11 +401,106 @@ int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr)
 		_alpm_log(handle, ALPM_LOG_DEBUG, "gpg error: %s\n", gpgme_strerror(gpg_err));
 	}
 	gpgme_key_unref(key);
+	session_release_ctx(handle, ctx, ret == -1);
+
+	return ret;
+}
+
+/* Whether a key ID or fingerprint, as found in a signature, names a key */
+static int key_matches(gpgme_key_t key, const char *fpr)
+{
+	size_t len = strlen(fpr);
+	gpgme_subkey_t subkey;
+
+	if(len == 0) {
+		return 0;
+	}
+	for(subkey = key->subkeys; subkey; subkey = subkey->next) {
+		size_t keylen = subkey->fpr ? strlen(subkey->fpr) : 0;
+		if(keylen >= len && strcasecmp(subkey->fpr + keylen - len, fpr) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Look up several keys in our local keyring with a single key listing.
+ * Keys that are found are remembered, so later calls to
+ * _alpm_key_in_keychain() for them do not reach gpg.
+ * @param handle the context handle
+ * @param fprs list of fingerprints or key IDs to look up
+ * @return 0 on success, -1 on error
+ */
+int _alpm_keys_in_keychain(alpm_handle_t *handle, alpm_list_t *fprs)
+{
+	gpgme_error_t gpg_err;
+	gpgme_ctx_t ctx = NULL;
+	gpgme_key_t key;
+	alpm_list_t *i, *wanted = NULL;
+	const char **patterns = NULL;
+	size_t count = 0, found = 0;
+	uint64_t start;
+	int ret = -1;
+
+	for(i = fprs; i; i = i->next) {
+		if(!alpm_list_find_str(handle->known_keys, i->data)
+				&& !alpm_list_find_str(wanted, i->data)) {
+			wanted = alpm_list_add(wanted, i->data);
+			count++;
+		}
+	}
+	if(count == 0) {
+		return 0;
+	}
+
+	CALLOC(patterns, count + 1, sizeof(char *),
+			alpm_list_free(wanted); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	for(i = wanted, count = 0; i; i = i->next) {
+		patterns[count++] = i->data;
+	}
+
+	if(session_acquire_ctx(handle, &ctx)) {
+		/* pm_errno was set in session_acquire_ctx() */
+		goto error;
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG, "looking up %zu keys locally\n", count);
+
+	start = session_clock();
+	gpg_err = gpgme_op_keylist_ext_start(ctx, patterns, 0, 0);
+	CHECK_ERR();
+	while(gpg_err_code(gpg_err = gpgme_op_keylist_next(ctx, &key)) == GPG_ERR_NO_ERROR) {
+		for(i = wanted; i; i = i->next) {
+			if(!alpm_list_find_str(handle->known_keys, i->data)
+					&& key_matches(key, i->data)) {
+				handle->known_keys = alpm_list_add(handle->known_keys, strdup(i->data));
+				found++;
+			}
+		}
+		gpgme_key_unref(key);
+	}
+	if(gpg_err_code(gpg_err) != GPG_ERR_EOF) {
+		goto gpg_error;
+	}
+	gpg_err = gpgme_op_keylist_end(ctx);
+	CHECK_ERR();
+	session_account(handle, SESSION_STEP_KEYLIST, start);
+
+	_alpm_log(handle, ALPM_LOG_DEBUG, "key lookup found %zu of %zu keys\n",
+			found, count);
+	ret = 0;
 
 gpg_error:
-	gpgme_release(ctx);
+	if(ret != 0) {
+		/* callers fall back to looking up keys one at a time */
+		_alpm_log(handle, ALPM_LOG_DEBUG, "gpg error: %s\n", gpgme_strerror(gpg_err));
+	}
+	session_release_ctx(handle, ctx, ret != 0);
 
 error:
+	free(patterns);
+	alpm_list_free(wanted);
 	return ret;
 }
 
@@ -566,19 +822,21 @@ int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr)
  * @param path the full path to a file
  * @param base64_sig optional PGP signature data in base64 encoding
  * @param siglist a pointer to storage for signature results
+ * @param missing set to 1 if the check failed for lack of a signature
  * @return 0 in normal cases, -1 if the something failed in the check process
  */
-int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
-		const char *base64_sig, alpm_siglist_t *siglist)
+static int gpgme_checksig(alpm_handle_t *handle, const char *path,
+		const char *base64_sig, alpm_siglist_t *siglist, int *missing)
 {
 	int ret = -1, sigcount;
 	gpgme_error_t gpg_err = 0;
-	gpgme_ctx_t ctx = {0};
+	gpgme_ctx_t ctx = NULL;
 	gpgme_data_t filedata = {0}, sigdata = {0};
 	gpgme_verify_result_t verify_result;
 	gpgme_signature_t gpgsig;
 	char *sigpath = NULL;
 	unsigned char *decoded_sigdata = NULL;
+	uint64_t start;
 	FILE *file = NULL, *sigfile = NULL;
 
 	if(!path || _alpm_access(handle, NULL, path, R_OK) != 0) {
@@ -589,6 +847,7 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 		RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1);
 	}
 	siglist->count = 0;
+	*missing = 0;
 
 	if(!base64_sig) {
 		sigpath = _alpm_sigpath(handle, path);
@@ -596,6 +855,7 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 				|| (sigfile = fopen(sigpath, "rb")) == NULL) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "sig path %s could not be opened\n",
 					sigpath);
+			*missing = 1;
 			GOTO_ERR(handle, ALPM_ERR_SIG_MISSING, error);
 		}
 	}
@@ -606,16 +866,13 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 		GOTO_ERR(handle, ALPM_ERR_NOT_A_FILE, error);
 	}
 
-	if(init_gpgme(handle)) {
-		/* pm_errno was set in gpgme_init() */
+	if(session_acquire_ctx(handle, &ctx)) {
+		/* pm_errno was set in session_acquire_ctx() */
 		goto error;
 	}
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "checking signature for %s\n", path);
 
-	gpg_err = gpgme_new(&ctx);
-	CHECK_ERR();
-
 	/* create our necessary data objects to verify the signature */
 	gpg_err = gpgme_data_new_from_stream(&filedata, file);
 	CHECK_ERR();
@@ -638,12 +895,15 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 	CHECK_ERR();
 
 	/* here's where the magic happens */
+	start = session_clock();
 	gpg_err = gpgme_op_verify(ctx, sigdata, filedata, NULL);
+	session_account(handle, SESSION_STEP_VERIFY, start);
 	CHECK_ERR();
 	verify_result = gpgme_op_verify_result(ctx);
 	CHECK_ERR();
 	if(!verify_result || !verify_result->signatures) {
 		_alpm_log(handle, ALPM_LOG_DEBUG, "no signatures returned\n");
+		*missing = 1;
 		GOTO_ERR(handle, ALPM_ERR_SIG_MISSING, gpg_error);
 	}
 	for(gpgsig = verify_result->signatures, sigcount = 0;
@@ -682,7 +942,9 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 				gpgme_strerror(gpgsig->validity_reason));
 
 		result = siglist->results + sigcount;
+		start = session_clock();
 		gpg_err = gpgme_get_key(ctx, gpgsig->fpr, &key, 0);
+		session_account(handle, SESSION_STEP_KEYLIST, start);
 		if(gpg_err_code(gpg_err) == GPG_ERR_EOF) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "key lookup failed, unknown key\n");
 			gpg_err = GPG_ERR_NO_ERROR;
@@ -758,7 +1020,7 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 gpg_error:
 	gpgme_data_release(sigdata);
 	gpgme_data_release(filedata);
-	gpgme_release(ctx);
+	session_release_ctx(handle, ctx, ret != 0);
 
 error:
 	if(sigfile) {
@@ -779,26 +1041,40 @@ error:
 #else /* HAVE_LIBGPGME */
 int _alpm_key_in_keychain(alpm_handle_t *handle, const char UNUSED *fpr)
 {
-	handle->pm_errno = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
+	PM_ERRNO(handle) = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
+	return -1;
+}
+
+int _alpm_keys_in_keychain(alpm_handle_t *handle, alpm_list_t UNUSED *fprs)
+{
+	PM_ERRNO(handle) = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
 	return -1;
 }
 
 int _alpm_key_import(alpm_handle_t *handle, const char UNUSED *uid,
 		const char UNUSED *fpr)
 {
-	handle->pm_errno = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
+	PM_ERRNO(handle) = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
 	return -1;
 }
 
-int _alpm_gpgme_checksig(alpm_handle_t *handle, const char UNUSED *path,
-		const char UNUSED *base64_sig, alpm_siglist_t *siglist)
+static int gpgme_checksig(alpm_handle_t *handle, const char UNUSED *path,
+		const char UNUSED *base64_sig, alpm_siglist_t *siglist, int *missing)
 {
 	siglist->count = 0;
-	handle->pm_errno = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
+	*missing = 0;
+	PM_ERRNO(handle) = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
 	return -1;
 }
 #endif /* HAVE_LIBGPGME */
 
+int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
+		const char *base64_sig, alpm_siglist_t *siglist)
+{
+	int missing;
+	return gpgme_checksig(handle, path, base64_sig, siglist, &missing);
+}
+
 /**
  * Form a signature path given a file path.
  * Caller must free the result.
@@ -839,16 +1115,17 @@ int _alpm_check_pgp_helper(alpm_handle_t *handle, const char *path,
 		alpm_siglist_t **sigdata)
 {
 	alpm_siglist_t *siglist;
-	int ret;
+	int ret, missing;
 
 	CALLOC(siglist, 1, sizeof(alpm_siglist_t),
 			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
 
-	ret = _alpm_gpgme_checksig(handle, path, base64_sig, siglist);
-	if(ret && handle->pm_errno == ALPM_ERR_SIG_MISSING) {
+	/* not judged by pm_errno, which other threads may be setting */
+	ret = gpgme_checksig(handle, path, base64_sig, siglist, &missing);
+	if(ret && missing) {
 		if(optional) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "missing optional signature\n");
-			handle->pm_errno = ALPM_ERR_OK;
+			PM_ERRNO(handle) = ALPM_ERR_OK;
 			ret = 0;
 		} else {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "missing required signature\n");
@@ -1002,7 +1279,7 @@ int SYMEXPORT alpm_pkg_check_pgp_signature(alpm_pkg_t *pkg,
 {
 	ASSERT(pkg != NULL, return -1);
 	ASSERT(siglist != NULL, RET_ERR(pkg->handle, ALPM_ERR_WRONG_ARGS, -1));
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 
 	return _alpm_gpgme_checksig(pkg->handle, pkg->filename,
 			pkg->base64_sig, siglist);
@@ -1013,7 +1290,7 @@ int SYMEXPORT alpm_db_check_pgp_signature(alpm_db_t *db,
 {
 	ASSERT(db != NULL, return -1);
 	ASSERT(siglist != NULL, RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
-	db->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(db->handle) = ALPM_ERR_OK;
 
 	return _alpm_gpgme_checksig(db->handle, _alpm_db_path(db), NULL, siglist);
 }
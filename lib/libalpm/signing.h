@@ -32,6 +32,12 @@ int _alpm_process_siglist(alpm_handle_t *handle, const char *identifier,
 		alpm_siglist_t *siglist, int optional, int marginal, int unknown);
 
 int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr);
+int _alpm_keys_in_keychain(alpm_handle_t *handle, alpm_list_t *fprs);
 int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr);
 
+#ifdef HAVE_LIBGPGME
+void _alpm_gpgme_session_log(alpm_handle_t *handle);
+void _alpm_gpgme_session_free(alpm_handle_t *handle);
+#endif
+
 #endif /* ALPM_SIGNING_H */
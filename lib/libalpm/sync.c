@@ -29,6 +29,7 @@
 #include <stdint.h> /* intmax_t */
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 
 /* libalpm */
 #include "sync.h"
@@ -47,6 +48,7 @@
 #include "remove.h"
 #include "diskspace.h"
 #include "signing.h"
+#include "verifycache.h"
 
 struct keyinfo_t {
        char* uid;
@@ -59,7 +61,7 @@ alpm_pkg_t SYMEXPORT *alpm_sync_get_new_version(alpm_pkg_t *pkg, alpm_list_t *db
 	alpm_pkg_t *spkg = NULL;
 
 	ASSERT(pkg != NULL, return NULL);
-	pkg->handle->pm_errno = ALPM_ERR_OK;
+	PM_ERRNO(pkg->handle) = ALPM_ERR_OK;
 
 	for(i = dbs_sync; !spkg && i; i = i->next) {
 		alpm_db_t *db = i->data;
@@ -450,7 +452,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 				   transaction. The packages will be removed from the actual
 				   transaction when the transaction packages are replaced with a
 				   dependency-reordered list below */
-				handle->pm_errno = ALPM_ERR_OK;
+				PM_ERRNO(handle) = ALPM_ERR_OK;
 				if(data) {
 					alpm_list_free_inner(*data,
 							(alpm_list_fn_free)alpm_depmissing_free);
@@ -473,7 +475,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 				alpm_pkg_t *pkg2 = j->data;
 				if(strcmp(pkg1->filename, pkg2->filename) == 0) {
 					ret = -1;
-					handle->pm_errno = ALPM_ERR_TRANS_DUP_FILENAME;
+					PM_ERRNO(handle) = ALPM_ERR_TRANS_DUP_FILENAME;
 					_alpm_log(handle, ALPM_LOG_ERROR, _("packages %s and %s have the same filename: %s\n"),
 						pkg1->name, pkg2->name, pkg1->filename);
 				}
@@ -544,7 +546,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 				sync = sync2;
 			} else {
 				_alpm_log(handle, ALPM_LOG_ERROR, _("unresolvable package conflicts detected\n"));
-				handle->pm_errno = ALPM_ERR_CONFLICTING_DEPS;
+				PM_ERRNO(handle) = ALPM_ERR_CONFLICTING_DEPS;
 				ret = -1;
 				if(data) {
 					alpm_conflict_t *newconflict = _alpm_conflict_dup(conflict);
@@ -616,7 +618,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 				sync->removes = alpm_list_add(sync->removes, local);
 			} else { /* abort */
 				_alpm_log(handle, ALPM_LOG_ERROR, _("unresolvable package conflicts detected\n"));
-				handle->pm_errno = ALPM_ERR_CONFLICTING_DEPS;
+				PM_ERRNO(handle) = ALPM_ERR_CONFLICTING_DEPS;
 				ret = -1;
 				if(data) {
 					alpm_conflict_t *newconflict = _alpm_conflict_dup(conflict);
@@ -656,7 +658,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 		deps = alpm_checkdeps(handle, _alpm_db_get_pkgcache(handle->db_local),
 				trans->remove, trans->add, 1);
 		if(deps) {
-			handle->pm_errno = ALPM_ERR_UNSATISFIED_DEPS;
+			PM_ERRNO(handle) = ALPM_ERR_UNSATISFIED_DEPS;
 			ret = -1;
 			if(data) {
 				*data = deps;
@@ -735,9 +737,9 @@ static int find_dl_candidates(alpm_handle_t *handle, alpm_list_t **files)
 			int siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(spkg));
 
 			if(!repo->servers) {
-				handle->pm_errno = ALPM_ERR_SERVER_NONE;
+				PM_ERRNO(handle) = ALPM_ERR_SERVER_NONE;
 				_alpm_log(handle, ALPM_LOG_ERROR, "%s: %s\n",
-						alpm_strerror(handle->pm_errno), repo->treename);
+						alpm_strerror(PM_ERRNO(handle)), repo->treename);
 				return -1;
 			}
 
@@ -769,15 +771,314 @@ static int find_dl_candidates(alpm_handle_t *handle, alpm_list_t **files)
 	return 0;
 }
 
+static int check_pkg_matches_db(alpm_pkg_t *spkg, alpm_pkg_t *pkgfile);
 
-static int download_files(alpm_handle_t *handle)
+/* Validates a package file, unless the verification cache already knows
+ * it to be valid. May be called from several threads at once. */
+static int validate_pkg(alpm_handle_t *handle, alpm_pkg_t *spkg,
+		const char *path, int siglevel, alpm_siglist_t **siglist,
+		int *validation)
+{
+	char *key = NULL;
+	int ret;
+
+	if(handle->verifycache) {
+		key = _alpm_verifycache_key(handle, path, spkg, siglevel);
+		if(key && _alpm_verifycache_lookup(handle->verifycache, key,
+					validation) == 0) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"%s: found in verification cache\n", spkg->name);
+			free(key);
+			return 0;
+		}
+	}
+
+	ret = _alpm_pkg_validate_internal(handle, path, spkg, siglevel,
+			siglist, validation);
+	if(ret == 0 && key) {
+		_alpm_verifycache_add(handle->verifycache, key, *validation);
+	}
+	free(key);
+	return ret;
+}
+
+/* Validates a package file on behalf of check_validity() from another
+ * thread. Only success is of interest there, so the signature results are
+ * dropped. */
+static int validate_ahead(alpm_handle_t *handle, alpm_pkg_t *spkg,
+		const char *path, int *validation)
+{
+	alpm_siglist_t *siglist = NULL;
+	int ret;
+
+	*validation = 0;
+	ret = validate_pkg(handle, spkg, path,
+			alpm_db_get_siglevel(alpm_pkg_get_db(spkg)), &siglist, validation);
+	alpm_siglist_cleanup(siglist);
+	free(siglist);
+	return ret;
+}
+
+/* A pipelined commit verifies and loads targets on a worker thread while the
+ * rest of the transaction is still downloading. The worker only records
+ * successes: check_validity() and load_packages() pick those up and redo
+ * everything else themselves, so failures, keys that still need importing
+ * and all user interaction are handled exactly as in a sequential commit. */
+struct pipeline_target {
+	struct pipeline *pipeline;
+	struct pipeline_target *next;
+	alpm_pkg_t *spkg;
+	alpm_pkg_t *pkgfile;   /* loaded package file, NULL if not loaded */
+	int validation;
+	int verified;
+	alpm_errno_t err;      /* the worker's pm_errno for this target */
+};
+
+struct pipeline {
+	alpm_handle_t *handle;
+	struct pipeline_target *targets; /* one per trans->add entry, in order */
+	size_t count;
+	int load;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pipeline_target *head, *tail;
+	int running, closed, cancelled;
+
+	alpm_cb_download dlcb;
+	void *dlcb_ctx;
+};
+
+static struct pipeline *pipeline_new(alpm_handle_t *handle, int load)
+{
+	struct pipeline *pipeline;
+	alpm_list_t *i;
+	size_t idx;
+
+	CALLOC(pipeline, 1, sizeof(*pipeline), return NULL);
+	pipeline->count = alpm_list_count(handle->trans->add);
+	CALLOC(pipeline->targets, pipeline->count, sizeof(*pipeline->targets),
+			free(pipeline); return NULL);
+	for(i = handle->trans->add, idx = 0; i; i = i->next, idx++) {
+		pipeline->targets[idx].pipeline = pipeline;
+		pipeline->targets[idx].spkg = i->data;
+	}
+	pipeline->handle = handle;
+	pipeline->load = load;
+	return pipeline;
+}
+
+static void pipeline_free(struct pipeline *pipeline)
+{
+	size_t idx;
+
+	if(pipeline == NULL) {
+		return;
+	}
+	for(idx = 0; idx < pipeline->count; idx++) {
+		_alpm_pkg_free(pipeline->targets[idx].pkgfile);
+	}
+	free(pipeline->targets);
+	free(pipeline);
+}
+
+static void pipeline_process(struct pipeline_target *target)
+{
+	alpm_handle_t *handle = target->pipeline->handle;
+	alpm_pkg_t *spkg = target->spkg;
+	char *path;
+	int validation;
+
+	/* failures are reported when the target is checked again, keep them
+	 * away from the pm_errno of the thread that does that */
+	_alpm_errno_redirect(&target->err);
+
+	path = _alpm_filecache_find(handle, spkg->filename);
+	if(path == NULL) {
+		_alpm_errno_redirect(NULL);
+		return;
+	}
+
+	if(validate_ahead(handle, spkg, path, &validation) == 0) {
+		target->validation = validation;
+		target->verified = 1;
+		if(target->pipeline->load) {
+			alpm_pkg_t *pkgfile = _alpm_pkg_load_internal(handle, path, 1);
+			if(pkgfile && check_pkg_matches_db(spkg, pkgfile) == 0) {
+				target->pkgfile = pkgfile;
+			} else {
+				_alpm_pkg_free(pkgfile);
+			}
+		}
+	}
+	if(target->verified) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "pipeline: %s %s\n", spkg->name,
+				target->pkgfile ? "verified and loaded" : "verified");
+	} else {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "pipeline: %s left for later (%s)\n",
+				spkg->name, alpm_strerror(target->err));
+	}
+
+	free(path);
+	_alpm_errno_redirect(NULL);
+}
+
+static void *pipeline_worker(void *arg)
+{
+	struct pipeline *pipeline = arg;
+	struct pipeline_target *target;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while(1) {
+		while(pipeline->head == NULL && !pipeline->closed) {
+			pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+		}
+		if(pipeline->head == NULL || pipeline->cancelled) {
+			break;
+		}
+		target = pipeline->head;
+		pipeline->head = target->next;
+		if(pipeline->head == NULL) {
+			pipeline->tail = NULL;
+		}
+		pthread_mutex_unlock(&pipeline->lock);
+
+		pipeline_process(target);
+
+		pthread_mutex_lock(&pipeline->lock);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+static void pipeline_push(struct pipeline_target *target)
+{
+	struct pipeline *pipeline = target->pipeline;
+
+	pthread_mutex_lock(&pipeline->lock);
+	if(pipeline->tail) {
+		pipeline->tail->next = target;
+	} else {
+		pipeline->head = target;
+	}
+	pipeline->tail = target;
+	pthread_cond_signal(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+static struct pipeline_target *pipeline_find(struct pipeline *pipeline,
+		alpm_pkg_t *spkg)
+{
+	size_t idx;
+
+	for(idx = 0; idx < pipeline->count; idx++) {
+		if(pipeline->targets[idx].spkg == spkg) {
+			return &pipeline->targets[idx];
+		}
+	}
+	return NULL;
+}
+
+/* called by _alpm_download() once a package and its signature are in place */
+static void pipeline_download_done(void *ctx, struct dload_payload *payload,
+		int result)
+{
+	struct pipeline_target *target = ctx;
+
+	if(target == NULL || result < 0) {
+		return;
+	}
+	/* hand the checksum over before the worker can look at the package */
+	free(target->spkg->download_digest);
+	target->spkg->download_digest = payload->digest;
+	payload->digest = NULL;
+	pipeline_push(target);
+}
+
+/* keeps the frontend from being called back from two threads at once */
+static void pipeline_dlcb(void *ctx, const char *filename,
+		alpm_download_event_type_t event, void *data)
+{
+	struct pipeline *pipeline = ctx;
+
+	pthread_mutex_lock(&pipeline->handle->log_lock);
+	pipeline->dlcb(pipeline->dlcb_ctx, filename, event, data);
+	pthread_mutex_unlock(&pipeline->handle->log_lock);
+}
+
+/* Starts the worker and queues the targets that are not going to be
+ * downloaded. Returns 0 if the worker is running. */
+static int pipeline_start(struct pipeline *pipeline, alpm_list_t *files)
+{
+	alpm_handle_t *handle = pipeline->handle;
+	size_t idx;
+
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	if(pthread_create(&pipeline->thread, NULL, pipeline_worker, pipeline) != 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"could not start pipeline worker, committing sequentially\n");
+		pthread_cond_destroy(&pipeline->cond);
+		pthread_mutex_destroy(&pipeline->lock);
+		return -1;
+	}
+	pipeline->running = 1;
+
+	if(handle->dlcb) {
+		pipeline->dlcb = handle->dlcb;
+		pipeline->dlcb_ctx = handle->dlcb_ctx;
+		handle->dlcb = pipeline_dlcb;
+		handle->dlcb_ctx = pipeline;
+	}
+
+	for(idx = 0; idx < pipeline->count; idx++) {
+		struct pipeline_target *target = &pipeline->targets[idx];
+		if(target->spkg->origin != ALPM_PKG_FROM_FILE
+				&& !alpm_list_find_ptr(files, target->spkg)) {
+			pipeline_push(target);
+		}
+	}
+	return 0;
+}
+
+/* Waits for the worker to finish the queued targets, or only the current
+ * one if cancel is set. */
+static void pipeline_stop(struct pipeline *pipeline, int cancel)
+{
+	alpm_handle_t *handle = pipeline->handle;
+
+	if(!pipeline->running) {
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->closed = 1;
+	pipeline->cancelled = cancel;
+	pthread_cond_signal(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+	pthread_join(pipeline->thread, NULL);
+
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->lock);
+	pipeline->running = 0;
+
+	if(handle->dlcb == pipeline_dlcb) {
+		handle->dlcb = pipeline->dlcb;
+		handle->dlcb_ctx = pipeline->dlcb_ctx;
+	}
+}
+
+static int download_files(alpm_handle_t *handle, struct pipeline *pipeline)
 {
 	const char *cachedir;
 	char * temporary_cachedir = NULL;
-	alpm_list_t *i, *files = NULL;
+	alpm_list_t *i, *j, *files = NULL;
 	int ret = 0;
 	alpm_event_t event = {0};
 	alpm_list_t *payloads = NULL;
+	int pipelined = 0;
 
 	cachedir = _alpm_filecache_setup(handle);
 	temporary_cachedir = _alpm_temporary_download_dir_setup(cachedir, handle->sandboxuser);
@@ -826,6 +1127,7 @@ static int download_files(alpm_handle_t *handle)
 		}
 
 		EVENT(handle, &event);
+		pipelined = pipeline && pipeline_start(pipeline, files) == 0;
 		for(i = files; i; i = i->next) {
 			alpm_pkg_t *pkg = i->data;
 			int siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(pkg));
@@ -850,11 +1152,40 @@ static int download_files(alpm_handle_t *handle)
 			payload->allow_resume = 1;
 			payload->download_signature = (siglevel & ALPM_SIG_PACKAGE);
 			payload->signature_optional = (siglevel & ALPM_SIG_PACKAGE_OPTIONAL);
+			/* the checksum check_validity() is going to test */
+			if(pkg->sha256sum) {
+				payload->digest_type = ALPM_PKG_VALIDATION_SHA256SUM;
+			} else if(pkg->md5sum) {
+				payload->digest_type = ALPM_PKG_VALIDATION_MD5SUM;
+			}
+			if(pipelined) {
+				payload->done_cb = pipeline_download_done;
+				payload->done_ctx = pipeline_find(pipeline, pkg);
+			}
 
 			payloads = alpm_list_add(payloads, payload);
 		}
 
 		ret = _alpm_download(handle, payloads, cachedir, temporary_cachedir);
+
+		if(pipelined) {
+			pipeline_stop(pipeline, ret == -1);
+			pipelined = 0;
+		}
+
+		/* keep the digests computed while downloading for check_validity() */
+		for(i = files, j = payloads; i && j; i = i->next, j = j->next) {
+			alpm_pkg_t *pkg = i->data;
+			struct dload_payload *payload = j->data;
+			if(payload->done_cb) {
+				/* handed over by pipeline_download_done() if at all */
+				continue;
+			}
+			free(pkg->download_digest);
+			pkg->download_digest = payload->digest;
+			payload->digest = NULL;
+		}
+
 		if(ret == -1) {
 			event.type = ALPM_EVENT_PKG_RETRIEVE_FAILED;
 			EVENT(handle, &event);
@@ -866,6 +1197,9 @@ static int download_files(alpm_handle_t *handle)
 	}
 
 finish:
+	if(pipelined) {
+		pipeline_stop(pipeline, 1);
+	}
 	if(payloads) {
 		alpm_list_free_inner(payloads, (alpm_list_fn_free)_alpm_dload_payload_reset);
 		FREELIST(payloads);
@@ -895,18 +1229,27 @@ static int key_cmp(const void *k1, const void *k2) {
 	return strcmp(key1->keyid, key2);
 }
 
+static void keyinfo_free(struct keyinfo_t *keyinfo)
+{
+	free(keyinfo->uid);
+	free(keyinfo->keyid);
+	free(keyinfo);
+}
+
 static int check_keyring(alpm_handle_t *handle)
 {
 	size_t current = 0, numtargs;
-	alpm_list_t *i, *errors = NULL;
+	alpm_list_t *i, *keys = NULL, *keyids = NULL, *errors = NULL;
 	alpm_event_t event;
 	struct keyinfo_t *keyinfo;
+	int batched;
 
 	event.type = ALPM_EVENT_KEYRING_START;
 	EVENT(handle, &event);
 
 	numtargs = alpm_list_count(handle->trans->add);
 
+	/* collect the signing keys first to look them all up at once */
 	for(i = handle->trans->add; i; i = i->next, current++) {
 		alpm_pkg_t *pkg = i->data;
 		int level;
@@ -925,31 +1268,45 @@ static int check_keyring(alpm_handle_t *handle)
 			size_t sig_len;
 			int ret = alpm_pkg_get_sig(pkg, &sig, &sig_len);
 			if(ret == 0) {
-				alpm_list_t *keys = NULL;
+				alpm_list_t *pkgkeys = NULL;
 				if(alpm_extract_keyid(handle, pkg->name, sig,
-							sig_len, &keys) == 0) {
+							sig_len, &pkgkeys) == 0) {
 					alpm_list_t *k;
-					for(k = keys; k; k = k->next) {
+					for(k = pkgkeys; k; k = k->next) {
 						char *key = k->data;
 						_alpm_log(handle, ALPM_LOG_DEBUG, "found signature key: %s\n", key);
-						if(!alpm_list_find(errors, key, key_cmp) &&
-								_alpm_key_in_keychain(handle, key) == 0) {
+						if(!alpm_list_find(keys, key, key_cmp)) {
 							keyinfo = malloc(sizeof(struct keyinfo_t));
 							if(!keyinfo) {
 								break;
 							}
 							keyinfo->uid = strdup(pkg->packager);
 							keyinfo->keyid = strdup(key);
-							errors = alpm_list_add(errors, keyinfo);
+							keys = alpm_list_add(keys, keyinfo);
+							keyids = alpm_list_add(keyids, keyinfo->keyid);
 						}
 					}
-					FREELIST(keys);
+					FREELIST(pkgkeys);
 				}
 			}
 			free(sig);
 		}
 	}
 
+	/* if that fails, ask for each key on its own */
+	batched = _alpm_keys_in_keychain(handle, keyids) == 0;
+	alpm_list_free(keyids);
+	for(i = keys; i; i = i->next) {
+		keyinfo = i->data;
+		if(batched ? !alpm_list_find_str(handle->known_keys, keyinfo->keyid)
+				: _alpm_key_in_keychain(handle, keyinfo->keyid) == 0) {
+			errors = alpm_list_add(errors, keyinfo);
+		} else {
+			keyinfo_free(keyinfo);
+		}
+	}
+	alpm_list_free(keys);
+
 	PROGRESS(handle, ALPM_PROGRESS_KEYRING_START, "", 100,
 			numtargs, current);
 	event.type = ALPM_EVENT_KEYRING_DONE;
@@ -965,9 +1322,7 @@ static int check_keyring(alpm_handle_t *handle)
 			if(_alpm_key_import(handle, keyinfo->uid, keyinfo->keyid) == -1) {
 				fail = 1;
 			}
-			free(keyinfo->uid);
-			free(keyinfo->keyid);
-			free(keyinfo);
+			keyinfo_free(keyinfo);
 		}
 		alpm_list_free(errors);
 		event.type = ALPM_EVENT_KEY_DOWNLOAD_DONE;
@@ -982,8 +1337,171 @@ static int check_keyring(alpm_handle_t *handle)
 }
 #endif /* HAVE_LIBGPGME */
 
+/* Verifies the targets of check_validity() ahead of it on a pool of threads.
+ * As with the commit pipeline only successes are kept. check_validity()
+ * verifies any other target again once the pool has finished, so that the
+ * pm_errno and signature results it reports are its own. */
+struct verify_job {
+	alpm_pkg_t *pkg;
+	int validation;
+	int verified;
+	int done;
+	alpm_errno_t err;      /* the worker's pm_errno for this target */
+};
+
+struct verify_pool {
+	alpm_handle_t *handle;
+	struct verify_job *jobs; /* one per trans->add entry, in order */
+	size_t count, next;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	pthread_t *threads;
+	size_t nthreads;
+	int cancelled;
+};
+
+static void *verify_worker(void *arg)
+{
+	struct verify_pool *pool = arg;
+	alpm_handle_t *handle = pool->handle;
+
+	pthread_mutex_lock(&pool->lock);
+	while(!pool->cancelled && pool->next < pool->count) {
+		struct verify_job *job = &pool->jobs[pool->next++];
+		int validation = 0, verified = 0;
+		char *path;
+
+		if(job->done) {
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		/* each worker reports into its own job, never the handle */
+		_alpm_errno_redirect(&job->err);
+		path = _alpm_filecache_find(handle, job->pkg->filename);
+		if(path) {
+			verified = validate_ahead(handle, job->pkg, path, &validation) == 0;
+			free(path);
+		}
+		_alpm_errno_redirect(NULL);
+
+		pthread_mutex_lock(&pool->lock);
+		job->validation = validation;
+		job->verified = verified;
+		job->done = 1;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* Returns NULL if the targets are better verified by the calling thread. */
+static struct verify_pool *verify_pool_start(alpm_handle_t *handle,
+		struct pipeline *pipeline)
+{
+	struct verify_pool *pool;
+	alpm_list_t *i;
+	size_t idx, pending = 0, nthreads;
+
+	if(handle->parallel_integrity_checks < 2) {
+		return NULL;
+	}
+
+	CALLOC(pool, 1, sizeof(*pool), return NULL);
+	pool->count = alpm_list_count(handle->trans->add);
+	CALLOC(pool->jobs, pool->count, sizeof(*pool->jobs), goto error);
+	for(i = handle->trans->add, idx = 0; i; i = i->next, idx++) {
+		struct verify_job *job = &pool->jobs[idx];
+		job->pkg = i->data;
+		/* check_validity() does not look at these */
+		if(job->pkg->origin == ALPM_PKG_FROM_FILE
+				|| (pipeline && pipeline->targets[idx].verified)) {
+			job->done = 1;
+		} else {
+			pending++;
+		}
+	}
+
+	nthreads = handle->parallel_integrity_checks < pending ?
+		handle->parallel_integrity_checks : pending;
+	if(nthreads < 2) {
+		goto error;
+	}
+	CALLOC(pool->threads, nthreads, sizeof(pthread_t), goto error);
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"verifying %zu packages using %zu threads\n", pending, nthreads);
+
+	pool->handle = handle;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(; pool->nthreads < nthreads; pool->nthreads++) {
+		if(pthread_create(&pool->threads[pool->nthreads], NULL,
+					verify_worker, pool) != 0) {
+			break;
+		}
+	}
+	if(pool->nthreads == 0) {
+		pthread_cond_destroy(&pool->done);
+		pthread_mutex_destroy(&pool->lock);
+		goto error;
+	}
+	return pool;
+
+error:
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+	return NULL;
+}
+
+/* Waits for the result of the given target. Returns 1 if it was verified. */
+static int verify_pool_wait(struct verify_pool *pool, size_t idx)
+{
+	struct verify_job *job = &pool->jobs[idx];
+
+	if(pool->nthreads) {
+		pthread_mutex_lock(&pool->lock);
+		while(!job->done) {
+			pthread_cond_wait(&pool->done, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return job->verified;
+}
+
+/* Stops the pool once the remaining targets are verified, or immediately
+ * if cancel is set. Results stay available. */
+static void verify_pool_stop(struct verify_pool *pool, int cancel)
+{
+	if(pool->nthreads == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->cancelled = cancel;
+	pthread_mutex_unlock(&pool->lock);
+	while(pool->nthreads > 0) {
+		pthread_join(pool->threads[--pool->nthreads], NULL);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static void verify_pool_free(struct verify_pool *pool)
+{
+	if(pool == NULL) {
+		return;
+	}
+	verify_pool_stop(pool, 1);
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+}
+
 static int check_validity(alpm_handle_t *handle,
-		size_t total, uint64_t total_bytes)
+		size_t total, uint64_t total_bytes, struct pipeline *pipeline)
 {
 	struct validity {
 		alpm_pkg_t *pkg;
@@ -997,11 +1515,14 @@ static int check_validity(alpm_handle_t *handle,
 	uint64_t current_bytes = 0;
 	alpm_list_t *i, *errors = NULL;
 	alpm_event_t event;
+	struct verify_pool *pool;
 
 	/* Check integrity of packages */
 	event.type = ALPM_EVENT_INTEGRITY_START;
 	EVENT(handle, &event);
 
+	pool = verify_pool_start(handle, pipeline);
+
 	for(i = handle->trans->add; i; i = i->next, current++) {
 		struct validity v = { i->data, NULL, NULL, 0, 0, 0 };
 		int percent = (int)(((double)current_bytes / total_bytes) * 100);
@@ -1013,9 +1534,22 @@ static int check_validity(alpm_handle_t *handle,
 		}
 
 		current_bytes += v.pkg->size;
+		if(pipeline && pipeline->targets[current].verified) {
+			v.pkg->validation = pipeline->targets[current].validation;
+			continue;
+		}
+		if(pool) {
+			if(verify_pool_wait(pool, current)) {
+				v.pkg->validation = pool->jobs[current].validation;
+				continue;
+			}
+			/* verify it again below, with no other thread around */
+			verify_pool_stop(pool, 0);
+		}
 		v.path = _alpm_filecache_find(handle, v.pkg->filename);
 
 		if(!v.path) {
+			verify_pool_free(pool);
 			_alpm_log(handle, ALPM_LOG_ERROR,
 					_("%s: could not find package in cache\n"), v.pkg->name);
 			RET_ERR(handle, ALPM_ERR_PKG_NOT_FOUND, -1);
@@ -1023,11 +1557,11 @@ static int check_validity(alpm_handle_t *handle,
 
 		v.siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(v.pkg));
 
-		if(_alpm_pkg_validate_internal(handle, v.path, v.pkg,
-					v.siglevel, &v.siglist, &v.validation) == -1) {
+		if(validate_pkg(handle, v.pkg, v.path, v.siglevel,
+					&v.siglist, &v.validation) == -1) {
 			struct validity *invalid;
-			v.error = handle->pm_errno;
-			MALLOC(invalid, sizeof(struct validity), return -1);
+			v.error = PM_ERRNO(handle);
+			MALLOC(invalid, sizeof(struct validity), verify_pool_free(pool); return -1);
 			memcpy(invalid, &v, sizeof(struct validity));
 			errors = alpm_list_add(errors, invalid);
 		} else {
@@ -1038,6 +1572,8 @@ static int check_validity(alpm_handle_t *handle,
 		}
 	}
 
+	verify_pool_free(pool);
+
 	PROGRESS(handle, ALPM_PROGRESS_INTEGRITY_START, "", 100,
 			total, current);
 	event.type = ALPM_EVENT_INTEGRITY_DONE;
@@ -1076,7 +1612,7 @@ static int check_validity(alpm_handle_t *handle,
 		}
 		alpm_list_free(errors);
 
-		if(handle->pm_errno == ALPM_ERR_OK) {
+		if(PM_ERRNO(handle) == ALPM_ERR_OK) {
 			RET_ERR(handle, ALPM_ERR_PKG_INVALID, -1);
 		}
 		return -1;
@@ -1155,7 +1691,7 @@ static int check_pkg_matches_db(alpm_pkg_t *spkg, alpm_pkg_t *pkgfile)
 
 
 static int load_packages(alpm_handle_t *handle, alpm_list_t **data,
-		size_t total, size_t total_bytes)
+		size_t total, size_t total_bytes, struct pipeline *pipeline)
 {
 	size_t current = 0, current_bytes = 0;
 	int errors = 0;
@@ -1169,6 +1705,7 @@ static int load_packages(alpm_handle_t *handle, alpm_list_t **data,
 	for(i = handle->trans->add; i; i = i->next, current++) {
 		int error = 0;
 		alpm_pkg_t *spkg = i->data;
+		alpm_pkg_t *pkgfile = NULL;
 		char *filepath;
 		int percent = (int)(((double)current_bytes / total_bytes) * 100);
 
@@ -1179,35 +1716,44 @@ static int load_packages(alpm_handle_t *handle, alpm_list_t **data,
 		}
 
 		current_bytes += spkg->size;
-		filepath = _alpm_filecache_find(handle, spkg->filename);
+		if(pipeline && pipeline->targets[current].pkgfile) {
+			/* already loaded and matched against the db */
+			pkgfile = pipeline->targets[current].pkgfile;
+			pipeline->targets[current].pkgfile = NULL;
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"replacing pkgcache entry with preloaded package file for target %s\n",
+					spkg->name);
+		} else {
+			filepath = _alpm_filecache_find(handle, spkg->filename);
 
-		if(!filepath) {
-			FREELIST(delete);
-			_alpm_log(handle, ALPM_LOG_ERROR,
-					_("%s: could not find package in cache\n"), spkg->name);
-			RET_ERR(handle, ALPM_ERR_PKG_NOT_FOUND, -1);
-		}
+			if(!filepath) {
+				FREELIST(delete);
+				_alpm_log(handle, ALPM_LOG_ERROR,
+						_("%s: could not find package in cache\n"), spkg->name);
+				RET_ERR(handle, ALPM_ERR_PKG_NOT_FOUND, -1);
+			}
 
-		/* load the package file and replace pkgcache entry with it in the target list */
-		/* TODO: alpm_pkg_get_db() will not work on this target anymore */
-		_alpm_log(handle, ALPM_LOG_DEBUG,
-				"replacing pkgcache entry with package file for target %s\n",
-				spkg->name);
-		alpm_pkg_t *pkgfile =_alpm_pkg_load_internal(handle, filepath, 1);
-		if(!pkgfile) {
-			_alpm_log(handle, ALPM_LOG_DEBUG, "failed to load pkgfile internal\n");
-			error = 1;
-		} else {
-			error |= check_pkg_matches_db(spkg, pkgfile);
-		}
-		if(error != 0) {
-			errors++;
-			*data = alpm_list_add(*data, strdup(spkg->filename));
-			delete = alpm_list_add(delete, filepath);
-			_alpm_pkg_free(pkgfile);
-			continue;
+			/* load the package file and replace pkgcache entry with it in the target list */
+			/* TODO: alpm_pkg_get_db() will not work on this target anymore */
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"replacing pkgcache entry with package file for target %s\n",
+					spkg->name);
+			pkgfile =_alpm_pkg_load_internal(handle, filepath, 1);
+			if(!pkgfile) {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "failed to load pkgfile internal\n");
+				error = 1;
+			} else {
+				error |= check_pkg_matches_db(spkg, pkgfile);
+			}
+			if(error != 0) {
+				errors++;
+				*data = alpm_list_add(*data, strdup(spkg->filename));
+				delete = alpm_list_add(delete, filepath);
+				_alpm_pkg_free(pkgfile);
+				continue;
+			}
+			free(filepath);
 		}
-		free(filepath);
 		/* copy over the install reason */
 		pkgfile->reason = spkg->reason;
 		/* copy over validation method */
@@ -1232,7 +1778,7 @@ static int load_packages(alpm_handle_t *handle, alpm_list_t **data,
 		}
 		FREELIST(delete);
 
-		if(handle->pm_errno == ALPM_ERR_OK) {
+		if(PM_ERRNO(handle) == ALPM_ERR_OK) {
 			RET_ERR(handle, ALPM_ERR_PKG_INVALID, -1);
 		}
 		return -1;
@@ -1247,15 +1793,26 @@ int _alpm_sync_load(alpm_handle_t *handle, alpm_list_t **data)
 	size_t total = 0;
 	uint64_t total_bytes = 0;
 	alpm_trans_t *trans = handle->trans;
+	struct pipeline *pipeline = NULL;
+	int ret = -1;
 
-	if(download_files(handle) == -1) {
-		return -1;
+	/* without it, every package is validated */
+	handle->verifycache = _alpm_verifycache_load(handle);
+
+	if(handle->pipelined_commit) {
+		/* without memory for it, commit sequentially */
+		pipeline = pipeline_new(handle,
+				!(trans->flags & ALPM_TRANS_FLAG_DOWNLOADONLY));
+	}
+
+	if(download_files(handle, pipeline) == -1) {
+		goto cleanup;
 	}
 
 #ifdef HAVE_LIBGPGME
 	/* make sure all required signatures are in keyring */
 	if(check_keyring(handle)) {
-		return -1;
+		goto cleanup;
 	}
 #endif
 
@@ -1271,19 +1828,29 @@ int _alpm_sync_load(alpm_handle_t *handle, alpm_list_t **data)
 	/* this can only happen maliciously */
 	total_bytes = total_bytes ? total_bytes : 1;
 
-	if(check_validity(handle, total, total_bytes) != 0) {
-		return -1;
+	if(check_validity(handle, total, total_bytes, pipeline) != 0) {
+		goto cleanup;
 	}
 
-	if(trans->flags & ALPM_TRANS_FLAG_DOWNLOADONLY) {
-		return 0;
-	}
+#ifdef HAVE_LIBGPGME
+	_alpm_gpgme_session_log(handle);
+#endif
 
-	if(load_packages(handle, data, total, total_bytes)) {
-		return -1;
+	if(!(trans->flags & ALPM_TRANS_FLAG_DOWNLOADONLY)
+			&& load_packages(handle, data, total, total_bytes, pipeline)) {
+		goto cleanup;
 	}
 
-	return 0;
+	ret = 0;
+
+cleanup:
+	pipeline_free(pipeline);
+	if(handle->verifycache) {
+		_alpm_verifycache_write(handle->verifycache);
+		_alpm_verifycache_free(handle->verifycache);
+		handle->verifycache = NULL;
+	}
+	return ret;
 }
 
 int _alpm_sync_check(alpm_handle_t *handle, alpm_list_t **data)
@@ -27,7 +27,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <sys/stat.h>
 
 /* libalpm */
 #include "trans.h"
@@ -212,17 +214,17 @@ int SYMEXPORT alpm_trans_commit(alpm_handle_t *handle, alpm_list_t **data)
 	if(trans->add == NULL) {
 		if(_alpm_remove_packages(handle, 1) == -1) {
 			/* pm_errno is set by _alpm_remove_packages() */
-			alpm_errno_t save = handle->pm_errno;
+			alpm_errno_t save = PM_ERRNO(handle);
 			alpm_logaction(handle, ALPM_CALLER_PREFIX, "transaction failed\n");
-			handle->pm_errno = save;
+			PM_ERRNO(handle) = save;
 			return -1;
 		}
 	} else {
 		if(_alpm_sync_commit(handle) == -1) {
 			/* pm_errno is set by _alpm_sync_commit() */
-			alpm_errno_t save = handle->pm_errno;
+			alpm_errno_t save = PM_ERRNO(handle);
 			alpm_logaction(handle, ALPM_CALLER_PREFIX, "transaction failed\n");
-			handle->pm_errno = save;
+			PM_ERRNO(handle) = save;
 			return -1;
 		}
 	}
@@ -285,6 +287,112 @@ int SYMEXPORT alpm_trans_release(alpm_handle_t *handle)
 	return 0;
 }
 
+/* The MD5 digest of a file on disk, for as long as the file is not
+ * changed, see _alpm_trans_file_md5(). */
+struct file_digest {
+	char *path;
+	unsigned long path_hash;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	char *md5;
+};
+
+static void file_digest_free(struct file_digest *digest)
+{
+	free(digest->path);
+	free(digest->md5);
+	free(digest);
+}
+
+static int file_digest_matches(struct file_digest *digest, struct stat *st)
+{
+	return digest->dev == st->st_dev && digest->ino == st->st_ino
+		&& digest->size == st->st_size
+		&& digest->mtime.tv_sec == st->st_mtim.tv_sec
+		&& digest->mtime.tv_nsec == st->st_mtim.tv_nsec
+		&& digest->ctime.tv_sec == st->st_ctim.tv_sec
+		&& digest->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/** Compute the MD5 digest of a file on disk, which is only read once per
+ * transaction for as long as it is not changed.
+ * @param handle the context handle
+ * @param path the path of the file
+ * @return the digest as a hex string to be freed, NULL on error
+ */
+char *_alpm_trans_file_md5(alpm_handle_t *handle, const char *path)
+{
+	alpm_trans_t *trans = handle->trans;
+	struct file_digest *digest = NULL;
+	unsigned long path_hash = _alpm_hash_sdbm(path);
+	alpm_digest_t *md5;
+	alpm_list_t *i;
+	struct stat st;
+	char *ret;
+	int fd;
+
+	if(trans == NULL) {
+		return alpm_compute_md5sum(path);
+	}
+
+	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	for(i = trans->file_digests; i; i = i->next) {
+		struct file_digest *d = i->data;
+		if(d->path_hash == path_hash && strcmp(d->path, path) == 0) {
+			digest = d;
+			break;
+		}
+	}
+	if(digest && digest->md5 && file_digest_matches(digest, &st)) {
+		close(fd);
+		STRDUP(ret, digest->md5, return NULL);
+		return ret;
+	}
+
+	if((md5 = _alpm_digest_new(ALPM_PKG_VALIDATION_MD5SUM)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	if(_alpm_digest_update_fd(md5, fd, -1) < 0) {
+		_alpm_digest_free(md5);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	if((ret = _alpm_digest_final(md5)) == NULL) {
+		return NULL;
+	}
+
+	if(digest == NULL) {
+		CALLOC(digest, 1, sizeof(struct file_digest), return ret);
+		STRDUP(digest->path, path, free(digest); return ret);
+		digest->path_hash = path_hash;
+		if(!alpm_list_append(&trans->file_digests, digest)) {
+			file_digest_free(digest);
+			return ret;
+		}
+	}
+	free(digest->md5);
+	digest->md5 = strdup(ret);
+	digest->dev = st.st_dev;
+	digest->ino = st.st_ino;
+	digest->size = st.st_size;
+	digest->mtime = st.st_mtim;
+	digest->ctime = st.st_ctim;
+	return ret;
+}
+
 void _alpm_trans_free(alpm_trans_t *trans)
 {
 	if(trans == NULL) {
@@ -301,6 +409,9 @@ void _alpm_trans_free(alpm_trans_t *trans)
 
 	FREELIST(trans->skip_remove);
 
+	alpm_list_free_inner(trans->file_digests, (alpm_list_fn_free)file_digest_free);
+	alpm_list_free(trans->file_digests);
+
 	FREE(trans);
 }
 
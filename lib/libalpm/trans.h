@@ -44,11 +44,13 @@ typedef struct _alpm_trans_t {
 	alpm_list_t *add;           /* list of (alpm_pkg_t *) */
 	alpm_list_t *remove;        /* list of (alpm_pkg_t *) */
 	alpm_list_t *skip_remove;   /* list of (char *) */
+	alpm_list_t *file_digests;  /* list of (struct file_digest *) */
 } alpm_trans_t;
 
 void _alpm_trans_free(alpm_trans_t *trans);
 /* flags is a bitfield of alpm_transflag_t flags */
 int _alpm_trans_init(alpm_trans_t *trans, int flags);
+char *_alpm_trans_file_md5(alpm_handle_t *handle, const char *path);
 int _alpm_runscriptlet(alpm_handle_t *handle, const char *filepath,
 		const char *script, const char *ver, const char *oldver, int is_archive);
 
@@ -443,10 +443,30 @@ cleanup:
  */
 ssize_t _alpm_files_in_directory(alpm_handle_t *handle, const char *path,
 		int full_count)
+{
+	return _alpm_files_in_directory_at(handle, AT_FDCWD, path, full_count);
+}
+
+/** Determine if there are files in a directory relative to a directory fd.
+ * @param handle the context handle
+ * @param dirfd directory @a path is relative to, or AT_FDCWD
+ * @param path the directory path
+ * @param full_count whether to return an exact count of files
+ * @return a file count if full_count is != 0, else >0 if directory has
+ * contents, 0 if no contents, and -1 on error
+ */
+ssize_t _alpm_files_in_directory_at(alpm_handle_t *handle, int dirfd,
+		const char *path, int full_count)
 {
 	ssize_t files = 0;
 	struct dirent *ent;
-	DIR *dir = opendir(path);
+	DIR *dir = NULL;
+	int fd;
+
+	OPENAT(fd, dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd >= 0 && (dir = fdopendir(fd)) == NULL) {
+		close(fd);
+	}
 
 	if(!dir) {
 		if(errno == ENOTDIR) {
@@ -1018,150 +1038,173 @@ void _alpm_remove_temporary_download_dir(const char *dir)
 }
 
 
-#if defined  HAVE_LIBSSL || defined HAVE_LIBNETTLE
-/** Compute the MD5 message digest of a file.
- * @param path file path of file to compute  MD5 digest of
- * @param output string to hold computed MD5 digest
- * @return 0 on success, 1 on file open error, 2 on file read error
- */
-static int md5_file(const char *path, unsigned char output[16])
-{
+struct _alpm_digest_t {
+	alpm_pkgvalidation_t type;
 #if HAVE_LIBSSL
 	EVP_MD_CTX *ctx;
-	const EVP_MD *md = EVP_get_digestbyname("MD5");
 #else /* HAVE_LIBNETTLE */
-	struct md5_ctx ctx;
+	union {
+		struct md5_ctx md5;
+		struct sha256_ctx sha256;
+	} ctx;
 #endif
-	unsigned char *buf;
-	ssize_t n;
-	int fd;
+};
 
-	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, return 1);
+/** Start computing a MD5 or SHA-256 message digest.
+ * @param type ALPM_PKG_VALIDATION_MD5SUM or ALPM_PKG_VALIDATION_SHA256SUM
+ * @return the digest context, NULL on error
+ */
+alpm_digest_t *_alpm_digest_new(alpm_pkgvalidation_t type)
+{
+	alpm_digest_t *digest;
 
-	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
-	if(fd < 0) {
-		free(buf);
-		return 1;
+	if(type != ALPM_PKG_VALIDATION_MD5SUM && type != ALPM_PKG_VALIDATION_SHA256SUM) {
+		return NULL;
 	}
 
+	CALLOC(digest, 1, sizeof(*digest), return NULL);
+	digest->type = type;
+
 #if HAVE_LIBSSL
-	ctx = EVP_MD_CTX_create();
-	EVP_DigestInit_ex(ctx, md, NULL);
+	digest->ctx = EVP_MD_CTX_create();
+	if(digest->ctx == NULL || !EVP_DigestInit_ex(digest->ctx,
+				EVP_get_digestbyname(type == ALPM_PKG_VALIDATION_MD5SUM ? "MD5" : "SHA256"),
+				NULL)) {
+		_alpm_digest_free(digest);
+		return NULL;
+	}
 #else /* HAVE_LIBNETTLE */
-	md5_init(&ctx);
+	if(type == ALPM_PKG_VALIDATION_MD5SUM) {
+		md5_init(&digest->ctx.md5);
+	} else {
+		sha256_init(&digest->ctx.sha256);
+	}
 #endif
+	return digest;
+}
 
-	while((n = read(fd, buf, ALPM_BUFFER_SIZE)) > 0 || errno == EINTR) {
-		if(n < 0) {
-			continue;
-		}
+void _alpm_digest_update(alpm_digest_t *digest, const void *buf, size_t len)
+{
 #if HAVE_LIBSSL
-		EVP_DigestUpdate(ctx, buf, n);
+	EVP_DigestUpdate(digest->ctx, buf, len);
 #else /* HAVE_LIBNETTLE */
-		md5_update(&ctx, n, buf);
+	if(digest->type == ALPM_PKG_VALIDATION_MD5SUM) {
+		md5_update(&digest->ctx.md5, len, buf);
+	} else {
+		sha256_update(&digest->ctx.sha256, len, buf);
+	}
 #endif
+}
+
+/** Add data read from a file descriptor to a digest.
+ * @param digest the digest context
+ * @param fd file descriptor to read from, at its current offset
+ * @param len number of bytes to read, -1 to read until the end of the file
+ * @return number of bytes added, -1 on read error
+ */
+off_t _alpm_digest_update_fd(alpm_digest_t *digest, int fd, off_t len)
+{
+	unsigned char *buf;
+	off_t total = 0;
+	ssize_t n = 0;
+
+	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, return -1);
+
+	while(len < 0 || total < len) {
+		size_t want = ALPM_BUFFER_SIZE;
+		if(len >= 0 && (off_t)want > len - total) {
+			want = len - total;
+		}
+		n = read(fd, buf, want);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		_alpm_digest_update(digest, buf, n);
+		total += n;
 	}
 
-	close(fd);
 	free(buf);
+	return n < 0 ? -1 : total;
+}
 
-	if(n < 0) {
-		return 2;
-	}
+/** Finish a digest and free its context.
+ * @param digest the digest context
+ * @return the digest as a hex string, NULL on error
+ */
+char *_alpm_digest_final(alpm_digest_t *digest)
+{
+	unsigned char output[32];
+	size_t size = digest->type == ALPM_PKG_VALIDATION_MD5SUM ? 16 : 32;
 
 #if HAVE_LIBSSL
-	EVP_DigestFinal_ex(ctx, output, NULL);
-	EVP_MD_CTX_destroy(ctx);
+	EVP_DigestFinal_ex(digest->ctx, output, NULL);
 #else /* HAVE_LIBNETTLE */
-	md5_digest(&ctx, MD5_DIGEST_SIZE, output);
+	if(digest->type == ALPM_PKG_VALIDATION_MD5SUM) {
+		md5_digest(&digest->ctx.md5, MD5_DIGEST_SIZE, output);
+	} else {
+		sha256_digest(&digest->ctx.sha256, SHA256_DIGEST_SIZE, output);
+	}
 #endif
-	return 0;
+	_alpm_digest_free(digest);
+	return hex_representation(output, size);
 }
 
-/** Compute the SHA-256 message digest of a file.
- * @param path file path of file to compute SHA256 digest of
- * @param output string to hold computed SHA256 digest
- * @return 0 on success, 1 on file open error, 2 on file read error
- */
-static int sha256_file(const char *path, unsigned char output[32])
+void _alpm_digest_free(alpm_digest_t *digest)
 {
+	if(digest == NULL) {
+		return;
+	}
 #if HAVE_LIBSSL
-	EVP_MD_CTX *ctx;
-	const EVP_MD *md = EVP_get_digestbyname("SHA256");
-#else /* HAVE_LIBNETTLE */
-	struct sha256_ctx ctx;
+	EVP_MD_CTX_destroy(digest->ctx);
 #endif
-	unsigned char *buf;
-	ssize_t n;
-	int fd;
+	free(digest);
+}
 
-	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, return 1);
+/** Compute the MD5 or SHA-256 message digest of a file.
+ * @param path file path of file to compute the digest of
+ * @param type digest type to use
+ * @return the digest as a hex string, NULL on error
+ */
+static char *digest_file(const char *path, alpm_pkgvalidation_t type)
+{
+	alpm_digest_t *digest;
+	off_t n;
+	int fd;
 
 	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
 	if(fd < 0) {
-		free(buf);
-		return 1;
+		return NULL;
 	}
 
-#if HAVE_LIBSSL
-	ctx = EVP_MD_CTX_create();
-	EVP_DigestInit_ex(ctx, md, NULL);
-#else /* HAVE_LIBNETTLE */
-	sha256_init(&ctx);
-#endif
-
-	while((n = read(fd, buf, ALPM_BUFFER_SIZE)) > 0 || errno == EINTR) {
-		if(n < 0) {
-			continue;
-		}
-#if HAVE_LIBSSL
-		EVP_DigestUpdate(ctx, buf, n);
-#else /* HAVE_LIBNETTLE */
-		sha256_update(&ctx, n, buf);
-#endif
+	digest = _alpm_digest_new(type);
+	if(digest == NULL) {
+		close(fd);
+		return NULL;
 	}
 
+	n = _alpm_digest_update_fd(digest, fd, -1);
 	close(fd);
-	free(buf);
 
 	if(n < 0) {
-		return 2;
+		_alpm_digest_free(digest);
+		return NULL;
 	}
-
-#if HAVE_LIBSSL
-	EVP_DigestFinal_ex(ctx, output, NULL);
-	EVP_MD_CTX_destroy(ctx);
-#else /* HAVE_LIBNETTLE */
-	sha256_digest(&ctx, SHA256_DIGEST_SIZE, output);
-#endif
-	return 0;
+	return _alpm_digest_final(digest);
 }
-#endif /* HAVE_LIBSSL || HAVE_LIBNETTLE */
 
 char SYMEXPORT *alpm_compute_md5sum(const char *filename)
 {
-	unsigned char output[16];
-
 	ASSERT(filename != NULL, return NULL);
-
-	if(md5_file(filename, output) > 0) {
-		return NULL;
-	}
-
-	return hex_representation(output, 16);
+	return digest_file(filename, ALPM_PKG_VALIDATION_MD5SUM);
 }
 
 char SYMEXPORT *alpm_compute_sha256sum(const char *filename)
 {
-	unsigned char output[32];
-
 	ASSERT(filename != NULL, return NULL);
-
-	if(sha256_file(filename, output) > 0) {
-		return NULL;
-	}
-
-	return hex_representation(output, 32);
+	return digest_file(filename, ALPM_PKG_VALIDATION_SHA256SUM);
 }
 
 /** Calculates a file's MD5 or SHA-2 digest and compares it to an expected value.
@@ -64,24 +64,24 @@ void _alpm_alloc_fail(size_t size);
 
 #define RET_ERR_VOID(handle, err) do { \
 	_alpm_log(handle, ALPM_LOG_DEBUG, "returning error %d from %s (%s: %d) : %s\n", err, __func__, __FILE__, __LINE__, alpm_strerror(err)); \
-	(handle)->pm_errno = (err); \
+	PM_ERRNO(handle) = (err); \
 	return; } while(0)
 
 #define RET_ERR(handle, err, ret) do { \
 	_alpm_log(handle, ALPM_LOG_DEBUG, "returning error %d from %s (%s: %d) : %s\n", err, __func__, __FILE__, __LINE__, alpm_strerror(err)); \
-	(handle)->pm_errno = (err); \
+	PM_ERRNO(handle) = (err); \
 	return (ret); } while(0)
 
 #define GOTO_ERR(handle, err, label) do { \
 	_alpm_log(handle, ALPM_LOG_DEBUG, "got error %d at %s (%s: %d) : %s\n", err, __func__, __FILE__, __LINE__, alpm_strerror(err)); \
-	(handle)->pm_errno = (err); \
+	PM_ERRNO(handle) = (err); \
 	goto label; } while(0)
 
 #define RET_ERR_ASYNC_SAFE(handle, err, ret) do { \
 	(handle)->pm_errno = (err); \
 	return (ret); } while(0)
 
-#define CHECK_HANDLE(handle, action) do { if(!(handle)) { action; } (handle)->pm_errno = ALPM_ERR_OK; } while(0)
+#define CHECK_HANDLE(handle, action) do { if(!(handle)) { action; } PM_ERRNO(handle) = ALPM_ERR_OK; } while(0)
 
 /** Standard buffer size used throughout the library. */
 #ifdef BUFSIZ
@@ -95,6 +95,7 @@ void _alpm_alloc_fail(size_t size);
 #endif
 
 #define OPEN(fd, path, flags) do { fd = open(path, flags | O_BINARY); } while(fd == -1 && errno == EINTR)
+#define OPENAT(fd, dirfd, path, flags) do { fd = openat(dirfd, path, flags | O_BINARY); } while(fd == -1 && errno == EINTR)
 
 /**
  * Used as a buffer/state holder for _alpm_archive_fgets().
@@ -127,6 +128,8 @@ int _alpm_unpack(alpm_handle_t *handle, const char *archive, const char *prefix,
 		alpm_list_t *list, int breakfirst);
 
 ssize_t _alpm_files_in_directory(alpm_handle_t *handle, const char *path, int full_count);
+ssize_t _alpm_files_in_directory_at(alpm_handle_t *handle, int dirfd,
+		const char *path, int full_count);
 
 typedef ssize_t (*_alpm_cb_io)(void *buf, ssize_t len, void *ctx);
 
@@ -145,6 +148,16 @@ void _alpm_remove_temporary_download_dir(const char *dir);
 /* Unlike many uses of alpm_pkgvalidation_t, _alpm_test_checksum expects
  * an enum value rather than a bitfield. */
 int _alpm_test_checksum(const char *filepath, const char *expected, alpm_pkgvalidation_t type);
+
+/* Incremental MD5 or SHA-256 message digests, types as for
+ * _alpm_test_checksum. */
+typedef struct _alpm_digest_t alpm_digest_t;
+
+alpm_digest_t *_alpm_digest_new(alpm_pkgvalidation_t type);
+void _alpm_digest_update(alpm_digest_t *digest, const void *buf, size_t len);
+off_t _alpm_digest_update_fd(alpm_digest_t *digest, int fd, off_t len);
+char *_alpm_digest_final(alpm_digest_t *digest);
+void _alpm_digest_free(alpm_digest_t *digest);
 int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b);
 int _alpm_splitname(const char *target, char **name, char **version,
 		unsigned long *name_hash);
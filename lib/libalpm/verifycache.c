@@ -0,0 +1,467 @@
+/*
+ *  verifycache.c : persistent record of validated package files
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* libalpm */
+#include "verifycache.h"
+#include "alpm.h"
+#include "handle.h"
+#include "log.h"
+#include "package.h"
+#include "signing.h"
+#include "util.h"
+
+#define VERIFYCACHE_MAGIC "ALPMVFC\n"
+/* bump whenever the on-disk layout changes */
+#define VERIFYCACHE_VERSION 1
+#define VERIFYCACHE_BYTEORDER 0x01020304u
+/* least recently used entries beyond this are dropped when writing */
+#define VERIFYCACHE_MAX_ENTRIES 4096
+#define VERIFYCACHE_KEY_SIZE 64
+
+/* files of the GnuPG home directory a verification result depends on */
+static const char *const keyring_files[] = {
+	"pubring.gpg", "pubring.kbx", "trustdb.gpg", "gpg.conf"
+};
+
+struct verifycache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	char keyring[VERIFYCACHE_KEY_SIZE];
+	uint32_t count;
+	uint32_t reserved;
+};
+
+/* entries are kept sorted by key, in memory and on disk */
+struct verifycache_entry {
+	char key[VERIFYCACHE_KEY_SIZE];
+	uint32_t validation;
+	uint32_t reserved;
+	int64_t used;
+};
+
+struct _alpm_verifycache_t {
+	alpm_handle_t *handle;
+	char *path;
+	char *keyring;
+	struct verifycache_entry *entries;
+	size_t count;
+	size_t size; /* allocated bytes */
+	int64_t now;
+	int dirty;
+	pthread_mutex_t lock;
+};
+
+/* Adds the identity of a file to a digest. Its content is left alone: any
+ * write to it changes the ctime, which cannot be set from userspace. */
+static void digest_file_identity(alpm_digest_t *digest, const char *path)
+{
+	struct stat st;
+	int64_t id[7];
+
+	memset(id, 0, sizeof(id));
+	if(path && stat(path, &st) == 0) {
+		id[0] = st.st_dev;
+		id[1] = st.st_ino;
+		id[2] = st.st_size;
+		id[3] = st.st_mtim.tv_sec;
+		id[4] = st.st_mtim.tv_nsec;
+		id[5] = st.st_ctim.tv_sec;
+		id[6] = st.st_ctim.tv_nsec;
+	}
+	_alpm_digest_update(digest, id, sizeof(id));
+}
+
+static void digest_string(alpm_digest_t *digest, const char *str)
+{
+	/* include the terminator so adjacent fields cannot run together */
+	_alpm_digest_update(digest, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+static char *keyring_digest(alpm_handle_t *handle)
+{
+	alpm_digest_t *digest;
+	size_t i;
+
+	digest = _alpm_digest_new(ALPM_PKG_VALIDATION_SHA256SUM);
+	if(digest == NULL) {
+		return NULL;
+	}
+	digest_string(digest, handle->gpgdir);
+	for(i = 0; i < sizeof(keyring_files) / sizeof(keyring_files[0]); i++) {
+		char *path = NULL;
+		if(handle->gpgdir) {
+			size_t len = strlen(handle->gpgdir) + strlen(keyring_files[i]) + 1;
+			MALLOC(path, len, _alpm_digest_free(digest); return NULL);
+			snprintf(path, len, "%s%s", handle->gpgdir, keyring_files[i]);
+		}
+		digest_file_identity(digest, path);
+		free(path);
+	}
+	return _alpm_digest_final(digest);
+}
+
+static int entry_cmp(const void *key, const void *entry)
+{
+	return memcmp(key, ((const struct verifycache_entry *)entry)->key,
+			VERIFYCACHE_KEY_SIZE);
+}
+
+static int entry_sort_cmp(const void *e1, const void *e2)
+{
+	return entry_cmp(((const struct verifycache_entry *)e1)->key, e2);
+}
+
+static int entry_used_cmp(const void *e1, const void *e2)
+{
+	int64_t u1 = ((const struct verifycache_entry *)e1)->used;
+	int64_t u2 = ((const struct verifycache_entry *)e2)->used;
+	return u1 < u2 ? 1 : (u1 > u2 ? -1 : 0);
+}
+
+/* Reads the entries of an existing cache file, if it can be trusted and
+ * was written against the current keyring. */
+static void read_entries(alpm_verifycache_t *cache)
+{
+	struct verifycache_header hdr;
+	struct stat st;
+	size_t i, len;
+	int fd;
+
+	fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return;
+	}
+	/* whoever can write the cache can vouch for any file */
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+			|| (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+				"ignoring verification cache %s: unsafe owner or mode\n", cache->path);
+		goto cleanup;
+	}
+	if(read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+			|| memcmp(hdr.magic, VERIFYCACHE_MAGIC, sizeof(hdr.magic)) != 0
+			|| hdr.version != VERIFYCACHE_VERSION
+			|| hdr.byteorder != VERIFYCACHE_BYTEORDER
+			|| hdr.count > VERIFYCACHE_MAX_ENTRIES
+			|| (off_t)(sizeof(hdr) + hdr.count * sizeof(struct verifycache_entry)) != st.st_size) {
+		_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+				"ignoring malformed verification cache %s\n", cache->path);
+		goto cleanup;
+	}
+	if(memcmp(hdr.keyring, cache->keyring, VERIFYCACHE_KEY_SIZE) != 0) {
+		_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+				"keyring changed, discarding verification cache\n");
+		cache->dirty = 1;
+		goto cleanup;
+	}
+	if(hdr.count == 0) {
+		goto cleanup;
+	}
+
+	len = hdr.count * sizeof(struct verifycache_entry);
+	MALLOC(cache->entries, len, goto cleanup);
+	if(read(fd, cache->entries, len) != (ssize_t)len) {
+		goto error;
+	}
+	for(i = 1; i < hdr.count; i++) {
+		if(entry_sort_cmp(&cache->entries[i - 1], &cache->entries[i]) >= 0) {
+			goto error;
+		}
+	}
+	cache->count = hdr.count;
+	cache->size = len;
+	goto cleanup;
+
+error:
+	_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+			"ignoring malformed verification cache %s\n", cache->path);
+	FREE(cache->entries);
+
+cleanup:
+	close(fd);
+}
+
+/** Load the verification cache of the package cache directory.
+ * A missing, stale or unreadable cache file results in an empty cache.
+ * @param handle the context handle
+ * @return the cache, NULL on error
+ */
+alpm_verifycache_t *_alpm_verifycache_load(alpm_handle_t *handle)
+{
+	alpm_verifycache_t *cache;
+	const char *cachedir;
+	size_t len;
+
+	cachedir = _alpm_filecache_setup(handle);
+	if(cachedir == NULL) {
+		return NULL;
+	}
+
+	CALLOC(cache, 1, sizeof(*cache), return NULL);
+	cache->handle = handle;
+	cache->now = time(NULL);
+	len = strlen(cachedir) + strlen(ALPM_VERIFYCACHE_FILE) + 1;
+	MALLOC(cache->path, len, goto error);
+	snprintf(cache->path, len, "%s%s", cachedir, ALPM_VERIFYCACHE_FILE);
+	cache->keyring = keyring_digest(handle);
+	if(cache->keyring == NULL) {
+		goto error;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+
+	read_entries(cache);
+	_alpm_log(handle, ALPM_LOG_DEBUG, "loaded %zu verification cache entries\n",
+			cache->count);
+	return cache;
+
+error:
+	free(cache->path);
+	free(cache);
+	return NULL;
+}
+
+/** Compute the cache key of a package file.
+ * The key has to be taken before the file is validated, so that a file
+ * changed in the meantime does not match it afterwards.
+ * @param handle the context handle
+ * @param path path of the package file
+ * @param spkg the sync package the file belongs to
+ * @param siglevel the signature level the file is validated with
+ * @return the key, NULL if the file cannot be cached
+ */
+char *_alpm_verifycache_key(alpm_handle_t *handle, const char *path,
+		alpm_pkg_t *spkg, int siglevel)
+{
+	alpm_digest_t *digest;
+	struct stat st;
+	char *sigpath = NULL;
+
+	if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+	if(!spkg->base64_sig) {
+		sigpath = _alpm_sigpath(handle, path);
+		if(sigpath == NULL) {
+			return NULL;
+		}
+	}
+
+	digest = _alpm_digest_new(ALPM_PKG_VALIDATION_SHA256SUM);
+	if(digest == NULL) {
+		free(sigpath);
+		return NULL;
+	}
+	_alpm_digest_update(digest, &siglevel, sizeof(siglevel));
+	digest_file_identity(digest, path);
+	digest_file_identity(digest, sigpath);
+	digest_string(digest, spkg->sha256sum);
+	digest_string(digest, spkg->md5sum);
+	digest_string(digest, spkg->base64_sig);
+	free(sigpath);
+
+	return _alpm_digest_final(digest);
+}
+
+/** Look up a package file in the cache.
+ * @param cache the verification cache
+ * @param key key of the package file
+ * @param validation set to the recorded validation on success
+ * @return 0 if the file is known to be valid, -1 otherwise
+ */
+int _alpm_verifycache_lookup(alpm_verifycache_t *cache, const char *key,
+		int *validation)
+{
+	struct verifycache_entry *entry;
+	int ret = -1;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = bsearch(key, cache->entries, cache->count,
+			sizeof(struct verifycache_entry), entry_cmp);
+	if(entry) {
+		*validation = entry->validation;
+		if(entry->used != cache->now) {
+			entry->used = cache->now;
+			cache->dirty = 1;
+		}
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+/** Record a successfully validated package file.
+ * @param cache the verification cache
+ * @param key key of the package file, taken before it was validated
+ * @param validation the resulting validation
+ */
+void _alpm_verifycache_add(alpm_verifycache_t *cache, const char *key,
+		int validation)
+{
+	struct verifycache_entry *entry;
+	size_t lo = 0, hi;
+
+	pthread_mutex_lock(&cache->lock);
+	hi = cache->count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = entry_cmp(key, &cache->entries[mid]);
+		if(cmp == 0) {
+			goto done;
+		} else if(cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	if(!_alpm_greedy_grow((void **)&cache->entries, &cache->size,
+				(cache->count + 1) * sizeof(struct verifycache_entry))) {
+		goto done;
+	}
+	entry = cache->entries + lo;
+	memmove(entry + 1, entry, (cache->count - lo) * sizeof(*entry));
+	memset(entry, 0, sizeof(*entry));
+	memcpy(entry->key, key, VERIFYCACHE_KEY_SIZE);
+	entry->validation = validation;
+	entry->used = cache->now;
+	cache->count++;
+	cache->dirty = 1;
+
+done:
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	while(len > 0) {
+		ssize_t n = write(fd, p, len);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/** Write the cache back if it has changed. Failing to do so is not an
+ * error for the caller; the next transaction simply validates again.
+ * @param cache the verification cache
+ * @return 0 on success, -1 on error
+ */
+int _alpm_verifycache_write(alpm_verifycache_t *cache)
+{
+	struct verifycache_header hdr;
+	char *temppath = NULL;
+	int fd = -1, ret = -1, created = 0;
+	size_t len;
+
+	if(!cache->dirty) {
+		return 0;
+	}
+
+	if(cache->count > VERIFYCACHE_MAX_ENTRIES) {
+		qsort(cache->entries, cache->count, sizeof(struct verifycache_entry),
+				entry_used_cmp);
+		cache->count = VERIFYCACHE_MAX_ENTRIES;
+		qsort(cache->entries, cache->count, sizeof(struct verifycache_entry),
+				entry_sort_cmp);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, VERIFYCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = VERIFYCACHE_VERSION;
+	hdr.byteorder = VERIFYCACHE_BYTEORDER;
+	memcpy(hdr.keyring, cache->keyring, sizeof(hdr.keyring));
+	hdr.count = cache->count;
+
+	len = strlen(cache->path) + 8;
+	MALLOC(temppath, len, goto cleanup);
+	snprintf(temppath, len, "%s.XXXXXX", cache->path);
+
+	fd = mkstemp(temppath);
+	if(fd < 0) {
+		_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+				"could not create verification cache %s: %s\n",
+				cache->path, strerror(errno));
+		goto cleanup;
+	}
+	created = 1;
+	if(fchmod(fd, 0644) != 0
+			|| write_all(fd, &hdr, sizeof(hdr)) != 0
+			|| write_all(fd, cache->entries,
+				cache->count * sizeof(struct verifycache_entry)) != 0) {
+		_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+				"could not write verification cache %s: %s\n",
+				cache->path, strerror(errno));
+		goto cleanup;
+	}
+	if(close(fd) != 0) {
+		fd = -1;
+		goto cleanup;
+	}
+	fd = -1;
+	if(rename(temppath, cache->path) != 0) {
+		goto cleanup;
+	}
+
+	_alpm_log(cache->handle, ALPM_LOG_DEBUG,
+			"wrote %zu verification cache entries\n", cache->count);
+	cache->dirty = 0;
+	ret = 0;
+
+cleanup:
+	if(fd >= 0) {
+		close(fd);
+	}
+	if(ret != 0 && created) {
+		unlink(temppath);
+	}
+	free(temppath);
+	return ret;
+}
+
+void _alpm_verifycache_free(alpm_verifycache_t *cache)
+{
+	if(cache == NULL) {
+		return;
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entries);
+	free(cache->keyring);
+	free(cache->path);
+	free(cache);
+}
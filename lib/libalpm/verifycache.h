@@ -0,0 +1,49 @@
+/*
+ *  verifycache.h
+ *
+ *  Copyright (c) 2024 Pacman Development Team <pacman-dev@lists.archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_VERIFYCACHE_H
+#define ALPM_VERIFYCACHE_H
+
+#include "alpm.h"
+
+/* Persistent record of successfully validated package files.
+ *
+ * The cache lives in the package cache directory as '.verify.cache'. Each
+ * entry is keyed on a digest of the identity of a package file and of its
+ * detached signature (device, inode, size, mtime and ctime), the checksums
+ * and signature the sync database expects and the signature level it was
+ * validated with, and records the resulting validation. The whole file is
+ * tied to the state of the keyring files in the GnuPG directory and ignored
+ * once any of them changes. Lookups and additions may be made from several
+ * threads. */
+
+#define ALPM_VERIFYCACHE_FILE ".verify.cache"
+
+typedef struct _alpm_verifycache_t alpm_verifycache_t;
+
+alpm_verifycache_t *_alpm_verifycache_load(alpm_handle_t *handle);
+char *_alpm_verifycache_key(alpm_handle_t *handle, const char *path,
+		alpm_pkg_t *spkg, int siglevel);
+int _alpm_verifycache_lookup(alpm_verifycache_t *cache, const char *key,
+		int *validation);
+void _alpm_verifycache_add(alpm_verifycache_t *cache, const char *key,
+		int validation);
+int _alpm_verifycache_write(alpm_verifycache_t *cache);
+void _alpm_verifycache_free(alpm_verifycache_t *cache);
+
+#endif /* ALPM_VERIFYCACHE_H */
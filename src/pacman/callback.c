@@ -1111,6 +1111,16 @@ static int strendswith(const char *haystack, const char *needle)
 	return hlen >= nlen && strcmp(haystack + hlen - nlen, needle) == 0;
 }
 
+/* The per-host transfer statistics are only of interest when debugging */
+static void dload_host_stats_event(const char *hostname,
+		alpm_download_event_host_stats_t *data)
+{
+	pm_printf(ALPM_LOG_DEBUG, "%s: %u transfers (%u failed, %u multiplexed) "
+			"over %u connections, %jd bytes\n", hostname, data->transfers,
+			data->failures, data->multiplexed, data->connections,
+			(intmax_t)data->downloaded);
+}
+
 /* Callback to handle display of download progress */
 void cb_download(void *ctx, const char *filename, alpm_download_event_type_t event, void *data)
 {
@@ -1129,6 +1139,8 @@ void cb_download(void *ctx, const char *filename, alpm_download_event_type_t eve
 		dload_retry_event(filename, data);
 	} else if(event == ALPM_DOWNLOAD_COMPLETED) {
 		dload_complete_event(filename, data);
+	} else if(event == ALPM_DOWNLOAD_HOST_STATS) {
+		dload_host_stats_event(filename, data);
 	} else {
 		pm_printf(ALPM_LOG_ERROR, _("unknown callback event type %d for %s\n"),
 				event, filename);
@@ -117,6 +117,9 @@ config_t *config_new(void)
 
 	/* by default use 1 download stream */
 	newconfig->parallel_downloads = 1;
+	newconfig->parallel_db_loads = 1;
+	newconfig->parallel_integrity_checks = 1;
+	newconfig->parallel_extractions = 1;
 	newconfig->colstr.colon   = ":: ";
 	newconfig->colstr.title   = "";
 	newconfig->colstr.repo    = "";
@@ -449,6 +452,45 @@ static int parse_number(char *value, long *result) {
 	return invalid;
 }
 
+/**
+ * Parse a positive integer option value.
+ * @param key the option name, used in error messages
+ * @param value the string to parse
+ * @param file path to the config file
+ * @param linenum current line number in file
+ * @param result location to store the parsed value
+ * @return 0 on success, 1 on any parsing error
+ */
+static int parse_positive_option(const char *key, char *value,
+		const char *file, int linenum, unsigned int *result)
+{
+	long number;
+
+	if(parse_number(value, &number)) {
+		pm_printf(ALPM_LOG_ERROR,
+				_("config file %s, line %d: invalid value for '%s' : '%s'\n"),
+				file, linenum, key, value);
+		return 1;
+	}
+
+	if(number < 1) {
+		pm_printf(ALPM_LOG_ERROR,
+				_("config file %s, line %d: value for '%s' has to be positive : '%s'\n"),
+				file, linenum, key, value);
+		return 1;
+	}
+
+	if(number > INT_MAX) {
+		pm_printf(ALPM_LOG_ERROR,
+				_("config file %s, line %d: value for '%s' is too large : '%s'\n"),
+				file, linenum, key, value);
+		return 1;
+	}
+
+	*result = number;
+	return 0;
+}
+
 /**
  * Parse a signature verification level line.
  * @param values the list of parsed option values
@@ -629,6 +671,8 @@ static int _parse_options(const char *key, char *value,
 			config->noprogressbar = 1;
 		} else if(strcmp(key, "DisableDownloadTimeout") == 0) {
 			config->disable_dl_timeout = 1;
+		} else if(strcmp(key, "PipelinedCommit") == 0) {
+			config->pipelined_commit = 1;
 		} else {
 			pm_printf(ALPM_LOG_WARNING,
 					_("config file %s, line %d: directive '%s' in section '%s' not recognized.\n"),
@@ -734,32 +778,59 @@ static int _parse_options(const char *key, char *value,
 			}
 			FREELIST(values);
 		} else if(strcmp(key, "ParallelDownloads") == 0) {
-			long number;
-			int err;
-
-			err = parse_number(value, &number);
-			if(err) {
-				pm_printf(ALPM_LOG_ERROR,
-						_("config file %s, line %d: invalid value for '%s' : '%s'\n"),
-						file, linenum, "ParallelDownloads", value);
+			if(parse_positive_option(key, value, file, linenum,
+						&config->parallel_downloads)) {
 				return 1;
 			}
-
-			if(number < 1) {
+		} else if(strcmp(key, "MaxHostConnections") == 0) {
+			if(parse_positive_option(key, value, file, linenum,
+						&config->max_host_connections)) {
+				return 1;
+			}
+		} else if(strcmp(key, "ParallelDatabaseLoads") == 0) {
+			if(parse_positive_option(key, value, file, linenum,
+						&config->parallel_db_loads)) {
+				return 1;
+			}
+		} else if(strcmp(key, "ParallelIntegrityChecks") == 0) {
+			if(parse_positive_option(key, value, file, linenum,
+						&config->parallel_integrity_checks)) {
+				return 1;
+			}
+		} else if(strcmp(key, "ParallelExtractions") == 0) {
+			if(parse_positive_option(key, value, file, linenum,
+						&config->parallel_extractions)) {
+				return 1;
+			}
+		} else if(strcmp(key, "SegmentedDownloadSize") == 0) {
+			if(parse_positive_option(key, value, file, linenum,
+						&config->segmented_download_size)) {
+				return 1;
+			}
+		} else if(strcmp(key, "DownloadOrder") == 0) {
+			if(strcmp(value, "Size") == 0) {
+				config->download_order = ALPM_DOWNLOAD_ORDER_SIZE;
+			} else if(strcmp(value, "Install") == 0) {
+				config->download_order = ALPM_DOWNLOAD_ORDER_INSTALL;
+			} else {
 				pm_printf(ALPM_LOG_ERROR,
-						_("config file %s, line %d: value for '%s' has to be positive : '%s'\n"),
-						file, linenum, "ParallelDownloads", value);
+						_("config file %s, line %d: invalid value for '%s' : '%s'\n"),
+						file, linenum, "DownloadOrder", value);
 				return 1;
 			}
-
-			if(number > INT_MAX) {
+		} else if(strcmp(key, "Durability") == 0) {
+			if(strcmp(value, "None") == 0) {
+				config->durability = ALPM_DURABILITY_NONE;
+			} else if(strcmp(value, "Batch") == 0) {
+				config->durability = ALPM_DURABILITY_BATCH;
+			} else if(strcmp(value, "PerFile") == 0) {
+				config->durability = ALPM_DURABILITY_FILE;
+			} else {
 				pm_printf(ALPM_LOG_ERROR,
-						_("config file %s, line %d: value for '%s' is too large : '%s'\n"),
-						file, linenum, "ParallelDownloads", value);
+						_("config file %s, line %d: invalid value for '%s' : '%s'\n"),
+						file, linenum, "Durability", value);
 				return 1;
 			}
-
-			config->parallel_downloads = number;
 		} else {
 			pm_printf(ALPM_LOG_WARNING,
 					_("config file %s, line %d: directive '%s' in section '%s' not recognized.\n"),
@@ -945,6 +1016,17 @@ static int setup_libalpm(void)
 
 	alpm_option_set_disable_dl_timeout(handle, config->disable_dl_timeout);
 	alpm_option_set_parallel_downloads(handle, config->parallel_downloads);
+	alpm_option_set_max_host_connections(handle, config->max_host_connections);
+	/* the transfer statistics of each host are only printed when debugging */
+	alpm_option_set_host_stats(handle, (config->logmask & ALPM_LOG_DEBUG) != 0);
+	alpm_option_set_parallel_db_loads(handle, config->parallel_db_loads);
+	alpm_option_set_parallel_integrity_checks(handle, config->parallel_integrity_checks);
+	alpm_option_set_parallel_extractions(handle, config->parallel_extractions);
+	alpm_option_set_segmented_download_size(handle,
+			(off_t)config->segmented_download_size * 1024 * 1024);
+	alpm_option_set_download_order(handle, config->download_order);
+	alpm_option_set_durability(handle, config->durability);
+	alpm_option_set_pipelined_commit(handle, config->pipelined_commit);
 
 	for(i = config->assumeinstalled; i; i = i->next) {
 		char *entry = i->data;
@@ -58,6 +58,7 @@ typedef struct __config_t {
 	unsigned short usesyslog;
 	unsigned short color;
 	unsigned short disable_dl_timeout;
+	unsigned short pipelined_commit;
 	char *print_format;
 	/* unfortunately, we have to keep track of paths both here and in the library
 	 * because they can come from both the command line or config file, and we
@@ -117,6 +118,20 @@ typedef struct __config_t {
 	unsigned short verbosepkglists;
 	/* number of parallel download streams */
 	unsigned int parallel_downloads;
+	/* connections per host, 0 for no limit */
+	unsigned int max_host_connections;
+	/* number of threads loading sync databases */
+	unsigned int parallel_db_loads;
+	/* number of threads verifying packages */
+	unsigned int parallel_integrity_checks;
+	/* number of threads extracting packages */
+	unsigned int parallel_extractions;
+	/* size in MiB from which packages are downloaded in segments */
+	unsigned int segmented_download_size;
+	/* order in which packages are downloaded */
+	alpm_download_order_t download_order;
+	/* how transactions sync the files they write */
+	alpm_durability_t durability;
 	/* select -Sc behavior */
 	unsigned short cleanmethod;
 	alpm_list_t *holdpkg;
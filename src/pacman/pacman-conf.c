@@ -179,6 +179,26 @@ static void show_cleanmethod(const char *directive, unsigned int method)
 	}
 }
 
+static void show_download_order(const char *directive, alpm_download_order_t order)
+{
+	if(order == ALPM_DOWNLOAD_ORDER_INSTALL) {
+		show_str(directive, "Install");
+	} else {
+		show_str(directive, "Size");
+	}
+}
+
+static void show_durability(const char *directive, alpm_durability_t durability)
+{
+	if(durability == ALPM_DURABILITY_BATCH) {
+		show_str(directive, "Batch");
+	} else if(durability == ALPM_DURABILITY_FILE) {
+		show_str(directive, "PerFile");
+	} else {
+		show_str(directive, "None");
+	}
+}
+
 static void show_siglevel(const char *directive, alpm_siglevel_t level, int pkgonly)
 {
 	if(level == ALPM_SIG_USE_DEFAULT) {
@@ -282,6 +302,14 @@ static void dump_config(void)
 	show_bool("NoProgressBar", config->noprogressbar);
 
 	show_int("ParallelDownloads", config->parallel_downloads);
+	show_int("MaxHostConnections", config->max_host_connections);
+	show_int("ParallelDatabaseLoads", config->parallel_db_loads);
+	show_int("ParallelIntegrityChecks", config->parallel_integrity_checks);
+	show_int("ParallelExtractions", config->parallel_extractions);
+	show_int("SegmentedDownloadSize", config->segmented_download_size);
+	show_download_order("DownloadOrder", config->download_order);
+	show_bool("PipelinedCommit", config->pipelined_commit);
+	show_durability("Durability", config->durability);
 
 	show_cleanmethod("CleanMethod", config->cleanmethod);
 
@@ -400,6 +428,22 @@ static int list_directives(void)
 
 		} else if(strcasecmp(i->data, "ParallelDownloads") == 0) {
 			show_int("ParallelDownloads", config->parallel_downloads);
+		} else if(strcasecmp(i->data, "MaxHostConnections") == 0) {
+			show_int("MaxHostConnections", config->max_host_connections);
+		} else if(strcasecmp(i->data, "ParallelDatabaseLoads") == 0) {
+			show_int("ParallelDatabaseLoads", config->parallel_db_loads);
+		} else if(strcasecmp(i->data, "ParallelIntegrityChecks") == 0) {
+			show_int("ParallelIntegrityChecks", config->parallel_integrity_checks);
+		} else if(strcasecmp(i->data, "ParallelExtractions") == 0) {
+			show_int("ParallelExtractions", config->parallel_extractions);
+		} else if(strcasecmp(i->data, "SegmentedDownloadSize") == 0) {
+			show_int("SegmentedDownloadSize", config->segmented_download_size);
+		} else if(strcasecmp(i->data, "DownloadOrder") == 0) {
+			show_download_order("DownloadOrder", config->download_order);
+		} else if(strcasecmp(i->data, "PipelinedCommit") == 0) {
+			show_bool("PipelinedCommit", config->pipelined_commit);
+		} else if(strcasecmp(i->data, "Durability") == 0) {
+			show_durability("Durability", config->durability);
 
 		} else if(strcasecmp(i->data, "CleanMethod") == 0) {
 			show_cleanmethod("CleanMethod", config->cleanmethod);
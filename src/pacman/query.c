@@ -142,7 +142,6 @@ static int query_fileowner(alpm_list_t *targets)
 	size_t rootlen = strlen(root);
 	alpm_list_t *t;
 	alpm_db_t *db_local;
-	alpm_list_t *packages;
 
 	/* This code is here for safety only */
 	if(targets == NULL) {
@@ -151,13 +150,12 @@ static int query_fileowner(alpm_list_t *targets)
 	}
 
 	db_local = alpm_get_localdb(config->handle);
-	packages = alpm_db_get_pkgcache(db_local);
 
 	for(t = targets; t; t = alpm_list_next(t)) {
 		char *filename = NULL;
 		char rpath[PATH_MAX], *rel_path;
 		struct stat buf;
-		alpm_list_t *i;
+		alpm_list_t *i, *owners;
 		size_t len;
 		unsigned int found = 0;
 		int is_dir = 0, is_missing = 0;
@@ -209,12 +207,12 @@ static int query_fileowner(alpm_list_t *targets)
 			strcat(rpath + rlen, "/");
 		}
 
-		for(i = packages; i && (!found || is_dir); i = alpm_list_next(i)) {
-			if(alpm_filelist_contains(alpm_pkg_get_files(i->data), rel_path)) {
-				print_query_fileowner(rpath, i->data);
-				found = 1;
-			}
+		owners = alpm_db_find_file_owners(db_local, rel_path);
+		for(i = owners; i && (!found || is_dir); i = alpm_list_next(i)) {
+			print_query_fileowner(rpath, i->data);
+			found = 1;
 		}
+		alpm_list_free(owners);
 		if(!found) {
 			pm_printf(ALPM_LOG_ERROR, _("No package owns %s\n"), filename);
 		}
@@ -111,6 +111,10 @@ static int sync_cleandb(const char *dbpath)
 			dbname = strndup(dname, len - 6);
 		} else if(len > 10 && strcmp(dname + len - 10, ".files.sig") == 0) {
 			dbname = strndup(dname, len - 10);
+		} else if(len > 9 && strcmp(dname + len - 9, ".db.cache") == 0) {
+			dbname = strndup(dname, len - 9);
+		} else if(len > 12 && strcmp(dname + len - 12, ".files.cache") == 0) {
+			dbname = strndup(dname, len - 12);
 		} else {
 			ret += unlink_verbose(path, 0);
 			continue;
@@ -228,7 +232,9 @@ static int sync_cleancache(int level)
 					/* skip package databases within the cache directory */
 					"*.db*", "*.files*",
 					/* skip source packages within the cache directory */
-					"*.src.tar.*"
+					"*.src.tar.*",
+					/* skip the record of packages verified by libalpm */
+					".verify.cache"
 				};
 				size_t j;
 
@@ -17,6 +17,7 @@
 import http.server
 import sys
 import re
+import time
 
 class pmHTTPServer(http.server.ThreadingHTTPServer):
     pass
@@ -25,14 +26,30 @@ class pmHTTPRequestHandler(http.server.BaseHTTPRequestHandler):
     """BaseHTTPRequestHandler subclass with helper methods and common setup"""
 
     logfile = sys.stderr
+    # keep connections open so clients can reuse them
+    protocol_version = "HTTP/1.1"
 
-    def respond(self, response, headers={}, code=200):
-        self.protocol_version = "HTTP/1.1"
+    def respond(self, response, headers={}, code=200, rate=None):
         self.send_response(code)
         for header, value in headers.items():
             self.send_header(header, value)
+        # the client asked to close the connection after this response
+        if self.close_connection:
+            self.send_header('Connection', 'close')
         self.end_headers()
-        self.wfile.write(response)
+        # clients may hang up early, e.g. to try another server
+        try:
+            if rate is None:
+                self.wfile.write(response)
+                return
+            # trickle the body out at roughly 'rate' bytes per second
+            chunk = max(rate // 10, 1)
+            for i in range(0, len(response), chunk):
+                self.wfile.write(response[i:i + chunk])
+                self.wfile.flush()
+                time.sleep(chunk / rate)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
 
     def parse_range_bytes(self, text):
         parser = re.compile(r'^bytes=(\d+)-(\d+)?$')
@@ -41,21 +58,24 @@ def parse_range_bytes(self, text):
         else:
             raise ValueError("Unrecognized Range value")
 
-    def respond_bytes(self, response, headers={}, code=200):
+    def respond_bytes(self, response, headers={}, code=200, rate=None, ranges=True):
         headers = headers.copy()
-        if code == 200 and self.headers['Range']:
+        if code == 200 and ranges and self.headers['Range']:
             (start, end) = self.parse_range_bytes(self.headers['Range'])
+            total = len(response)
+            if end is None or end >= total:
+                end = total - 1
             code = 206
-            response = response[start:end]
-            headers.setdefault('Content-Range', 'bytes */%s' % (len(response)))
+            response = response[start:end + 1]
+            headers.setdefault('Content-Range', 'bytes %d-%d/%d' % (start, end, total))
         headers.setdefault('Content-Type', "application/octet-stream")
         headers.setdefault('Content-Length', str(len(response)))
-        self.respond(response, headers, code)
+        self.respond(response, headers, code, rate)
 
-    def respond_string(self, response, headers={}, code=200):
+    def respond_string(self, response, headers={}, code=200, rate=None, ranges=True):
         headers = headers.copy()
         headers.setdefault('Content-Type', 'text/plain; charset=utf-8')
-        self.respond_bytes(response.encode('UTF-8'), headers, code)
+        self.respond_bytes(response.encode('UTF-8'), headers, code, rate, ranges)
 
     def log_message(self, format, *args):
         if callable(self.logfile):
@@ -74,10 +94,13 @@ def do_GET(self):
         response = self.responses.get(self.path, self.responses.get(''))
         if response is not None:
             if isinstance(response, dict):
-                self.respond_string(
-                        response.get('body', ''),
+                body = response.get('body', '')
+                respond = self.respond_bytes if isinstance(body, bytes) else self.respond_string
+                respond(body,
                         headers=response.get('headers', {}),
-                        code=response.get('code', 200))
+                        code=response.get('code', 200),
+                        rate=response.get('rate'),
+                        ranges=response.get('ranges', True))
             elif isinstance(response, bytes):
                 self.respond_bytes(response)
             else:
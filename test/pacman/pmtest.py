@@ -92,6 +92,10 @@ def load(self):
             "fail": 0
         }
         self.args = ""
+        # pacman invocations run before args, e.g. to populate caches;
+        # callables are called with the test instead, e.g. to change files
+        # between runs
+        self.setupargs = []
         self.retcode = 0
         self.db = {
             "local": pmdb.pmdb("local", self.root)
@@ -284,21 +288,27 @@ def run(self, pacman):
             cmd.append("--confirm")
         if pacman["debug"]:
             cmd.append("--debug=%s" % pacman["debug"])
-        cmd.extend(shlex.split(self.args))
 
         if not (pacman["gdb"] or pacman["nolog"]):
             output = open(os.path.join(self.root, util.LOGFILE), 'w')
         else:
             output = None
-        vprint("\trunning: %s" % " ".join(cmd))
 
         self.start_http_servers()
 
         # Change to the tmp dir before running pacman, so that local package
         # archives are made available more easily.
         time_start = time.time()
-        self.retcode = subprocess.call(cmd, stdout=output, stderr=output,
-                cwd=os.path.join(self.root, util.TMPDIR), env={'LC_ALL': 'C'})
+        for args in self.setupargs + [self.args]:
+            if callable(args):
+                args(self)
+                continue
+            runcmd = cmd + shlex.split(args)
+            vprint("\trunning: %s" % " ".join(runcmd))
+            if output:
+                output.flush()
+            self.retcode = subprocess.call(runcmd, stdout=output, stderr=output,
+                    cwd=os.path.join(self.root, util.TMPDIR), env={'LC_ALL': 'C'})
         time_end = time.time()
         vprint("\ttime elapsed: %.2fs" % (time_end - time_start))
 
@@ -0,0 +1,23 @@
+self.description = "Report target conflicts with installed packages in conflict order"
+
+sp = pmpkg("target")
+sp.conflicts = ["virt", "alpha"]
+self.addpkg2db("sync", sp)
+
+for name, provides in [("alpha", []), ("mid", ["virt"]), ("beta", ["virt"])]:
+    lp = pmpkg(name)
+    lp.provides = provides
+    self.addpkg2db("local", lp)
+
+self.args = "-S %s" % sp.name
+
+# conflicts are checked in the order the target declares them, each against
+# the installed packages in name order; the first one found is asked about
+self.addrule("PACMAN_RETCODE=1")
+self.addrule("PACMAN_OUTPUT=target-1.0-1 and beta-1.0-1 are in conflict.*Remove beta")
+self.addrule("!PACMAN_OUTPUT=Remove alpha")
+self.addrule("!PACMAN_OUTPUT=Remove mid")
+self.addrule("!PKG_EXIST=target")
+self.addrule("PKG_EXIST=alpha")
+self.addrule("PKG_EXIST=beta")
+self.addrule("PKG_EXIST=mid")
@@ -0,0 +1,25 @@
+self.description = "dependency provided by several packages across sync dbs"
+
+sp1 = pmpkg("pkg1")
+sp1.depends = ["provision"]
+self.addpkg2db("sync1", sp1)
+
+sp2 = pmpkg("pkg2")
+sp2.provides = ["provision=1.0-1", "provision"]
+self.addpkg2db("sync1", sp2)
+
+sp3 = pmpkg("pkg3")
+sp3.provides = ["provision"]
+self.addpkg2db("sync1", sp3)
+
+sp4 = pmpkg("pkg4")
+sp4.provides = ["provision"]
+self.addpkg2db("sync2", sp4)
+
+self.args = "-S %s" % sp1.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+self.addrule("!PKG_EXIST=pkg3")
+self.addrule("!PKG_EXIST=pkg4")
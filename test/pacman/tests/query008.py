@@ -0,0 +1,22 @@
+self.description = "Query ownership of a directory with several owners"
+
+lp1 = pmpkg("owner1")
+lp1.files = ["usr/share/shared/",
+             "usr/share/shared/one"]
+self.addpkg2db("local", lp1)
+
+lp2 = pmpkg("owner2")
+lp2.files = ["usr/share/shared/",
+             "usr/share/shared/two"]
+self.addpkg2db("local", lp2)
+
+lp3 = pmpkg("other")
+lp3.files = ["usr/share/other"]
+self.addpkg2db("local", lp3)
+
+self.args = "-Qo ../usr/share/shared"
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=owner1")
+self.addrule("PACMAN_OUTPUT=owner2")
+self.addrule("!PACMAN_OUTPUT=other")
@@ -0,0 +1,32 @@
+self.description = "Remove a package spanning more directories than are kept open"
+
+dirs = ["usr/share/pkg1/d%02d/" % i for i in range(24)]
+
+lp1 = pmpkg("pkg1")
+lp1.files = ["usr/", "usr/share/", "usr/share/pkg1/"]
+for d in dirs:
+    lp1.files += [d, d + "sub/", d + "sub/file", d + "file"]
+lp1.files += ["usr/share/shared/", "usr/share/shared/pkg1"]
+self.addpkg2db("local", lp1)
+
+lp2 = pmpkg("pkg2")
+lp2.files = ["usr/", "usr/share/", "usr/share/shared/",
+             "usr/share/shared/pkg2"]
+self.addpkg2db("local", lp2)
+
+self.filesystem = ["usr/share/pkg1/d07/sub/untracked"]
+
+self.args = "-R pkg1"
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("!PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+for i, d in enumerate(dirs):
+    self.addrule("!FILE_EXIST=%sfile" % d)
+    self.addrule("!FILE_EXIST=%ssub/file" % d)
+    if i != 7:
+        self.addrule("!DIR_EXIST=%s" % d)
+self.addrule("FILE_EXIST=usr/share/pkg1/d07/sub/untracked")
+self.addrule("!FILE_EXIST=usr/share/shared/pkg1")
+self.addrule("FILE_EXIST=usr/share/shared/pkg2")
+self.addrule("DIR_EXIST=usr/share/shared/")
@@ -0,0 +1,30 @@
+self.description = "Remove packages sharing a directory with a remaining package"
+
+lp1 = pmpkg("pkg1")
+lp1.files = ["usr/share/shared/",
+             "usr/share/shared/one",
+             "usr/share/gone/",
+             "usr/share/gone/one"]
+self.addpkg2db("local", lp1)
+
+lp2 = pmpkg("pkg2")
+lp2.files = ["usr/share/shared/",
+             "usr/share/shared/two",
+             "usr/share/gone/",
+             "usr/share/gone/two"]
+self.addpkg2db("local", lp2)
+
+lp3 = pmpkg("pkg3")
+lp3.files = ["usr/share/shared/"]
+self.addpkg2db("local", lp3)
+
+self.args = "-R pkg1 pkg2"
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("!PKG_EXIST=pkg1")
+self.addrule("!PKG_EXIST=pkg2")
+self.addrule("PKG_EXIST=pkg3")
+self.addrule("DIR_EXIST=usr/share/shared/")
+self.addrule("!FILE_EXIST=usr/share/shared/one")
+self.addrule("!FILE_EXIST=usr/share/shared/two")
+self.addrule("!DIR_EXIST=usr/share/gone/")
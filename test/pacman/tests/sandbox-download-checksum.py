@@ -0,0 +1,29 @@
+self.description = "checksums of a sandboxed download are taken by the parent"
+self.require_capability("curl")
+
+import hashlib
+
+p1 = pmpkg('pkg1', '1.0-1')
+p1.files = ['bin/pkg1']
+self.addpkg2db('sync', p1)
+
+p1_bytes = p1.makepkg_bytes()
+p1.csize = len(p1_bytes)
+p1.md5sum = hashlib.md5(p1_bytes).hexdigest()
+
+url = self.add_simple_http_server({
+    '/{}'.format(p1.filename()): p1_bytes,
+})
+
+self.option['DownloadUser'] = ['root']
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--debug -S pkg1'
+
+# the parent hashes the file while copying it out of the sandbox's reach
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=using checksum computed while downloading .*/pkg1-1.0-1")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("FILE_EXIST=bin/pkg1")
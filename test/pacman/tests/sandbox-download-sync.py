@@ -0,0 +1,14 @@
+self.description = "--sync --refresh with DownloadUser set"
+self.require_capability("curl")
+
+p1 = pmpkg('pkg1', '1.0-1')
+self.addpkg2db('sync', p1)
+
+self.option['DownloadUser'] = ['root']
+self.cachepkgs = False
+
+self.args = '-Syy pkg1'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("CACHE_EXISTS=pkg1|1.0-1")
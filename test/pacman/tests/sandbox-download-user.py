@@ -0,0 +1,23 @@
+self.description = "--sync --refresh with an unprivileged DownloadUser"
+self.require_capability("curl")
+
+import os
+import pwd
+
+p1 = pmpkg('pkg1', '1.0-1')
+self.addpkg2db('sync', p1)
+
+self.option['DownloadUser'] = ['nobody']
+self.cachepkgs = False
+
+def allow_download_user(test):
+    # the download user has to reach the cache and the repository
+    os.chmod(test.root, 0o755)
+
+self.setupargs = [allow_download_user]
+self.args = '--debug -Syy pkg1'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=started download worker .* as user nobody")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("CACHE_EXISTS=pkg1|1.0-1")
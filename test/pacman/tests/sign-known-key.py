@@ -0,0 +1,31 @@
+self.description = "Install a package signed with a key in the keyring"
+self.require_capability("gpg")
+
+import os
+import subprocess
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+self.db["sync"].option["SigLevel"] = ["PackageRequired"]
+
+gpgdir = os.path.join(self.root, "etc/pacman.d/gnupg")
+self.option["GPGDir"] = [gpgdir]
+
+def sign(test):
+    pkgfile = sp.path
+    gpg = ["gpg", "--batch", "--quiet", "--homedir", gpgdir]
+    os.makedirs(gpgdir, mode=0o700, exist_ok=True)
+    # a generated key is ultimately trusted in its own keyring
+    subprocess.check_call(gpg + ["--passphrase", "", "--quick-gen-key",
+            "pactest <pactest@localhost>", "ed25519", "sign", "never"])
+    subprocess.check_call(gpg + ["--detach-sign", "--output",
+            pkgfile + ".sig", pkgfile])
+    subprocess.call(["gpgconf", "--homedir", gpgdir, "--kill", "all"])
+
+self.setupargs = [sign]
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
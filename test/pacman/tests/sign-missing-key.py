@@ -0,0 +1,42 @@
+self.description = "Refuse a package signed with a key missing from the keyring"
+self.require_capability("gpg")
+
+import os
+import shutil
+import subprocess
+import tempfile
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+self.db["sync"].option["SigLevel"] = ["PackageRequired"]
+
+gpgdir = os.path.join(self.root, "etc/pacman.d/gnupg")
+self.option["GPGDir"] = [gpgdir]
+
+def sign(test):
+    pkgfile = sp.path
+    keydir = tempfile.mkdtemp(prefix="pactest-key-")
+    gpg = ["gpg", "--batch", "--quiet", "--homedir", keydir]
+    try:
+        subprocess.check_call(gpg + ["--passphrase", "", "--quick-gen-key",
+                "pactest <pactest@localhost>", "ed25519", "sign", "never"])
+        subprocess.check_call(gpg + ["--detach-sign", "--output",
+                pkgfile + ".sig", pkgfile])
+    finally:
+        subprocess.call(["gpgconf", "--homedir", keydir, "--kill", "all"])
+        shutil.rmtree(keydir)
+    # an empty keyring that can not fetch the key from anywhere
+    os.makedirs(gpgdir, mode=0o700, exist_ok=True)
+    with open(os.path.join(gpgdir, "gpg.conf"), "w") as f:
+        f.write("keyserver hkp://127.0.0.1:1\n")
+    subprocess.check_call(["gpg", "--batch", "--quiet", "--homedir", gpgdir,
+            "--list-keys"])
+
+self.setupargs = [sign]
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=1")
+self.addrule("PACMAN_OUTPUT=required key missing from keyring")
+self.addrule("!PKG_EXIST=dummy")
+self.addrule("!FILE_EXIST=bin/dummy")
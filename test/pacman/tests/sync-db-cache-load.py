@@ -0,0 +1,20 @@
+self.description = "Load sync packages from an existing sync db cache"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+sp.depends = ["provision>=1.0: a description"]
+self.addpkg2db("sync", sp)
+
+sp2 = pmpkg("provider")
+sp2.provides = ["provision=1.0"]
+self.addpkg2db("sync", sp2)
+
+# the first run writes the cache, the second one reads it
+self.setupargs = ["-Sp %s" % sp.name]
+self.args = "--debug -S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=loaded 2 packages from package cache file for db 'sync'")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("PKG_EXIST=provider")
+self.addrule("FILE_EXIST=bin/dummy")
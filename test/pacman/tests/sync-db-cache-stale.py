@@ -0,0 +1,15 @@
+self.description = "Ignore a sync db cache that does not match the db"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+# not a valid cache file, must be rebuilt from the db archive
+self.filesystem = ["var/lib/pacman/sync/sync.db.cache"]
+
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
+self.addrule("FILE_EXIST=var/lib/pacman/sync/sync.db.cache")
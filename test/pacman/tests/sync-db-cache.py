@@ -0,0 +1,18 @@
+self.description = "Install a package and write the sync db cache"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+sp.depends = ["provision>=1.0: a description"]
+self.addpkg2db("sync", sp)
+
+sp2 = pmpkg("provider")
+sp2.provides = ["provision=1.0"]
+self.addpkg2db("sync", sp2)
+
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("PKG_EXIST=provider")
+self.addrule("FILE_EXIST=bin/dummy")
+self.addrule("FILE_EXIST=var/lib/pacman/sync/sync.db.cache")
@@ -0,0 +1,26 @@
+self.description = "package not matching its checksum while downloading"
+self.require_capability("curl")
+
+import hashlib
+
+p = pmpkg('pkg')
+p.files = ['bin/pkg']
+self.addpkg2db('sync', p)
+
+p_bytes = p.makepkg_bytes()
+p.csize = len(p_bytes)
+p.md5sum = hashlib.md5(p_bytes + b'\0').hexdigest()
+
+url = self.add_simple_http_server({
+    '/{}'.format(p.filename()): p_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--noconfirm -S pkg'
+
+self.addrule("PACMAN_RETCODE=1")
+self.addrule("!PKG_EXIST=pkg")
+self.addrule("PACMAN_OUTPUT=invalid or corrupted package")
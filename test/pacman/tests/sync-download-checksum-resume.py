@@ -0,0 +1,29 @@
+self.description = "checksum taken while resuming a partial download"
+self.require_capability("curl")
+
+import hashlib
+
+p = pmpkg('pkg')
+self.addpkg2db('sync', p)
+
+# the partial download holds its own path, see util.mkfile()
+part = 'var/cache/pacman/pkg/{}.part'.format(p.filename())
+self.filesystem = [ part ]
+
+p_bytes = part.encode() + b'\n' + bytes(64 * 1024)
+p.csize = len(p_bytes)
+p.md5sum = hashlib.md5(p_bytes).hexdigest()
+
+url = self.add_simple_http_server({
+    '/{}'.format(p.filename()): p_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--debug -Sw pkg'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=using checksum computed while downloading .*/pkg-1.0-1")
+self.addrule("CACHE_EXISTS=pkg|1.0-1")
@@ -0,0 +1,44 @@
+self.description = "checksums of downloaded packages taken while downloading"
+self.require_capability("curl")
+
+import gzip
+import hashlib
+
+self.option['ParallelDownloads'] = ['3']
+self.option['SegmentedDownloadSize'] = ['1']
+
+small = pmpkg('small')
+small.files = ['bin/small']
+self.addpkg2db('sync', small)
+
+large = pmpkg('large')
+large.files = ['bin/large']
+self.addpkg2db('sync', large)
+
+small_bytes = small.makepkg_bytes()
+# pad the archive past the segmenting size with an extra gzip member
+large_bytes = large.makepkg_bytes() + gzip.compress(bytes(2 * 1024 * 1024), compresslevel=0)
+for p, b in ((small, small_bytes), (large, large_bytes)):
+    p.csize = len(b)
+    p.md5sum = hashlib.md5(b).hexdigest()
+
+url1 = self.add_simple_http_server({
+    '/{}'.format(small.filename()): small_bytes,
+    '/{}'.format(large.filename()): large_bytes,
+})
+url2 = self.add_simple_http_server({
+    '/{}'.format(large.filename()): large_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url1, url2 ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--debug -S small large'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=using checksum computed while downloading .*/small-1.0-1")
+self.addrule("PACMAN_OUTPUT=using checksum computed while downloading .*/large-1.0-1")
+self.addrule("PKG_EXIST=small")
+self.addrule("PKG_EXIST=large")
+self.addrule("FILE_EXIST=bin/large")
@@ -0,0 +1,38 @@
+self.description = "download packages in install order"
+self.require_capability("curl")
+
+import gzip
+
+self.option['ParallelDownloads'] = ['2']
+self.option['DownloadOrder'] = ['Install']
+
+lib = pmpkg('lib')
+lib.files = ['usr/lib/libfoo.so']
+self.addpkg2db('sync', lib)
+
+app = pmpkg('app')
+app.files = ['usr/bin/app']
+app.depends = ['lib']
+self.addpkg2db('sync', app)
+
+# make the package that is installed last the largest one
+lib_bytes = lib.makepkg_bytes()
+app_bytes = app.makepkg_bytes() + gzip.compress(bytes(64 * 1024), compresslevel=0)
+lib.csize = len(lib_bytes)
+app.csize = len(app_bytes)
+
+url = self.add_simple_http_server({
+    '/{}'.format(lib.filename()): lib_bytes,
+    '/{}'.format(app.filename()): app_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '-S app'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=lib")
+self.addrule("PKG_EXIST=app")
+self.addrule("FILE_EXIST=usr/bin/app")
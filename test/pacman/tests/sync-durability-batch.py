@@ -0,0 +1,41 @@
+self.description = "Upgrade packages with files flushed in batches"
+
+self.option['Durability'] = ['Batch']
+
+lp = pmpkg('dummy')
+lp.files = ['usr/bin/dummy',
+            'usr/share/dummy/old',
+            'etc/dummy.conf']
+lp.backup = ['etc/dummy.conf*']
+self.addpkg2db('local', lp)
+
+sp = pmpkg('dummy', '2.0-1')
+sp.files = ['usr/bin/dummy',
+            'usr/bin/dummy-link -> dummy',
+            'usr/share/dummy/new',
+            'etc/dummy.conf**']
+sp.backup = ['etc/dummy.conf']
+self.addpkg2db('sync', sp)
+
+sp2 = pmpkg('other')
+sp2.files = ['usr/share/other/file']
+self.addpkg2db('sync', sp2)
+
+self.args = '--debug -S dummy other'
+
+self.addrule('PACMAN_RETCODE=0')
+self.addrule('PACMAN_OUTPUT=syncing [0-9]+ files on 1 filesystems')
+self.addrule('PKG_VERSION=dummy|2.0-1')
+self.addrule('PKG_EXIST=other')
+self.addrule('FILE_MODIFIED=usr/bin/dummy')
+self.addrule('FILE_TYPE=usr/bin/dummy-link|link')
+self.addrule('FILE_EXIST=usr/share/dummy/new')
+self.addrule('!FILE_EXIST=usr/share/dummy/old')
+self.addrule('FILE_EXIST=usr/share/other/file')
+self.addrule('FILE_PACNEW=etc/dummy.conf')
+self.addrule('!FILE_MODIFIED=etc/dummy.conf')
+for f in ['usr/bin/dummy', 'usr/bin/dummy-link', 'usr/share/dummy/new',
+          'usr/share/other/file', 'etc/dummy.conf.pacnew']:
+    self.addrule('!FILE_EXIST=%s.alpmtmp' % f)
+self.addrule('!FILE_EXIST=var/lib/pacman/local/dummy-2.0-1/desc.alpmtmp')
+self.addrule('!FILE_EXIST=var/lib/pacman/local/dummy-2.0-1/files.alpmtmp')
@@ -0,0 +1,35 @@
+self.description = "parallel downloads keep to the configured mirror order"
+self.require_capability("curl")
+
+self.option['ParallelDownloads'] = ['2']
+
+p1 = pmpkg('pkg1')
+p1.files = ['bin/pkg1']
+self.addpkg2db('sync', p1)
+
+p2 = pmpkg('pkg2')
+p2.files = ['bin/pkg2']
+self.addpkg2db('sync', p2)
+
+# the second mirror serves packages that fail their checksums, it must not
+# be used while the first one works
+url_first = self.add_simple_http_server({
+    '/{}'.format(p1.filename()): p1.makepkg_bytes(),
+    '/{}'.format(p2.filename()): p2.makepkg_bytes(),
+})
+url_second = self.add_simple_http_server({
+    '/{}'.format(p1.filename()): 'broken',
+    '/{}'.format(p2.filename()): 'broken',
+})
+
+self.db['sync'].option['Server'] = [ url_first, url_second ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '-S pkg1 pkg2'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+self.addrule("FILE_EXIST=bin/pkg1")
+self.addrule("FILE_EXIST=bin/pkg2")
@@ -0,0 +1,45 @@
+self.description = "stalled download moves to a faster mirror"
+self.require_capability("curl")
+
+import gzip
+
+self.option['ParallelDownloads'] = ['2']
+
+p1 = pmpkg('pkg1')
+p1.files = ['bin/pkg1']
+self.addpkg2db('sync', p1)
+
+p2 = pmpkg('pkg2')
+p2.files = ['bin/pkg2']
+self.addpkg2db('sync', p2)
+
+# pad the archives with an extra gzip member so their throughput can be
+# measured; the padding decompresses to zeros past the end of the tar stream
+def padded(pkg, size):
+    return pkg.makepkg_bytes() + gzip.compress(bytes(size), compresslevel=0)
+
+p1_bytes = padded(p1, 256 * 1024)
+p2_bytes = padded(p2, 128 * 1024)
+
+# fast enough to never trip curl's low speed timeout, far too slow to
+# finish within the test's time limit
+url_slow = self.add_simple_http_server({
+    '/{}'.format(p1.filename()): { 'body': p1_bytes, 'rate': 1024 },
+    '/{}'.format(p2.filename()): { 'body': p2_bytes, 'rate': 1024 },
+})
+url_fast = self.add_simple_http_server({
+    '/{}'.format(p1.filename()): p1_bytes,
+    '/{}'.format(p2.filename()): p2_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url_slow, url_fast ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '-S pkg1 pkg2'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+self.addrule("FILE_EXIST=bin/pkg1")
+self.addrule("FILE_EXIST=bin/pkg2")
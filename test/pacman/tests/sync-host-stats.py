@@ -0,0 +1,13 @@
+self.description = "Report the transfer statistics of each host when debugging"
+self.require_capability("curl")
+
+p1 = pmpkg('pkg1', '1.0-1')
+self.addpkg2db('sync', p1)
+
+self.cachepkgs = False
+
+self.args = '--debug -S pkg1'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=1 transfers \\(0 failed, 0 multiplexed\\)")
+self.addrule("PKG_EXIST=pkg1")
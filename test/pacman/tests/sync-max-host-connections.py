@@ -0,0 +1,25 @@
+self.description = "parallel downloads share a single connection to a host"
+self.require_capability("curl")
+
+self.option['ParallelDownloads'] = ['3']
+self.option['MaxHostConnections'] = ['1']
+
+files = {}
+for name in ['pkg1', 'pkg2', 'pkg3']:
+    p = pmpkg(name)
+    self.addpkg2db('sync', p)
+    files['/{}'.format(p.filename())] = p.makepkg_bytes()
+
+url = self.add_simple_http_server(files)
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--debug -S pkg1 pkg2 pkg3'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+self.addrule("PKG_EXIST=pkg3")
+self.addrule("PACMAN_OUTPUT=3 transfers .* over 1 connections")
@@ -0,0 +1,23 @@
+self.description = "Install packages from several repos loaded in parallel"
+
+self.option["ParallelDatabaseLoads"] = ["2"]
+
+sp1 = pmpkg("pkg1")
+sp1.files = ["bin/pkg1"]
+sp1.depends = ["provision"]
+self.addpkg2db("sync1", sp1)
+
+sp2 = pmpkg("pkg2")
+sp2.provides = ["provision"]
+self.addpkg2db("sync2", sp2)
+
+sp3 = pmpkg("pkg3")
+self.addpkg2db("sync3", sp3)
+
+self.args = "-S %s %s" % (sp1.name, sp3.name)
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg1")
+self.addrule("PKG_EXIST=pkg2")
+self.addrule("PKG_EXIST=pkg3")
+self.addrule("FILE_EXIST=bin/pkg1")
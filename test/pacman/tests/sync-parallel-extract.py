@@ -0,0 +1,47 @@
+self.description = "extract packages on several threads"
+
+self.option['ParallelExtractions'] = ['4']
+
+lp = pmpkg('pkg1', '1.0-1')
+lp.files = ['usr/share/pkg1/',
+            'usr/share/pkg1/old',
+            'usr/share/pkg1/moved']
+self.addpkg2db('local', lp)
+
+names = []
+for i in range(8):
+    p = pmpkg('pkg%d' % i, '2.0-1')
+    p.files = ['usr/share/common/',
+               'usr/share/pkg%d/file' % i]
+    if i % 3 == 2:
+        p.depends = ['pkg%d' % (i - 1)]
+    self.addpkg2db('sync', p)
+    names.append(p.name)
+
+# a file moving between packages waits for the old owner to be upgraded
+self.db['sync'].getpkg('pkg5').files.append('usr/share/pkg1/moved')
+
+# packages with a backup file are extracted by the main thread
+bp = pmpkg('backup', '1.0-1')
+bp.files = ['etc/backup.conf']
+bp.backup = ['etc/backup.conf']
+self.addpkg2db('sync', bp)
+names.append(bp.name)
+
+self.args = '--debug -S {}'.format(' '.join(names))
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=extracting packages using")
+for name in names:
+    self.addrule("PKG_EXIST={}".format(name))
+for i in range(8):
+    self.addrule("PKG_VERSION=pkg%d|2.0-1" % i)
+    self.addrule("FILE_EXIST=usr/share/pkg%d/file" % i)
+self.addrule("PKG_FILES=pkg5|usr/share/pkg1/moved")
+self.addrule("FILE_EXIST=usr/share/pkg1/moved")
+self.addrule("!FILE_EXIST=usr/share/pkg1/old")
+self.addrule("FILE_EXIST=etc/backup.conf")
+# database entries written while other threads extract keep the umask
+for i in range(8):
+    for entry in ('desc', 'files'):
+        self.addrule("FILE_MODE=var/lib/pacman/local/pkg%d-2.0-1/%s|644" % (i, entry))
@@ -0,0 +1,20 @@
+self.description = "verify cached packages on several threads, one corrupted"
+
+self.option['ParallelIntegrityChecks'] = ['4']
+
+names = []
+for i in range(8):
+    p = pmpkg('pkg%d' % i)
+    p.files = ['usr/share/pkg%d/file' % i]
+    self.addpkg2db('sync', p)
+    names.append(p.name)
+
+# replaces the cached package after its checksum was taken
+self.filesystem = ['var/cache/pacman/pkg/pkg5-1.0-1.pkg.tar.gz']
+
+self.args = '--noconfirm -S {}'.format(' '.join(names))
+
+self.addrule("PACMAN_RETCODE=1")
+self.addrule("PACMAN_OUTPUT=pkg5-1.0-1.pkg.tar.gz is corrupted")
+for name in names:
+    self.addrule("!PKG_EXIST={}".format(name))
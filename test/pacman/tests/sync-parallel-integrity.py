@@ -0,0 +1,18 @@
+self.description = "verify cached packages on several threads"
+
+self.option['ParallelIntegrityChecks'] = ['4']
+
+names = []
+for i in range(8):
+    p = pmpkg('pkg%d' % i)
+    p.files = ['usr/share/pkg%d/file' % i]
+    self.addpkg2db('sync', p)
+    names.append(p.name)
+
+self.args = '--debug -S {}'.format(' '.join(names))
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=verifying 8 packages using 4 threads")
+for name in names:
+    self.addrule("PKG_EXIST={}".format(name))
+    self.addrule("FILE_EXIST=usr/share/{}/file".format(name))
@@ -0,0 +1,40 @@
+self.description = "pipelined commit with one corrupted package"
+self.require_capability("curl")
+
+import hashlib
+
+self.option['ParallelDownloads'] = ['2']
+self.option['PipelinedCommit'] = []
+
+good = pmpkg('good')
+good.files = ['bin/good']
+self.addpkg2db('sync', good)
+
+bad = pmpkg('bad')
+bad.files = ['bin/bad']
+self.addpkg2db('sync', bad)
+
+good_bytes = good.makepkg_bytes()
+good.csize = len(good_bytes)
+good.md5sum = hashlib.md5(good_bytes).hexdigest()
+
+bad_bytes = bad.makepkg_bytes()
+bad.csize = len(bad_bytes)
+bad.md5sum = hashlib.md5(bad_bytes + b'\0').hexdigest()
+
+url = self.add_simple_http_server({
+    '/{}'.format(good.filename()): good_bytes,
+    '/{}'.format(bad.filename()): bad_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--noconfirm -S good bad'
+
+self.addrule("PACMAN_RETCODE=1")
+self.addrule("!PKG_EXIST=good")
+self.addrule("!PKG_EXIST=bad")
+self.addrule("!FILE_EXIST=bin/good")
+self.addrule("PACMAN_OUTPUT=invalid or corrupted package")
@@ -0,0 +1,41 @@
+self.description = "pipelined commit of a dependency chain"
+self.require_capability("curl")
+
+self.option['ParallelDownloads'] = ['2']
+self.option['DownloadOrder'] = ['Install']
+self.option['PipelinedCommit'] = []
+
+lib = pmpkg('lib')
+lib.files = ['usr/lib/libfoo.so']
+self.addpkg2db('sync', lib)
+
+tool = pmpkg('tool')
+tool.files = ['usr/bin/tool']
+tool.depends = ['lib']
+self.addpkg2db('sync', tool)
+
+app = pmpkg('app')
+app.files = ['usr/bin/app']
+app.depends = ['tool']
+self.addpkg2db('sync', app)
+
+files = {}
+for p in (lib, tool, app):
+    p_bytes = p.makepkg_bytes()
+    p.csize = len(p_bytes)
+    files['/{}'.format(p.filename())] = p_bytes
+
+url = self.add_simple_http_server(files)
+
+self.db['sync'].option['Server'] = [ url ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '--debug -S app'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=preloaded package file for target app")
+for p in (lib, tool, app):
+    self.addrule("PKG_EXIST={}".format(p.name))
+    self.addrule("PKG_REASON={}|{}".format(p.name, 0 if p is app else 1))
+    self.addrule("FILE_EXIST={}".format(p.files[0]))
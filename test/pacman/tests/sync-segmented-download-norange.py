@@ -0,0 +1,31 @@
+self.description = "segmented download from mirrors ignoring ranges"
+self.require_capability("curl")
+
+import gzip
+
+self.option['ParallelDownloads'] = ['2']
+self.option['SegmentedDownloadSize'] = ['1']
+
+p = pmpkg('pkg')
+p.files = ['bin/pkg']
+self.addpkg2db('sync', p)
+
+p_bytes = p.makepkg_bytes() + gzip.compress(bytes(2 * 1024 * 1024), compresslevel=0)
+p.csize = len(p_bytes)
+
+url1 = self.add_simple_http_server({
+    '/{}'.format(p.filename()): { 'body': p_bytes, 'ranges': False },
+})
+url2 = self.add_simple_http_server({
+    '/{}'.format(p.filename()): { 'body': p_bytes, 'ranges': False },
+})
+
+self.db['sync'].option['Server'] = [ url1, url2 ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '-S pkg'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg")
+self.addrule("FILE_EXIST=bin/pkg")
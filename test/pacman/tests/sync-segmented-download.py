@@ -0,0 +1,33 @@
+self.description = "large package downloaded in segments from two mirrors"
+self.require_capability("curl")
+
+import gzip
+
+self.option['ParallelDownloads'] = ['2']
+self.option['SegmentedDownloadSize'] = ['1']
+
+p = pmpkg('pkg')
+p.files = ['bin/pkg']
+self.addpkg2db('sync', p)
+
+# pad the archive past the segmenting size with an extra gzip member, the
+# padding decompresses to zeros past the end of the tar stream
+p_bytes = p.makepkg_bytes() + gzip.compress(bytes(2 * 1024 * 1024), compresslevel=0)
+p.csize = len(p_bytes)
+
+url1 = self.add_simple_http_server({
+    '/{}'.format(p.filename()): p_bytes,
+})
+url2 = self.add_simple_http_server({
+    '/{}'.format(p.filename()): p_bytes,
+})
+
+self.db['sync'].option['Server'] = [ url1, url2 ]
+self.db['sync'].syncdir = False
+self.cachepkgs = False
+
+self.args = '-S pkg'
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=pkg")
+self.addrule("FILE_EXIST=bin/pkg")
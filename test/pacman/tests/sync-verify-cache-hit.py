@@ -0,0 +1,14 @@
+self.description = "Skip validating a package found in the verification cache"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+# the first run validates the package and records it
+self.setupargs = ["-Sw %s" % sp.name]
+self.args = "--debug -S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=dummy: found in verification cache")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
@@ -0,0 +1,24 @@
+self.description = "Discard the verification cache once the keyring changed"
+
+import os
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+gpgdir = os.path.join(self.root, "etc/pacman.d/gnupg/")
+self.option["GPGDir"] = [gpgdir]
+self.filesystem = ["etc/pacman.d/gnupg/pubring.gpg"]
+
+def touch_keyring(test):
+    with open(os.path.join(gpgdir, "pubring.gpg"), "a") as f:
+        f.write("new key\n")
+
+self.setupargs = ["-Sw %s" % sp.name, touch_keyring]
+self.args = "--debug -S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PACMAN_OUTPUT=keyring changed, discarding verification cache")
+self.addrule("!PACMAN_OUTPUT=found in verification cache")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
@@ -0,0 +1,18 @@
+self.description = "Validate a package again once its file changed"
+
+import os
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+def touch_pkg(test):
+    os.utime(os.path.join(test.cachedir(), sp.filename()))
+
+self.setupargs = ["-Sw %s" % sp.name, touch_pkg]
+self.args = "--debug -S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("!PACMAN_OUTPUT=found in verification cache")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
@@ -0,0 +1,20 @@
+self.description = "Validate a package again once its signature changed"
+
+import os
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+def add_sig(test):
+    path = os.path.join(test.cachedir(), sp.filename() + ".sig")
+    with open(path, "wb") as f:
+        f.write(b"not a signature")
+
+self.setupargs = ["-Sw %s" % sp.name, add_sig]
+self.args = "--debug -S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("!PACMAN_OUTPUT=found in verification cache")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
@@ -0,0 +1,15 @@
+self.description = "Ignore a verification cache that cannot be read"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+# not a valid cache file, must be replaced
+self.filesystem = ["var/cache/pacman/pkg/.verify.cache"]
+
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
+self.addrule("FILE_MODIFIED=var/cache/pacman/pkg/.verify.cache")
@@ -0,0 +1,12 @@
+self.description = "Record validated packages in the verification cache"
+
+sp = pmpkg("dummy")
+sp.files = ["bin/dummy"]
+self.addpkg2db("sync", sp)
+
+self.args = "-S %s" % sp.name
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_EXIST=dummy")
+self.addrule("FILE_EXIST=bin/dummy")
+self.addrule("FILE_EXIST=var/cache/pacman/pkg/.verify.cache")
@@ -0,0 +1,41 @@
+self.description = "Upgrade a package with several files in 'backup'"
+
+lp = pmpkg("dummy")
+lp.files = ["etc/dummy/a.conf",
+            "etc/dummy/b.conf*",
+            "etc/dummy/c.conf",
+            "etc/dummy/d.conf"]
+lp.backup = ["etc/dummy/a.conf",
+             "etc/dummy/b.conf",
+             "etc/dummy/c.conf*"]
+self.addpkg2db("local", lp)
+
+p = pmpkg("dummy", "1.0-2")
+p.files = ["etc/dummy/a.conf*",
+           "etc/dummy/b.conf",
+           "etc/dummy/c.conf**",
+           "etc/dummy/d.conf",
+           "etc/dummy/e.conf"]
+p.backup = ["etc/dummy/a.conf",
+            "etc/dummy/b.conf",
+            "etc/dummy/c.conf",
+            "etc/dummy/d.conf",
+            "etc/dummy/e.conf"]
+self.addpkg(p)
+
+self.args = "-U %s" % p.filename()
+
+self.addrule("PACMAN_RETCODE=0")
+self.addrule("PKG_VERSION=dummy|1.0-2")
+# local unchanged, new modified
+self.addrule("FILE_MODIFIED=etc/dummy/a.conf")
+self.addrule("!FILE_PACNEW=etc/dummy/a.conf")
+# local modified, new unchanged
+self.addrule("!FILE_MODIFIED=etc/dummy/b.conf")
+self.addrule("!FILE_PACNEW=etc/dummy/b.conf")
+# local and new modified
+self.addrule("!FILE_MODIFIED=etc/dummy/c.conf")
+self.addrule("FILE_PACNEW=etc/dummy/c.conf")
+for f in "abcde":
+    self.addrule("PKG_BACKUP=dummy|etc/dummy/%s.conf" % f)
+    self.addrule("!FILE_PACSAVE=etc/dummy/%s.conf" % f)
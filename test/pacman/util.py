@@ -114,6 +114,9 @@ def mkcfgfile(filename, root, option, db):
     # Options
     data = ["[options]"]
     for key, value in option.items():
+        if not value:
+            # options without settings
+            data.append(key)
         data.extend(["%s = %s" % (key, j) for j in value])
 
     # Repositories